@@ -6,7 +6,21 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <chrono>
+
+#include "draw_list.h"
+#include "soft_raster.h"
+#include "frame_capture.h"
+#include "trace.h"
+#include "shm_channel.h"
+#include "kinematics.h"
+#include "collision.h"
+#include "motion_planner.h"
+#include "arm_assignment.h"
+#include "snapshot.h"
+#include "arm_world.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979
@@ -51,7 +65,43 @@ const double ARM_LENGTH2 = 12.0;
 const double ARM_LENGTH3 = 8.0;
 const double ARM_THICKNESS = 1.0;
 
+const KinematicsReal ARM_LENGTHS[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+
+const double IK_MAX_STEP = 2.0; // 一歩で先端を動かす距離の上限
+
 const double TARGET_RADIUS = 2.0;
+const double OBSTACLE_RADIUS = 3.0;
+
+// 光源の位置 (w = 0 なので平行光源) と地面の枡の数・大きさ
+
+const GLfloat LIGHT_POSITION[4] = {-20.0, 50.0, 40.0, 0.0};
+const int GROUND_NUM = 10;
+const double GROUND_SIZE = 10.0;
+
+// 複数の視点で描くときの視点．画面を 2x2 に分けて左上から並べる
+
+enum {
+	VIEW_MAIN,     // EYE_* から TARGET_* を見る (マウスで目標を置く視点)
+	VIEW_TOP,      // 真上からの平行投影
+	VIEW_SIDE,     // 腕の動く面 (+z 側) からの平行投影
+	VIEW_END,      // 先端の近くから先端を見る
+	NUM_VIEWS
+};
+
+const double ORTHO_HALF_HEIGHT = 35.0;   // 平行投影で見える高さの半分
+const double ORTHO_DISTANCE = 200.0;     // 平行投影の視点から注視点まで
+const double SIDE_VIEW_Y = 12.0;
+const double END_VIEW_OFFSET_X = 6.0;    // 先端から見た，先端を見る視点の位置
+const double END_VIEW_OFFSET_Y = 4.0;
+const double END_VIEW_OFFSET_Z = 14.0;
+
+// 多数のアーム (--cell で数を指定したときだけ)
+
+const double CELL_SPACING_X = 20.0;   // 隣のアームと届く範囲が重なる間隔
+const double CELL_SPACING_Z = 4.0;
+const int CELL_TARGETS_PER_ARM = 8;   // 待ち行列に保つ目標の数 (アームあたり)
+const double CELL_TARGET_RADIUS = 0.8;
+const double CELL_VIEW_WIDTH = 60.0;  // 主視点がそのままで収まる並びの幅
 
 
 
@@ -59,209 +109,591 @@ const double TARGET_RADIUS = 2.0;
 
 int window_width;
 int window_height;
-int counter;
-int is_moving;
 
 int mouse_button_down;
 
-double arm_angle1, arm_angle2, arm_angle3;
-double base_x, base_y, base_z;
+int show_stats;
+int use_soft_raster; // 1 なら CPU で描く
+int save_frame;      // 1 なら次の描画を PPM に保存する
+const char *capture_request; // 次の描画から撮影を始めるときの出力先
+int multi_view;      // 1 なら画面を分けて複数の視点から描く
+
+DrawView views[NUM_VIEWS];
+
+// 外部の計画プロセスとの通信 (--channel で指定したときだけ)
+
+ArmChannel *channel;
+unsigned long long channel_target_seq;      // 最後に受け取った目標の番号
+unsigned long long channel_target_send_ns;  // その目標が積まれた時刻
+long long channel_status_dropped;           // 相手が読まずに満杯だった回数
+
+// アームの世界 (関節角，目標，障害物など)．互いに独立していて，全部を
+// 毎回進めるが，描いてマウスやキーで触るのは selected_world 番目だけ
+
+std::vector<ArmWorld> worlds;
+int selected_world;
+ArmWorld *world;                      // &worlds[selected_world]
+WorldHostStats world_stats;
+
+// 関節空間の経路計画
 
-double target_x, target_y, target_z;
+PlannerArm planner_arm;
+PlannerSettings planner_settings;
+PlannerStats planner_stats;           // 直近の計画の結果
+int use_planner;                      // 1 なら目標が変わるたびに経路を計画する
+double planned_target_x, planned_target_y; // 最後に計画した目標
+
+// 多数のアームへの目標の割り当て
+
+ArmCell cell;
+AssignmentWork cell_work;
+AssignmentStats cell_stats;
+int cell_arms;                        // 0 なら 1 本のアームを動かす
+double cell_view_scale;               // 並び全体が入るよう視点を引く倍率
+unsigned long long cell_random_state;
+
+// 場面のスナップショット
+
+const char *snapshot_path;            // S で書き，L で読むファイル
+Snapshot mesh_snapshot;               // 起動時に読んだもの．メッシュがここを指す
+
+// マテリアル番号
+
+int material_joint;
+int material_arm1, material_arm2, material_arm3;
+int material_target;
+int material_waiting;
+int material_obstacle;
+int material_ground1, material_ground2;
 
 
 // オブジェクトの初期化 ///////////////////////////////////////////////////////
 
-void InitArmPosition(void)
+// 描いて操作する世界を選ぶ．選んだときの目標は計画済みとみなす
+
+void SelectWorld(const int i)
 {
-	arm_angle1 = 30.0;
-	arm_angle2 = 120.0;
-	arm_angle3 = 30.0;
-	base_x = 0.0;
-	base_y = 0.0;
-	base_z = 0.0;
+	selected_world = i;
+	world = &worlds[i];
+	planned_target_x = world->target_x;
+	planned_target_y = world->target_y;
+}
+
+// n 個の世界を作る．最初の世界の目標はマウスで置き，ほかの世界は届くたびに
+// 自分の乱数で次の目標を選ぶ
 
-	target_x = 0.0;
-	target_y = (ARM_LENGTH1 + ARM_LENGTH2) * 0.8;
-	target_z = 0.0;
+void InitWorlds(const int n)
+{
+	const double length[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	worlds.assign(n, ArmWorld());
+	for (int i = 0; i < n; i++) {
+		InitArmWorld(&worlds[i], length, IK_MAX_STEP, ARM_THICKNESS, i + 1);
+		if (i > 0) {
+			worlds[i].retarget = 1;
+			RandomArmTarget(&worlds[i]);
+		}
+	}
+	SelectWorld(0);
 }
 
+void InitArmPlanner(void)
+{
+	const float length[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	InitPlannerArm(&planner_arm, length, ARM_THICKNESS);
+	InitPlannerSettings(&planner_settings);
+}
 
+// 並び全体が入るよう視点を引く
 
-// OpenGLの設定 ///////////////////////////////////////////////////////////////
+void SetCellViewScale(void)
+{
+	double width = ceil(sqrt((double) cell_arms)) * CELL_SPACING_X;
+	cell_view_scale = width > CELL_VIEW_WIDTH ? width / CELL_VIEW_WIDTH : 1.0;
+}
 
-// 初期設定
+// アームを格子状に並べ，待ち行列を目標で満たす
 
-void InitGL(void)
+void InitCell(void)
 {
-	// 背景色の設定
+	const float length[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	InitArmCell(&cell, length);
+	LayoutCellArms(&cell, cell_arms, CELL_SPACING_X, CELL_SPACING_Z);
+	cell_random_state = 1;
+	for (int i = 0; i < cell_arms * CELL_TARGETS_PER_ARM; i++) {
+		PushRandomCellTarget(&cell, &cell_random_state);
+	}
+	UpdateCellEnds(&cell);
+	SetCellViewScale();
+}
+
 
-	glClearColor(1.0, 1.0, 1.0, 1.0);
 
-	// シェーディング方法の設定
+// スナップショット ///////////////////////////////////////////////////////////
+
+// 世界の数と選んでいる世界，世界ごとの設定と状態，並んだアームの大きさ・
+// 設定．構造体ごとそのまま書くので，メンバの型は大きさの決まったものにする
+
+struct ArmSnapshotHost {
+	int num_worlds;
+	int selected_world;
+	int use_planner;
+	int reserved;
+};
+
+struct ArmSnapshotState {
+	double length[3];
+	double max_step;
+	double radius;
+	double arm_angle[3];
+	double base[3];
+	double target[3];
+	double distance;
+	long long counter;
+	long long reached;
+	unsigned long long random_state;
+	int avoid_collisions;
+	int retarget;
+	int is_moving;
+	int reserved;
+};
+
+struct CellSnapshotState {
+	float length[3];
+	float reach_min, reach_max;
+	float plane_tolerance;
+	float switch_cost;
+	float done_tolerance;
+	float max_step;
+	int num_arms;
+	int num_targets;
+	long long next_target_id;
+	long long completed;
+	unsigned long long random_state;
+};
+
+// 場面を path に書く．配列もメッシュもそのまま書くので，アームが何本でも
+// 読むときに作り直すものは無い
+
+int SaveSnapshot(const char *path)
+{
+	TRACE_SCOPE("SaveSnapshot");
+
+	SnapshotWriter writer;
+
+	ArmSnapshotHost host;
+	memset(&host, 0, sizeof(host));
+	host.num_worlds = worlds.size();
+	host.selected_world = selected_world;
+	host.use_planner = use_planner;
+	AddSnapshotSection(&writer, "arm.host", &host, sizeof(host), 1);
+
+	// 軌道は保存しない (読んだ世界は逆運動学から始める)
+
+	ArmSnapshotState *states = (ArmSnapshotState *) AllocSnapshotSection(&writer,
+		"arm.worlds", sizeof(ArmSnapshotState), worlds.size());
+	CollisionScene *scenes = (CollisionScene *) AllocSnapshotSection(&writer,
+		"arm.obstacles", sizeof(CollisionScene), worlds.size());
+	for (size_t i = 0; i < worlds.size(); i++) {
+		const ArmWorld &w = worlds[i];
+		ArmSnapshotState &state = states[i];
+		memset(&state, 0, sizeof(state));
+		for (int k = 0; k < 3; k++) {
+			state.length[k] = w.length[k];
+		}
+		state.max_step = w.max_step;
+		state.radius = w.radius;
+		state.arm_angle[0] = w.arm_angle1;
+		state.arm_angle[1] = w.arm_angle2;
+		state.arm_angle[2] = w.arm_angle3;
+		state.base[0] = w.base_x;
+		state.base[1] = w.base_y;
+		state.base[2] = w.base_z;
+		state.target[0] = w.target_x;
+		state.target[1] = w.target_y;
+		state.target[2] = w.target_z;
+		state.distance = w.distance;
+		state.counter = w.counter;
+		state.reached = w.reached;
+		state.random_state = w.random_state;
+		state.avoid_collisions = w.avoid_collisions;
+		state.retarget = w.retarget;
+		state.is_moving = w.is_moving;
+		scenes[i] = w.scene;
+	}
 
-	glShadeModel(GL_SMOOTH);
+	CellSnapshotState cell_state;
+	if (cell_arms) {
+		memset(&cell_state, 0, sizeof(cell_state));
+		memcpy(cell_state.length, cell.length, sizeof(cell_state.length));
+		cell_state.reach_min = cell.reach_min;
+		cell_state.reach_max = cell.reach_max;
+		cell_state.plane_tolerance = cell.plane_tolerance;
+		cell_state.switch_cost = cell.switch_cost;
+		cell_state.done_tolerance = cell.done_tolerance;
+		cell_state.max_step = cell.max_step;
+		cell_state.num_arms = cell.num_arms;
+		cell_state.num_targets = cell.num_targets;
+		cell_state.next_target_id = cell.next_target_id;
+		cell_state.completed = cell.completed;
+		cell_state.random_state = cell_random_state;
+		AddSnapshotSection(&writer, "cell.state", &cell_state, sizeof(cell_state), 1);
+		AddSnapshotVector(&writer, "cell.base_x", cell.base_x);
+		AddSnapshotVector(&writer, "cell.base_y", cell.base_y);
+		AddSnapshotVector(&writer, "cell.base_z", cell.base_z);
+		AddSnapshotVector(&writer, "cell.angle1", cell.angle1);
+		AddSnapshotVector(&writer, "cell.angle2", cell.angle2);
+		AddSnapshotVector(&writer, "cell.angle3", cell.angle3);
+		AddSnapshotVector(&writer, "cell.end_x", cell.end_x);
+		AddSnapshotVector(&writer, "cell.end_y", cell.end_y);
+		AddSnapshotVector(&writer, "cell.arm_target", cell.arm_target);
+		AddSnapshotVector(&writer, "cell.target_x", cell.target_x);
+		AddSnapshotVector(&writer, "cell.target_y", cell.target_y);
+		AddSnapshotVector(&writer, "cell.target_z", cell.target_z);
+		AddSnapshotVector(&writer, "cell.target_arm", cell.target_arm);
+		AddSnapshotVector(&writer, "cell.target_id", cell.target_id);
+	}
 
-	// Zバッファによる隠面消去を有効にする
+	AddMeshSnapshot(&writer);
 
-	glEnable(GL_DEPTH_TEST);
+	if (WriteSnapshot(&writer, path) != 0) {
+		return -1;
+	}
+	fprintf(stderr, "snapshot: wrote %s\n", path);
+	return 0;
+}
 
-	// 裏を向いているポリゴンを描かない
+// 並んだアームを読む．配列がどれか欠けていれば -1 で，*loaded は途中まで
 
-	glCullFace(GL_BACK);
-	glEnable(GL_CULL_FACE);
+int ReadCellSnapshot(const Snapshot &snapshot, const CellSnapshotState &state,
+	ArmCell *loaded)
+{
+	InitArmCell(loaded, state.length);
+	loaded->reach_min = state.reach_min;
+	loaded->reach_max = state.reach_max;
+	loaded->plane_tolerance = state.plane_tolerance;
+	loaded->switch_cost = state.switch_cost;
+	loaded->done_tolerance = state.done_tolerance;
+	loaded->max_step = state.max_step;
+	loaded->num_arms = state.num_arms;
+	loaded->num_targets = state.num_targets;
+	loaded->next_target_id = state.next_target_id;
+	loaded->completed = state.completed;
+
+	// 目標の配列は 4 の倍数まで埋めてある (ResizeCellTargets())
+
+	unsigned long long arms = state.num_arms;
+	unsigned long long targets = (state.num_targets + 3) & ~3;
+	if (state.num_arms <= 0 || state.num_targets < 0
+		|| ReadSnapshotVector(snapshot, "cell.base_x", arms, &loaded->base_x)
+		|| ReadSnapshotVector(snapshot, "cell.base_y", arms, &loaded->base_y)
+		|| ReadSnapshotVector(snapshot, "cell.base_z", arms, &loaded->base_z)
+		|| ReadSnapshotVector(snapshot, "cell.angle1", arms, &loaded->angle1)
+		|| ReadSnapshotVector(snapshot, "cell.angle2", arms, &loaded->angle2)
+		|| ReadSnapshotVector(snapshot, "cell.angle3", arms, &loaded->angle3)
+		|| ReadSnapshotVector(snapshot, "cell.end_x", arms, &loaded->end_x)
+		|| ReadSnapshotVector(snapshot, "cell.end_y", arms, &loaded->end_y)
+		|| ReadSnapshotVector(snapshot, "cell.arm_target", arms, &loaded->arm_target)
+		|| ReadSnapshotVector(snapshot, "cell.target_x", targets, &loaded->target_x)
+		|| ReadSnapshotVector(snapshot, "cell.target_y", targets, &loaded->target_y)
+		|| ReadSnapshotVector(snapshot, "cell.target_z", targets, &loaded->target_z)
+		|| ReadSnapshotVector(snapshot, "cell.target_arm", targets, &loaded->target_arm)
+		|| ReadSnapshotVector(snapshot, "cell.target_id", targets, &loaded->target_id)) {
+		return -1;
+	}
 
-	// 法線を正規化(長さ1に)する
+	// 割り当ては番号で引くので，範囲の外を指すファイルは受け付けない (-1 は無し)
 
-	glEnable(GL_NORMALIZE);
+	for (int i = 0; i < state.num_arms; i++) {
+		if (loaded->arm_target[i] < -1 || loaded->arm_target[i] >= state.num_targets) {
+			return -1;
+		}
+	}
+	for (unsigned long long j = 0; j < targets; j++) {
+		if (loaded->target_arm[j] < -1 || loaded->target_arm[j] >= state.num_arms) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
-// 光源の設定
+// path から場面を戻す．with_meshes なら，メッシュも作らずにスナップショットを
+// 指す (描画の初期化より前だけ)．読めなければ -1 で，場面はそのまま
 
-void SetLight(void)
+int LoadSnapshot(const char *path, const int with_meshes)
 {
-	GLfloat light_position0[] = {-20.0, 50.0, 40.0, 0.0};
-	GLfloat light_ambient0[] = {0.2, 0.2, 0.2, 1.0};
-	GLfloat light_diffuse0[] = {1.0, 1.0, 1.0, 1.0};
-	GLfloat light_specular0[] = {1.0, 1.0, 1.0, 1.0};
+	TRACE_SCOPE("LoadSnapshot");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	Snapshot snapshot;
+	if (OpenSnapshot(&snapshot, path) != 0) {
+		return -1;
+	}
+
+	ArmSnapshotHost host;
+	unsigned long long num_states = 0, num_scenes = 0;
+	const ArmSnapshotState *states = NULL;
+	const CollisionScene *scenes = NULL;
+	if (ReadSnapshotValue(snapshot, "arm.host", &host) == 0) {
+		states = (const ArmSnapshotState *) FindSnapshotSection(snapshot,
+			"arm.worlds", sizeof(ArmSnapshotState), &num_states);
+		scenes = (const CollisionScene *) FindSnapshotSection(snapshot,
+			"arm.obstacles", sizeof(CollisionScene), &num_scenes);
+	}
+	int valid = states && scenes && host.num_worlds > 0
+		&& num_states == (unsigned long long) host.num_worlds
+		&& num_scenes == (unsigned long long) host.num_worlds;
+	for (int i = 0; valid && i < host.num_worlds; i++) {
+		valid = scenes[i].num_spheres >= 0 && scenes[i].num_spheres <= MAX_COLLISION_SPHERES
+			&& scenes[i].num_planes >= 0 && scenes[i].num_planes <= MAX_COLLISION_PLANES;
+	}
+	if (!valid) {
+		fprintf(stderr, "%s: no arm worlds\n", path);
+		CloseSnapshot(&snapshot);
+		return -1;
+	}
+
+	CellSnapshotState cell_state;
+	ArmCell loaded_cell;
+	int has_cell = ReadSnapshotValue(snapshot, "cell.state", &cell_state) == 0;
+	if (has_cell && ReadCellSnapshot(snapshot, cell_state, &loaded_cell) != 0) {
+		fprintf(stderr, "%s: arm cell is incomplete or out of range\n", path);
+		CloseSnapshot(&snapshot);
+		return -1;
+	}
+
+	// 読めたものだけで置き換える
+
+	worlds.assign(host.num_worlds, ArmWorld());
+	for (int i = 0; i < host.num_worlds; i++) {
+		const ArmSnapshotState &state = states[i];
+		ArmWorld &w = worlds[i];
+		InitArmWorld(&w, state.length, state.max_step, state.radius, 0);
+		w.random_state = state.random_state;
+		w.arm_angle1 = state.arm_angle[0];
+		w.arm_angle2 = state.arm_angle[1];
+		w.arm_angle3 = state.arm_angle[2];
+		w.base_x = state.base[0];
+		w.base_y = state.base[1];
+		w.base_z = state.base[2];
+		w.target_x = state.target[0];
+		w.target_y = state.target[1];
+		w.target_z = state.target[2];
+		w.distance = state.distance;
+		w.counter = state.counter;
+		w.reached = state.reached;
+		w.avoid_collisions = state.avoid_collisions;
+		w.retarget = state.retarget;
+		w.is_moving = state.is_moving;
+		w.scene = scenes[i];
+	}
+	use_planner = host.use_planner;
+	SelectWorld(host.selected_world >= 0 && host.selected_world < host.num_worlds
+		? host.selected_world : 0);
+
+	if (has_cell) {
+		std::swap(cell, loaded_cell);
+		cell_arms = cell.num_arms;
+		cell_random_state = cell_state.random_state;
+		SetCellViewScale();
+	} else {
+		cell_arms = 0;
+	}
 
-	glLightfv(GL_LIGHT0, GL_POSITION, light_position0);
-	glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient0);
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse0);
-	glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular0);
+	unsigned long long size = snapshot.size;
+	int mapped = with_meshes && LoadMeshSnapshot(snapshot) == 0;
+	if (with_meshes && !mapped) {
+		InitMeshes();
+	}
+	if (mapped) {
+		mesh_snapshot = snapshot;
+	} else {
+		CloseSnapshot(&snapshot);
+	}
 
-	glEnable(GL_LIGHT0);
-	glEnable(GL_LIGHTING);
+	fprintf(stderr, "snapshot: loaded %s (%.1f MB, %d worlds%s%s) in %.2f ms\n", path,
+		size / 1048576.0, host.num_worlds, has_cell ? ", arm cell" : "",
+		mapped ? ", meshes mapped" : "",
+		std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count());
+	return 0;
 }
 
-// 物体の色の設定
 
-void SetMaterial(const double r, const double g, const double b,
-	const double shininess = 50.0)
-{
-	const double ratio = 0.2;
 
-	GLfloat mat_ambient[] = {r * ratio, g * ratio, b * ratio, 1.0};
-	GLfloat mat_diffuse[] = {r, g, b, 1.0};
-	GLfloat mat_specular[] = {1.0, 1.0, 1.0, 1.0};
-	GLfloat mat_shininess[] = {shininess};
+// OpenGLの設定 ///////////////////////////////////////////////////////////////
 
-	glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-	glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess);
+// 物体の色の設定
+
+void InitMaterials(void)
+{
+	material_joint = AddMaterial(0.6, 0.6, 0.6);
+	material_arm1 = AddMaterial(0.1, 0.2, 1.0);
+	material_arm2 = AddMaterial(0.9, 0.2, 0.1);
+	material_arm3 = AddMaterial(0.2, 0.9, 0.1);
+	material_target = AddMaterial(0.2, 1.0, 0.2);
+	material_waiting = AddMaterial(1.0, 0.6, 0.1);
+	material_obstacle = AddMaterial(0.8, 0.8, 0.2);
+	material_ground1 = AddMaterial(0.9, 0.9, 0.9);
+	material_ground2 = AddMaterial(0.6, 0.6, 1.0);
 }
 
 
 
 // 物体の描画 /////////////////////////////////////////////////////////////////
 
+// 球を描く
+
+void DrawSphere(const double radius, const int material)
+{
+	PushMatrix();
+	Scale(radius, radius, radius);
+	RecordDraw(MESH_SPHERE, material);
+	PopMatrix();
+}
+
 // 腕を描く
 
-void DrawOneArm(const double length, const double thickness)
+void DrawOneArm(const double length, const double thickness,
+	const int material)
 {
-	glPushMatrix();
-	glTranslated(length / 2, 0.0, 0.0);
-	glScaled(length, thickness, thickness);
-	glutSolidCube(1.0);
-	glPopMatrix();
+	PushMatrix();
+	Translate(length / 2, 0.0, 0.0);
+	Scale(length, thickness, thickness);
+	RecordDraw(MESH_CUBE, material);
+	PopMatrix();
 }
 
-// アーム全体を描く
+// 土台が (x, y, z) で関節角が angle1, angle2, angle3 [rad] のアームを描く
 
-void DrawArm(void)
+void DrawArmAt(const double x, const double y, const double z,
+	const double angle1, const double angle2, const double angle3)
 {
-	glPushMatrix();
+	PushMatrix();
 
 	// 土台の位置を移動
 
-	glTranslated(base_x, base_y, base_z);
+	Translate(x, y, z);
+
+	// 腕を伸ばしきった範囲が見えなければ何も積まない
+
+	if (!IsSphereVisible(0.0, 0.0, 0.0,
+		ARM_LENGTH1 + ARM_LENGTH2 + ARM_LENGTH3 + ARM_THICKNESS)) {
+		PopMatrix();
+		return;
+	}
 
 	// ジョイント1
 
-	SetMaterial(0.6, 0.6, 0.6);
-	glutSolidSphere(ARM_THICKNESS, 16, 8);
+	DrawSphere(ARM_THICKNESS, material_joint);
 
 	// アーム1
 
-	SetMaterial(0.1, 0.2, 1.0);
-	glRotated(arm_angle1, 0.0, 0.0, 1.0);
-	DrawOneArm(ARM_LENGTH1, ARM_THICKNESS);
+	Rotate(angle1, 0.0, 0.0, 1.0);
+	DrawOneArm(ARM_LENGTH1, ARM_THICKNESS, material_arm1);
 
 	// アームの長さだけ座標系を移動
 
-	glTranslated(ARM_LENGTH1, 0.0, 0.0);
+	Translate(ARM_LENGTH1, 0.0, 0.0);
 
 	// ジョイント2
 
-	SetMaterial(0.6, 0.6, 0.6);
-	glutSolidSphere(ARM_THICKNESS, 16, 8);
+	DrawSphere(ARM_THICKNESS, material_joint);
 
 	// アーム2
 
-	SetMaterial(0.9, 0.2, 0.1);
-	glRotated(arm_angle2, 0.0, 0.0, 1.0);
-	DrawOneArm(ARM_LENGTH2, ARM_THICKNESS);
+	Rotate(angle2, 0.0, 0.0, 1.0);
+	DrawOneArm(ARM_LENGTH2, ARM_THICKNESS, material_arm2);
 
 	// アームの長さだけ座標系を移動
 
-	glTranslated(ARM_LENGTH2, 0.0, 0.0);
+	Translate(ARM_LENGTH2, 0.0, 0.0);
 
 	// ジョイント3
 
-	SetMaterial(0.6, 0.6, 0.6);
-	glutSolidSphere(ARM_THICKNESS, 16, 8);
+	DrawSphere(ARM_THICKNESS, material_joint);
 
 	// アーム3
 
-	SetMaterial(0.2, 0.9, 0.1);
-	glRotated(arm_angle3, 0.0, 0.0, 1.0);
-	DrawOneArm(ARM_LENGTH3, ARM_THICKNESS);
+	Rotate(angle3, 0.0, 0.0, 1.0);
+	DrawOneArm(ARM_LENGTH3, ARM_THICKNESS, material_arm3);
 
-	glPopMatrix();
+	PopMatrix();
+}
+
+// アーム全体を描く
+
+void DrawArm(void)
+{
+	TRACE_SCOPE("DrawArm");
+
+	DrawArmAt(world->base_x, world->base_y, world->base_z,
+		world->arm_angle1, world->arm_angle2, world->arm_angle3);
+}
+
+// 並んだアームと待ち行列の目標を描く．割り当て済みの目標と待っている目標は
+// 色を変える
+
+void DrawCell(void)
+{
+	TRACE_SCOPE("DrawCell");
+
+	for (int i = 0; i < cell.num_arms; i++) {
+		DrawArmAt(cell.base_x[i], cell.base_y[i], cell.base_z[i],
+			cell.angle1[i], cell.angle2[i], cell.angle3[i]);
+	}
+	for (int j = 0; j < cell.num_targets; j++) {
+		PushMatrix();
+		Translate(cell.target_x[j], cell.target_y[j], cell.target_z[j]);
+		DrawSphere(CELL_TARGET_RADIUS,
+			cell.target_arm[j] >= 0 ? material_target : material_waiting);
+		PopMatrix();
+	}
 }
 
 // ターゲットを描く
 
 void DrawTarget(void)
 {
-	glPushMatrix();
-	glTranslated(target_x, target_y, target_z);
-
-	SetMaterial(0.2, 1.0, 0.2);
-	glutSolidSphere(TARGET_RADIUS, 16, 8);
-	glPopMatrix();
+	PushMatrix();
+	Translate(world->target_x, world->target_y, world->target_z);
+	DrawSphere(TARGET_RADIUS, material_target);
+	PopMatrix();
 }
 
-// 地面を描く
+// 障害物を描く
 
-void DrawGround(void)
+void DrawObstacles(void)
 {
-	const int num = 10;
-	const double size = 10.0;
+	for (int i = 0; i < world->scene.num_spheres; i++) {
+		const CollisionSphere &sphere = world->scene.spheres[i];
+		PushMatrix();
+		Translate(sphere.x, sphere.y, sphere.z);
+		DrawSphere(sphere.r, material_obstacle);
+		PopMatrix();
+	}
+}
 
-	glPushMatrix();
-	glScaled(size, 1.0, size);
-	glTranslated(-num / 2.0, 0.0, -num / 2.0);
+// 場面全体を積む
 
-	glNormal3d(0.0, 1.0, 0.0);
-	glBegin(GL_QUADS);
-	for (int i = 0; i < num; i++) {
-		for (int j = 0; j < num; j++) {
-			if ((i + j) % 2 == 0) {
-				SetMaterial(0.9, 0.9, 0.9);
-			} else {
-				SetMaterial(0.6, 0.6, 1.0);
-			}
-			glVertex3i(i, 0, j);
-			glVertex3i(i, 0, (j + 1));
-			glVertex3i((i + 1), 0, (j + 1));
-			glVertex3i((i + 1), 0, j);
-		}
+void DrawScene(void)
+{
+	PushMatrix();
+
+	if (cell_arms) {
+		PushMatrix();
+		Scale(cell_view_scale, 1.0, cell_view_scale);
+		RecordGround(GROUND_NUM, GROUND_SIZE, material_ground1, material_ground2);
+		PopMatrix();
+		DrawCell();
+	} else {
+		RecordGround(GROUND_NUM, GROUND_SIZE, material_ground1, material_ground2);
+		DrawArm();
+		DrawTarget();
 	}
-	glEnd();
+	DrawObstacles();
 
-	glPopMatrix();
+	PopMatrix();
 }
 
 
@@ -276,9 +708,14 @@ GLint viewport[4];
 
 void SaveCurrentTransform(void)
 {
-	glGetDoublev(GL_MODELVIEW_MATRIX, modelview_matrix);
-	glGetDoublev(GL_PROJECTION_MATRIX, projection_matrix);
-	glGetIntegerv(GL_VIEWPORT, viewport);
+	const GLfloat *modelview = CurrentMatrix();
+	for (int i = 0; i < 16; i++) {
+		modelview_matrix[i] = modelview[i];
+		projection_matrix[i] = render_projection[i];
+	}
+	for (int i = 0; i < 4; i++) {
+		viewport[i] = render_viewport[i];
+	}
 }
 
 // 任意の平面との交点を求める
@@ -318,112 +755,234 @@ int UnProject(const int x, const int y,
 	return is_error;
 }
 
-double toRadian(double x){
-	return x * M_PI / 180.0;
+// 逆運動学に基づいてアームの姿勢を制御 ///////////////////////////////////////
+
+// 選んでいる世界の目標までの経路を計画し，見つかればその軌道を辿り始める．
+// 見つからなければ，これまでどおり逆運動学で目標へ向かう
+
+void PlanToTarget(void)
+{
+	planned_target_x = world->target_x;
+	planned_target_y = world->target_y;
+
+	planner_arm.base_x = world->base_x;
+	planner_arm.base_y = world->base_y;
+	planner_arm.base_z = world->base_z;
+	float start[3] = {(float) world->arm_angle1, (float) world->arm_angle2,
+		(float) world->arm_angle3};
+	if (PlanArmMotion(planner_arm, world->scene, planner_settings, start,
+		(float) world->target_x, (float) world->target_y, &world->trajectory,
+		&planner_stats)) {
+		world->trajectory_index = 0;
+	} else {
+		world->trajectory_index = world->trajectory.num_points;
+	}
 }
 
-double toDegree(double x){
-	return x * 180.0 / M_PI;
+// 全部の世界の先端を目標へ一歩近づける (arm_world.h)．選んでいる世界の
+// 目標が変わっていれば，先に経路を計画する
+
+void UpdateWorlds(void)
+{
+	TRACE_SCOPE("UpdateWorlds");
+
+	// ドラッグ中は目標が動き続けるので，放してから計画する
+
+	if (use_planner && !mouse_button_down && world->is_moving
+		&& (world->target_x != planned_target_x || world->target_y != planned_target_y)) {
+		PlanToTarget();
+	}
+	TickWorlds(&worlds, 1, 0, &world_stats);
 }
 
-// 逆運動学に基づいてアームの姿勢を制御 ///////////////////////////////////////
+// 並んだアームに目標を割り当てて一歩ずつ動かし，届いた分だけ待ち行列を補う
 
-void UpdateArmStatus(void)
+void UpdateCell(void)
 {
-	// 現在のエンドエフェクタの位置を計算する
+	TRACE_SCOPE("UpdateCell");
+
+	TickArmCell(&cell, &cell_work, &cell_stats);
+	while (cell.num_targets < cell_arms * CELL_TARGETS_PER_ARM) {
+		PushRandomCellTarget(&cell, &cell_random_state);
+	}
+}
+
 
-	double endEffecter_x = ARM_LENGTH1 * cos(toRadian(arm_angle1)) + ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	double endEffecter_y = ARM_LENGTH1 * sin(toRadian(arm_angle1)) + ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
 
-	// 現在の位置から目標の位置へのベクトルを求める
+// 外部プロセスとの通信 ///////////////////////////////////////////////////////
 
-	double endToTarget_x = target_x - endEffecter_x;
-	double endToTarget_y = target_y - endEffecter_y;
+// 届いている目標をすべて取り出し，最後のものを採用する．
+// 新しい目標が来たら 1 を返す
 
-	// エンドエフェクタの変位を計算する
-	double endToTarget_dx, endToTarget_dy;
-	double length = sqrt(endToTarget_x * endToTarget_x + endToTarget_y * endToTarget_y);
+int ReceiveTargets(void)
+{
+	if (!channel) {
+		return 0;
+	}
 
-	if (length > 2.0){
-		endToTarget_dx = (endToTarget_x / length) * 2.0;
-		endToTarget_dy = (endToTarget_y / length) * 2.0;
+	TargetMessage message = {};
+	int received = 0;
+	while (channel->targets.Pop(&message)) {
+		received = 1;
+	}
+	if (!received) {
+		return 0;
+	}
+
+	world->target_x = message.x;
+	world->target_y = message.y;
+	world->target_z = message.z;
+	channel_target_seq = message.seq;
+	channel_target_send_ns = message.send_ns;
+	return 1;
+}
+
+// 現在の関節角と目標までの誤差を送る
+
+void PublishStatus(void)
+{
+	if (!channel || channel_target_seq == 0) {
+		return;
+	}
+
+	KinematicsReal angle[3] = {(KinematicsReal) world->arm_angle1,
+		(KinematicsReal) world->arm_angle2, (KinematicsReal) world->arm_angle3};
+	KinematicsReal end_x, end_y;
+	ArmForward<KinematicsReal, KINEMATICS_FAST>(ARM_LENGTHS, angle, &end_x, &end_y);
+
+	StatusMessage message;
+	message.target_seq = channel_target_seq;
+	message.target_send_ns = channel_target_send_ns;
+	message.angle[0] = RadianToDegree(world->arm_angle1);
+	message.angle[1] = RadianToDegree(world->arm_angle2);
+	message.angle[2] = RadianToDegree(world->arm_angle3);
+	message.end_x = end_x;
+	message.end_y = end_y;
+	double error_x = world->target_x - message.end_x;
+	double error_y = world->target_y - message.end_y;
+	message.error = sqrt(error_x * error_x + error_y * error_y);
+	message.publish_ns = MonotonicNs();
+
+	if (!channel->status.Push(message)) {
+		channel_status_dropped++;
+	}
+}
+
+
+
+// 視点の設定 /////////////////////////////////////////////////////////////////
+
+// 視点 view を，ウィンドウ内の (x, y) から幅 w，高さ h の領域に設定する
+
+void SetView(const int view, const int x, const int y, const int w, const int h)
+{
+	SetRenderViewport(x, y, w, h);
+
+	double scale = cell_arms ? cell_view_scale : 1.0; // 並んだアームが全部入るように引く
+	if (view == VIEW_TOP || view == VIEW_SIDE) {
+		SetOrthoProjection(ORTHO_HALF_HEIGHT * scale,
+			NEAR_CLIPPING_LENGTH, FAR_CLIPPING_LENGTH);
 	} else {
-		endToTarget_dx = endToTarget_x;
-		endToTarget_dy = endToTarget_y;
-	}
-	
-	// ヤコビアンを計算する
-
-	double ja[2][3];
-	ja[0][0] = -ARM_LENGTH1 * sin(toRadian(arm_angle1)) - ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) - ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	ja[0][1] = -ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) - ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	ja[0][2] = -ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	ja[1][0] = ARM_LENGTH1 * cos(toRadian(arm_angle1)) + ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	ja[1][1] = ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	ja[1][2] = ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
-	
-	// ヤコビアンの擬似逆行列を求める
-
-	// - ヤコビアンの転置行列を求める
-	double jaT[3][2];
-	for(int i = 0; i < 3; i++){
-		for(int j = 0; j < 2; j++){
-			jaT[i][j] = ja[j][i];
-		}
+		SetPerspectiveProjection(FIELD_OF_VIEW, NEAR_CLIPPING_LENGTH, FAR_CLIPPING_LENGTH);
 	}
-	
-	double jajaT[2][2];
 
-	for(int i = 0; i < 2; i++){
-		for(int j = 0; j < 2; j++){
-			jajaT[i][j] = ja[i][0] * jaT[0][j] + ja[i][1] * jaT[1][j] + ja[i][2] * jaT[2][j];
-		}
+	if (view == VIEW_TOP) {
+		LookAt(world->base_x, ORTHO_DISTANCE, world->base_z,
+			world->base_x, 0.0, world->base_z, 0.0, 0.0, -1.0);
+	} else if (view == VIEW_SIDE) {
+		LookAt(world->base_x, SIDE_VIEW_Y, ORTHO_DISTANCE,
+			world->base_x, SIDE_VIEW_Y, world->base_z, UP_X, UP_Y, UP_Z);
+	} else if (view == VIEW_END && cell_arms) {
+		// 並びの最初のアームの先端を見る
+
+		LookAt(cell.end_x[0] + END_VIEW_OFFSET_X, cell.end_y[0] + END_VIEW_OFFSET_Y,
+			cell.base_z[0] + END_VIEW_OFFSET_Z, cell.end_x[0], cell.end_y[0], cell.base_z[0],
+			UP_X, UP_Y, UP_Z);
+	} else if (view == VIEW_END) {
+		KinematicsReal angle[3] = {(KinematicsReal) world->arm_angle1,
+			(KinematicsReal) world->arm_angle2, (KinematicsReal) world->arm_angle3};
+		KinematicsReal end_x, end_y;
+		ArmForward<KinematicsReal, KINEMATICS_FAST>(ARM_LENGTHS, angle, &end_x, &end_y);
+		LookAt(world->base_x + end_x + END_VIEW_OFFSET_X,
+			world->base_y + end_y + END_VIEW_OFFSET_Y, world->base_z + END_VIEW_OFFSET_Z,
+			world->base_x + end_x, world->base_y + end_y, world->base_z,
+			UP_X, UP_Y, UP_Z);
+	} else {
+		LookAt(EYE_X, EYE_Y * scale, EYE_Z * scale, // カメラの位置
+			TARGET_X, TARGET_Y, TARGET_Z, // 注視点
+			UP_X, UP_Y, UP_Z); // カメラ撮像面の上向き方向
 	}
-	
-	// - jajaTの逆行列を求める
+}
+
+// 一つの視点から描く
+
+void DrawSingleView(void)
+{
+	SetView(VIEW_MAIN, 0, 0, window_width, window_height);
+
+	// ここでマウスでのターゲット位置指定のために，OpenGLの座標変換情報を保存
+
+	SaveCurrentTransform();
+
+	// 光源位置の設定
+
+	SetRenderLight(LIGHT_POSITION);
+
+	// 物体の配置
+
+	do {
+		BeginDrawList();
+		DrawScene();
+	} while (RetryDrawList());
 
-	double det_jajaT = jajaT[0][0] * jajaT[1][1] - jajaT[0][1] * jajaT[1][0];
-	double jajaT_inv[2][2];
+	// マテリアル順に並べ替えて描く
 
-	if (det_jajaT == 0) {
-		// 逆行列が存在しないならば
-		jajaT_inv[0][0] = 0.0;
-		jajaT_inv[0][1] = 0.0;
-		jajaT_inv[1][0] = 0.0;
-		jajaT_inv[1][1] = 0.0;
+	if (use_soft_raster) {
+		SubmitDrawListSoft();
 	} else {
-		// 逆行列が存在するならば
-		jajaT_inv[0][0] = jajaT[1][1];
-		jajaT_inv[0][1] = -jajaT[0][1];
-		jajaT_inv[1][0] = -jajaT[1][0];
-		jajaT_inv[1][1] = jajaT[0][0];
-
-		for(int i = 0; i < 2; i++){
-			for(int j = 0; j < 2; j++){
-				jajaT_inv[i][j] /= det_jajaT;
-			}
-		}
+		SubmitDrawList();
 	}
+}
+
+// 画面を 2x2 に分けて全部の視点から描く．場面を積むのは一度だけで，
+// 視点ごとにはカリングと描画だけを繰り返す
+
+void DrawMultiView(void)
+{
+	TRACE_SCOPE("DrawMultiView");
+
+	int w = window_width / 2, h = window_height / 2;
+	for (int i = 0; i < NUM_VIEWS; i++) {
+		SetView(i, (i % 2) * w, (1 - i / 2) * h, w, h);
+		CaptureDrawView(&views[i]);
 
-	// - ヤコビアンの擬似逆行列を求める
-	double ja_sharp[3][2];
-	for(int i = 0; i < 3; i++){
-		for(int j = 0; j < 2; j++){
-			ja_sharp[i][j] = jaT[i][0] * jajaT_inv[0][j] + jaT[i][1] * jajaT_inv[1][j];
+		// マウスで目標を置くのは左上の視点
+
+		if (i == VIEW_MAIN) {
+			SaveCurrentTransform();
 		}
 	}
 
-	// 角度の変化量を計算する
-	
-	double d_arm_angle_1 = ja_sharp[0][0] * endToTarget_dx + ja_sharp[0][1] * endToTarget_dy;
-	double d_arm_angle_2 = ja_sharp[1][0] * endToTarget_dx + ja_sharp[1][1] * endToTarget_dy;
-	double d_arm_angle_3 = ja_sharp[2][0] * endToTarget_dx + ja_sharp[2][1] * endToTarget_dy;
-	
-	// 現在の角度に加える
-
-	arm_angle1 += toDegree(d_arm_angle_1);
-	arm_angle2 += toDegree(d_arm_angle_2);
-	arm_angle3 += toDegree(d_arm_angle_3);
+	// ワールド座標系で積む
+
+	LoadIdentity();
+	do {
+		BeginSharedDrawList(views, NUM_VIEWS);
+		DrawScene();
+		EndSharedDrawList();
+	} while (RetryDrawList());
+
+	for (int i = 0; i < NUM_VIEWS; i++) {
+		ApplyDrawView(views[i]);
+		SetRenderLight(LIGHT_POSITION);
+		CullDrawView(&views[i]);
+		if (use_soft_raster) {
+			SubmitDrawListSoft();
+		} else {
+			SubmitDrawList();
+		}
+		FinishDrawView(&views[i]);
+	}
 }
 
 
@@ -432,39 +991,91 @@ void UpdateArmStatus(void)
 
 void Display(void)
 {
-	// 画面をクリア
+	TRACE_SCOPE("Display");
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	MarkFrameStart();
 
-	// カメラの位置を設定
+	// 撮影の開始 (--capture で指定されたとき)
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	gluLookAt(EYE_X, EYE_Y, EYE_Z, // カメラの位置
-		TARGET_X, TARGET_Y, TARGET_Z, // 注視点
-		UP_X, UP_Y, UP_Z); // カメラ撮像面の上向き方向
+	if (capture_request) {
+		StartCapture(capture_request, window_width, window_height);
+		capture_request = NULL;
+	}
 
-	// ここでマウスでのターゲット位置指定のために，OpenGLの座標変換情報を保存
+	// 画面をクリア
 
-	SaveCurrentTransform();
+	SetRenderViewport(0, 0, window_width, window_height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// 光源位置の設定
+	// カメラを置いて描く
 
-	SetLight();
+	if (multi_view) {
+		DrawMultiView();
+	} else {
+		DrawSingleView();
+	}
+	SetRenderViewport(0, 0, window_width, window_height);
 
-	// 物体の配置
+	if (show_stats) {
+		PrintDrawListStats(stderr);
+		if (use_soft_raster) {
+			PrintSoftRasterStats(stderr);
+		}
+		if (multi_view) {
+			PrintDrawViewStats(stderr);
+		}
+		if (!cell_arms) {
+			PrintWorldHostStats(stderr, world_stats);
+			fprintf(stderr, "world %d: step %lld, %lld targets reached, distance %.2f\n",
+				selected_world, world->counter, world->reached, world->distance);
+		}
+		if (world->avoid_collisions) {
+			fprintf(stderr, "collision: %d obstacles, clearance %.2f, %d contacts\n",
+				world->scene.num_spheres, world->avoidance.clearance,
+				world->avoidance.contacts);
+		}
+		if (use_planner) {
+			fprintf(stderr, "planner: %s in %.2f ms, %lld samples, %lld nodes, "
+				"%d waypoints, %.2f -> %.2f rad, trajectory %d/%d\n",
+				planner_stats.solved ? "solved" : "failed", planner_stats.seconds * 1e3,
+				planner_stats.samples, planner_stats.nodes, planner_stats.waypoints,
+				planner_stats.raw_length,
+				planner_stats.smooth_length, world->trajectory_index,
+				world->trajectory.num_points);
+		}
+		if (cell_arms) {
+			fprintf(stderr, "cell: %d arms, %d targets waiting, %d assigned (cost %.1f, "
+				"%d candidates of %lld pairs), %lld completed, "
+				"score %.3f ms, solve %.3f ms, IK %.3f ms\n",
+				cell.num_arms, cell.num_targets, cell_stats.assigned, cell_stats.total_cost,
+				cell_stats.candidates, cell_stats.pairs, cell.completed,
+				cell_stats.score_ms, cell_stats.solve_ms, cell_stats.ik_ms);
+		}
+		if (channel) {
+			fprintf(stderr, "channel: target %llu, status dropped %lld\n",
+				channel_target_seq, channel_status_dropped);
+		}
+	}
 
-	glPushMatrix();
+	// 画像比較用に保存
 
-	DrawGround();
-	DrawArm();
-	DrawTarget();
+	if (save_frame) {
+		SaveFramebufferPPM(use_soft_raster ? "frame_soft.ppm" : "frame_gl.ppm",
+			window_width, window_height);
+		save_frame = 0;
+	}
 
-	glPopMatrix();
+	// 撮影中なら読み出しを発行する
+
+	CaptureFrame();
+	MarkFrameEnd();
 
 	// バッファの入れ替え
 
-	glutSwapBuffers();
+	{
+		TRACE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers();
+	}
 }
 
 // ウィンドウリサイズ
@@ -474,34 +1085,81 @@ void Reshape(int w, int h)
 	window_width = w;
 	window_height = h;
 
-	glViewport(0, 0, window_width, window_height);
+	// 動画の途中で大きさは変えられないので，撮影を終える
+
+	if (capture.active && (w != capture.width || h != capture.height)) {
+		StopCapture();
+	}
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(FIELD_OF_VIEW, window_width / (double) window_height,
-		NEAR_CLIPPING_LENGTH, FAR_CLIPPING_LENGTH);
+	// 投影は描くたびに SetView() で視点ごとに決める
 
-	glMatrixMode(GL_MODELVIEW);
+	SetRenderViewport(0, 0, window_width, window_height);
 }
 
 // キー入力
 
 void Keyboard(unsigned char key, int x, int y)
 {
+	TRACE_SCOPE("Keyboard");
+
 	if (key == 'q' || key == 3 || key == 27) { // 3: Ctrl-C, 27: ESC
+		StopCapture();
 		exit(0);
 	} else if (key == 'r') {
-		InitArmPosition();
+		ResetArmWorld(world);
+		planned_target_x = world->target_x;
+		planned_target_y = world->target_y;
+		if (cell_arms) {
+			InitCell();
+		}
 	} else if (key == 'a') {
-		arm_angle2 += 1.0;
+		world->arm_angle2 += DegreeToRadian(1.0);
 	} else if (key == 's') {
-		arm_angle2 -= 1.0;
+		world->arm_angle2 -= DegreeToRadian(1.0);
 	} else if (key == 'z') {
-		arm_angle1 += 1.0;
+		world->arm_angle1 += DegreeToRadian(1.0);
 	} else if (key == 'x') {
-		arm_angle1 -= 1.0;
+		world->arm_angle1 -= DegreeToRadian(1.0);
 	} else if (key == ' ') {
-		is_moving = 1 - is_moving;
+		world->is_moving = 1 - world->is_moving;
+	} else if (key == 'i') {
+		show_stats = 1 - show_stats;
+	} else if (key == 'b') {
+		use_soft_raster = 1 - use_soft_raster;
+	} else if (key == 'g') {
+		ToggleRenderShader();
+	} else if (key == 'c') {
+		if (capture.active) {
+			StopCapture();
+		} else {
+			StartCapture("capture.y4m", window_width, window_height);
+		}
+	} else if (key == 't') {
+		ToggleTrace("trace.json");
+	} else if (key == 'o') {
+		world->avoid_collisions = 1 - world->avoid_collisions;
+	} else if (key == 'O') {
+		world->scene.num_spheres = 0;
+	} else if (key == 'm') {
+		use_planner = 1 - use_planner;
+		planned_target_x = world->target_x;
+		planned_target_y = world->target_y;
+		world->trajectory_index = world->trajectory.num_points;
+		if (use_planner) {
+			PlanToTarget();
+		}
+	} else if (key == 'p') {
+		save_frame = 1;
+	} else if (key == 'v') {
+		multi_view = 1 - multi_view;
+	} else if ((key == '[' || key == ']') && worlds.size() > 1) {
+		int n = worlds.size();
+		SelectWorld((selected_world + (key == ']' ? 1 : n - 1)) % n);
+		fprintf(stderr, "world %d of %d\n", selected_world, n);
+	} else if (key == 'S') {
+		SaveSnapshot(snapshot_path);
+	} else if (key == 'L') {
+		LoadSnapshot(snapshot_path, 0);
 	}
 	glutPostRedisplay();
 }
@@ -510,29 +1168,62 @@ void Keyboard(unsigned char key, int x, int y)
 
 void MouseButton(int button, int state, int x, int y)
 {
-	if (button == GLUT_LEFT_BUTTON) {
+	TRACE_SCOPE("MouseButton");
+
+	if (button == GLUT_LEFT_BUTTON && cell_arms) {
+		// 並びの中央の面 z = 0 でクリックした位置に最も近いアームの面へ，
+		// 目標を積む
+
+		double target_cell_x, target_cell_y, target_cell_z;
+		if (state == GLUT_DOWN && !UnProject(x, (window_height - 1) - y,
+			0.0, 0.0, 1.0, 0.0,
+			&target_cell_x, &target_cell_y, &target_cell_z)) {
+			int nearest = 0;
+			for (int i = 1; i < cell.num_arms; i++) {
+				if (fabs(cell.base_x[i] - target_cell_x) + fabs(cell.base_z[i])
+					< fabs(cell.base_x[nearest] - target_cell_x) + fabs(cell.base_z[nearest])) {
+					nearest = i;
+				}
+			}
+			PushCellTarget(&cell, target_cell_x, target_cell_y, cell.base_z[nearest]);
+			glutPostRedisplay();
+		}
+	} else if (button == GLUT_LEFT_BUTTON) {
 		if (state == GLUT_DOWN) {
 			mouse_button_down = 1;
 			UnProject(x, (window_height - 1) - y, // スクリーン座標
-				0.0, 0.0, 1.0, -base_z, // 平面 z - base_z = 0
-				&target_x, &target_y, &target_z); // オブジェクト座標
+				0.0, 0.0, 1.0, -world->base_z, // 平面 z - base_z = 0
+				&world->target_x, &world->target_y, &world->target_z); // オブジェクト座標
 			glutPostRedisplay();
 		} else {
 			mouse_button_down = 0;
 		}
 	}
 	if (button == GLUT_MIDDLE_BUTTON && state == GLUT_DOWN) {}
-	if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN) {}
+	if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN) {
+		// クリックした位置に障害物を置く
+
+		double obstacle_x, obstacle_y, obstacle_z;
+		if (!UnProject(x, (window_height - 1) - y,
+			0.0, 0.0, 1.0, -world->base_z,
+			&obstacle_x, &obstacle_y, &obstacle_z)) {
+			AddCollisionSphere(&world->scene, obstacle_x, obstacle_y, obstacle_z,
+				OBSTACLE_RADIUS);
+			glutPostRedisplay();
+		}
+	}
 }
 
 // マウスドラッグ
 
 void MouseMotion(int x, int y)
 {
+	TRACE_SCOPE("MouseMotion");
+
 	if (mouse_button_down) {
 		UnProject(x, (window_height - 1) - y,
-			0.0, 0.0, 1.0, -base_z,
-			&target_x, &target_y, &target_z);
+			0.0, 0.0, 1.0, -world->base_z,
+			&world->target_x, &world->target_y, &world->target_z);
 		glutPostRedisplay();
 	}
 }
@@ -541,8 +1232,23 @@ void MouseMotion(int x, int y)
 
 void Idle(void)
 {
-	if (is_moving) {
-		UpdateArmStatus();
+	// 止まっている間も目標は受け取っておく
+
+	if (ReceiveTargets()) {
+		glutPostRedisplay();
+	}
+
+	// 並んだアームは選んでいる世界といっしょに止める
+
+	if (cell_arms ? world->is_moving : AnyWorldMoving(worlds)) {
+		TRACE_SCOPE("Idle"); // 空回りは記録しない
+
+		if (cell_arms) {
+			UpdateCell();
+		} else {
+			UpdateWorlds();
+			PublishStatus();
+		}
 		glutPostRedisplay();
 	}
 }
@@ -557,11 +1263,25 @@ int main(int argc, char **argv)
 
 	window_width = WINDOW_WIDTH;
 	window_height = WINDOW_HEIGHT;
-	counter = 0;
-	is_moving = 1;
 	mouse_button_down = 0;
+	show_stats = 0;
+	use_planner = 0;
+	use_soft_raster = 0;
+	save_frame = 0;
+	multi_view = 0;
+	cell_arms = 0;
+	channel = NULL;
+	channel_target_seq = 0;
+	channel_status_dropped = 0;
+	snapshot_path = "scene.snap";
 
-	InitArmPosition();
+	InitArmPlanner();
+	InitMaterials();
+
+	// GLUT_TRACE が設定されていれば記録を始める
+
+	TRACE_THREAD_NAME("main");
+	InitTrace();
 
 	// GLUTの初期化
 
@@ -571,6 +1291,52 @@ int main(int argc, char **argv)
 	glutInitWindowPosition(WINDOW_POSITION_X, WINDOW_POSITION_Y);
 	glutCreateWindow(argv[0]);
 
+	// GLUT が使わなかった引数の解釈
+
+	int load_snapshot = 0;
+	int num_worlds = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--soft") == 0) {
+			use_soft_raster = 1;
+		} else if (strcmp(argv[i], "--views") == 0) {
+			multi_view = 1;
+		} else if (strcmp(argv[i], "--cell") == 0 && i + 1 < argc) {
+			cell_arms = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--worlds") == 0 && i + 1 < argc) {
+			num_worlds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_request = argv[++i];
+		} else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+			snapshot_path = argv[++i];
+			load_snapshot = 1;
+		} else if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc) {
+			channel = OpenArmChannel(argv[++i]);
+			if (!channel) {
+				return 1;
+			}
+		}
+	}
+
+	// --snapshot のファイルがあれば場面とメッシュをそこから取る (--cell,
+	// --worlds より優先する)．無ければいつもどおり作り，次から使えるよう書いておく
+
+	if (load_snapshot && access(snapshot_path, F_OK) == 0) {
+		if (LoadSnapshot(snapshot_path, 1) != 0) {
+			return 1;
+		}
+	} else {
+		InitWorlds(num_worlds > 0 ? num_worlds : 1);
+		if (cell_arms > 0) {
+			InitCell();
+		} else {
+			cell_arms = 0;
+		}
+		InitMeshes();
+		if (load_snapshot) {
+			SaveSnapshot(snapshot_path);
+		}
+	}
+
 	// コールバック関数の設定
 
 	glutDisplayFunc(Display);
@@ -580,9 +1346,9 @@ int main(int argc, char **argv)
 	glutMotionFunc(MouseMotion);
 	glutIdleFunc(Idle);
 
-	// OpenGLの各種初期設定
+	// OpenGLの各種初期設定 (背景色は白)
 
-	InitGL();
+	InitRender(1.0, 1.0, 1.0, 1.0);
 
 	// GLUTに制御を移管
 
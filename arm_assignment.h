@@ -0,0 +1,590 @@
+// arm_assignment.h
+//
+// 多数のアームへの，待ち行列に並んだ目標の割り当て
+//
+// 毎ティック，すべてのアームと待っているすべての目標の組について，届くか
+// どうかと先端から目標までの距離を見積もる (SSE が使えれば目標 4 個ずつ)．
+// アームごとに安い方から ASSIGN_CANDIDATES 個の目標だけを候補に残し，
+// その疎な二部グラフで費用の和が最小になる割り当てを最短増加路法で求める．
+// 割り当てた組は ArmIkStep() で一歩ずつ動かし，届いた目標は列から外す．
+//
+// アームは平面 z = base_z 内の 3 関節 (3dof_arm.cpp と同じ形) で，
+// 目標がその面から plane_tolerance より離れていれば届かないとみなす．
+
+#ifndef ARM_ASSIGNMENT_H
+#define ARM_ASSIGNMENT_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kinematics.h"
+#include "random.h"
+#include "trace.h"
+
+
+
+// アームと目標 ///////////////////////////////////////////////////////////////
+
+const int ASSIGN_CANDIDATES = 8;          // アームごとに残す候補の数
+const float ASSIGN_UNREACHABLE = 1e30f;   // 届かない組の費用
+
+// アームの並びと目標の待ち行列．どちらも成分ごとの配列に持つ．
+// 目標の配列は SSE で 4 個ずつ読むので，届かない位置で埋めて切り上げておく
+
+struct ArmCell {
+	float length[3];
+	float reach_min, reach_max;   // 根元から届く距離の範囲
+	float plane_tolerance;        // 目標が腕の面からこれだけ離れていても届くとみなす
+	float switch_cost;            // 割り当て済みの目標を続けるときは費用をこれだけ下げる
+	float done_tolerance;         // 先端がここまで近づいたら目標を終える
+	float max_step;               // 逆運動学の一歩で先端を動かす距離の上限
+
+	int num_arms;
+	std::vector<float> base_x, base_y, base_z;
+	std::vector<float> angle1, angle2, angle3; // [rad]
+	std::vector<float> end_x, end_y;           // 先端のワールド座標 (z は base_z)
+	std::vector<int> arm_target;               // 割り当てた目標 (-1 なら無し)
+
+	int num_targets;
+	std::vector<float> target_x, target_y, target_z;
+	std::vector<int> target_arm;               // 割り当てたアーム (-1 なら待ち)
+	std::vector<long long> target_id;          // 列に入れた順の通し番号
+	long long next_target_id;
+	long long completed;                       // 終えた目標の累計
+};
+
+inline void InitArmCell(ArmCell *cell, const float length[3])
+{
+	float longest = 0.0f, total = 0.0f;
+	for (int i = 0; i < 3; i++) {
+		cell->length[i] = length[i];
+		longest = std::max(longest, length[i]);
+		total += length[i];
+	}
+	cell->reach_max = total;
+	cell->reach_min = std::max(0.0f, 2.0f * longest - total);
+	cell->plane_tolerance = 0.5f;
+	cell->switch_cost = 2.0f;
+	cell->done_tolerance = 0.2f;
+	cell->max_step = 2.0f;
+	cell->num_arms = 0;
+	cell->num_targets = 0;
+	cell->next_target_id = 0;
+	cell->completed = 0;
+}
+
+inline int AddCellArm(ArmCell *cell, const float x, const float y, const float z)
+{
+	cell->base_x.push_back(x);
+	cell->base_y.push_back(y);
+	cell->base_z.push_back(z);
+	cell->angle1.push_back(DegreeToRadian(30.0f));
+	cell->angle2.push_back(DegreeToRadian(120.0f));
+	cell->angle3.push_back(DegreeToRadian(30.0f));
+	cell->end_x.push_back(x);
+	cell->end_y.push_back(y);
+	cell->arm_target.push_back(-1);
+	return cell->num_arms++;
+}
+
+// 目標の配列を n 個に詰め直し，4 の倍数までを届かない位置で埋める
+
+inline void ResizeCellTargets(ArmCell *cell, const int n)
+{
+	int padded = (n + 3) & ~3;
+	cell->num_targets = n;
+	cell->target_x.resize(padded);
+	cell->target_y.resize(padded);
+	cell->target_z.resize(padded);
+	cell->target_arm.resize(padded);
+	cell->target_id.resize(padded);
+	for (int j = n; j < padded; j++) {
+		cell->target_x[j] = 0.0f;
+		cell->target_y[j] = 0.0f;
+		cell->target_z[j] = ASSIGN_UNREACHABLE;
+		cell->target_arm[j] = -1;
+		cell->target_id[j] = -1;
+	}
+}
+
+// 目標を列の末尾に入れ，通し番号を返す
+
+inline long long PushCellTarget(ArmCell *cell, const float x, const float y,
+	const float z)
+{
+	int j = cell->num_targets;
+	ResizeCellTargets(cell, j + 1);
+	cell->target_x[j] = x;
+	cell->target_y[j] = y;
+	cell->target_z[j] = z;
+	cell->target_arm[j] = -1;
+	cell->target_id[j] = cell->next_target_id;
+	return cell->next_target_id++;
+}
+
+// n 本のアームを格子に並べる．同じ列 (z が同じ) のアームは腕の面を共有し，
+// 間隔が腕の長さより狭ければ同じ目標を取り合う
+
+inline void LayoutCellArms(ArmCell *cell, const int n, const float spacing_x,
+	const float spacing_z)
+{
+	int columns = (int) std::ceil(std::sqrt((float) n));
+	int rows = (n + columns - 1) / columns;
+	for (int i = 0; i < n; i++) {
+		AddCellArm(cell, (i % columns - (columns - 1) * 0.5f) * spacing_x, 0.0f,
+			(i / columns - (rows - 1) * 0.5f) * spacing_z);
+	}
+}
+
+// 乱数で選んだアームの，乱数で選んだ姿勢の先端を目標として列に入れる．
+// 地面より下になる姿勢は選び直すので，必ずどれかのアームが届く
+
+inline long long PushRandomCellTarget(ArmCell *cell, unsigned long long *state)
+{
+	int i = (int) (RandomFloat(state) * cell->num_arms) % cell->num_arms;
+	float x, y;
+	do {
+		float angle[3] = {(float) KINEMATICS_PI * RandomFloat(state),
+			(float) KINEMATICS_PI * (1.6f * RandomFloat(state) - 0.8f),
+			(float) KINEMATICS_PI * (1.6f * RandomFloat(state) - 0.8f)};
+		ArmForward<float, false>(cell->length, angle, &x, &y);
+	} while (y < 0.0f);
+	return PushCellTarget(cell, cell->base_x[i] + x, cell->base_y[i] + y, cell->base_z[i]);
+}
+
+// 全アームの先端位置を求め直す
+
+inline void UpdateCellEnds(ArmCell *cell)
+{
+	ArmForwardBatch<float, true>(cell->num_arms, cell->length, &cell->angle1[0],
+		&cell->angle2[0], &cell->angle3[0], &cell->end_x[0], &cell->end_y[0]);
+	for (int i = 0; i < cell->num_arms; i++) {
+		cell->end_x[i] += cell->base_x[i];
+		cell->end_y[i] += cell->base_y[i];
+	}
+}
+
+
+
+// 費用の見積もり /////////////////////////////////////////////////////////////
+
+// アーム i から目標 j への費用．根元からの距離が届く範囲にあり，腕の面の
+// 近くで，地面 (根元の高さ) より上なら，今の先端から目標までの面内の距離．
+// そうでなければ ASSIGN_UNREACHABLE．SSE 版の確かめにも使う
+
+inline float ArmTargetCost(const ArmCell &cell, const int i, const int j)
+{
+	float dx = cell.target_x[j] - cell.base_x[i];
+	float dy = cell.target_y[j] - cell.base_y[i];
+	float dz = cell.target_z[j] - cell.base_z[i];
+	float r2 = dx * dx + dy * dy;
+	if (!(std::fabs(dz) <= cell.plane_tolerance && dy >= 0.0f
+		&& r2 <= cell.reach_max * cell.reach_max
+		&& r2 >= cell.reach_min * cell.reach_min)) {
+		return ASSIGN_UNREACHABLE;
+	}
+	float gx = cell.target_x[j] - cell.end_x[i];
+	float gy = cell.target_y[j] - cell.end_y[i];
+	return std::sqrt(gx * gx + gy * gy);
+}
+
+// 候補の並び (費用の昇順) に (cost, j) を入れる．あふれた最後は捨てる
+
+inline void InsertCandidate(float *cost, int *target, int *count,
+	const float c, const int j)
+{
+	int k;
+	if (*count < ASSIGN_CANDIDATES) {
+		k = (*count)++;
+	} else if (c < cost[ASSIGN_CANDIDATES - 1]) {
+		k = ASSIGN_CANDIDATES - 1;
+	} else {
+		return;
+	}
+	while (k > 0 && cost[k - 1] > c) {
+		cost[k] = cost[k - 1];
+		target[k] = target[k - 1];
+		k--;
+	}
+	cost[k] = c;
+	target[k] = j;
+}
+
+// アーム i について全目標の費用を求め，安い方から ASSIGN_CANDIDATES 個を
+// cost[] と target[] に残す．残した数を返す
+
+inline int ScoreArmTargetsScalar(const ArmCell &cell, const int i,
+	float *cost, int *target)
+{
+	int count = 0;
+	for (int j = 0; j < cell.num_targets; j++) {
+		float c = ArmTargetCost(cell, i, j);
+		if (c < ASSIGN_UNREACHABLE) {
+			InsertCandidate(cost, target, &count, c, j);
+		}
+	}
+	return count;
+}
+
+inline int ScoreArmTargets(const ArmCell &cell, const int i, float *cost, int *target)
+{
+#ifdef __SSE2__
+	const __m128 bx = _mm_set1_ps(cell.base_x[i]), by = _mm_set1_ps(cell.base_y[i]);
+	const __m128 bz = _mm_set1_ps(cell.base_z[i]);
+	const __m128 ex = _mm_set1_ps(cell.end_x[i]), ey = _mm_set1_ps(cell.end_y[i]);
+	const __m128 tolerance = _mm_set1_ps(cell.plane_tolerance);
+	const __m128 max2 = _mm_set1_ps(cell.reach_max * cell.reach_max);
+	const __m128 min2 = _mm_set1_ps(cell.reach_min * cell.reach_min);
+	const __m128 unreachable = _mm_set1_ps(ASSIGN_UNREACHABLE);
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	// 候補が埋まるまでは届くものをすべて，埋まった後は最後の候補より
+	// 安いものだけを入れる．多くの組はこの比較だけで終わる
+
+	int count = 0;
+	__m128 worst = unreachable;
+	for (int j = 0; j < cell.num_targets; j += 4) {
+		__m128 tx = _mm_loadu_ps(&cell.target_x[j]), ty = _mm_loadu_ps(&cell.target_y[j]);
+		__m128 dx = _mm_sub_ps(tx, bx), dy = _mm_sub_ps(ty, by);
+		__m128 dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&cell.target_z[j]), bz), abs_mask);
+		__m128 r2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		__m128 ok = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(dz, tolerance),
+			_mm_cmpge_ps(dy, _mm_setzero_ps())),
+			_mm_and_ps(_mm_cmple_ps(r2, max2), _mm_cmpge_ps(r2, min2)));
+		__m128 gx = _mm_sub_ps(tx, ex), gy = _mm_sub_ps(ty, ey);
+		__m128 c = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)));
+		c = _mm_or_ps(_mm_and_ps(ok, c), _mm_andnot_ps(ok, unreachable));
+
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(c, worst));
+		if (mask == 0) {
+			continue;
+		}
+		float lane[4];
+		_mm_storeu_ps(lane, c);
+		for (int k = 0; k < 4; k++) {
+			if (mask & (1 << k)) {
+				InsertCandidate(cost, target, &count, lane[k], j + k);
+			}
+		}
+		if (count == ASSIGN_CANDIDATES) {
+			worst = _mm_set1_ps(cost[ASSIGN_CANDIDATES - 1]);
+		}
+	}
+	return count;
+#else
+	return ScoreArmTargetsScalar(cell, i, cost, target);
+#endif
+}
+
+
+
+// 割り当て ///////////////////////////////////////////////////////////////////
+
+// アーム (行) ごとの候補の辺と，最短増加路法の作業領域．毎ティック使い回す
+
+struct AssignmentWork {
+	std::vector<float> edge_cost;   // num_arms * ASSIGN_CANDIDATES
+	std::vector<int> edge_target;
+	std::vector<int> edge_count;
+
+	std::vector<int> arm_match;     // 行 → 列 (-1 なら無し)
+	std::vector<int> target_match;  // 列 → 行
+	std::vector<float> row_potential, column_potential;
+	std::vector<float> row_distance, column_distance;
+	std::vector<int> column_from;   // 列に来た行
+	std::vector<int> column_stamp;  // 距離を付けた探索の番号
+	std::vector<int> settled_stamp; // 距離が確定した探索の番号
+	std::vector<int> rows, settled;
+	std::vector<std::pair<float, int> > heap;
+	int stamp;
+
+	std::vector<unsigned char> target_done; // StepCellArms() で終えた目標
+	std::vector<int> target_moved;          // 列を詰めた後の番号
+};
+
+struct AssignmentStats {
+	long long pairs;     // 費用を見積もった組の数
+	int candidates;      // 残した辺の数
+	int assigned;        // 割り当てた組の数
+	float total_cost;    // 割り当てた組の費用の和
+	int completed;       // このティックで終えた目標の数
+	double score_ms;
+	double solve_ms;
+	double ik_ms;
+};
+
+inline double AssignElapsedMs(const std::chrono::steady_clock::time_point &from)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - from).count();
+}
+
+inline void ResizeAssignmentWork(AssignmentWork *work, const int rows, const int columns)
+{
+	work->edge_cost.resize((size_t) rows * ASSIGN_CANDIDATES);
+	work->edge_target.resize((size_t) rows * ASSIGN_CANDIDATES);
+	work->edge_count.assign(rows, 0);
+	work->arm_match.assign(rows, -1);
+	work->target_match.assign(columns, -1);
+	work->row_potential.assign(rows, 0.0f);
+	work->column_potential.assign(columns, 0.0f);
+	work->row_distance.resize(rows);
+	work->column_distance.resize(columns);
+	work->column_from.resize(columns);
+	work->column_stamp.assign(columns, 0);
+	work->settled_stamp.assign(columns, 0);
+	work->stamp = 0;
+	work->target_done.assign(columns, 0);
+	work->target_moved.resize(columns);
+}
+
+// 行 r の辺を距離 d から緩める．被約費用 c - u[r] - v[j] は常に 0 以上
+
+inline void RelaxAssignmentRow(AssignmentWork *work, const int r, const float d)
+{
+	const float *cost = &work->edge_cost[(size_t) r * ASSIGN_CANDIDATES];
+	const int *target = &work->edge_target[(size_t) r * ASSIGN_CANDIDATES];
+	for (int k = 0; k < work->edge_count[r]; k++) {
+		int j = target[k];
+		if (work->settled_stamp[j] == work->stamp) {
+			continue;
+		}
+		float nd = d + cost[k] - work->row_potential[r] - work->column_potential[j];
+		if (work->column_stamp[j] != work->stamp || nd < work->column_distance[j]) {
+			work->column_stamp[j] = work->stamp;
+			work->column_distance[j] = nd;
+			work->column_from[j] = r;
+			work->heap.push_back(std::make_pair(-nd, j));
+			std::push_heap(work->heap.begin(), work->heap.end());
+		}
+	}
+}
+
+// 空いている行 i から空いている列への最短増加路を探し，見つかれば
+// ポテンシャルを更新して割り当てを一つ増やす．辿れる列がすべて埋まって
+// いれば何もせず 0 を返す (後の行を足してもこの行は増やせない)
+
+inline int AugmentAssignment(AssignmentWork *work, const int i)
+{
+	work->stamp++;
+	work->heap.clear();
+	work->rows.clear();
+	work->settled.clear();
+
+	work->rows.push_back(i);
+	work->row_distance[i] = 0.0f;
+	RelaxAssignmentRow(work, i, 0.0f);
+
+	int free_column = -1;
+	float total = 0.0f;
+	while (!work->heap.empty()) {
+		std::pop_heap(work->heap.begin(), work->heap.end());
+		float d = -work->heap.back().first;
+		int j = work->heap.back().second;
+		work->heap.pop_back();
+		if (work->settled_stamp[j] == work->stamp || d > work->column_distance[j]) {
+			continue;
+		}
+		work->settled_stamp[j] = work->stamp;
+		work->settled.push_back(j);
+		int r = work->target_match[j];
+		if (r < 0) {
+			free_column = j;
+			total = d;
+			break;
+		}
+
+		// 割り当て済みの辺は被約費用 0 なので，行 r にも距離 d で着く
+
+		work->rows.push_back(r);
+		work->row_distance[r] = d;
+		RelaxAssignmentRow(work, r, d);
+	}
+	if (free_column < 0) {
+		return 0;
+	}
+
+	// 確定した列と辿った行のポテンシャルを，割り当て済みの辺の被約費用が
+	// 0 のまま，ほかの辺も 0 以上に保たれるよう動かす
+
+	for (size_t k = 0; k < work->settled.size(); k++) {
+		int j = work->settled[k];
+		work->column_potential[j] += work->column_distance[j] - total;
+	}
+	for (size_t k = 0; k < work->rows.size(); k++) {
+		int r = work->rows[k];
+		work->row_potential[r] += total - work->row_distance[r];
+	}
+
+	// 増加路に沿って割り当てを入れ替える
+
+	int j = free_column;
+	for (;;) {
+		int r = work->column_from[j];
+		int next = work->arm_match[r];
+		work->arm_match[r] = j;
+		work->target_match[j] = r;
+		if (r == i) {
+			break;
+		}
+		j = next;
+	}
+	return 1;
+}
+
+// 候補の辺 (edge_*) の中で，割り当てる組の数が最大で，その中で費用の和が
+// 最小の割り当てを arm_match / target_match に求める．割り当てた数を返す
+
+inline int SolveAssignment(AssignmentWork *work, const int rows, const int columns)
+{
+	TRACE_SCOPE("SolveAssignment");
+	work->arm_match.assign(rows, -1);
+	work->target_match.assign(columns, -1);
+	work->row_potential.assign(rows, 0.0f);
+	work->column_potential.assign(columns, 0.0f);
+
+	int assigned = 0;
+	for (int i = 0; i < rows; i++) {
+		if (work->edge_count[i] > 0) {
+			assigned += AugmentAssignment(work, i);
+		}
+	}
+	return assigned;
+}
+
+// 全アームと全目標の組を見積もって割り当てを決め直す．今の目標を続ける
+// アームは，その目標の費用を switch_cost だけ下げて候補に必ず入れる
+
+inline void AssignCellTargets(ArmCell *cell, AssignmentWork *work, AssignmentStats *stats)
+{
+	TRACE_SCOPE("AssignCellTargets");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	ResizeAssignmentWork(work, cell->num_arms, cell->num_targets);
+
+	stats->candidates = 0;
+	for (int i = 0; i < cell->num_arms; i++) {
+		float *cost = &work->edge_cost[(size_t) i * ASSIGN_CANDIDATES];
+		int *target = &work->edge_target[(size_t) i * ASSIGN_CANDIDATES];
+		int count = ScoreArmTargets(*cell, i, cost, target);
+
+		int current = cell->arm_target[i];
+		float current_cost = current >= 0 ? ArmTargetCost(*cell, i, current)
+			: ASSIGN_UNREACHABLE;
+		if (current_cost < ASSIGN_UNREACHABLE) {
+			int k = 0;
+			while (k < count && target[k] != current) {
+				k++;
+			}
+			if (k < count) {
+				// 取り除いてから入れ直す
+
+				for (; k + 1 < count; k++) {
+					cost[k] = cost[k + 1];
+					target[k] = target[k + 1];
+				}
+				count--;
+			}
+			InsertCandidate(cost, target, &count,
+				std::max(0.0f, current_cost - cell->switch_cost), current);
+		}
+		work->edge_count[i] = count;
+		stats->candidates += count;
+	}
+	stats->pairs = (long long) cell->num_arms * cell->num_targets;
+	stats->score_ms = AssignElapsedMs(start);
+
+	start = std::chrono::steady_clock::now();
+	stats->assigned = SolveAssignment(work, cell->num_arms, cell->num_targets);
+	stats->total_cost = 0.0f;
+	for (int j = 0; j < cell->num_targets; j++) {
+		cell->target_arm[j] = work->target_match[j];
+	}
+	for (int i = 0; i < cell->num_arms; i++) {
+		int j = work->arm_match[i];
+		cell->arm_target[i] = j;
+		if (j >= 0) {
+			stats->total_cost += ArmTargetCost(*cell, i, j);
+		}
+	}
+	stats->solve_ms = AssignElapsedMs(start);
+}
+
+
+
+// 1 ティック /////////////////////////////////////////////////////////////////
+
+// 割り当てた目標へ全アームを一歩ずつ動かし，届いた目標を列から外す．
+// 列の順 (古いものが先) は保つ．作業領域は AssignCellTargets() と共有する
+
+inline void StepCellArms(ArmCell *cell, AssignmentWork *work, AssignmentStats *stats)
+{
+	TRACE_SCOPE("StepCellArms");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<unsigned char> &done = work->target_done;
+	done.assign(cell->num_targets, 0);
+	stats->completed = 0;
+	for (int i = 0; i < cell->num_arms; i++) {
+		int j = cell->arm_target[i];
+		if (j < 0) {
+			continue;
+		}
+		float angle[3] = {cell->angle1[i], cell->angle2[i], cell->angle3[i]};
+		float error = ArmIkStep<float, true>(cell->length, angle,
+			cell->target_x[j] - cell->base_x[i], cell->target_y[j] - cell->base_y[i],
+			cell->max_step);
+		cell->angle1[i] = angle[0];
+		cell->angle2[i] = angle[1];
+		cell->angle3[i] = angle[2];
+		if (error < cell->done_tolerance) {
+			done[j] = 1;
+			cell->arm_target[i] = -1;
+		}
+	}
+
+	// 残る目標を詰め，アームが持つ目標の番号を付け直す
+
+	std::vector<int> &moved = work->target_moved;
+	moved.assign(cell->num_targets, -1);
+	int n = 0;
+	for (int j = 0; j < cell->num_targets; j++) {
+		if (done[j]) {
+			stats->completed++;
+			continue;
+		}
+		moved[j] = n;
+		cell->target_x[n] = cell->target_x[j];
+		cell->target_y[n] = cell->target_y[j];
+		cell->target_z[n] = cell->target_z[j];
+		cell->target_arm[n] = cell->target_arm[j];
+		cell->target_id[n] = cell->target_id[j];
+		n++;
+	}
+	ResizeCellTargets(cell, n);
+	for (int i = 0; i < cell->num_arms; i++) {
+		if (cell->arm_target[i] >= 0) {
+			cell->arm_target[i] = moved[cell->arm_target[i]];
+		}
+	}
+	cell->completed += stats->completed;
+	stats->ik_ms = AssignElapsedMs(start);
+}
+
+// 先端位置の更新，割り当て，逆運動学の一歩
+
+inline void TickArmCell(ArmCell *cell, AssignmentWork *work, AssignmentStats *stats)
+{
+	TRACE_SCOPE("TickArmCell");
+	UpdateCellEnds(cell);
+	AssignCellTargets(cell, work, stats);
+	StepCellArms(cell, work, stats);
+}
+
+#endif // ARM_ASSIGNMENT_H
@@ -0,0 +1,403 @@
+// arm_planner_stub.cpp
+//
+// 3dof_arm に共有メモリ越しに目標を送る計画プロセスの代役
+//
+// 目標を円に沿って一定の周期で送り，アームから返ってくる状態を読んで
+// 往復の遅延とメッセージの処理量を測る．
+// --self-test ではアームの代わりに同じプロセスのスレッドが受け手になり，
+// 通信路だけの遅延と処理量を測る．
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <thread>
+
+#include <sched.h>
+#include <signal.h>
+
+#include "shm_channel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const char *DEFAULT_CHANNEL_NAME = "/glut_arm";
+
+// 目標の軌道 (アームの根元を原点とする円)
+
+const double CIRCLE_CENTER_X = 0.0;
+const double CIRCLE_CENTER_Y = 15.0;
+const double CIRCLE_RADIUS = 8.0;
+const double CIRCLE_PERIOD = 4.0; // [s]
+
+// 遅延の度数分布．2 のべきごとに 16 に分ける
+
+const int HISTOGRAM_OCTAVES = 64;
+const int HISTOGRAM_STEPS = 16;
+
+struct LatencyHistogram {
+	unsigned long long count[HISTOGRAM_OCTAVES * HISTOGRAM_STEPS];
+	unsigned long long samples;
+	unsigned long long max_ns;
+	double sum_ns;
+};
+
+// グローバル変数
+
+const char *channel_name;
+double send_rate;    // [Hz]．0 なら詰められるだけ詰める
+double run_seconds;
+int self_test;
+int unlink_channel;
+
+volatile sig_atomic_t interrupted;
+
+std::atomic<int> echo_running;
+std::atomic<unsigned long long> echo_received;
+
+
+
+// 遅延の集計 /////////////////////////////////////////////////////////////////
+
+void ClearHistogram(LatencyHistogram *histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void AddLatency(LatencyHistogram *histogram, unsigned long long ns)
+{
+	int bucket;
+	if (ns < HISTOGRAM_STEPS) {
+		bucket = (int) ns;
+	} else {
+		int octave = 63 - __builtin_clzll(ns);
+		int step = (int) ((ns >> (octave - 4)) & (HISTOGRAM_STEPS - 1));
+		bucket = (octave - 3) * HISTOGRAM_STEPS + step;
+	}
+	histogram->count[bucket]++;
+	histogram->samples++;
+	histogram->sum_ns += ns;
+	if (ns > histogram->max_ns) {
+		histogram->max_ns = ns;
+	}
+}
+
+// 区間の下端を返す
+
+unsigned long long BucketValue(int bucket)
+{
+	if (bucket < HISTOGRAM_STEPS) {
+		return bucket;
+	}
+	int octave = bucket / HISTOGRAM_STEPS + 3;
+	int step = bucket % HISTOGRAM_STEPS;
+	return (1ull << octave) | ((unsigned long long) step << (octave - 4));
+}
+
+unsigned long long Percentile(const LatencyHistogram *histogram, double p)
+{
+	unsigned long long rank = (unsigned long long) (p * histogram->samples);
+	unsigned long long seen = 0;
+	for (int i = 0; i < HISTOGRAM_OCTAVES * HISTOGRAM_STEPS; i++) {
+		seen += histogram->count[i];
+		if (seen > rank) {
+			return BucketValue(i);
+		}
+	}
+	return histogram->max_ns;
+}
+
+void PrintLatency(FILE *fp, const LatencyHistogram *histogram)
+{
+	if (histogram->samples == 0) {
+		fprintf(fp, "latency: no replies");
+		return;
+	}
+	fprintf(fp, "latency [us]: mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f",
+		histogram->sum_ns / histogram->samples * 1e-3,
+		Percentile(histogram, 0.5) * 1e-3,
+		Percentile(histogram, 0.9) * 1e-3,
+		Percentile(histogram, 0.99) * 1e-3,
+		Percentile(histogram, 0.999) * 1e-3,
+		histogram->max_ns * 1e-3);
+}
+
+
+
+// アームの代役 (--self-test) /////////////////////////////////////////////////
+
+// 3dof_arm の Idle と同じく，届いた目標を全部取り出して最後のものに応える
+
+void EchoLoop(ArmChannel *channel)
+{
+	while (echo_running.load(std::memory_order_relaxed)) {
+		TargetMessage target;
+		memset(&target, 0, sizeof(target));
+		unsigned long long received = 0;
+		while (channel->targets.Pop(&target)) {
+			received++;
+		}
+		if (received == 0) {
+			sched_yield();
+			continue;
+		}
+		echo_received.fetch_add(received, std::memory_order_relaxed);
+
+		StatusMessage status;
+		memset(&status, 0, sizeof(status));
+		status.target_seq = target.seq;
+		status.target_send_ns = target.send_ns;
+		status.end_x = target.x;
+		status.end_y = target.y;
+		status.publish_ns = MonotonicNs();
+		channel->status.Push(status);
+	}
+}
+
+
+
+// 送信と受信 /////////////////////////////////////////////////////////////////
+
+struct ProducerStats {
+	unsigned long long sent;
+	unsigned long long full;      // 満杯で送れなかった回数
+	unsigned long long replies;   // 受け取った状態の数
+	unsigned long long last_seq;  // 応答を受け取った最新の目標
+	double error_sum;
+};
+
+// 届いている状態をすべて読み，新しい目標に対する最初の応答から遅延を測る
+
+void ReceiveStatus(ArmChannel *channel, ProducerStats *stats,
+	LatencyHistogram *interval, LatencyHistogram *total)
+{
+	StatusMessage status;
+	while (channel->status.Pop(&status)) {
+		unsigned long long now = MonotonicNs();
+		stats->replies++;
+		stats->error_sum += status.error;
+		if (status.target_seq > stats->last_seq) {
+			stats->last_seq = status.target_seq;
+			AddLatency(interval, now - status.target_send_ns);
+			AddLatency(total, now - status.target_send_ns);
+		}
+	}
+}
+
+void SendTarget(ArmChannel *channel, ProducerStats *stats, double t)
+{
+	TargetMessage target;
+	target.seq = stats->sent + stats->full + 1;
+	target.x = CIRCLE_CENTER_X + CIRCLE_RADIUS * cos(2.0 * M_PI * t / CIRCLE_PERIOD);
+	target.y = CIRCLE_CENTER_Y + CIRCLE_RADIUS * sin(2.0 * M_PI * t / CIRCLE_PERIOD);
+	target.z = 0.0;
+	target.send_ns = MonotonicNs();
+	if (channel->targets.Push(target)) {
+		stats->sent++;
+	} else {
+		stats->full++;
+	}
+}
+
+void SleepNs(unsigned long long ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ull;
+	ts.tv_nsec = ns % 1000000000ull;
+	nanosleep(&ts, NULL);
+}
+
+void Interrupt(int)
+{
+	interrupted = 1;
+}
+
+int Run(ArmChannel *channel)
+{
+	ProducerStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	static LatencyHistogram interval, total;
+	ClearHistogram(&interval);
+	ClearHistogram(&total);
+
+	// 前回の実行で残った状態を捨てる
+
+	StatusMessage stale;
+	while (channel->status.Pop(&stale)) {}
+
+	const unsigned long long period_ns =
+		send_rate > 0.0 ? (unsigned long long) (1e9 / send_rate) : 0;
+	const unsigned long long start_ns = MonotonicNs();
+	const unsigned long long end_ns = start_ns + (unsigned long long) (run_seconds * 1e9);
+	unsigned long long next_send_ns = start_ns;
+	unsigned long long next_report_ns = start_ns + 1000000000ull;
+	ProducerStats reported = stats;
+	unsigned long long reported_echo = 0;
+
+	while (!interrupted) {
+		unsigned long long now = MonotonicNs();
+		if (now >= end_ns) {
+			break;
+		}
+
+		// 送る時刻が来ていれば目標を積む
+
+		if (now >= next_send_ns) {
+			SendTarget(channel, &stats, (now - start_ns) * 1e-9);
+			next_send_ns = period_ns ? next_send_ns + period_ns : now;
+			if (next_send_ns < now) {
+				next_send_ns = now; // 大きく遅れたら追いつこうとしない
+			}
+		}
+
+		ReceiveStatus(channel, &stats, &interval, &total);
+
+		// 1 秒ごとの報告
+
+		if (now >= next_report_ns) {
+			double seconds = (now - next_report_ns + 1000000000ull) * 1e-9;
+			unsigned long long replies = stats.replies - reported.replies;
+			fprintf(stderr, "sent %.0f/s full %llu replies %.0f/s",
+				(stats.sent - reported.sent) / seconds,
+				stats.full - reported.full, replies / seconds);
+			if (self_test) {
+				unsigned long long echo = echo_received.load();
+				fprintf(stderr, " consumed %.0f/s", (echo - reported_echo) / seconds);
+				reported_echo = echo;
+			} else if (replies > 0) {
+				fprintf(stderr, " error %.3f",
+					(stats.error_sum - reported.error_sum) / replies);
+			}
+			fprintf(stderr, " | ");
+			PrintLatency(stderr, &interval);
+			fprintf(stderr, "\n");
+			ClearHistogram(&interval);
+			reported = stats;
+			next_report_ns = now + 1000000000ull;
+		}
+
+		// 次に送るまで時間があれば少し休む (相手に CPU を譲る)
+
+		if (period_ns) {
+			unsigned long long wait = next_send_ns > now ? next_send_ns - now : 0;
+			if (wait > 20000) {
+				wait = 20000;
+			}
+			if (wait > 0) {
+				SleepNs(wait);
+			}
+		}
+	}
+
+	// 遅れて届いた応答を拾う
+
+	unsigned long long drain_end = MonotonicNs() + 100000000ull;
+	while (stats.last_seq < stats.sent && MonotonicNs() < drain_end) {
+		ReceiveStatus(channel, &stats, &interval, &total);
+		SleepNs(100000);
+	}
+
+	double elapsed = (MonotonicNs() - start_ns) * 1e-9;
+	fprintf(stderr, "\ntotal: %.2f s, sent %llu (%.0f/s), full %llu, replies %llu (%.0f/s)",
+		elapsed, stats.sent, stats.sent / elapsed, stats.full,
+		stats.replies, stats.replies / elapsed);
+	if (self_test) {
+		fprintf(stderr, ", consumed %llu (%.0f/s)",
+			echo_received.load(), echo_received.load() / elapsed);
+	}
+	fprintf(stderr, "\n");
+	PrintLatency(stderr, &total);
+	fprintf(stderr, "\n");
+
+	return total.samples > 0 ? 0 : 1;
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+void Usage(const char *program)
+{
+	fprintf(stderr,
+		"usage: %s [--channel NAME] [--rate HZ] [--seconds S] [--self-test] [--unlink]\n"
+		"  --channel NAME  shared memory name (default %s)\n"
+		"  --rate HZ       targets per second, 0 for as fast as possible (default 1000)\n"
+		"  --seconds S     run time (default 10)\n"
+		"  --self-test     answer from a thread in this process instead of 3dof_arm\n"
+		"  --unlink        remove the shared memory when done\n",
+		program, DEFAULT_CHANNEL_NAME);
+}
+
+int main(int argc, char **argv)
+{
+	// 変数の初期化
+
+	channel_name = DEFAULT_CHANNEL_NAME;
+	send_rate = 1000.0;
+	run_seconds = 10.0;
+	self_test = 0;
+	unlink_channel = 0;
+	interrupted = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--channel") == 0 && i + 1 < argc) {
+			channel_name = argv[++i];
+		} else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+			send_rate = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+			run_seconds = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--self-test") == 0) {
+			self_test = 1;
+		} else if (strcmp(argv[i], "--unlink") == 0) {
+			unlink_channel = 1;
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+
+	// 自己試験ではアームとぶつからないよう別の名前を使い，終わったら消す
+
+	char self_test_name[64];
+	if (self_test && channel_name == DEFAULT_CHANNEL_NAME) {
+		snprintf(self_test_name, sizeof(self_test_name), "/glut_arm_test_%d", (int) getpid());
+		channel_name = self_test_name;
+		unlink_channel = 1;
+	}
+
+	ArmChannel *channel = OpenArmChannel(channel_name);
+	if (!channel) {
+		return 1;
+	}
+
+	signal(SIGINT, Interrupt);
+
+	std::thread echo_thread;
+	if (self_test) {
+		echo_running = 1;
+		echo_thread = std::thread(EchoLoop, channel);
+	} else {
+		fprintf(stderr, "sending to %s; run ./3dof_arm --channel %s\n",
+			channel_name, channel_name);
+	}
+
+	int result = Run(channel);
+
+	if (self_test) {
+		echo_running = 0;
+		echo_thread.join();
+	}
+
+	CloseArmChannel(channel);
+	if (unlink_channel) {
+		shm_unlink(channel_name);
+	}
+	return result;
+}
@@ -0,0 +1,151 @@
+// arm_world.h
+//
+// 3 自由度アームの世界
+//
+// 一本のアームの関節角，目標，障害物，避けるための作業領域，辿っている
+// 軌道までを一つの ArmWorld にまとめる．世界どうしは何も共有しないので，
+// world_host.h の TickWorlds() で別々のスレッドから進められる．
+// retarget を立てた世界は，目標に届くたびに自分の乱数で次の目標を選ぶ．
+
+#ifndef ARM_WORLD_H
+#define ARM_WORLD_H
+
+#include <cmath>
+
+#include "kinematics.h"
+#include "collision.h"
+#include "motion_planner.h"
+#include "world_host.h"
+
+
+
+// 世界 ///////////////////////////////////////////////////////////////////////
+
+const double ARM_WORLD_REACHED = 0.2; // 先端がここまで近づいたら届いたとみなす
+
+struct alignas(64) ArmWorld {
+	// 設定
+
+	KinematicsReal length[3];
+	KinematicsReal max_step;    // 一歩で先端を動かす距離の上限
+	float radius;               // 腕の太さ (障害物との距離に使う)
+	int avoid_collisions;       // 1 なら障害物を避けながら目標へ向かう
+	int retarget;               // 1 なら目標に届くたびに乱数で次を選ぶ
+
+	// 状態
+
+	double arm_angle1, arm_angle2, arm_angle3; // [rad]
+	double base_x, base_y, base_z;
+	double target_x, target_y, target_z;
+	double distance;            // 直近の一歩での先端から目標までの距離
+	int is_moving;
+	long long counter;          // 進めた刻みの数
+	long long reached;          // retarget で届いた目標の数
+	unsigned long long random_state;
+
+	CollisionScene scene;       // 地面と球の障害物
+	ArmAvoidance avoidance;
+	ArmTrajectory trajectory;   // 辿っている軌道 (経路計画の結果)
+	int trajectory_index;       // 次に使う軌道の点
+};
+
+// 姿勢と目標を始めの状態に戻す
+
+inline void ResetArmWorld(ArmWorld *world)
+{
+	world->arm_angle1 = DegreeToRadian(30.0);
+	world->arm_angle2 = DegreeToRadian(120.0);
+	world->arm_angle3 = DegreeToRadian(30.0);
+	world->base_x = 0.0;
+	world->base_y = 0.0;
+	world->base_z = 0.0;
+
+	world->target_x = 0.0;
+	world->target_y = (world->length[0] + world->length[1]) * 0.8;
+	world->target_z = 0.0;
+	world->distance = 0.0;
+	world->trajectory.num_points = 0;
+	world->trajectory_index = 0;
+}
+
+// 障害物は地面だけにする
+
+inline void InitArmWorld(ArmWorld *world, const double length[3],
+	const double max_step, const double radius, const unsigned long long seed)
+{
+	for (int i = 0; i < 3; i++) {
+		world->length[i] = length[i];
+	}
+	world->max_step = max_step;
+	world->radius = radius;
+	world->avoid_collisions = 1;
+	world->retarget = 0;
+	world->is_moving = 1;
+	world->counter = 0;
+	world->reached = 0;
+	world->random_state = SeedRandom(seed);
+	ResetArmWorld(world);
+
+	ClearCollisionScene(&world->scene);
+	AddCollisionPlane(&world->scene, 0.0f, 1.0f, 0.0f, 0.0f);
+	InitArmAvoidance(&world->avoidance, radius);
+}
+
+// 乱数で選んだ姿勢の先端を次の目標にする．地面より下になる姿勢は選び直す
+
+inline void RandomArmTarget(ArmWorld *world)
+{
+	KinematicsReal x, y;
+	do {
+		KinematicsReal angle[3] = {
+			(KinematicsReal) (KINEMATICS_PI * RandomDouble(&world->random_state)),
+			(KinematicsReal) (KINEMATICS_PI * (1.6 * RandomDouble(&world->random_state) - 0.8)),
+			(KinematicsReal) (KINEMATICS_PI * (1.6 * RandomDouble(&world->random_state) - 0.8))};
+		ArmForward<KinematicsReal, false>(world->length, angle, &x, &y);
+	} while (y < 0);
+	world->target_x = world->base_x + x;
+	world->target_y = world->base_y + y;
+	world->target_z = world->base_z;
+}
+
+// 先端を目標へ一歩近づける．軌道があれば，それを一刻みずつ辿る
+
+inline void TickWorld(ArmWorld *world)
+{
+	if (!world->is_moving) {
+		return;
+	}
+	world->counter++;
+
+	if (world->trajectory_index < world->trajectory.num_points) {
+		const float *q = &world->trajectory.angle[3 * world->trajectory_index++];
+		world->arm_angle1 = q[0];
+		world->arm_angle2 = q[1];
+		world->arm_angle3 = q[2];
+		return;
+	}
+
+	KinematicsReal angle[3] = {(KinematicsReal) world->arm_angle1,
+		(KinematicsReal) world->arm_angle2, (KinematicsReal) world->arm_angle3};
+	if (world->avoid_collisions) {
+		world->distance = ArmIkStepAvoiding<KinematicsReal, KINEMATICS_FAST>(
+			world->length, angle, (KinematicsReal) world->base_x,
+			(KinematicsReal) world->base_y, (KinematicsReal) world->base_z,
+			(KinematicsReal) world->target_x, (KinematicsReal) world->target_y,
+			world->max_step, world->radius, world->scene, &world->avoidance);
+	} else {
+		world->distance = ArmIkStep<KinematicsReal, KINEMATICS_FAST>(world->length,
+			angle, (KinematicsReal) (world->target_x - world->base_x),
+			(KinematicsReal) (world->target_y - world->base_y), world->max_step);
+	}
+	world->arm_angle1 = angle[0];
+	world->arm_angle2 = angle[1];
+	world->arm_angle3 = angle[2];
+
+	if (world->retarget && world->distance < ARM_WORLD_REACHED) {
+		world->reached++;
+		RandomArmTarget(world);
+	}
+}
+
+#endif // ARM_WORLD_H
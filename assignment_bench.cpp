@@ -0,0 +1,326 @@
+// assignment_bench.cpp
+//
+// arm_assignment.h の割り当ての手間と質を測る
+//
+// まず SSE で見積もった候補が 1 組ずつ求めたものと一致すること，最短増加路法の
+// 割り当てが密な費用行列のハンガリー法と同じ費用になることを確かめ，
+// 候補を絞ったことによる損と，費用の安い組から貪欲に取った場合を並べる．
+// 次にアームと目標の数ごとに 1 ティックの手間 (見積もり，割り当て，
+// 逆運動学) を表にし，最後に目標を補充し続けたときのティックの時間の分布と
+// 終えた目標の数を示す．
+//
+//   ./assignment_bench [ticks]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "arm_assignment.h"
+#include "bench.h"
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const float ARM_LENGTHS[3] = {10.0f, 12.0f, 8.0f};
+const float SPACING_X = 20.0f;  // 隣のアームと届く範囲が重なる
+const float SPACING_Z = 4.0f;
+
+unsigned long long random_state = 1;
+
+
+
+// 準備 ///////////////////////////////////////////////////////////////////////
+
+// アームを並べ，目標を入れる．一部のアームは乱数の姿勢にしておく
+
+void BuildCell(ArmCell *cell, const int arms, const int targets)
+{
+	InitArmCell(cell, ARM_LENGTHS);
+	LayoutCellArms(cell, arms, SPACING_X, SPACING_Z);
+	for (int i = 0; i < arms; i++) {
+		cell->angle1[i] = (float) KINEMATICS_PI * RandomFloat(&random_state);
+		cell->angle2[i] = 2.0f * RandomFloat(&random_state) - 1.0f;
+		cell->angle3[i] = 2.0f * RandomFloat(&random_state) - 1.0f;
+	}
+	for (int j = 0; j < targets; j++) {
+		PushRandomCellTarget(cell, &random_state);
+	}
+	UpdateCellEnds(cell);
+}
+
+template <typename F>
+double MeasureMs(F run)
+{
+	return MeasureSeconds(run) * 1e3;
+}
+
+
+
+// 確かめ /////////////////////////////////////////////////////////////////////
+
+// 密な費用行列 (rows <= columns) のハンガリー法．cost[i][j] が ASSIGN_UNREACHABLE
+// の組は，割り当てる数を最大にした上で避けるよう大きな費用に置き換える．
+// 割り当てた組の数と，届く組だけの費用の和を返す
+
+int DenseHungarian(const std::vector<std::vector<float> > &cost, double *total)
+{
+	const double BIG = 1e7;
+	int n = (int) cost.size(), m = n ? (int) cost[0].size() : 0;
+	std::vector<double> u(n + 1, 0.0), v(m + 1, 0.0), way_cost(m + 1);
+	std::vector<int> p(m + 1, 0), way(m + 1, 0);
+	std::vector<char> used(m + 1);
+	for (int i = 1; i <= n; i++) {
+		p[0] = i;
+		int j0 = 0;
+		std::fill(way_cost.begin(), way_cost.end(), 1e300);
+		std::fill(used.begin(), used.end(), 0);
+		do {
+			used[j0] = 1;
+			int i0 = p[j0], j1 = 0;
+			double delta = 1e300;
+			for (int j = 1; j <= m; j++) {
+				if (used[j]) {
+					continue;
+				}
+				float c = cost[i0 - 1][j - 1];
+				double cur = (c < ASSIGN_UNREACHABLE ? c : BIG) - u[i0] - v[j];
+				if (cur < way_cost[j]) {
+					way_cost[j] = cur;
+					way[j] = j0;
+				}
+				if (way_cost[j] < delta) {
+					delta = way_cost[j];
+					j1 = j;
+				}
+			}
+			for (int j = 0; j <= m; j++) {
+				if (used[j]) {
+					u[p[j]] += delta;
+					v[j] -= delta;
+				} else {
+					way_cost[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (p[j0] != 0);
+		do {
+			int j1 = way[j0];
+			p[j0] = p[j1];
+			j0 = j1;
+		} while (j0);
+	}
+
+	int assigned = 0;
+	*total = 0.0;
+	for (int j = 1; j <= m; j++) {
+		if (p[j] && cost[p[j] - 1][j - 1] < ASSIGN_UNREACHABLE) {
+			assigned++;
+			*total += cost[p[j] - 1][j - 1];
+		}
+	}
+	return assigned;
+}
+
+// 費用の安い組から順に，アームも目標も空いていれば取る
+
+int GreedyAssignment(const AssignmentWork &work, const int rows, const int columns,
+	double *total)
+{
+	std::vector<std::pair<float, std::pair<int, int> > > edges;
+	for (int i = 0; i < rows; i++) {
+		for (int k = 0; k < work.edge_count[i]; k++) {
+			edges.push_back(std::make_pair(work.edge_cost[i * ASSIGN_CANDIDATES + k],
+				std::make_pair(i, work.edge_target[i * ASSIGN_CANDIDATES + k])));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::vector<char> row_used(rows), column_used(columns);
+	int assigned = 0;
+	*total = 0.0;
+	for (size_t e = 0; e < edges.size(); e++) {
+		int i = edges[e].second.first, j = edges[e].second.second;
+		if (!row_used[i] && !column_used[j]) {
+			row_used[i] = column_used[j] = 1;
+			assigned++;
+			*total += edges[e].first;
+		}
+	}
+	return assigned;
+}
+
+void CheckAssignment(void)
+{
+	// SSE の候補と 1 組ずつ求めた候補
+
+	ArmCell cell;
+	BuildCell(&cell, 256, 4096);
+	int mismatches = 0;
+	for (int i = 0; i < cell.num_arms; i++) {
+		float cost_a[ASSIGN_CANDIDATES], cost_b[ASSIGN_CANDIDATES];
+		int target_a[ASSIGN_CANDIDATES], target_b[ASSIGN_CANDIDATES];
+		int na = ScoreArmTargets(cell, i, cost_a, target_a);
+		int nb = ScoreArmTargetsScalar(cell, i, cost_b, target_b);
+		bool same = na == nb;
+		for (int k = 0; same && k < na; k++) {
+			same = cost_a[k] == cost_b[k] && target_a[k] == target_b[k];
+		}
+		mismatches += !same;
+	}
+	printf("candidates: batched and one by one differ for %d of %d arms\n",
+		mismatches, cell.num_arms);
+
+	// 小さな場面で，密なハンガリー法と比べる
+
+	printf("\nassignment quality (%d candidates per arm, 20 cells of 48 arms x 160 targets)\n",
+		ASSIGN_CANDIDATES);
+	double max_gap = 0, sparse_sum = 0, dense_sum = 0, full_sum = 0, greedy_sum = 0;
+	int sparse_pairs = 0, full_pairs = 0, greedy_pairs = 0;
+	for (int trial = 0; trial < 20; trial++) {
+		ArmCell small;
+		BuildCell(&small, 48, 160);
+		AssignmentWork work;
+		AssignmentStats stats;
+		AssignCellTargets(&small, &work, &stats);
+
+		// 候補だけの費用行列と，届くすべての組の費用行列
+
+		std::vector<std::vector<float> > candidates(small.num_arms,
+			std::vector<float>(small.num_targets, ASSIGN_UNREACHABLE));
+		std::vector<std::vector<float> > full(small.num_arms,
+			std::vector<float>(small.num_targets));
+		for (int i = 0; i < small.num_arms; i++) {
+			for (int k = 0; k < work.edge_count[i]; k++) {
+				candidates[i][work.edge_target[i * ASSIGN_CANDIDATES + k]]
+					= work.edge_cost[i * ASSIGN_CANDIDATES + k];
+			}
+			for (int j = 0; j < small.num_targets; j++) {
+				full[i][j] = ArmTargetCost(small, i, j);
+			}
+		}
+		double dense, whole, greedy;
+		int dense_pairs = DenseHungarian(candidates, &dense);
+		full_pairs += DenseHungarian(full, &whole);
+		greedy_pairs += GreedyAssignment(work, small.num_arms, small.num_targets, &greedy);
+		if (dense_pairs != stats.assigned) {
+			printf("  trial %d: %d pairs, dense Hungarian %d\n", trial, stats.assigned, dense_pairs);
+		}
+		max_gap = std::max(max_gap, fabs(stats.total_cost - dense));
+		sparse_pairs += stats.assigned;
+		sparse_sum += stats.total_cost;
+		dense_sum += dense;
+		full_sum += whole;
+		greedy_sum += greedy;
+	}
+	printf("  %-36s %6s %12s\n", "method", "pairs", "total cost");
+	printf("  %-36s %6d %12.2f\n", "shortest augmenting paths", sparse_pairs, sparse_sum);
+	printf("  %-36s %6d %12.2f  (max diff %.2e)\n", "dense Hungarian, same candidates",
+		sparse_pairs, dense_sum, max_gap);
+	printf("  %-36s %6d %12.2f\n", "dense Hungarian, every pair", full_pairs, full_sum);
+	printf("  %-36s %6d %12.2f\n", "greedy, same candidates", greedy_pairs, greedy_sum);
+}
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+void BenchSizes(void)
+{
+	const int SIZES[][2] = {{100, 1000}, {256, 2048}, {256, 4096}, {512, 4096}, {1024, 8192}};
+	const int NUM_SIZES = sizeof(SIZES) / sizeof(SIZES[0]);
+
+	printf("\none tick (ms)\n");
+	printf("  %5s %6s %10s %10s %8s %8s %8s %8s %9s %8s\n", "arms", "targets", "Mpairs/s",
+		"one by one", "score", "solve", "IK", "total", "assigned", "edges");
+	for (int k = 0; k < NUM_SIZES; k++) {
+		ArmCell cell;
+		BuildCell(&cell, SIZES[k][0], SIZES[k][1]);
+		AssignmentWork work;
+		AssignmentStats stats;
+
+		float cost[ASSIGN_CANDIDATES];
+		int target[ASSIGN_CANDIDATES];
+		double batched = MeasureMs([&] {
+			for (int i = 0; i < cell.num_arms; i++) {
+				bench_sink += ScoreArmTargets(cell, i, cost, target);
+			}
+		});
+		double scalar = MeasureMs([&] {
+			for (int i = 0; i < cell.num_arms; i++) {
+				bench_sink += ScoreArmTargetsScalar(cell, i, cost, target);
+			}
+		});
+
+		// 割り当てと逆運動学は目標を減らすので，毎回写しから始める
+
+		ArmCell copy = cell;
+		double score = 0, solve = 0, ik = 0;
+		int runs = 0, assigned = 0, edges = 0;
+		MeasureMs([&] {
+			cell = copy;
+			TickArmCell(&cell, &work, &stats);
+			score += stats.score_ms;
+			solve += stats.solve_ms;
+			ik += stats.ik_ms;
+			assigned = stats.assigned;
+			edges = stats.candidates;
+			runs++;
+		});
+		printf("  %5d %6d %10.1f %10.2f %8.3f %8.3f %8.3f %8.3f %9d %8d\n",
+			SIZES[k][0], SIZES[k][1], stats.pairs / batched * 1e-3, scalar,
+			score / runs, solve / runs, ik / runs, (score + solve + ik) / runs,
+			assigned, edges);
+	}
+}
+
+double Percentile(std::vector<double> x, const double p)
+{
+	std::sort(x.begin(), x.end());
+	return x[(size_t) (p / 100.0 * (x.size() - 1) + 0.5)];
+}
+
+// 終えた目標を補充しながら回す
+
+void BenchQueue(const int ticks)
+{
+	const int arms = 512, targets = 4096;
+	ArmCell cell;
+	BuildCell(&cell, arms, targets);
+	AssignmentWork work;
+	AssignmentStats stats;
+
+	std::vector<double> ms;
+	double assigned = 0;
+	for (int t = 0; t < ticks; t++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		TickArmCell(&cell, &work, &stats);
+		ms.push_back(std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count());
+		assigned += stats.assigned;
+		while (cell.num_targets < targets) {
+			PushRandomCellTarget(&cell, &random_state);
+		}
+	}
+	printf("\nqueue kept at %d targets, %d arms, %d ticks\n", targets, arms, ticks);
+	printf("  tick p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", Percentile(ms, 50),
+		Percentile(ms, 99), Percentile(ms, 100));
+	printf("  %.1f arms busy per tick, %lld targets completed (%.2f per tick)\n",
+		assigned / ticks, cell.completed, (double) cell.completed / ticks);
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	const int ticks = argc > 1 ? atoi(argv[1]) : 1000;
+
+	CheckAssignment();
+	BenchSizes();
+	BenchQueue(ticks);
+	return 0;
+}
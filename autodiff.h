@@ -0,0 +1,293 @@
+// autodiff.h
+//
+// 前進型の自動微分 (二重数)
+//
+// Dual<T, FIRST, COUNT> は値 v と，独立変数 FIRST 〜 FIRST + COUNT - 1 に
+// ついての偏微分 d[] を持つ．それ以外の変数についての偏微分は 0 だと型で
+// 決まっているので，持たずに計算もしない．たとえば関節 2 の角は
+// Dual<T, 2, 1>，関節 0〜2 の累積角は Dual<T, 0, 3> で，和や積の偏微分の
+// 範囲は両者を覆うものになる．独立変数の偏微分 1 も定数として展開される
+// ので，インライン展開の後には 0 や 1 との積和が消え，手で導いた式と
+// 同じ形の計算だけが残る．
+//
+// 関数は計算の型についてのテンプレートに書き，ForwardJacobian() に渡す．
+// 独立変数ごとに型の違う二重数で実体化されて，値とヤコビアンが同時に求まる．
+// 差分ではなく連鎖律そのものなので，丸め誤差を除いて厳密．
+//
+//   T y[2], jacobian[2][3];
+//   ForwardJacobian<2, 3>([&](auto out, const auto &a, const auto &b, const auto &c) {
+//       out(0, a * b + c);
+//       out(1, sqrt(a));
+//   }, x, y, jacobian);
+
+#ifndef AUTODIFF_H
+#define AUTODIFF_H
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// 二重数の式は一段ごとには小さくても，入れ子になるとコンパイラのインライン
+// 展開の上限を超えて関数呼び出しが残り，手書きより遅くなる．そうした所に使う
+
+#if defined(__GNUC__)
+#define DUAL_INLINE inline __attribute__((always_inline))
+#else
+#define DUAL_INLINE inline
+#endif
+
+
+// 二重数 /////////////////////////////////////////////////////////////////////
+
+template <typename T, int FIRST, int COUNT>
+struct Dual {
+	typedef T Scalar;
+	T v;
+	T d[COUNT > 0 ? COUNT : 1];
+};
+
+// i 番目の独立変数．自分自身についての偏微分は 1
+
+template <int I, typename T>
+inline Dual<T, I, 1> DualVariable(const T value)
+{
+	Dual<T, I, 1> x;
+	x.v = value;
+	x.d[0] = (T) 1;
+	return x;
+}
+
+// 二つの偏微分の範囲を覆う範囲
+
+constexpr int DualUnionFirst(const int f1, const int c1, const int f2, const int c2)
+{
+	return c1 == 0 ? f2 : c2 == 0 ? f1 : (f1 < f2 ? f1 : f2);
+}
+
+constexpr int DualUnionCount(const int f1, const int c1, const int f2, const int c2)
+{
+	return c1 == 0 ? c2 : c2 == 0 ? c1
+		: (f1 + c1 > f2 + c2 ? f1 + c1 : f2 + c2) - (f1 < f2 ? f1 : f2);
+}
+
+template <typename T, int F1, int C1, int F2, int C2>
+using DualUnion = Dual<T, DualUnionFirst(F1, C1, F2, C2), DualUnionCount(F1, C1, F2, C2)>;
+
+// 結果の K 番目の偏微分 (変数 F + K)．wa * (a の偏微分) + wb * (b の偏微分) を，
+// どちらの範囲に入るかに応じてコンパイル時に選ぶ
+
+template <int K, int F, typename T, int F1, int C1, int F2, int C2>
+inline T CombineDerivative(const Dual<T, F1, C1> &a, const T wa,
+	const Dual<T, F2, C2> &b, const T wb)
+{
+	constexpr int i = F + K;
+	constexpr bool in_a = i >= F1 && i < F1 + C1;
+	constexpr bool in_b = i >= F2 && i < F2 + C2;
+	if constexpr (in_a && in_b) {
+		return wa * a.d[i - F1] + wb * b.d[i - F2];
+	} else if constexpr (in_a) {
+		return wa * a.d[i - F1];
+	} else if constexpr (in_b) {
+		return wb * b.d[i - F2];
+	} else {
+		return (T) 0;
+	}
+}
+
+template <typename T, int F1, int C1, int F2, int C2, std::size_t... K>
+inline DualUnion<T, F1, C1, F2, C2> CombineDual(const T v, const Dual<T, F1, C1> &a,
+	const T wa, const Dual<T, F2, C2> &b, const T wb, std::index_sequence<K...>)
+{
+	constexpr int F = DualUnionFirst(F1, C1, F2, C2);
+	DualUnion<T, F1, C1, F2, C2> r;
+	r.v = v;
+	((r.d[K] = CombineDerivative<(int) K, F>(a, wa, b, wb)), ...);
+	return r;
+}
+
+// 値が v で，偏微分が wa * (a の偏微分) + wb * (b の偏微分) の二重数
+
+template <typename T, int F1, int C1, int F2, int C2>
+inline DualUnion<T, F1, C1, F2, C2> CombineDual(const T v, const Dual<T, F1, C1> &a,
+	const T wa, const Dual<T, F2, C2> &b, const T wb)
+{
+	return CombineDual(v, a, wa, b, wb,
+		std::make_index_sequence<DualUnionCount(F1, C1, F2, C2)>());
+}
+
+// 値が v で，偏微分が w * (a の偏微分) の二重数
+
+template <typename T, int F, int C, std::size_t... K>
+inline Dual<T, F, C> ScaleDual(const T v, const Dual<T, F, C> &a, const T w,
+	std::index_sequence<K...>)
+{
+	Dual<T, F, C> r;
+	r.v = v;
+	((r.d[K] = w * a.d[K]), ...);
+	return r;
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> ScaleDual(const T v, const Dual<T, F, C> &a, const T w)
+{
+	return ScaleDual(v, a, w, std::make_index_sequence<C>());
+}
+
+
+
+// 演算 ///////////////////////////////////////////////////////////////////////
+
+// 定数の型は二重数の側から決める (float の二重数に double の定数を掛けるなど)
+
+template <typename T, int F, int C>
+using DualScalar = typename Dual<T, F, C>::Scalar;
+
+template <typename T, int F1, int C1, int F2, int C2>
+inline DualUnion<T, F1, C1, F2, C2> operator+(const Dual<T, F1, C1> &a, const Dual<T, F2, C2> &b)
+{
+	return CombineDual(a.v + b.v, a, (T) 1, b, (T) 1);
+}
+
+template <typename T, int F1, int C1, int F2, int C2>
+inline DualUnion<T, F1, C1, F2, C2> operator-(const Dual<T, F1, C1> &a, const Dual<T, F2, C2> &b)
+{
+	return CombineDual(a.v - b.v, a, (T) 1, b, (T) -1);
+}
+
+template <typename T, int F1, int C1, int F2, int C2>
+inline DualUnion<T, F1, C1, F2, C2> operator*(const Dual<T, F1, C1> &a, const Dual<T, F2, C2> &b)
+{
+	return CombineDual(a.v * b.v, a, b.v, b, a.v);
+}
+
+template <typename T, int F1, int C1, int F2, int C2>
+inline DualUnion<T, F1, C1, F2, C2> operator/(const Dual<T, F1, C1> &a, const Dual<T, F2, C2> &b)
+{
+	const T v = a.v / b.v;
+	return CombineDual(v, a, (T) 1 / b.v, b, -v / b.v);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator-(const Dual<T, F, C> &a)
+{
+	return ScaleDual(-a.v, a, (T) -1);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator+(const Dual<T, F, C> &a, const DualScalar<T, F, C> s)
+{
+	return ScaleDual(a.v + s, a, (T) 1);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator+(const DualScalar<T, F, C> s, const Dual<T, F, C> &a)
+{
+	return ScaleDual(s + a.v, a, (T) 1);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator-(const Dual<T, F, C> &a, const DualScalar<T, F, C> s)
+{
+	return ScaleDual(a.v - s, a, (T) 1);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator-(const DualScalar<T, F, C> s, const Dual<T, F, C> &a)
+{
+	return ScaleDual(s - a.v, a, (T) -1);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator*(const Dual<T, F, C> &a, const DualScalar<T, F, C> s)
+{
+	return ScaleDual(a.v * s, a, s);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator*(const DualScalar<T, F, C> s, const Dual<T, F, C> &a)
+{
+	return ScaleDual(s * a.v, a, s);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> operator/(const Dual<T, F, C> &a, const DualScalar<T, F, C> s)
+{
+	return ScaleDual(a.v / s, a, (T) 1 / s);
+}
+
+template <typename T, int F, int C>
+inline Dual<T, F, C> sqrt(const Dual<T, F, C> &a)
+{
+	const T v = std::sqrt(a.v);
+	return ScaleDual(v, a, (T) 0.5 / v);
+}
+
+// 値の sin・cos (sv, cv) から二重数の sin・cos を作る．sin・cos の求め方は
+// 呼ぶ側が選ぶ (kinematics.h の SinCos)
+
+template <typename T, int F, int C>
+inline void DualSinCos(const Dual<T, F, C> &a, const T sv, const T cv,
+	Dual<T, F, C> *s, Dual<T, F, C> *c)
+{
+	*s = ScaleDual(sv, a, cv);
+	*c = ScaleDual(cv, a, -sv);
+}
+
+
+
+// ヤコビアン /////////////////////////////////////////////////////////////////
+
+// 出力 y の値と，N 個の独立変数についての偏微分 (ヤコビアンの一行)
+
+template <int N, typename T, int F, int C>
+inline void StoreDual(const Dual<T, F, C> &y, T *value, T row[N])
+{
+	*value = y.v;
+	for (int i = 0; i < N; i++) {
+		row[i] = i >= F && i < F + C ? y.d[i - F] : (T) 0;
+	}
+}
+
+// 独立変数によらない出力
+
+template <int N, typename T>
+inline void StoreDual(const T y, T *value, T row[N])
+{
+	*value = y;
+	for (int i = 0; i < N; i++) {
+		row[i] = (T) 0;
+	}
+}
+
+// f に渡す出力先．out(k, 値) で k 番目の出力の値と偏微分を書き込む
+
+template <int N, typename T>
+struct DualOutput {
+	T *y;
+	T (*jacobian)[N];
+
+	template <typename V>
+	DUAL_INLINE void operator()(const int k, const V &value) const
+	{
+		StoreDual<N>(value, &y[k], jacobian[k]);
+	}
+};
+
+template <int M, int N, typename T, typename F, std::size_t... I>
+DUAL_INLINE void ForwardJacobian(const F &f, const T x[N], T y[M], T jacobian[M][N],
+	std::index_sequence<I...>)
+{
+	DualOutput<N, T> output = {y, jacobian};
+	f(output, DualVariable<(int) I>(x[I])...);
+}
+
+// f(out, x0, ..., x{N-1}) を呼び，f が out(k, 値) で渡した M 個の出力の値 y と
+// ヤコビアン jacobian[k][i] = ∂y[k] / ∂x[i] を求める
+
+template <int M, int N, typename T, typename F>
+DUAL_INLINE void ForwardJacobian(const F &f, const T x[N], T y[M], T jacobian[M][N])
+{
+	ForwardJacobian<M, N>(f, x, y, jacobian, std::make_index_sequence<N>());
+}
+
+#endif // AUTODIFF_H
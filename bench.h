@@ -0,0 +1,39 @@
+// bench.h
+//
+// *_bench.cpp が共通に使う時間の測り方
+//
+// 一度温めてから，合わせて BENCH_MIN_SECONDS 以上になるまで繰り返し，
+// 一回あたりの時間を返す．結果は bench_sink に足し込んで，計算が
+// 消されないようにする．
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+const double BENCH_MIN_SECONDS = 0.3; // 一項目あたりの計測時間
+
+static volatile double bench_sink; // 計算が消されないように結果を足し込む
+
+// run() 一回あたりの時間 [s]
+
+template <typename F>
+inline double MeasureSeconds(F run)
+{
+	run(); // 温める
+	long long runs = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed;
+	do {
+		run();
+		runs++;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < BENCH_MIN_SECONDS);
+	return elapsed / runs;
+}
+
+#endif // BENCH_H
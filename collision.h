@@ -0,0 +1,510 @@
+// collision.h
+//
+// カプセル (線分に太さを持たせたもの) と障害物の距離，およびそれを使って
+// 障害物を避ける逆運動学
+//
+// アームのリンクは長さ ARM_LENGTH*，半径 ARM_THICKNESS のカプセルとみなす．
+// 障害物は球と平面 (地面) の並び CollisionScene に入れる．
+// 距離はカプセルを並べた配列 (CapsuleBatch) に対してまとめて求め，
+// SSE が使えれば 4 本ずつ計算する．距離が負なら食い込んでいる．
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kinematics.h"
+
+
+
+// 形状 ///////////////////////////////////////////////////////////////////////
+
+// カプセルの並び．i 番目は (ax,ay,az)-(bx,by,bz) の線分と半径 r[i]
+
+struct CapsuleBatch {
+	int n;
+	std::vector<float> ax, ay, az;
+	std::vector<float> bx, by, bz;
+	std::vector<float> r;
+};
+
+inline void ResizeCapsuleBatch(CapsuleBatch *batch, const int n)
+{
+	// SSE で 4 本ずつ読むので端数ぶん余分に取っておく
+
+	int padded = (n + 3) & ~3;
+	batch->n = n;
+	std::vector<float> *arrays[7] = {&batch->ax, &batch->ay, &batch->az,
+		&batch->bx, &batch->by, &batch->bz, &batch->r};
+	for (int i = 0; i < 7; i++) {
+		arrays[i]->resize(padded, 0.0f);
+	}
+}
+
+inline void SetCapsule(CapsuleBatch *batch, const int i, const float ax,
+	const float ay, const float az, const float bx, const float by,
+	const float bz, const float r)
+{
+	batch->ax[i] = ax;
+	batch->ay[i] = ay;
+	batch->az[i] = az;
+	batch->bx[i] = bx;
+	batch->by[i] = by;
+	batch->bz[i] = bz;
+	batch->r[i] = r;
+}
+
+struct CollisionSphere {
+	float x, y, z, r;
+};
+
+// nx x + ny y + nz z + d = 0．(nx, ny, nz) は長さ 1 で，表の向き
+
+struct CollisionPlane {
+	float nx, ny, nz, d;
+};
+
+const int MAX_COLLISION_SPHERES = 64;
+const int MAX_COLLISION_PLANES = 8;
+
+struct CollisionScene {
+	int num_spheres;
+	CollisionSphere spheres[MAX_COLLISION_SPHERES];
+	int num_planes;
+	CollisionPlane planes[MAX_COLLISION_PLANES];
+};
+
+inline void ClearCollisionScene(CollisionScene *scene)
+{
+	scene->num_spheres = 0;
+	scene->num_planes = 0;
+}
+
+inline int AddCollisionSphere(CollisionScene *scene, const float x,
+	const float y, const float z, const float r)
+{
+	if (scene->num_spheres == MAX_COLLISION_SPHERES) {
+		return 0;
+	}
+	CollisionSphere &s = scene->spheres[scene->num_spheres++];
+	s.x = x;
+	s.y = y;
+	s.z = z;
+	s.r = r;
+	return 1;
+}
+
+inline int AddCollisionPlane(CollisionScene *scene, const float nx,
+	const float ny, const float nz, const float d)
+{
+	if (scene->num_planes == MAX_COLLISION_PLANES) {
+		return 0;
+	}
+	CollisionPlane &p = scene->planes[scene->num_planes++];
+	p.nx = nx;
+	p.ny = ny;
+	p.nz = nz;
+	p.d = d;
+	return 1;
+}
+
+
+
+// 距離 (1 本ずつ) ////////////////////////////////////////////////////////////
+
+// 線分上の最近点の位置 t (0: 始点, 1: 終点) も返す．SSE 版の確かめにも使う
+
+inline float Clamp01(const float x)
+{
+	return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+inline float CapsuleSphereDistance(const CapsuleBatch &c, const int i,
+	const CollisionSphere &s, float *t)
+{
+	float dx = c.bx[i] - c.ax[i], dy = c.by[i] - c.ay[i], dz = c.bz[i] - c.az[i];
+	float ex = s.x - c.ax[i], ey = s.y - c.ay[i], ez = s.z - c.az[i];
+	float dd = dx * dx + dy * dy + dz * dz;
+	float u = Clamp01((ex * dx + ey * dy + ez * dz) / (dd > 1e-12f ? dd : 1e-12f));
+	float qx = ex - u * dx, qy = ey - u * dy, qz = ez - u * dz;
+	*t = u;
+	return sqrtf(qx * qx + qy * qy + qz * qz) - c.r[i] - s.r;
+}
+
+inline float CapsulePlaneDistance(const CapsuleBatch &c, const int i,
+	const CollisionPlane &p, float *t)
+{
+	float da = p.nx * c.ax[i] + p.ny * c.ay[i] + p.nz * c.az[i] + p.d;
+	float db = p.nx * c.bx[i] + p.ny * c.by[i] + p.nz * c.bz[i] + p.d;
+	*t = da <= db ? 0.0f : 1.0f;
+	return (da <= db ? da : db) - c.r[i];
+}
+
+// a の i 番目と b の j 番目．最近点の位置を s (a 側) と t (b 側) に返す
+
+inline float CapsuleCapsuleDistance(const CapsuleBatch &a, const int i,
+	const CapsuleBatch &b, const int j, float *s, float *t)
+{
+	float d1x = a.bx[i] - a.ax[i], d1y = a.by[i] - a.ay[i], d1z = a.bz[i] - a.az[i];
+	float d2x = b.bx[j] - b.ax[j], d2y = b.by[j] - b.ay[j], d2z = b.bz[j] - b.az[j];
+	float rx = a.ax[i] - b.ax[j], ry = a.ay[i] - b.ay[j], rz = a.az[i] - b.az[j];
+	float aa = d1x * d1x + d1y * d1y + d1z * d1z;
+	float ee = d2x * d2x + d2y * d2y + d2z * d2z;
+	float bb = d1x * d2x + d1y * d2y + d1z * d2z;
+	float cc = d1x * rx + d1y * ry + d1z * rz;
+	float ff = d2x * rx + d2y * ry + d2z * rz;
+	aa = aa > 1e-12f ? aa : 1e-12f;
+	ee = ee > 1e-12f ? ee : 1e-12f;
+
+	// 無限直線どうしの最近点から始め，線分の範囲に収める (Ericson 5.1.9)
+
+	float denom = aa * ee - bb * bb;
+	float u = denom > 1e-12f ? Clamp01((bb * ff - cc * ee) / denom) : 0.0f;
+	float v = (bb * u + ff) / ee;
+	if (v < 0.0f) {
+		v = 0.0f;
+		u = Clamp01(-cc / aa);
+	} else if (v > 1.0f) {
+		v = 1.0f;
+		u = Clamp01((bb - cc) / aa);
+	}
+
+	float qx = rx + u * d1x - v * d2x;
+	float qy = ry + u * d1y - v * d2y;
+	float qz = rz + u * d1z - v * d2z;
+	*s = u;
+	*t = v;
+	return sqrtf(qx * qx + qy * qy + qz * qz) - a.r[i] - b.r[j];
+}
+
+
+
+// 距離 (まとめて) ////////////////////////////////////////////////////////////
+
+// 各カプセルと一つの障害物の距離を distance[i] に，最近点の位置を t[i] に書く．
+// distance と t は 4 の倍数に切り上げた長さが要る
+
+#ifdef __SSE2__
+inline __m128 Clamp01Ps(const __m128 x)
+{
+	return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+inline __m128 SelectPs(const __m128 mask, const __m128 a, const __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+inline void CapsuleSphereDistances(const CapsuleBatch &c, const CollisionSphere &s,
+	float *distance, float *t)
+{
+#ifdef __SSE2__
+	const __m128 sx = _mm_set1_ps(s.x), sy = _mm_set1_ps(s.y), sz = _mm_set1_ps(s.z);
+	const __m128 sr = _mm_set1_ps(s.r), tiny = _mm_set1_ps(1e-12f);
+	for (int i = 0; i < c.n; i += 4) {
+		__m128 ax = _mm_loadu_ps(&c.ax[i]), ay = _mm_loadu_ps(&c.ay[i]), az = _mm_loadu_ps(&c.az[i]);
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&c.bx[i]), ax);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&c.by[i]), ay);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&c.bz[i]), az);
+		__m128 ex = _mm_sub_ps(sx, ax), ey = _mm_sub_ps(sy, ay), ez = _mm_sub_ps(sz, az);
+		__m128 dd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 ed = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, dx), _mm_mul_ps(ey, dy)), _mm_mul_ps(ez, dz));
+		__m128 u = Clamp01Ps(_mm_div_ps(ed, _mm_max_ps(dd, tiny)));
+		__m128 qx = _mm_sub_ps(ex, _mm_mul_ps(u, dx));
+		__m128 qy = _mm_sub_ps(ey, _mm_mul_ps(u, dy));
+		__m128 qz = _mm_sub_ps(ez, _mm_mul_ps(u, dz));
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz)));
+		_mm_storeu_ps(&distance[i], _mm_sub_ps(_mm_sub_ps(len, _mm_loadu_ps(&c.r[i])), sr));
+		_mm_storeu_ps(&t[i], u);
+	}
+#else
+	for (int i = 0; i < c.n; i++) {
+		distance[i] = CapsuleSphereDistance(c, i, s, &t[i]);
+	}
+#endif
+}
+
+inline void CapsulePlaneDistances(const CapsuleBatch &c, const CollisionPlane &p,
+	float *distance, float *t)
+{
+#ifdef __SSE2__
+	const __m128 nx = _mm_set1_ps(p.nx), ny = _mm_set1_ps(p.ny), nz = _mm_set1_ps(p.nz);
+	const __m128 pd = _mm_set1_ps(p.d);
+	for (int i = 0; i < c.n; i += 4) {
+		__m128 da = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(&c.ax[i])),
+			_mm_mul_ps(ny, _mm_loadu_ps(&c.ay[i]))), _mm_mul_ps(nz, _mm_loadu_ps(&c.az[i]))), pd);
+		__m128 db = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(&c.bx[i])),
+			_mm_mul_ps(ny, _mm_loadu_ps(&c.by[i]))), _mm_mul_ps(nz, _mm_loadu_ps(&c.bz[i]))), pd);
+		_mm_storeu_ps(&distance[i], _mm_sub_ps(_mm_min_ps(da, db), _mm_loadu_ps(&c.r[i])));
+		_mm_storeu_ps(&t[i], _mm_and_ps(_mm_cmpgt_ps(da, db), _mm_set1_ps(1.0f)));
+	}
+#else
+	for (int i = 0; i < c.n; i++) {
+		distance[i] = CapsulePlaneDistance(c, i, p, &t[i]);
+	}
+#endif
+}
+
+// a の i 番目と b の i 番目の組ごとの距離
+
+inline void CapsuleCapsuleDistances(const CapsuleBatch &a, const CapsuleBatch &b,
+	float *distance, float *s, float *t)
+{
+#ifdef __SSE2__
+	const __m128 tiny = _mm_set1_ps(1e-12f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	for (int i = 0; i < a.n; i += 4) {
+		__m128 pax = _mm_loadu_ps(&a.ax[i]), pay = _mm_loadu_ps(&a.ay[i]), paz = _mm_loadu_ps(&a.az[i]);
+		__m128 pbx = _mm_loadu_ps(&b.ax[i]), pby = _mm_loadu_ps(&b.ay[i]), pbz = _mm_loadu_ps(&b.az[i]);
+		__m128 d1x = _mm_sub_ps(_mm_loadu_ps(&a.bx[i]), pax);
+		__m128 d1y = _mm_sub_ps(_mm_loadu_ps(&a.by[i]), pay);
+		__m128 d1z = _mm_sub_ps(_mm_loadu_ps(&a.bz[i]), paz);
+		__m128 d2x = _mm_sub_ps(_mm_loadu_ps(&b.bx[i]), pbx);
+		__m128 d2y = _mm_sub_ps(_mm_loadu_ps(&b.by[i]), pby);
+		__m128 d2z = _mm_sub_ps(_mm_loadu_ps(&b.bz[i]), pbz);
+		__m128 rx = _mm_sub_ps(pax, pbx), ry = _mm_sub_ps(pay, pby), rz = _mm_sub_ps(paz, pbz);
+
+		__m128 aa = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d1x, d1x), _mm_mul_ps(d1y, d1y)), _mm_mul_ps(d1z, d1z));
+		__m128 ee = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d2x, d2x), _mm_mul_ps(d2y, d2y)), _mm_mul_ps(d2z, d2z));
+		__m128 bb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d1x, d2x), _mm_mul_ps(d1y, d2y)), _mm_mul_ps(d1z, d2z));
+		__m128 cc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d1x, rx), _mm_mul_ps(d1y, ry)), _mm_mul_ps(d1z, rz));
+		__m128 ff = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d2x, rx), _mm_mul_ps(d2y, ry)), _mm_mul_ps(d2z, rz));
+		aa = _mm_max_ps(aa, tiny);
+		ee = _mm_max_ps(ee, tiny);
+
+		// 分岐の代わりに両方求めて選ぶ
+
+		__m128 denom = _mm_sub_ps(_mm_mul_ps(aa, ee), _mm_mul_ps(bb, bb));
+		__m128 u = _mm_and_ps(_mm_cmpgt_ps(denom, tiny), Clamp01Ps(_mm_div_ps(
+			_mm_sub_ps(_mm_mul_ps(bb, ff), _mm_mul_ps(cc, ee)), _mm_max_ps(denom, tiny))));
+		__m128 v = _mm_div_ps(_mm_add_ps(_mm_mul_ps(bb, u), ff), ee);
+		__m128 below = _mm_cmplt_ps(v, zero), above = _mm_cmpgt_ps(v, one);
+		u = SelectPs(below, Clamp01Ps(_mm_div_ps(_mm_sub_ps(zero, cc), aa)), u);
+		u = SelectPs(above, Clamp01Ps(_mm_div_ps(_mm_sub_ps(bb, cc), aa)), u);
+		v = Clamp01Ps(v);
+
+		__m128 qx = _mm_sub_ps(_mm_add_ps(rx, _mm_mul_ps(u, d1x)), _mm_mul_ps(v, d2x));
+		__m128 qy = _mm_sub_ps(_mm_add_ps(ry, _mm_mul_ps(u, d1y)), _mm_mul_ps(v, d2y));
+		__m128 qz = _mm_sub_ps(_mm_add_ps(rz, _mm_mul_ps(u, d1z)), _mm_mul_ps(v, d2z));
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz)));
+		_mm_storeu_ps(&distance[i], _mm_sub_ps(_mm_sub_ps(len, _mm_loadu_ps(&a.r[i])), _mm_loadu_ps(&b.r[i])));
+		_mm_storeu_ps(&s[i], u);
+		_mm_storeu_ps(&t[i], v);
+	}
+#else
+	for (int i = 0; i < a.n; i++) {
+		distance[i] = CapsuleCapsuleDistance(a, i, b, i, &s[i], &t[i]);
+	}
+#endif
+}
+
+
+
+// 衝突を避ける逆運動学 ///////////////////////////////////////////////////////
+
+// 平面 (z = base_z) 内の 3 関節アームを，目標へ向かう擬似逆行列の一歩に，
+// 障害物から離れる向きの動きを J の零空間へ射影して足したもので動かす．
+// 零空間の動きは先端の位置を変えないので，目標への追従は邪魔しない．
+//
+// 距離が margin を切った組 (リンクと障害物，リンク 1 と 3) ごとに，
+// (margin - 距離) の重みで距離の勾配を足し合わせる．勾配は最近点を
+// 関節 j まわりに回したときの速度と，離れる向きの内積で求める．
+// リンク 1 は根元が地面に付いているので，平面とは比べない．
+
+const int ARM_LINKS = 3;
+
+struct ArmAvoidance {
+	float margin;        // この距離から避け始める
+	float gain;          // 零空間の動きの大きさ [rad / 距離]
+	float max_angle;     // 一歩で零空間の動きが変える角度の上限 [rad]
+	float clearance;     // 直近の一歩での最小距離 (結果)
+	int contacts;        // margin を切った組の数 (結果)
+};
+
+inline void InitArmAvoidance(ArmAvoidance *avoid, const float radius)
+{
+	avoid->margin = radius * 2.0f;
+	avoid->gain = 0.05f;
+	avoid->max_angle = 0.05f;
+	avoid->clearance = 0.0f;
+	avoid->contacts = 0;
+}
+
+// 平面内の点 (px, py) を関節 j まわりに回したときの速度との内積を勾配へ足す
+
+inline void AddDistanceGradient(float gradient[ARM_LINKS], const float weight,
+	const float joint_x[ARM_LINKS + 1], const float joint_y[ARM_LINKS + 1],
+	const int link, const float px, const float py, const float nx,
+	const float ny)
+{
+	for (int j = 0; j <= link; j++) {
+		float vx = -(py - joint_y[j]);
+		float vy = px - joint_x[j];
+		gradient[j] += weight * (nx * vx + ny * vy);
+	}
+}
+
+template <typename T, bool FAST>
+inline T ArmIkStepAvoiding(const T length[ARM_LINKS], T angle[ARM_LINKS],
+	const T base_x, const T base_y, const T base_z, const T target_x,
+	const T target_y, const T max_step, const float radius,
+	const CollisionScene &scene, ArmAvoidance *avoid)
+{
+	// 先端の位置とヤコビアンは ArmIkStep と同じく ArmForwardJacobian() で
+	// 求める．カプセルに使う途中の関節の位置だけは別に求める
+
+	T end_x, end_y, ja[2][3];
+	ArmForwardJacobian<T, FAST>(length, angle, &end_x, &end_y, ja);
+	end_x += base_x;
+	end_y += base_y;
+
+	float joint_x[ARM_LINKS + 1], joint_y[ARM_LINKS + 1];
+	{
+		T s1, c1, s12, c12;
+		SinCos<T, FAST>(angle[0], &s1, &c1);
+		SinCos<T, FAST>(angle[0] + angle[1], &s12, &c12);
+		const T x1 = base_x + length[0] * c1, y1 = base_y + length[0] * s1;
+		const T x2 = x1 + length[1] * c12, y2 = y1 + length[1] * s12;
+		joint_x[0] = (float) base_x;
+		joint_y[0] = (float) base_y;
+		joint_x[1] = (float) x1;
+		joint_y[1] = (float) y1;
+		joint_x[2] = (float) x2;
+		joint_y[2] = (float) y2;
+		joint_x[3] = (float) end_x;
+		joint_y[3] = (float) end_y;
+	}
+
+	// 目標へ向かう一歩 (ArmIkStep と同じ擬似逆行列)．距離は T のまま測る
+
+	T dx = target_x - end_x;
+	T dy = target_y - end_y;
+	const T distance = ClampIkStep(&dx, &dy, max_step);
+	T step[ARM_LINKS];
+	if (!ArmPseudoInverse(ja, dx, dy, step)) {
+		return distance;
+	}
+
+	// リンクをカプセルにして，障害物との距離をまとめて求める
+
+	static thread_local CapsuleBatch links, first_link, last_link;
+	if (links.n != ARM_LINKS) {
+		ResizeCapsuleBatch(&links, ARM_LINKS);
+		ResizeCapsuleBatch(&first_link, 1);
+		ResizeCapsuleBatch(&last_link, 1);
+	}
+	for (int i = 0; i < ARM_LINKS; i++) {
+		SetCapsule(&links, i, joint_x[i], joint_y[i], (float) base_z,
+			joint_x[i + 1], joint_y[i + 1], (float) base_z, radius);
+	}
+
+	float gradient[ARM_LINKS] = {0.0f, 0.0f, 0.0f};
+	float clearance = 1e30f;
+	int contacts = 0;
+	float dist[4], t[4], s[4];
+
+	for (int k = 0; k < scene.num_spheres; k++) {
+		const CollisionSphere &sphere = scene.spheres[k];
+		CapsuleSphereDistances(links, sphere, dist, t);
+		for (int i = 0; i < ARM_LINKS; i++) {
+			clearance = dist[i] < clearance ? dist[i] : clearance;
+			if (dist[i] >= avoid->margin) {
+				continue;
+			}
+			float px = joint_x[i] + t[i] * (joint_x[i + 1] - joint_x[i]);
+			float py = joint_y[i] + t[i] * (joint_y[i + 1] - joint_y[i]);
+			float nx = px - sphere.x, ny = py - sphere.y;
+			float len = sqrtf(nx * nx + ny * ny);
+			if (len < 1e-6f) {
+				continue;
+			}
+			AddDistanceGradient(gradient, avoid->margin - dist[i], joint_x, joint_y,
+				i, px, py, nx / len, ny / len);
+			contacts++;
+		}
+	}
+
+	for (int k = 0; k < scene.num_planes; k++) {
+		const CollisionPlane &plane = scene.planes[k];
+		CapsulePlaneDistances(links, plane, dist, t);
+		for (int i = 1; i < ARM_LINKS; i++) {
+			clearance = dist[i] < clearance ? dist[i] : clearance;
+			if (dist[i] >= avoid->margin) {
+				continue;
+			}
+			float px = t[i] == 0.0f ? joint_x[i] : joint_x[i + 1];
+			float py = t[i] == 0.0f ? joint_y[i] : joint_y[i + 1];
+			AddDistanceGradient(gradient, avoid->margin - dist[i], joint_x, joint_y,
+				i, px, py, plane.nx, plane.ny);
+			contacts++;
+		}
+	}
+
+	// リンク 1 と 3 (隣り合うものは関節でつながっているので比べない)
+
+	SetCapsule(&first_link, 0, joint_x[0], joint_y[0], (float) base_z,
+		joint_x[1], joint_y[1], (float) base_z, radius);
+	SetCapsule(&last_link, 0, joint_x[2], joint_y[2], (float) base_z,
+		joint_x[3], joint_y[3], (float) base_z, radius);
+	CapsuleCapsuleDistances(first_link, last_link, dist, s, t);
+	clearance = dist[0] < clearance ? dist[0] : clearance;
+	if (dist[0] < avoid->margin) {
+		float p0x = joint_x[0] + s[0] * (joint_x[1] - joint_x[0]);
+		float p0y = joint_y[0] + s[0] * (joint_y[1] - joint_y[0]);
+		float p2x = joint_x[2] + t[0] * (joint_x[3] - joint_x[2]);
+		float p2y = joint_y[2] + t[0] * (joint_y[3] - joint_y[2]);
+		float nx = p2x - p0x, ny = p2y - p0y;
+		float len = sqrtf(nx * nx + ny * ny);
+		if (len > 1e-6f) {
+			nx /= len;
+			ny /= len;
+
+			// 両方の最近点が動くので差をとる．リンク 1 側は関節 1 にしか依らない
+
+			AddDistanceGradient(gradient, avoid->margin - dist[0], joint_x, joint_y,
+				2, p2x, p2y, nx, ny);
+			AddDistanceGradient(gradient, -(avoid->margin - dist[0]), joint_x, joint_y,
+				0, p0x, p0y, nx, ny);
+			contacts++;
+		}
+	}
+
+	avoid->clearance = clearance;
+	avoid->contacts = contacts;
+
+	// 勾配を零空間へ射影する: g - J^# (J g)
+
+	if (contacts > 0) {
+		T g[ARM_LINKS];
+		for (int i = 0; i < ARM_LINKS; i++) {
+			g[i] = (T) (avoid->gain * gradient[i]);
+		}
+		T jg0 = ja[0][0] * g[0] + ja[0][1] * g[1] + ja[0][2] * g[2];
+		T jg1 = ja[1][0] * g[0] + ja[1][1] * g[1] + ja[1][2] * g[2];
+		T range_step[ARM_LINKS];
+		ArmPseudoInverse(ja, jg0, jg1, range_step);
+		T null_step[ARM_LINKS];
+		T largest = 0;
+		for (int i = 0; i < ARM_LINKS; i++) {
+			null_step[i] = g[i] - range_step[i];
+			T m = null_step[i] < 0 ? -null_step[i] : null_step[i];
+			largest = m > largest ? m : largest;
+		}
+		T scale = largest > (T) avoid->max_angle ? (T) avoid->max_angle / largest : (T) 1;
+		for (int i = 0; i < ARM_LINKS; i++) {
+			step[i] += scale * null_step[i];
+		}
+	}
+
+	for (int i = 0; i < ARM_LINKS; i++) {
+		angle[i] += step[i];
+	}
+	return distance;
+}
+
+#endif // COLLISION_H
@@ -0,0 +1,301 @@
+// collision_bench.cpp
+//
+// collision.h の距離計算と，障害物を避ける逆運動学の速さを測る
+//
+// カプセル対球・平面・カプセルのそれぞれについて，SSE でまとめて求めた
+// ときと 1 本ずつ求めたときの 1 秒あたりの判定数と，両者の差を表にする．
+// 最後に多数のアームを避けながら動かし，一歩あたりの手間と，
+// 避けない場合と比べた最終的な食い込みの数を示す．
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "collision.h"
+#include "bench.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const int NUM_CAPSULES = 3 * 4096;
+const int NUM_SPHERES = 16;
+const int NUM_ARMS = 4096;
+const int IK_ITERATIONS = 200;
+
+const float ARM_LENGTHS[3] = {10.0f, 12.0f, 8.0f};
+const float ARM_RADIUS = 1.0f;
+
+CapsuleBatch capsules, other_capsules;
+CollisionScene scene;
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+// run() を BENCH_MIN_SECONDS 以上繰り返し，1 秒あたりの件数を返す
+
+template <typename F>
+double MeasureRate(F run, const long long items_per_run)
+{
+	return items_per_run / MeasureSeconds(run);
+}
+
+float Random(const float lo, const float hi)
+{
+	return lo + (hi - lo) * (rand() / (float) RAND_MAX);
+}
+
+void RandomCapsules(CapsuleBatch *batch, const int n)
+{
+	ResizeCapsuleBatch(batch, n);
+	for (int i = 0; i < n; i++) {
+		float ax = Random(-40, 40), ay = Random(-5, 40), az = Random(-10, 10);
+		SetCapsule(batch, i, ax, ay, az, ax + Random(-12, 12), ay + Random(-12, 12),
+			az + Random(-3, 3), Random(0.5f, 1.5f));
+	}
+}
+
+void PrintRow(const char *name, const double simd, const double scalar,
+	const double max_difference)
+{
+	printf("  %-18s %12.1f %12.1f %8.2fx %12.2e\n", name, simd * 1e-6,
+		scalar * 1e-6, simd / scalar, max_difference);
+}
+
+
+
+// 距離の計算 /////////////////////////////////////////////////////////////////
+
+void BenchKernels(void)
+{
+	std::vector<float> distance(NUM_CAPSULES + 4), s(NUM_CAPSULES + 4), t(NUM_CAPSULES + 4);
+
+	printf("\ndistance kernels, %d capsules (Mchecks/s)\n", NUM_CAPSULES);
+	printf("  %-18s %12s %12s %9s %12s\n", "kernel", "batched", "one by one", "speedup", "max diff");
+
+	// カプセル対球
+
+	double simd = MeasureRate([&] {
+		for (int k = 0; k < scene.num_spheres; k++) {
+			CapsuleSphereDistances(capsules, scene.spheres[k], &distance[0], &t[0]);
+			bench_sink += distance[k];
+		}
+	}, (long long) NUM_CAPSULES * scene.num_spheres);
+	double scalar = MeasureRate([&] {
+		for (int k = 0; k < scene.num_spheres; k++) {
+			for (int i = 0; i < NUM_CAPSULES; i++) {
+				distance[i] = CapsuleSphereDistance(capsules, i, scene.spheres[k], &t[i]);
+			}
+			bench_sink += distance[k];
+		}
+	}, (long long) NUM_CAPSULES * scene.num_spheres);
+	double difference = 0;
+	for (int k = 0; k < scene.num_spheres; k++) {
+		CapsuleSphereDistances(capsules, scene.spheres[k], &distance[0], &t[0]);
+		for (int i = 0; i < NUM_CAPSULES; i++) {
+			float u;
+			difference = fmax(difference, fabs(distance[i]
+				- CapsuleSphereDistance(capsules, i, scene.spheres[k], &u)));
+		}
+	}
+	PrintRow("capsule-sphere", simd, scalar, difference);
+
+	// カプセル対平面
+
+	const CollisionPlane &ground = scene.planes[0];
+	simd = MeasureRate([&] {
+		CapsulePlaneDistances(capsules, ground, &distance[0], &t[0]);
+		bench_sink += distance[0];
+	}, NUM_CAPSULES);
+	scalar = MeasureRate([&] {
+		for (int i = 0; i < NUM_CAPSULES; i++) {
+			distance[i] = CapsulePlaneDistance(capsules, i, ground, &t[i]);
+		}
+		bench_sink += distance[0];
+	}, NUM_CAPSULES);
+	difference = 0;
+	CapsulePlaneDistances(capsules, ground, &distance[0], &t[0]);
+	for (int i = 0; i < NUM_CAPSULES; i++) {
+		float u;
+		difference = fmax(difference, fabs(distance[i] - CapsulePlaneDistance(capsules, i, ground, &u)));
+	}
+	PrintRow("capsule-plane", simd, scalar, difference);
+
+	// カプセル対カプセル
+
+	simd = MeasureRate([&] {
+		CapsuleCapsuleDistances(capsules, other_capsules, &distance[0], &s[0], &t[0]);
+		bench_sink += distance[0];
+	}, NUM_CAPSULES);
+	scalar = MeasureRate([&] {
+		for (int i = 0; i < NUM_CAPSULES; i++) {
+			distance[i] = CapsuleCapsuleDistance(capsules, i, other_capsules, i, &s[i], &t[i]);
+		}
+		bench_sink += distance[0];
+	}, NUM_CAPSULES);
+	difference = 0;
+	CapsuleCapsuleDistances(capsules, other_capsules, &distance[0], &s[0], &t[0]);
+	for (int i = 0; i < NUM_CAPSULES; i++) {
+		float u, v;
+		difference = fmax(difference, fabs(distance[i]
+			- CapsuleCapsuleDistance(capsules, i, other_capsules, i, &u, &v)));
+	}
+	PrintRow("capsule-capsule", simd, scalar, difference);
+}
+
+
+
+// 障害物を避ける逆運動学 /////////////////////////////////////////////////////
+
+struct ArmCase {
+	float angle[3];
+	float target_x, target_y;
+};
+
+std::vector<ArmCase> arm_cases;
+
+// 全リンクと全障害物との最小距離 (根元のリンクと地面は除く)
+
+float ArmClearance(const float angle[3])
+{
+	static CapsuleBatch links;
+	ResizeCapsuleBatch(&links, 3);
+	float x = 0, y = 0, a = 0;
+	for (int i = 0; i < 3; i++) {
+		a += angle[i];
+		float nx = x + ARM_LENGTHS[i] * cosf(a), ny = y + ARM_LENGTHS[i] * sinf(a);
+		SetCapsule(&links, i, x, y, 0, nx, ny, 0, ARM_RADIUS);
+		x = nx;
+		y = ny;
+	}
+	float clearance = 1e30f, t;
+	for (int k = 0; k < scene.num_spheres; k++) {
+		for (int i = 0; i < 3; i++) {
+			clearance = fminf(clearance, CapsuleSphereDistance(links, i, scene.spheres[k], &t));
+		}
+	}
+	for (int i = 1; i < 3; i++) {
+		clearance = fminf(clearance, CapsulePlaneDistance(links, i, scene.planes[0], &t));
+	}
+	return clearance;
+}
+
+void BenchAvoidingIk(void)
+{
+	// 腕の届く範囲の目標と，その周りの球
+
+	CollisionScene arm_scene;
+	ClearCollisionScene(&arm_scene);
+	AddCollisionPlane(&arm_scene, 0, 1, 0, 0);
+	for (int k = 0; k < 4; k++) {
+		AddCollisionSphere(&arm_scene, Random(-20, 20), Random(8, 25), 0, 3.0f);
+	}
+	CollisionScene saved = scene;
+	scene = arm_scene;
+
+	arm_cases.resize(NUM_ARMS);
+	for (int i = 0; i < NUM_ARMS; i++) {
+		ArmCase &c = arm_cases[i];
+
+		// はじめから障害物に当たっている姿勢は選び直す
+
+		do {
+			c.angle[0] = DegreeToRadian(30.0f) + Random(-0.5f, 0.5f);
+			c.angle[1] = DegreeToRadian(120.0f) + Random(-0.5f, 0.5f);
+			c.angle[2] = DegreeToRadian(30.0f) + Random(-0.5f, 0.5f);
+		} while (ArmClearance(c.angle) < 0);
+
+		// 先端が球に埋まる目標は避けようがないので選び直す
+
+		bool inside;
+		do {
+			float r = Random(8, 26), theta = Random(0.1f, (float) M_PI - 0.1f);
+			c.target_x = r * cosf(theta);
+			c.target_y = r * sinf(theta);
+			inside = false;
+			for (int k = 0; k < arm_scene.num_spheres; k++) {
+				const CollisionSphere &s = arm_scene.spheres[k];
+				float dx = c.target_x - s.x, dy = c.target_y - s.y;
+				inside |= dx * dx + dy * dy < (s.r + 2 * ARM_RADIUS) * (s.r + 2 * ARM_RADIUS);
+			}
+		} while (inside);
+	}
+
+	ArmAvoidance avoid;
+	InitArmAvoidance(&avoid, ARM_RADIUS);
+	std::vector<ArmCase> work = arm_cases;
+
+	long long checks = 0;
+	double avoiding = MeasureRate([&] {
+		for (int i = 0; i < NUM_ARMS; i++) {
+			ArmIkStepAvoiding<float, true>(ARM_LENGTHS, work[i].angle, 0.0f, 0.0f, 0.0f,
+				work[i].target_x, work[i].target_y, 2.0f, ARM_RADIUS, scene, &avoid);
+		}
+		bench_sink += work[0].angle[0];
+	}, NUM_ARMS);
+	checks = 3 * arm_scene.num_spheres + 2 * arm_scene.num_planes + 1;
+
+	work = arm_cases;
+	double plain = MeasureRate([&] {
+		for (int i = 0; i < NUM_ARMS; i++) {
+			ArmIkStep<float, true>(ARM_LENGTHS, work[i].angle, work[i].target_x,
+				work[i].target_y, 2.0f);
+		}
+		bench_sink += work[0].angle[0];
+	}, NUM_ARMS);
+
+	printf("\nIK step, %d arms, %d spheres + ground (%lld checks per step)\n",
+		NUM_ARMS, arm_scene.num_spheres, checks);
+	printf("  plain IK           %10.2f Msteps/s\n", plain * 1e-6);
+	printf("  avoiding IK        %10.2f Msteps/s (%.1f Mchecks/s, %.2f us per step)\n",
+		avoiding * 1e-6, avoiding * checks * 1e-6, 1e6 / avoiding);
+
+	// 食い込みの比較
+
+	int colliding_plain = 0, colliding_avoiding = 0;
+	double error_plain = 0, error_avoiding = 0;
+	for (int i = 0; i < NUM_ARMS; i++) {
+		ArmCase a = arm_cases[i], b = arm_cases[i];
+		float distance_a = 0, distance_b = 0;
+		for (int n = 0; n < IK_ITERATIONS; n++) {
+			distance_a = ArmIkStep<float, true>(ARM_LENGTHS, a.angle, a.target_x, a.target_y, 2.0f);
+			distance_b = ArmIkStepAvoiding<float, true>(ARM_LENGTHS, b.angle, 0.0f, 0.0f, 0.0f,
+				b.target_x, b.target_y, 2.0f, ARM_RADIUS, scene, &avoid);
+		}
+		colliding_plain += ArmClearance(a.angle) < 0;
+		colliding_avoiding += ArmClearance(b.angle) < 0;
+		error_plain += distance_a / NUM_ARMS;
+		error_avoiding += distance_b / NUM_ARMS;
+	}
+	printf("  after %d steps from collision-free poses: colliding arms %d -> %d of %d,\n"
+		"  mean target error %.3f -> %.3f\n", IK_ITERATIONS, colliding_plain,
+		colliding_avoiding, NUM_ARMS, error_plain, error_avoiding);
+
+	scene = saved;
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(void)
+{
+	srand(1);
+	RandomCapsules(&capsules, NUM_CAPSULES);
+	RandomCapsules(&other_capsules, NUM_CAPSULES);
+	ClearCollisionScene(&scene);
+	AddCollisionPlane(&scene, 0, 1, 0, 0);
+	for (int k = 0; k < NUM_SPHERES; k++) {
+		AddCollisionSphere(&scene, Random(-40, 40), Random(0, 40), Random(-10, 10), Random(1, 5));
+	}
+
+	BenchKernels();
+	BenchAvoidingIk();
+	return 0;
+}
@@ -0,0 +1,620 @@
+// draw_list.h
+//
+// フレーム単位の描画コマンドバッファ
+//
+// 描画関数は glutSolid* を直接呼ぶ代わりに RecordDraw() でコマンドを積み，
+// SubmitDrawList() がマテリアル・メッシュ順に並べ替えてから render_core.h の
+// パイプラインでまとめて描く．コマンドの行列は render_core.h の行列スタックの
+// 今の段をそのまま写すので，GL から読み戻すことはない．
+// コマンド列はフレームアリーナから確保し，毎フレームリセットする．
+// 積みきれなかったフレームは RetryDrawList() で容量を広げて積み直す．
+// 広げるときのほかは malloc を呼ばない．
+//
+// 記録するときに境界球で視錐台カリングを行い，画面上の大きさから
+// メッシュの詳細度を選ぶ．
+//
+// 複数の視点から描くときは BeginSharedDrawList() で記録を始める．場面の
+// 走査は一度だけで，コマンドはワールド座標系のまま共有し，視点ごとには
+// CullDrawView() でカリングと詳細度の選択だけをやり直して描く．
+
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include <GL/glut.h>
+
+#include <cstdio>
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+
+#include "mesh.h"
+#include "render_core.h"
+#include "trace.h"
+
+
+
+// フレームアリーナ ///////////////////////////////////////////////////////////
+
+static unsigned char *frame_arena;
+static size_t frame_arena_size;
+static size_t frame_arena_used;
+
+// フレームの先頭で呼ぶ．前のフレームで確保した領域はすべて無効になる．
+// アリーナが size バイトより小さければ確保し直す
+
+inline void ResetFrameArena(const size_t size)
+{
+	if (size > frame_arena_size) {
+		delete[] frame_arena;
+		frame_arena = new unsigned char[size];
+		frame_arena_size = size;
+	}
+	frame_arena_used = 0;
+}
+
+// アリーナから確保する．足りなければ NULL を返す
+
+inline void *AllocFrame(const size_t size, const size_t align = 16)
+{
+	size_t offset = (frame_arena_used + align - 1) & ~(align - 1);
+	if (offset + size > frame_arena_size) {
+		return NULL;
+	}
+	frame_arena_used = offset + size;
+	return frame_arena + offset;
+}
+
+
+
+// 視錐台カリング /////////////////////////////////////////////////////////////
+
+// 視点座標系での視錐台の 6 平面 (ax + by + cz + d >= 0 が内側) と，
+// 距離 1 にある長さ 1 が画面上で何 pixel になるか
+
+static GLfloat frustum_planes[6][4];
+static GLfloat pixels_per_unit;
+
+// 変換行列 p (列優先) の座標系で，クリップ座標の範囲に入る 6 平面を求める
+
+inline void ExtractFrustumPlanes(const GLfloat p[16], GLfloat planes[6][4])
+{
+	// 行列の行 i は p[i], p[4 + i], p[8 + i], p[12 + i]
+
+	for (int i = 0; i < 6; i++) {
+		int row = i / 2;
+		GLfloat sign = (i % 2 == 0) ? 1.0f : -1.0f;
+		GLfloat *plane = planes[i];
+		for (int k = 0; k < 4; k++) {
+			plane[k] = p[k * 4 + 3] + sign * p[k * 4 + row];
+		}
+		GLfloat len = sqrt(plane[0] * plane[0] + plane[1] * plane[1]
+			+ plane[2] * plane[2]);
+		for (int k = 0; k < 4; k++) {
+			plane[k] /= len;
+		}
+	}
+}
+
+// 現在の投影行列とビューポートから視錐台を求める
+
+inline void UpdateFrustum(void)
+{
+	ExtractFrustumPlanes(render_projection, frustum_planes);
+	pixels_per_unit = render_projection[5] * render_viewport[3] / 2.0f;
+}
+
+// 球が 6 平面の内側と交わるか
+
+inline int IsSphereInPlanes(const GLfloat planes[6][4], const GLfloat c[3],
+	const GLfloat radius)
+{
+	for (int i = 0; i < 6; i++) {
+		const GLfloat *plane = planes[i];
+		if (plane[0] * c[0] + plane[1] * c[1] + plane[2] * c[2] + plane[3]
+			< -radius) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// 視点座標系の球が視錐台と交わるか
+
+inline int IsEyeSphereVisible(const GLfloat c[3], const GLfloat radius)
+{
+	return IsSphereInPlanes(frustum_planes, c, radius);
+}
+
+// モデルビュー行列 m で点 p と半径 r の球を視点座標系へ移す
+
+inline void TransformSphere(const GLfloat m[16], const GLfloat p[3],
+	const GLfloat r, GLfloat c[3], GLfloat *radius)
+{
+	for (int k = 0; k < 3; k++) {
+		c[k] = m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k];
+	}
+
+	// 拡大縮小が一様でないときは最も大きい軸で見積もる
+
+	GLfloat s = 0.0;
+	for (int i = 0; i < 3; i++) {
+		const GLfloat *axis = m + i * 4;
+		s = fmax(s, axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	}
+	*radius = r * sqrt(s);
+}
+
+
+
+// 視点 ///////////////////////////////////////////////////////////////////////
+
+// 共有した場面を描く視点の一つ．視錐台はワールド座標系で持つ
+
+const int MAX_DRAW_VIEWS = 8;
+
+struct DrawView {
+	GLfloat projection[16];
+	GLfloat view[16];         // ワールド座標系から視点座標系への変換
+	GLint viewport[4];
+	GLfloat planes[6][4];     // ワールド座標系での視錐台
+	GLfloat pixels_per_unit;
+	int perspective;          // 0 なら平行投影 (画面上の大きさが距離によらない)
+
+	// 直前のフレームでの統計
+
+	int commands;             // 描いたコマンド数
+	int culled;               // この視点の視錐台の外で捨てたコマンド数
+	double cull_ms;           // カリングと詳細度の選択
+	double draw_ms;           // 並べ替えと描画 (FinishDrawView() まで)
+	std::chrono::steady_clock::time_point start;
+};
+
+static DrawView *draw_views;
+static int num_draw_views;
+
+// 投影行列，ビュー行列，ビューポートから視点を作る
+
+inline void SetDrawView(DrawView *view, const GLfloat projection[16],
+	const GLfloat modelview[16], const GLint viewport[4])
+{
+	for (int i = 0; i < 16; i++) {
+		view->projection[i] = projection[i];
+		view->view[i] = modelview[i];
+	}
+	for (int i = 0; i < 4; i++) {
+		view->viewport[i] = viewport[i];
+	}
+
+	// 投影とビューの積から平面を取り出すと，ワールド座標系の平面になる
+
+	GLfloat clip[16];
+	MultiplyMatrix(projection, modelview, clip);
+	ExtractFrustumPlanes(clip, view->planes);
+
+	view->pixels_per_unit = projection[5] * viewport[3] / 2.0f;
+	view->perspective = projection[11] != 0.0f;
+}
+
+// 今の投影行列，行列スタックの段 (ビュー変換)，ビューポートから視点を作る
+
+inline void CaptureDrawView(DrawView *view)
+{
+	SetDrawView(view, render_projection, CurrentMatrix(), render_viewport);
+}
+
+// 視点のビューポート，投影行列，ビュー行列を設定し直す．
+// この後に光源を置けば，光源の位置もこの視点から見たものになる
+
+inline void ApplyDrawView(const DrawView &view)
+{
+	SetRenderViewport(view.viewport[0], view.viewport[1], view.viewport[2],
+		view.viewport[3]);
+	SetRenderProjection(view.projection);
+	LoadMatrix(view.view);
+}
+
+// ワールド座標系の球がどれかの視点から見えるか
+
+inline int IsWorldSphereVisible(const GLfloat c[3], const GLfloat radius)
+{
+	for (int i = 0; i < num_draw_views; i++) {
+		if (IsSphereInPlanes(draw_views[i].planes, c, radius)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+
+// 描画コマンド ///////////////////////////////////////////////////////////////
+
+const int INITIAL_DRAW_COMMANDS = 16384; // 最初のフレームで積めるコマンド数
+
+struct DrawCommand {
+	GLfloat matrix[16]; // 記録時のモデルビュー行列 (共有時はモデル行列)
+	int mesh;
+	int lod;
+	int material;
+};
+
+struct DrawListStats {
+	int commands;          // 描いたコマンド数
+	int dropped;           // 容量不足で捨てたコマンド数
+	int culled;            // 視錐台の外で捨てたコマンド数
+	int objects_culled;    // IsSphereVisible() で丸ごと捨てた物体の数
+	int lod_counts[MAX_LOD_LEVELS]; // 詳細度ごとのコマンド数
+	int material_changes;  // マテリアルの切り替え回数
+	int mesh_changes;      // メッシュの切り替え回数
+	size_t arena_used;     // アリーナの使用量 [byte]
+};
+
+static DrawCommand *draw_commands;
+static int num_draw_commands;
+static int draw_command_capacity; // アリーナから取れなければ 0 (すべて捨てる)
+static int draw_command_limit = INITIAL_DRAW_COMMANDS; // 次の記録で確保する数
+static DrawListStats draw_list_stats;
+
+// BeginSharedDrawList() から EndSharedDrawList() までは 1．コマンドには
+// ワールド座標系での境界球 (中心と半径) を添えておく
+
+static int shared_record;
+static GLfloat (*shared_spheres)[4];
+
+// フレームの記録を開始する
+
+inline void BeginDrawList(void)
+{
+	// コマンドと並べ替えのキー，それぞれの揃え分
+
+	ResetFrameArena((sizeof(DrawCommand) + sizeof(unsigned long long))
+		* draw_command_limit + 2 * 16);
+	draw_commands = (DrawCommand *) AllocFrame(
+		sizeof(DrawCommand) * draw_command_limit);
+	draw_command_capacity = draw_commands ? draw_command_limit : 0;
+	num_draw_commands = 0;
+	draw_list_stats.dropped = 0;
+	draw_list_stats.culled = 0;
+	draw_list_stats.objects_culled = 0;
+	for (int i = 0; i < MAX_LOD_LEVELS; i++) {
+		draw_list_stats.lod_counts[i] = 0;
+	}
+
+	UpdateFrustum();
+}
+
+// 現在の座標系で中心 (x, y, z)，半径 radius の球が見えるか．
+// 物体全体を先に判定して，見えなければ部品の記録を省くのに使う
+
+inline int IsSphereVisible(const double x, const double y, const double z,
+	const double radius)
+{
+	GLfloat c[3], r;
+	GLfloat p[3] = {(GLfloat) x, (GLfloat) y, (GLfloat) z};
+	TransformSphere(CurrentMatrix(), p, radius, c, &r);
+	if (shared_record ? IsWorldSphereVisible(c, r) : IsEyeSphereVisible(c, r)) {
+		return 1;
+	}
+	draw_list_stats.objects_culled++;
+	return 0;
+}
+
+// 半径 r の球が視点座標系で c にあるとき，画面上で何 pixel になるか
+
+inline GLfloat ProjectedPixels(const GLfloat c[3], const GLfloat r,
+	const GLfloat pixels_per_unit, const int perspective)
+{
+	if (!perspective) {
+		return r * pixels_per_unit;
+	}
+	if (-c[2] > r) {
+		return r * pixels_per_unit / -c[2];
+	}
+	return pixels_per_unit; // 視点が球の中にあるときは最も細かく
+}
+
+// 現在のモデルビュー行列でメッシュを描くコマンドを積む．
+// 視錐台の外なら捨て，見えるなら画面上の大きさで詳細度を決める．
+// 共有して記録しているときは，どの視点からも見えないものだけを捨て，
+// 詳細度は視点ごとに CullDrawView() で決める
+
+inline void RecordDraw(const int mesh, const int material)
+{
+	if (num_draw_commands >= draw_command_capacity) {
+		draw_list_stats.dropped++;
+		return;
+	}
+	DrawCommand &cmd = draw_commands[num_draw_commands];
+	const GLfloat *m = CurrentMatrix();
+	for (int i = 0; i < 16; i++) {
+		cmd.matrix[i] = m[i];
+	}
+
+	GLfloat c[3], r;
+	TransformSphere(cmd.matrix, meshes[mesh].center, meshes[mesh].radius, c, &r);
+	if (shared_record) {
+		if (!IsWorldSphereVisible(c, r)) {
+			draw_list_stats.culled++;
+			return;
+		}
+		GLfloat *sphere = shared_spheres[num_draw_commands];
+		sphere[0] = c[0];
+		sphere[1] = c[1];
+		sphere[2] = c[2];
+		sphere[3] = r;
+		cmd.mesh = mesh;
+		cmd.lod = 0;
+		cmd.material = material;
+		num_draw_commands++;
+		return;
+	}
+	if (!IsEyeSphereVisible(c, r)) {
+		draw_list_stats.culled++;
+		return;
+	}
+
+	cmd.mesh = mesh;
+	cmd.lod = SelectLod(mesh, ProjectedPixels(c, r, pixels_per_unit, 1));
+	cmd.material = material;
+	draw_list_stats.lod_counts[cmd.lod]++;
+	num_draw_commands++;
+}
+
+// 記録を終えたら呼ぶ．容量が足りずに捨てたコマンドがあれば，次からすべて
+// 積めるよう容量を広げて 1 を返す．呼んだ側は同じ場面を積み直す
+
+inline int RetryDrawList(void)
+{
+	if (draw_list_stats.dropped == 0) {
+		return 0;
+	}
+	int needed = num_draw_commands + draw_list_stats.dropped;
+	while (draw_command_limit < needed) {
+		draw_command_limit *= 2;
+	}
+	fprintf(stderr, "draw: %d commands did not fit, growing the list to %d\n",
+		needed, draw_command_limit);
+	return 1;
+}
+
+// マテリアル，メッシュの順に並べ替える．返す配列の下位 32bit がコマンド番号．
+// アリーナが足りなければ NULL を返し，記録順のまま描く
+
+inline unsigned long long *SortDrawList(void)
+{
+	// ソートキー: 上位からマテリアル 16bit，メッシュ 8bit，詳細度 8bit，
+	// 記録順 32bit
+
+	unsigned long long *keys = (unsigned long long *) AllocFrame(
+		sizeof(unsigned long long) * num_draw_commands);
+	if (!keys) {
+		return NULL;
+	}
+	for (int i = 0; i < num_draw_commands; i++) {
+		const DrawCommand &cmd = draw_commands[i];
+		keys[i] = ((unsigned long long) cmd.material << 48)
+			| ((unsigned long long) cmd.mesh << 40)
+			| ((unsigned long long) cmd.lod << 32)
+			| (unsigned int) i;
+	}
+	std::sort(keys, keys + num_draw_commands);
+
+	return keys;
+}
+
+// 並べ替えた i 番目のコマンド番号
+
+inline int SortedCommand(const unsigned long long *keys, const int i)
+{
+	return keys ? (int) (keys[i] & 0xffffffffu) : i;
+}
+
+// 並べ替えた順に，状態が変わったときだけ切り替えながら描く
+
+inline void SubmitDrawList(void)
+{
+	TRACE_SCOPE("SubmitDrawList");
+
+	unsigned long long *keys = SortDrawList();
+
+	int current_material = -1;
+	int current_mesh = -1;
+	int current_lod = -1;
+
+	draw_list_stats.material_changes = 0;
+	draw_list_stats.mesh_changes = 0;
+
+	BeginRenderPass();
+	for (int i = 0; i < num_draw_commands; i++) {
+		const DrawCommand &cmd = draw_commands[SortedCommand(keys, i)];
+		if (cmd.material != current_material) {
+			ApplyMaterial(cmd.material);
+			current_material = cmd.material;
+			draw_list_stats.material_changes++;
+		}
+		if (cmd.mesh != current_mesh || cmd.lod != current_lod) {
+			BindRenderMesh(cmd.mesh, cmd.lod);
+			current_mesh = cmd.mesh;
+			current_lod = cmd.lod;
+			draw_list_stats.mesh_changes++;
+		}
+		DrawRenderMesh(cmd.matrix, cmd.mesh, cmd.lod);
+	}
+	EndRenderPass();
+
+	draw_list_stats.commands = num_draw_commands;
+	draw_list_stats.arena_used = frame_arena_used;
+}
+
+inline void PrintDrawListStats(FILE *fp)
+{
+	fprintf(fp, "draw (%s): %d commands (%d culled, %d objects culled, "
+		"%d dropped), lod %d/%d/%d/%d, %d material changes, "
+		"%d mesh changes, arena %lu bytes\n", RenderPathName(),
+		draw_list_stats.commands, draw_list_stats.culled,
+		draw_list_stats.objects_culled, draw_list_stats.dropped,
+		draw_list_stats.lod_counts[0], draw_list_stats.lod_counts[1],
+		draw_list_stats.lod_counts[2], draw_list_stats.lod_counts[3],
+		draw_list_stats.material_changes, draw_list_stats.mesh_changes,
+		(unsigned long) draw_list_stats.arena_used);
+}
+
+
+
+// 複数の視点からの描画 ///////////////////////////////////////////////////////
+
+// 共有して記録したコマンド列と，視点ごとに作り直すコマンド列
+
+static DrawCommand *shared_commands;
+static int num_shared_commands;
+static DrawCommand *view_commands;
+static size_t shared_arena_used;  // 視点ごとの確保はここまで巻き戻す
+static double shared_record_ms;
+static std::chrono::steady_clock::time_point shared_record_start;
+
+inline double DrawElapsedMs(const std::chrono::steady_clock::time_point &from)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - from).count();
+}
+
+// views (CaptureDrawView() などで設定済み) から描くフレームの記録を始める．
+// モデルビュー行列にはビュー変換を含めず，ワールド座標系で記録する
+
+inline void BeginSharedDrawList(DrawView *views, const int n)
+{
+	shared_record_start = std::chrono::steady_clock::now();
+
+	// 共有のコマンドと境界球，視点ごとのコマンドとキー，それぞれの揃え分
+
+	ResetFrameArena((2 * sizeof(DrawCommand) + sizeof(GLfloat) * 4
+		+ sizeof(unsigned long long)) * draw_command_limit + 4 * 16);
+	shared_commands = (DrawCommand *) AllocFrame(
+		sizeof(DrawCommand) * draw_command_limit);
+	shared_spheres = (GLfloat (*)[4]) AllocFrame(
+		sizeof(GLfloat) * 4 * draw_command_limit);
+	view_commands = (DrawCommand *) AllocFrame(
+		sizeof(DrawCommand) * draw_command_limit);
+	shared_arena_used = frame_arena_used;
+	draw_command_capacity = shared_commands && shared_spheres && view_commands
+		? draw_command_limit : 0;
+
+	draw_views = views;
+	num_draw_views = n < MAX_DRAW_VIEWS ? n : MAX_DRAW_VIEWS;
+	draw_commands = shared_commands;
+	num_draw_commands = 0;
+	draw_list_stats.dropped = 0;
+	draw_list_stats.culled = 0;
+	draw_list_stats.objects_culled = 0;
+	shared_record = 1;
+}
+
+inline void EndSharedDrawList(void)
+{
+	shared_record = 0;
+	num_shared_commands = num_draw_commands;
+	shared_record_ms = DrawElapsedMs(shared_record_start);
+}
+
+// 共有したコマンド列から，この視点で見えるものだけを視点座標系の行列と
+// 詳細度を付けて選び出す．後は SubmitDrawList() などがそのまま使える．
+// 前の視点で並べ替えに確保した領域は捨てる
+
+inline void CullDrawView(DrawView *view)
+{
+	TRACE_SCOPE("CullDrawView");
+	view->start = std::chrono::steady_clock::now();
+
+	frame_arena_used = shared_arena_used;
+	for (int i = 0; i < MAX_LOD_LEVELS; i++) {
+		draw_list_stats.lod_counts[i] = 0;
+	}
+
+	const GLfloat *v = view->view;
+	int n = 0;
+	for (int i = 0; i < num_shared_commands; i++) {
+		const GLfloat *sphere = shared_spheres[i];
+		if (!IsSphereInPlanes(view->planes, sphere, sphere[3])) {
+			continue;
+		}
+		const DrawCommand &src = shared_commands[i];
+		DrawCommand &cmd = view_commands[n++];
+
+		// ビュー変換は剛体なので，半径はそのまま使える
+
+		GLfloat c[3];
+		for (int k = 0; k < 3; k++) {
+			c[k] = v[k] * sphere[0] + v[4 + k] * sphere[1] + v[8 + k] * sphere[2]
+				+ v[12 + k];
+		}
+		MultiplyMatrix(v, src.matrix, cmd.matrix);
+		cmd.mesh = src.mesh;
+		cmd.material = src.material;
+		cmd.lod = SelectLod(src.mesh, ProjectedPixels(c, sphere[3],
+			view->pixels_per_unit, view->perspective));
+		draw_list_stats.lod_counts[cmd.lod]++;
+	}
+
+	draw_commands = view_commands;
+	num_draw_commands = n;
+	view->commands = n;
+	view->culled = num_shared_commands - n;
+	view->cull_ms = DrawElapsedMs(view->start);
+}
+
+// この視点を描き終えたら呼ぶ．CullDrawView() からの時間を記録する
+
+inline void FinishDrawView(DrawView *view)
+{
+	view->draw_ms = DrawElapsedMs(view->start) - view->cull_ms;
+}
+
+// 記録 (場面の走査) は全視点で一度，カリング以降は視点ごとにかかる時間
+
+inline void PrintDrawViewStats(FILE *fp)
+{
+	double per_view = 0.0;
+	for (int i = 0; i < num_draw_views; i++) {
+		per_view += draw_views[i].cull_ms + draw_views[i].draw_ms;
+	}
+	fprintf(fp, "views: %d views, shared record %.3f ms (%d commands, "
+		"%d culled by all), per view %.3f ms on average\n", num_draw_views,
+		shared_record_ms, num_shared_commands, draw_list_stats.culled,
+		num_draw_views ? per_view / num_draw_views : 0.0);
+	for (int i = 0; i < num_draw_views; i++) {
+		const DrawView &view = draw_views[i];
+		fprintf(fp, "  view %d: %d commands (%d culled), cull %.3f ms, "
+			"draw %.3f ms\n", i, view.commands, view.culled, view.cull_ms,
+			view.draw_ms);
+	}
+}
+
+
+
+
+// 地面 ///////////////////////////////////////////////////////////////////////
+
+// 原点を中心に，一辺 size の枡を num x num 並べた市松模様の地面を積む
+
+inline void RecordGround(const int num, const double size, const int material1,
+	const int material2)
+{
+	TRACE_SCOPE("RecordGround");
+
+	PushMatrix();
+	Scale(size, 1.0, size);
+	Translate(-num / 2.0, 0.0, -num / 2.0);
+
+	for (int i = 0; i < num; i++) {
+		for (int j = 0; j < num; j++) {
+			PushMatrix();
+			Translate(i, 0.0, j);
+			RecordDraw(MESH_QUAD, (i + j) % 2 == 0 ? material1 : material2);
+			PopMatrix();
+		}
+	}
+
+	PopMatrix();
+}
+
+#endif // DRAW_LIST_H
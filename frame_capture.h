@@ -0,0 +1,472 @@
+// frame_capture.h
+//
+// 画面を動画として書き出す
+//
+// glutSwapBuffers() の直後に glReadPixels() で読むと，そのたびに描画の
+// 終わりを待つことになる．ここではピクセルバッファオブジェクト (PBO) を
+// CAPTURE_PBO_COUNT 個の輪にして読み出しを非同期に発行し，
+// CAPTURE_PBO_COUNT - 1 フレーム遅れて取り出す．取り出した画像は
+// あらかじめ確保したスロットに写して書き出し用のスレッドへ渡し，
+// そちらで Y4M (YUV 4:2:0) か生の RGB に変換してファイルか標準出力へ流す．
+// 撮影中にメモリを確保することはない．
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glut.h>
+#include <GL/glext.h>
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "trace.h"
+
+
+
+// 設定 ///////////////////////////////////////////////////////////////////////
+
+const int CAPTURE_PBO_COUNT = 3;  // 読み出しの遅れは 2 フレーム
+const int CAPTURE_SLOTS = 8;      // 書き出し待ちにできるフレーム数
+const int CAPTURE_FPS = 30;       // Y4M のヘッダに書くフレームレート
+
+enum CaptureFormat {
+	CAPTURE_Y4M,
+	CAPTURE_RGB
+};
+
+
+
+// PBO の関数 /////////////////////////////////////////////////////////////////
+
+// OpenGL 1.5 の関数なので，実行時に GLUT から取り出す．
+// glutGetProcAddress() の無い GLUT では同期読み出しになる
+
+static PFNGLGENBUFFERSPROC capture_glGenBuffers;
+static PFNGLDELETEBUFFERSPROC capture_glDeleteBuffers;
+static PFNGLBINDBUFFERPROC capture_glBindBuffer;
+static PFNGLBUFFERDATAPROC capture_glBufferData;
+static PFNGLMAPBUFFERPROC capture_glMapBuffer;
+static PFNGLUNMAPBUFFERPROC capture_glUnmapBuffer;
+
+inline int LoadCaptureFunctions(void)
+{
+#ifdef FREEGLUT
+	capture_glGenBuffers = (PFNGLGENBUFFERSPROC) glutGetProcAddress("glGenBuffers");
+	capture_glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) glutGetProcAddress("glDeleteBuffers");
+	capture_glBindBuffer = (PFNGLBINDBUFFERPROC) glutGetProcAddress("glBindBuffer");
+	capture_glBufferData = (PFNGLBUFFERDATAPROC) glutGetProcAddress("glBufferData");
+	capture_glMapBuffer = (PFNGLMAPBUFFERPROC) glutGetProcAddress("glMapBuffer");
+	capture_glUnmapBuffer = (PFNGLUNMAPBUFFERPROC) glutGetProcAddress("glUnmapBuffer");
+
+	return capture_glGenBuffers && capture_glDeleteBuffers && capture_glBindBuffer
+		&& capture_glBufferData && capture_glMapBuffer && capture_glUnmapBuffer;
+#else
+	return 0;
+#endif
+}
+
+
+
+// 撮影の状態 /////////////////////////////////////////////////////////////////
+
+struct FrameCapture {
+	int active;
+	int format;
+	int width, height;
+	size_t frame_bytes;  // RGB 一枚の大きさ
+	FILE *fp;
+
+	// 描画側: PBO の輪
+
+	int use_pbo;         // 0 なら PBO が使えないので同期読み出し
+	GLuint pbo[CAPTURE_PBO_COUNT];
+	int issued;          // 読み出しを発行したフレーム数
+	int retired;         // 取り出したフレーム数
+
+	// 書き出し側: スロットの輪 (描画側が head を進め，書き出し側が tail を進める)
+
+	unsigned char *slots[CAPTURE_SLOTS];
+	unsigned char *yuv;  // Y4M 変換用
+	int head, tail;
+	int quit;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable freed;
+	std::thread writer;
+
+	// 計測
+
+	double capture_ms;   // 描画スレッドで撮影に使った時間の合計
+	double stall_ms;     // 書き出しが追いつかず待った時間の合計
+	int frames_written;
+};
+
+static FrameCapture capture;
+
+// 撮影していないときと撮影中の，Display() 一回あたりの時間
+
+struct FrameTiming {
+	std::chrono::steady_clock::time_point start;
+	double plain_ms;
+	int plain_frames;
+	double captured_ms;
+	int captured_frames;
+};
+
+static FrameTiming frame_timing;
+
+inline double CaptureElapsedMs(const std::chrono::steady_clock::time_point &from)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - from).count();
+}
+
+// Display() の最初と glutSwapBuffers() の直前で呼ぶ
+
+inline void MarkFrameStart(void)
+{
+	frame_timing.start = std::chrono::steady_clock::now();
+}
+
+inline void MarkFrameEnd(void)
+{
+	double ms = CaptureElapsedMs(frame_timing.start);
+	if (capture.active) {
+		frame_timing.captured_ms += ms;
+		frame_timing.captured_frames++;
+	} else {
+		frame_timing.plain_ms += ms;
+		frame_timing.plain_frames++;
+	}
+}
+
+
+
+// 書き出しスレッド ///////////////////////////////////////////////////////////
+
+// 下から並んだ RGB を上からの YUV 4:2:0 (BT.601, フルレンジ) にする
+
+inline void ConvertToYuv420(const unsigned char *rgb, const int width,
+	const int height, unsigned char *yuv)
+{
+	const int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	unsigned char *y_plane = yuv;
+	unsigned char *u_plane = yuv + width * height;
+	unsigned char *v_plane = u_plane + cw * ch;
+
+	for (int y = 0; y < height; y++) {
+		const unsigned char *src = rgb + (size_t) (height - 1 - y) * width * 3;
+		unsigned char *dst = y_plane + (size_t) y * width;
+		for (int x = 0; x < width; x++) {
+			int r = src[x * 3], g = src[x * 3 + 1], b = src[x * 3 + 2];
+			dst[x] = (unsigned char) ((77 * r + 150 * g + 29 * b + 128) >> 8);
+		}
+	}
+
+	// 色差は 2x2 画素の平均から求める
+
+	for (int cy = 0; cy < ch; cy++) {
+		for (int cx = 0; cx < cw; cx++) {
+			int r = 0, g = 0, b = 0, n = 0;
+			for (int dy = 0; dy < 2; dy++) {
+				int y = cy * 2 + dy;
+				if (y >= height) {
+					continue;
+				}
+				const unsigned char *src = rgb + (size_t) (height - 1 - y) * width * 3;
+				for (int dx = 0; dx < 2; dx++) {
+					int x = cx * 2 + dx;
+					if (x >= width) {
+						continue;
+					}
+					r += src[x * 3];
+					g += src[x * 3 + 1];
+					b += src[x * 3 + 2];
+					n++;
+				}
+			}
+			r /= n;
+			g /= n;
+			b /= n;
+			int u = ((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128;
+			int v = ((128 * r - 107 * g - 21 * b + 128) >> 8) + 128;
+			u_plane[cy * cw + cx] = (unsigned char) (u < 0 ? 0 : (u > 255 ? 255 : u));
+			v_plane[cy * cw + cx] = (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+		}
+	}
+}
+
+inline void WriteCaptureFrame(const unsigned char *rgb)
+{
+	TRACE_SCOPE("WriteCaptureFrame");
+	if (capture.format == CAPTURE_Y4M) {
+		int cw = (capture.width + 1) / 2, ch = (capture.height + 1) / 2;
+		ConvertToYuv420(rgb, capture.width, capture.height, capture.yuv);
+		fputs("FRAME\n", capture.fp);
+		fwrite(capture.yuv, 1, capture.width * capture.height + cw * ch * 2, capture.fp);
+	} else {
+		for (int y = capture.height - 1; y >= 0; y--) {
+			fwrite(rgb + (size_t) y * capture.width * 3, 1, capture.width * 3, capture.fp);
+		}
+	}
+}
+
+inline void CaptureWriterThread(void)
+{
+	TRACE_THREAD_NAME("capture writer");
+	for (;;) {
+		unsigned char *slot;
+		{
+			std::unique_lock<std::mutex> lock(capture.mutex);
+			capture.ready.wait(lock, [] {
+				return capture.head != capture.tail || capture.quit;
+			});
+			if (capture.head == capture.tail) {
+				break; // quit かつ空
+			}
+			slot = capture.slots[capture.tail % CAPTURE_SLOTS];
+		}
+
+		WriteCaptureFrame(slot);
+
+		{
+			std::lock_guard<std::mutex> lock(capture.mutex);
+			capture.tail++;
+			capture.frames_written++;
+		}
+		capture.freed.notify_one();
+	}
+	fflush(capture.fp);
+}
+
+// 空きスロットを待って画像を写し，書き出しスレッドに渡す
+
+inline void PushCaptureFrame(const void *pixels)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(capture.mutex);
+	capture.freed.wait(lock, [] {
+		return capture.head - capture.tail < CAPTURE_SLOTS;
+	});
+	capture.stall_ms += CaptureElapsedMs(start);
+	unsigned char *slot = capture.slots[capture.head % CAPTURE_SLOTS];
+	lock.unlock();
+
+	// スロットは書き出し側が tail を進めるまで触らないので，写すときは鍵は要らない
+
+	memcpy(slot, pixels, capture.frame_bytes);
+
+	lock.lock();
+	capture.head++;
+	lock.unlock();
+	capture.ready.notify_one();
+}
+
+
+
+// 撮影の開始と終了 ///////////////////////////////////////////////////////////
+
+// ウィンドウを閉じるなどして StopCapture() を通らずに終わったときのために，
+// 書き出しスレッドだけは止めてファイルを閉じる (GL はもう使えないかもしれない)
+
+inline void FinishCaptureAtExit(void)
+{
+	if (!capture.active) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(capture.mutex);
+		capture.quit = 1;
+	}
+	capture.ready.notify_one();
+	capture.writer.join();
+	if (capture.fp != stdout) {
+		fclose(capture.fp);
+	}
+	capture.active = 0;
+}
+
+// path が "-" なら標準出力へ．拡張子が .rgb なら生の RGB，それ以外は Y4M
+
+inline int StartCapture(const char *path, const int width, const int height)
+{
+	if (capture.active) {
+		return 0;
+	}
+
+	size_t len = strlen(path);
+	capture.format = (len > 4 && strcmp(path + len - 4, ".rgb") == 0)
+		? CAPTURE_RGB : CAPTURE_Y4M;
+	capture.fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+	if (!capture.fp) {
+		perror(path);
+		return 1;
+	}
+
+	capture.width = width;
+	capture.height = height;
+	capture.frame_bytes = (size_t) width * height * 3;
+	for (int i = 0; i < CAPTURE_SLOTS; i++) {
+		capture.slots[i] = new unsigned char[capture.frame_bytes];
+	}
+	capture.yuv = new unsigned char[width * height + ((width + 1) / 2) * ((height + 1) / 2) * 2];
+
+	if (capture.format == CAPTURE_Y4M) {
+		fprintf(capture.fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+			width, height, CAPTURE_FPS);
+	}
+
+	capture.use_pbo = LoadCaptureFunctions();
+	if (capture.use_pbo) {
+		capture_glGenBuffers(CAPTURE_PBO_COUNT, capture.pbo);
+		for (int i = 0; i < CAPTURE_PBO_COUNT; i++) {
+			capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[i]);
+			capture_glBufferData(GL_PIXEL_PACK_BUFFER, capture.frame_bytes, NULL,
+				GL_STREAM_READ);
+		}
+		capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	} else {
+		fprintf(stderr, "capture: pixel buffer objects unavailable, "
+			"falling back to synchronous glReadPixels\n");
+	}
+
+	capture.issued = 0;
+	capture.retired = 0;
+	capture.head = 0;
+	capture.tail = 0;
+	capture.quit = 0;
+	capture.capture_ms = 0.0;
+	capture.stall_ms = 0.0;
+	capture.frames_written = 0;
+	frame_timing.captured_ms = 0.0;
+	frame_timing.captured_frames = 0;
+	capture.writer = std::thread(CaptureWriterThread);
+	capture.active = 1;
+
+	static int registered = 0;
+	if (!registered) {
+		atexit(FinishCaptureAtExit);
+		registered = 1;
+	}
+
+	fprintf(stderr, "capture: recording %dx%d to %s\n", width, height, path);
+	return 0;
+}
+
+// 最も古い PBO を取り出して書き出しへ渡す
+
+inline void RetireCapturePbo(void)
+{
+	capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[capture.retired % CAPTURE_PBO_COUNT]);
+	void *pixels = capture_glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (pixels) {
+		PushCaptureFrame(pixels);
+		capture_glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capture.retired++;
+}
+
+// 描き終えてから glutSwapBuffers() の前に呼ぶ
+
+inline void CaptureFrame(void)
+{
+	if (!capture.active) {
+		return;
+	}
+	TRACE_SCOPE("CaptureFrame");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	if (capture.use_pbo) {
+		// 読み出しを発行するだけで，終わりは待たない
+
+		capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbo[capture.issued % CAPTURE_PBO_COUNT]);
+		glReadPixels(0, 0, capture.width, capture.height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		capture_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		capture.issued++;
+
+		// 輪が一周したら，いちばん古いものはもう読み終わっている
+
+		if (capture.issued - capture.retired == CAPTURE_PBO_COUNT) {
+			RetireCapturePbo();
+		}
+	} else {
+		std::unique_lock<std::mutex> lock(capture.mutex);
+		capture.freed.wait(lock, [] {
+			return capture.head - capture.tail < CAPTURE_SLOTS;
+		});
+		unsigned char *slot = capture.slots[capture.head % CAPTURE_SLOTS];
+		lock.unlock();
+		glReadPixels(0, 0, capture.width, capture.height, GL_RGB, GL_UNSIGNED_BYTE, slot);
+		lock.lock();
+		capture.head++;
+		lock.unlock();
+		capture.ready.notify_one();
+	}
+
+	capture.capture_ms += CaptureElapsedMs(start);
+}
+
+inline void PrintCaptureReport(FILE *fp)
+{
+	double plain = frame_timing.plain_frames > 0
+		? frame_timing.plain_ms / frame_timing.plain_frames : 0.0;
+	double captured = frame_timing.captured_frames > 0
+		? frame_timing.captured_ms / frame_timing.captured_frames : 0.0;
+	double per_frame = frame_timing.captured_frames > 0
+		? capture.capture_ms / frame_timing.captured_frames : 0.0;
+
+	fprintf(fp, "capture: %d frames written, %.3f ms/frame on the render thread "
+		"(%.1f ms stalled on the writer in total)\n",
+		capture.frames_written, per_frame, capture.stall_ms);
+	fprintf(fp, "capture: frame time %.3f ms uncaptured, %.3f ms captured",
+		plain, captured);
+	if (plain > 0.0) {
+		fprintf(fp, " (overhead %+.1f%%)", (captured - plain) / plain * 100.0);
+	}
+	fprintf(fp, "\n");
+}
+
+// 残りの PBO を取り出し，書き出しが終わるのを待って閉じる
+
+inline void StopCapture(void)
+{
+	if (!capture.active) {
+		return;
+	}
+	if (capture.use_pbo) {
+		while (capture.retired < capture.issued) {
+			RetireCapturePbo();
+		}
+		capture_glDeleteBuffers(CAPTURE_PBO_COUNT, capture.pbo);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(capture.mutex);
+		capture.quit = 1;
+	}
+	capture.ready.notify_one();
+	capture.writer.join();
+
+	if (capture.fp != stdout) {
+		fclose(capture.fp);
+	}
+	for (int i = 0; i < CAPTURE_SLOTS; i++) {
+		delete [] capture.slots[i];
+	}
+	delete [] capture.yuv;
+	capture.active = 0;
+
+	PrintCaptureReport(stderr);
+}
+
+#endif // FRAME_CAPTURE_H
@@ -0,0 +1,342 @@
+// kinematics.h
+//
+// アームの順運動学・ヤコビアン・逆運動学の一歩と，歩行の一歩
+//
+// どれも計算の型 T (float / double / long double) と，sin・cos を多項式で
+// 近似するかどうか (FAST) をテンプレート引数に取る．角度は内部ではすべて
+// ラジアンで扱い，度への変換は描画や入出力の境目でだけ行う．
+//
+// プログラムから使う型は，コンパイル時に次で選ぶ．
+//   -DKINEMATICS_FLOAT      float で計算する (既定は double)
+//   -DKINEMATICS_FAST_TRIG  多項式の sin・cos を使う (既定は libm)
+// 精度と速さの兼ね合いは kinematics_bench で測る．
+//
+// ヤコビアンは順運動学を autodiff.h の二重数で実体化して求めるので，
+// リンクの数や形を変えても偏微分を導き直さなくてよい．
+
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <cmath>
+#include <limits>
+
+#include "autodiff.h"
+
+
+
+// 計算の型 ///////////////////////////////////////////////////////////////////
+
+#ifdef KINEMATICS_FLOAT
+typedef float KinematicsReal;
+#else
+typedef double KinematicsReal;
+#endif
+
+#ifdef KINEMATICS_FAST_TRIG
+const bool KINEMATICS_FAST = true;
+#else
+const bool KINEMATICS_FAST = false;
+#endif
+
+const long double KINEMATICS_PI = 3.141592653589793238462643383279502884L;
+
+template <typename T>
+inline T DegreeToRadian(const T x)
+{
+	return x * (T) (KINEMATICS_PI / 180);
+}
+
+template <typename T>
+inline T RadianToDegree(const T x)
+{
+	return x * (T) (180 / KINEMATICS_PI);
+}
+
+
+
+// sin と cos /////////////////////////////////////////////////////////////////
+
+// 多項式による近似．π/2 の倍数を引いて |r| <= π/4 にしてから，Cephes の
+// sinf / cosf と同じ係数で求める．誤差は型によらず 1e-7 程度．
+// 分岐を持たないので，配列に対するループはベクトル化できる
+
+template <typename T>
+inline void FastSinCos(const T a, T *s, T *c)
+{
+	// 仮数部の桁数ぶんずらした定数を足して引くと，最も近い整数に丸まる
+
+	const T round = std::ldexp((T) 1.5, std::numeric_limits<T>::digits - 1);
+	const T k = (a * (T) (2 / KINEMATICS_PI) + round) - round;
+	const int q = (int) k;
+
+	// π/2 を上位と下位に分けて引き，桁落ちを抑える
+
+	const T r = (a - k * (T) 1.5707963705062866) - k * (T) -4.3711388286737929e-08;
+	const T r2 = r * r;
+
+	const T ps = r + r * r2 * ((T) -1.6666654611e-1
+		+ r2 * ((T) 8.3321608736e-3 + r2 * (T) -1.9515295891e-4));
+	const T pc = (T) 1 - (T) 0.5 * r2 + r2 * r2 * ((T) 4.166664568298827e-2
+		+ r2 * ((T) -1.388731625493765e-3 + r2 * (T) 2.443315711809948e-5));
+
+	// 象限に応じて入れ替えと符号反転
+
+	const T qs = (q & 1) ? pc : ps;
+	const T qc = (q & 1) ? -ps : pc;
+	*s = (q & 2) ? -qs : qs;
+	*c = (q & 2) ? -qc : qc;
+}
+
+// 型ごとに差し替えられるよう，実体は構造体の静的関数に置く
+
+template <typename T, bool FAST>
+struct SinCosOf {
+	static void Compute(const T a, T *s, T *c)
+	{
+		if (FAST) {
+			FastSinCos(a, s, c);
+		} else {
+			*s = std::sin(a);
+			*c = std::cos(a);
+		}
+	}
+};
+
+// 二重数では値の sin・cos を一度だけ求め，偏微分はそれに角の偏微分を掛ける
+
+template <typename T, int F, int C, bool FAST>
+struct SinCosOf<Dual<T, F, C>, FAST> {
+	static void Compute(const Dual<T, F, C> &a, Dual<T, F, C> *s, Dual<T, F, C> *c)
+	{
+		T sv, cv;
+		SinCosOf<T, FAST>::Compute(a.v, &sv, &cv);
+		DualSinCos(a, sv, cv, s, c);
+	}
+};
+
+template <typename T, bool FAST>
+inline void SinCos(const T a, T *s, T *c)
+{
+	SinCosOf<T, FAST>::Compute(a, s, c);
+}
+
+
+
+// 平面内の関節の鎖 ///////////////////////////////////////////////////////////
+
+// x と y の組．二重数では偏微分の範囲が違うので，型を別々に持てるようにする
+
+template <typename X, typename Y>
+struct Planar {
+	X x;
+	Y y;
+};
+
+template <typename X, typename Y>
+inline Planar<X, Y> MakePlanar(const X &x, const Y &y)
+{
+	Planar<X, Y> p;
+	p.x = x;
+	p.y = y;
+	return p;
+}
+
+// 平面内の関節の鎖で，根元からの累積角が a のリンク (長さ length[0]) から
+// 先端までが先端位置に寄与する分．続く関節の相対角を rest に並べる．
+// 根元から呼ぶと先端位置になる．累積角とその sin・cos はリンクごとに一度だけ
+// 求まり，先端側からの部分和はヤコビアンの列としてそのまま共有される
+
+template <bool FAST, typename S, typename A>
+DUAL_INLINE Planar<A, A> ChainTail(const S *length, const A &a)
+{
+	A s, c;
+	SinCos<A, FAST>(a, &s, &c);
+	return MakePlanar(c * length[0], s * length[0]);
+}
+
+template <bool FAST, typename S, typename A, typename B, typename... R>
+DUAL_INLINE auto ChainTail(const S *length, const A &a, const B &next, const R &... rest)
+{
+	A s, c;
+	SinCos<A, FAST>(a, &s, &c);
+	auto tail = ChainTail<FAST>(length + 1, a + next, rest...);
+	return MakePlanar(c * length[0] + tail.x, s * length[0] + tail.y);
+}
+
+// ForwardJacobian() に渡す，鎖の先端位置 (出力 0 が x，1 が y)
+
+template <bool FAST, typename S>
+struct ChainEnd {
+	const S *length;
+
+	template <typename O, typename... A>
+	DUAL_INLINE void operator()(const O &out, const A &... angle) const
+	{
+		auto end = ChainTail<FAST>(length, angle...);
+		out(0, end.x);
+		out(1, end.y);
+	}
+};
+
+// LINKS 関節の鎖の先端位置と，関節角に対するヤコビアン (2 x LINKS)
+
+template <int LINKS, bool FAST, typename T>
+inline void ChainForwardJacobian(const T length[LINKS], const T angle[LINKS],
+	T *end_x, T *end_y, T jacobian[2][LINKS])
+{
+	T end[2];
+	ChainEnd<FAST, T> chain = {length};
+	ForwardJacobian<2, LINKS>(chain, angle, end, jacobian);
+	*end_x = end[0];
+	*end_y = end[1];
+}
+
+
+
+// 3 関節アーム ///////////////////////////////////////////////////////////////
+
+// 平面内の 3 関節アーム．angle[i] は一つ手前のリンクからの相対角 [rad]．
+// 位置だけなら式をそのまま書いた方が ArmForwardBatch() でベクトル化される
+
+template <typename T, bool FAST>
+inline void ArmForward(const T length[3], const T angle[3], T *end_x, T *end_y)
+{
+	T s1, c1, s12, c12, s123, c123;
+	SinCos<T, FAST>(angle[0], &s1, &c1);
+	SinCos<T, FAST>(angle[0] + angle[1], &s12, &c12);
+	SinCos<T, FAST>(angle[0] + angle[1] + angle[2], &s123, &c123);
+	*end_x = length[0] * c1 + length[1] * c12 + length[2] * c123;
+	*end_y = length[0] * s1 + length[1] * s12 + length[2] * s123;
+}
+
+// 先端位置と，関節角に対するヤコビアン (2x3)
+
+template <typename T, bool FAST>
+inline void ArmForwardJacobian(const T length[3], const T angle[3],
+	T *end_x, T *end_y, T jacobian[2][3])
+{
+	ChainForwardJacobian<3, FAST>(length, angle, end_x, end_y, jacobian);
+}
+
+// (dx, dy) の長さを返す．max_step より長ければ，向きを保ってそこまで縮める
+
+template <typename T>
+inline T ClampIkStep(T *dx, T *dy, const T max_step)
+{
+	const T distance = std::sqrt(*dx * *dx + *dy * *dy);
+	if (distance > max_step) {
+		*dx *= max_step / distance;
+		*dy *= max_step / distance;
+	}
+	return distance;
+}
+
+// ヤコビアン ja (2x3) の擬似逆行列 J^# = J^T (J J^T)^-1 を先端の変位
+// (dx, dy) に掛け，関節角の変化 dq を求める．J J^T が特異なら 0 を返す
+
+template <typename T>
+inline int ArmPseudoInverse(const T ja[2][3], const T dx, const T dy, T dq[3])
+{
+	// J J^T (2x2 対称) とその逆行列
+
+	const T a = ja[0][0] * ja[0][0] + ja[0][1] * ja[0][1] + ja[0][2] * ja[0][2];
+	const T b = ja[0][0] * ja[1][0] + ja[0][1] * ja[1][1] + ja[0][2] * ja[1][2];
+	const T d = ja[1][0] * ja[1][0] + ja[1][1] * ja[1][1] + ja[1][2] * ja[1][2];
+	const T det = a * d - b * b;
+	if (det == 0) {
+		return 0;
+	}
+
+	// (J J^T)^-1 を変位に掛けてから J^T を掛ける
+
+	const T u = (d * dx - b * dy) / det;
+	const T v = (a * dy - b * dx) / det;
+	for (int i = 0; i < 3; i++) {
+		dq[i] = ja[0][i] * u + ja[1][i] * v;
+	}
+	return 1;
+}
+
+// 目標 (target_x, target_y) へ向けて擬似逆行列で一歩動かす．
+// 先端の移動量は max_step までに抑える．特異な姿勢では動かさない．
+// 先端から目標までの距離を返す
+
+template <typename T, bool FAST>
+inline T ArmIkStep(const T length[3], T angle[3], const T target_x,
+	const T target_y, const T max_step)
+{
+	T end_x, end_y, ja[2][3];
+	ArmForwardJacobian<T, FAST>(length, angle, &end_x, &end_y, ja);
+
+	T dx = target_x - end_x;
+	T dy = target_y - end_y;
+	const T distance = ClampIkStep(&dx, &dy, max_step);
+	T dq[3];
+	if (ArmPseudoInverse(ja, dx, dy, dq)) {
+		for (int i = 0; i < 3; i++) {
+			angle[i] += dq[i];
+		}
+	}
+	return distance;
+}
+
+// 多数の姿勢の先端位置をまとめて求める．FAST なら分岐の無いループになるので，
+// コンパイラがベクトル化しやすい
+
+template <typename T, bool FAST>
+inline void ArmForwardBatch(const int n, const T length[3],
+	const T *angle1, const T *angle2, const T *angle3, T *end_x, T *end_y)
+{
+	for (int i = 0; i < n; i++) {
+		const T angle[3] = {angle1[i], angle2[i], angle3[i]};
+		ArmForward<T, FAST>(length, angle, &end_x[i], &end_y[i]);
+	}
+}
+
+
+
+// 歩行 ///////////////////////////////////////////////////////////////////////
+
+// 胴の位置と向き，脚の開き．角度はラジアン
+
+template <typename T>
+struct GaitState {
+	T leg_angle;    // 両脚のなす角．片脚は leg_angle / 2 だけ傾く
+	T x, y, z;
+	T dir;          // 鉛直軸まわりの向き
+	int on_ground;  // 0: 左足が接地, 1: 右足が接地
+};
+
+// 接地している脚を支点に step だけ脚を振り，胴を動かす．
+// 脚の開きが angle_max を越えたら支える脚を替える．ラジアンでは step を
+// 足し重ねた値がちょうど angle_max にならないので，少し余裕を見て比べる
+
+template <typename T, bool FAST>
+inline void GaitStep(GaitState<T> *state, const T leg_length, const T step,
+	const T angle_max)
+{
+	const T previous = state->leg_angle;
+	const T sign = state->on_ground == 0 ? (T) -1 : (T) 1;
+	state->leg_angle += sign * step;
+
+	// 腰の高さと前後位置は，接地した脚の傾きの cos と sin で決まる
+
+	T s0, c0, s1, c1, sd, cd;
+	SinCos<T, FAST>(previous / 2, &s0, &c0);
+	SinCos<T, FAST>(state->leg_angle / 2, &s1, &c1);
+	SinCos<T, FAST>(state->dir, &sd, &cd);
+
+	const T forward = sign * leg_length * (s1 - s0);
+	state->x += forward * cd;
+	state->y += leg_length * (c1 - c0);
+	state->z -= forward * sd;
+
+	const T limit = angle_max + step * (T) 1e-3;
+	if (state->on_ground == 0 && state->leg_angle < -limit) {
+		state->on_ground = 1;
+	} else if (state->on_ground == 1 && state->leg_angle > limit) {
+		state->on_ground = 0;
+	}
+}
+
+#endif // KINEMATICS_H
@@ -0,0 +1,678 @@
+// kinematics_bench.cpp
+//
+// kinematics.h の計算を型と sin・cos の求め方ごとに比べる
+//
+// それぞれについて処理量 (1 秒あたりの回数) と，long double で求めた値からの
+// ずれ (エンドエフェクタの位置，歩行後の胴の位置) を表にする．
+// 比較の基準 (legacy) は，度で持った角度を項ごとにラジアンへ直していた
+// 元の UpdateArmStatus() と Idle() の計算．
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "kinematics.h"
+#include "bench.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const double ARM_LENGTH1 = 10.0;
+const double ARM_LENGTH2 = 12.0;
+const double ARM_LENGTH3 = 8.0;
+const double IK_MAX_STEP = 2.0;
+
+const double LEG_LENGTH = 5.0;
+const double GAIT_STEP = 2.0;   // [deg]
+const double GAIT_MAX = 40.0;   // [deg]
+
+const int NUM_POSES = 4096;
+const int IK_ITERATIONS = 100;
+const int GAIT_STEPS = 100000;
+
+// 姿勢と目標 (ラジアン)
+
+std::vector<double> pose_angle[3];
+std::vector<double> pose_target_x, pose_target_y;
+
+
+
+// 元の実装 ///////////////////////////////////////////////////////////////////
+
+double toRadian(double x){
+	return x * M_PI / 180.0;
+}
+
+double toDegree(double x){
+	return x * 180.0 / M_PI;
+}
+
+// 3dof_arm.cpp の UpdateArmStatus() から，位置とヤコビアンを求める部分
+
+void LegacyForwardJacobian(const double arm_angle1, const double arm_angle2,
+	const double arm_angle3, double *end_x, double *end_y, double ja[2][3])
+{
+	*end_x = ARM_LENGTH1 * cos(toRadian(arm_angle1)) + ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	*end_y = ARM_LENGTH1 * sin(toRadian(arm_angle1)) + ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[0][0] = -ARM_LENGTH1 * sin(toRadian(arm_angle1)) - ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) - ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[0][1] = -ARM_LENGTH2 * sin(toRadian(arm_angle1 + arm_angle2)) - ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[0][2] = -ARM_LENGTH3 * sin(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[1][0] = ARM_LENGTH1 * cos(toRadian(arm_angle1)) + ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[1][1] = ARM_LENGTH2 * cos(toRadian(arm_angle1 + arm_angle2)) + ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+	ja[1][2] = ARM_LENGTH3 * cos(toRadian(arm_angle1 + arm_angle2 + arm_angle3));
+}
+
+// UpdateArmStatus() の一歩 (角度は度)
+
+void LegacyIkStep(double angle[3], const double target_x, const double target_y)
+{
+	double end_x, end_y, ja[2][3];
+	LegacyForwardJacobian(angle[0], angle[1], angle[2], &end_x, &end_y, ja);
+
+	double dx = target_x - end_x;
+	double dy = target_y - end_y;
+	double length = sqrt(dx * dx + dy * dy);
+	if (length > IK_MAX_STEP) {
+		dx = dx / length * IK_MAX_STEP;
+		dy = dy / length * IK_MAX_STEP;
+	}
+
+	double jajaT[2][2];
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			jajaT[i][j] = ja[i][0] * ja[j][0] + ja[i][1] * ja[j][1] + ja[i][2] * ja[j][2];
+		}
+	}
+	double det = jajaT[0][0] * jajaT[1][1] - jajaT[0][1] * jajaT[1][0];
+	if (det == 0) {
+		return;
+	}
+	double inv[2][2] = {{jajaT[1][1] / det, -jajaT[0][1] / det},
+		{-jajaT[1][0] / det, jajaT[0][0] / det}};
+	for (int i = 0; i < 3; i++) {
+		double sharp0 = ja[0][i] * inv[0][0] + ja[1][i] * inv[1][0];
+		double sharp1 = ja[0][i] * inv[0][1] + ja[1][i] * inv[1][1];
+		angle[i] += toDegree(sharp0 * dx + sharp1 * dy);
+	}
+}
+
+// walk.cpp の Idle() の一歩 (角度は度)
+
+struct LegacyGait {
+	double leg_angle;
+	double body_x, body_y, body_z;
+	double body_dir;
+	int on_ground;
+};
+
+void LegacyGaitStep(LegacyGait *g)
+{
+	switch (g->on_ground)
+	{
+	case 0:
+		g->leg_angle -= GAIT_STEP;
+		g->body_x -= ((LEG_LENGTH * cos(M_PI * (90 - g->leg_angle / 2) / 180)) - (LEG_LENGTH * cos(M_PI * ( 90 - (g->leg_angle + GAIT_STEP) / 2) / 180))) * cos(M_PI * g->body_dir / 180);
+		g->body_y += (LEG_LENGTH * sin(M_PI * (90 - g->leg_angle / 2) / 180)) - (LEG_LENGTH * sin(M_PI * ( 90 - (g->leg_angle + GAIT_STEP) / 2) / 180));
+		g->body_z += ((LEG_LENGTH * cos(M_PI * (90 - g->leg_angle / 2) / 180)) - (LEG_LENGTH * cos(M_PI * ( 90 - (g->leg_angle + GAIT_STEP) / 2) / 180))) * sin(M_PI * g->body_dir / 180);
+		if (g->leg_angle < -GAIT_MAX) {
+			g->on_ground = 1;
+		}
+		break;
+	case 1:
+		g->leg_angle += GAIT_STEP;
+		g->body_x += ((LEG_LENGTH * cos(M_PI * (90 - g->leg_angle / 2) / 180) - (LEG_LENGTH * cos(M_PI * (90 - (g->leg_angle - GAIT_STEP) / 2) / 180)))) * cos(M_PI * g->body_dir / 180);
+		g->body_y += (LEG_LENGTH * sin(M_PI * (90 - g->leg_angle / 2) / 180) - (LEG_LENGTH * sin(M_PI * (90 - (g->leg_angle - GAIT_STEP) / 2) / 180)));
+		g->body_z -= ((LEG_LENGTH * cos(M_PI * (90 - g->leg_angle / 2) / 180) - (LEG_LENGTH * cos(M_PI * (90 - (g->leg_angle - GAIT_STEP) / 2) / 180)))) * sin(M_PI * g->body_dir / 180);
+		if (g->leg_angle > GAIT_MAX) {
+			g->on_ground = 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+// run(n) を BENCH_MIN_SECONDS 以上繰り返し，一件あたりの時間 [ns] を返す
+
+template <typename F>
+double MeasureNs(F run, const long long items_per_run)
+{
+	return MeasureSeconds(run) * 1e9 / items_per_run;
+}
+
+struct Row {
+	const char *name;
+	double ns;
+	double max_error;
+	double mean_error;
+};
+
+void PrintHeader(const char *title, const char *unit, const char *max_name,
+	const char *mean_name)
+{
+	printf("\n%s\n", title);
+	printf("  %-22s %12s %9s %14s %14s\n", "variant", unit, "speedup", max_name, mean_name);
+}
+
+void PrintRow(const Row &row, const double baseline_ns)
+{
+	printf("  %-22s %12.2f %8.2fx %14.3e %14.3e\n", row.name, 1e3 / row.ns,
+		baseline_ns / row.ns, row.max_error, row.mean_error);
+}
+
+
+
+// 順運動学とヤコビアン ///////////////////////////////////////////////////////
+
+// long double で求めた先端位置との差
+
+template <typename T, bool FAST>
+Row BenchForwardJacobian(const char *name)
+{
+	const T length[3] = {(T) ARM_LENGTH1, (T) ARM_LENGTH2, (T) ARM_LENGTH3};
+	const long double length_ref[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	std::vector<T> angle(NUM_POSES * 3);
+	for (int i = 0; i < NUM_POSES; i++) {
+		for (int k = 0; k < 3; k++) {
+			angle[i * 3 + k] = (T) pose_angle[k][i];
+		}
+	}
+
+	Row row;
+	row.name = name;
+	row.ns = MeasureNs([&] {
+		T sum = 0;
+		for (int i = 0; i < NUM_POSES; i++) {
+			T x, y, ja[2][3];
+			ArmForwardJacobian<T, FAST>(length, &angle[i * 3], &x, &y, ja);
+			sum += x + ja[0][1] + ja[1][2];
+		}
+		bench_sink = sum;
+	}, NUM_POSES);
+
+	row.max_error = 0;
+	row.mean_error = 0;
+	for (int i = 0; i < NUM_POSES; i++) {
+		T x, y, ja[2][3];
+		ArmForwardJacobian<T, FAST>(length, &angle[i * 3], &x, &y, ja);
+		long double ref_angle[3] = {pose_angle[0][i], pose_angle[1][i], pose_angle[2][i]};
+		long double rx, ry;
+		ArmForward<long double, false>(length_ref, ref_angle, &rx, &ry);
+		double e = (double) hypotl(x - rx, y - ry);
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+Row BenchLegacyForwardJacobian(void)
+{
+	std::vector<double> angle(NUM_POSES * 3);
+	for (int i = 0; i < NUM_POSES; i++) {
+		for (int k = 0; k < 3; k++) {
+			angle[i * 3 + k] = toDegree(pose_angle[k][i]);
+		}
+	}
+
+	Row row;
+	row.name = "legacy (deg, 12 trig)";
+	row.ns = MeasureNs([&] {
+		double sum = 0;
+		for (int i = 0; i < NUM_POSES; i++) {
+			double x, y, ja[2][3];
+			LegacyForwardJacobian(angle[i * 3], angle[i * 3 + 1], angle[i * 3 + 2], &x, &y, ja);
+			sum += x + ja[0][1] + ja[1][2];
+		}
+		bench_sink = sum;
+	}, NUM_POSES);
+
+	const long double length_ref[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	row.max_error = 0;
+	row.mean_error = 0;
+	for (int i = 0; i < NUM_POSES; i++) {
+		double x, y, ja[2][3];
+		LegacyForwardJacobian(angle[i * 3], angle[i * 3 + 1], angle[i * 3 + 2], &x, &y, ja);
+		long double ref_angle[3] = {pose_angle[0][i], pose_angle[1][i], pose_angle[2][i]};
+		long double rx, ry;
+		ArmForward<long double, false>(length_ref, ref_angle, &rx, &ry);
+		double e = (double) hypotl(x - rx, y - ry);
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+// ヤコビアンの求め方 /////////////////////////////////////////////////////////
+
+enum {
+	JACOBIAN_HAND,   // 手で導いた式
+	JACOBIAN_AUTO,   // 自動微分 (ArmForwardJacobian)
+	JACOBIAN_FINITE  // 中心差分
+};
+
+// 自動微分に置き換える前の ArmForwardJacobian()
+
+template <typename T, bool FAST>
+void HandForwardJacobian(const T length[3], const T angle[3],
+	T *end_x, T *end_y, T jacobian[2][3])
+{
+	T s1, c1, s12, c12, s123, c123;
+	SinCos<T, FAST>(angle[0], &s1, &c1);
+	SinCos<T, FAST>(angle[0] + angle[1], &s12, &c12);
+	SinCos<T, FAST>(angle[0] + angle[1] + angle[2], &s123, &c123);
+
+	const T x3 = length[2] * c123, y3 = length[2] * s123;
+	const T x23 = x3 + length[1] * c12, y23 = y3 + length[1] * s12;
+	const T x123 = x23 + length[0] * c1, y123 = y23 + length[0] * s1;
+
+	*end_x = x123;
+	*end_y = y123;
+	jacobian[0][0] = -y123;
+	jacobian[0][1] = -y23;
+	jacobian[0][2] = -y3;
+	jacobian[1][0] = x123;
+	jacobian[1][1] = x23;
+	jacobian[1][2] = x3;
+}
+
+// 関節ごとに前後へ h ずらして順運動学を二回ずつ呼ぶ．
+// 打ち切り誤差と丸め誤差が釣り合う h は機械イプシロンの 1/3 乗程度
+
+template <typename T, bool FAST>
+void FiniteDifferenceJacobian(const T length[3], const T angle[3],
+	T *end_x, T *end_y, T jacobian[2][3])
+{
+	const T h = std::cbrt(std::numeric_limits<T>::epsilon());
+	ArmForward<T, FAST>(length, angle, end_x, end_y);
+	for (int j = 0; j < 3; j++) {
+		T a[3] = {angle[0], angle[1], angle[2]};
+		T xp, yp, xm, ym;
+		a[j] = angle[j] + h;
+		ArmForward<T, FAST>(length, a, &xp, &yp);
+		a[j] = angle[j] - h;
+		ArmForward<T, FAST>(length, a, &xm, &ym);
+		jacobian[0][j] = (xp - xm) / (2 * h);
+		jacobian[1][j] = (yp - ym) / (2 * h);
+	}
+}
+
+template <typename T, bool FAST, int METHOD>
+void ComputeJacobian(const T length[3], const T angle[3], T *end_x, T *end_y,
+	T jacobian[2][3])
+{
+	if (METHOD == JACOBIAN_HAND) {
+		HandForwardJacobian<T, FAST>(length, angle, end_x, end_y, jacobian);
+	} else if (METHOD == JACOBIAN_AUTO) {
+		ArmForwardJacobian<T, FAST>(length, angle, end_x, end_y, jacobian);
+	} else {
+		FiniteDifferenceJacobian<T, FAST>(length, angle, end_x, end_y, jacobian);
+	}
+}
+
+// 誤差は long double で手で導いたヤコビアンとの，要素ごとの差の最大
+
+template <typename T, bool FAST, int METHOD>
+Row BenchJacobian(const char *name)
+{
+	const T length[3] = {(T) ARM_LENGTH1, (T) ARM_LENGTH2, (T) ARM_LENGTH3};
+	const long double length_ref[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	std::vector<T> angle(NUM_POSES * 3);
+	for (int i = 0; i < NUM_POSES; i++) {
+		for (int k = 0; k < 3; k++) {
+			angle[i * 3 + k] = (T) pose_angle[k][i];
+		}
+	}
+
+	Row row;
+	row.name = name;
+	row.ns = MeasureNs([&] {
+		T sum = 0;
+		for (int i = 0; i < NUM_POSES; i++) {
+			T x, y, ja[2][3];
+			ComputeJacobian<T, FAST, METHOD>(length, &angle[i * 3], &x, &y, ja);
+			sum += x + ja[0][1] + ja[1][2];
+		}
+		bench_sink = sum;
+	}, NUM_POSES);
+
+	row.max_error = 0;
+	row.mean_error = 0;
+	for (int i = 0; i < NUM_POSES; i++) {
+		T x, y, ja[2][3];
+		ComputeJacobian<T, FAST, METHOD>(length, &angle[i * 3], &x, &y, ja);
+		long double ref_angle[3] = {pose_angle[0][i], pose_angle[1][i], pose_angle[2][i]};
+		long double rx, ry, ref[2][3];
+		HandForwardJacobian<long double, false>(length_ref, ref_angle, &rx, &ry, ref);
+		double e = 0;
+		for (int r = 0; r < 2; r++) {
+			for (int c = 0; c < 3; c++) {
+				e = fmax(e, (double) fabsl(ja[r][c] - ref[r][c]));
+			}
+		}
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+// 配列にまとめた順運動学．誤差は一つずつのときと同じく先端位置で測る
+
+template <typename T, bool FAST>
+Row BenchForwardBatch(const char *name)
+{
+	const T length[3] = {(T) ARM_LENGTH1, (T) ARM_LENGTH2, (T) ARM_LENGTH3};
+	const long double length_ref[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	std::vector<T> a1(NUM_POSES), a2(NUM_POSES), a3(NUM_POSES), x(NUM_POSES), y(NUM_POSES);
+	for (int i = 0; i < NUM_POSES; i++) {
+		a1[i] = (T) pose_angle[0][i];
+		a2[i] = (T) pose_angle[1][i];
+		a3[i] = (T) pose_angle[2][i];
+	}
+
+	Row row;
+	row.name = name;
+	row.ns = MeasureNs([&] {
+		ArmForwardBatch<T, FAST>(NUM_POSES, length, &a1[0], &a2[0], &a3[0], &x[0], &y[0]);
+		bench_sink = x[NUM_POSES - 1];
+	}, NUM_POSES);
+
+	row.max_error = 0;
+	row.mean_error = 0;
+	ArmForwardBatch<T, FAST>(NUM_POSES, length, &a1[0], &a2[0], &a3[0], &x[0], &y[0]);
+	for (int i = 0; i < NUM_POSES; i++) {
+		long double ref_angle[3] = {pose_angle[0][i], pose_angle[1][i], pose_angle[2][i]};
+		long double rx, ry;
+		ArmForward<long double, false>(length_ref, ref_angle, &rx, &ry);
+		double e = (double) hypotl(x[i] - rx, y[i] - ry);
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+
+
+// 逆運動学 ///////////////////////////////////////////////////////////////////
+
+// IK_ITERATIONS 歩進めた後の先端位置を，long double で同じだけ進めたものと比べる
+
+template <typename T>
+void ArmEnd(const T angle[3], long double *x, long double *y)
+{
+	const long double length[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	long double a[3] = {angle[0], angle[1], angle[2]};
+	ArmForward<long double, false>(length, a, x, y);
+}
+
+std::vector<long double> ik_reference_x, ik_reference_y;
+
+void ComputeIkReference(void)
+{
+	const long double length[3] = {ARM_LENGTH1, ARM_LENGTH2, ARM_LENGTH3};
+	ik_reference_x.resize(NUM_POSES);
+	ik_reference_y.resize(NUM_POSES);
+	for (int i = 0; i < NUM_POSES; i++) {
+		long double angle[3] = {pose_angle[0][i], pose_angle[1][i], pose_angle[2][i]};
+		for (int n = 0; n < IK_ITERATIONS; n++) {
+			ArmIkStep<long double, false>(length, angle, pose_target_x[i],
+				pose_target_y[i], IK_MAX_STEP);
+		}
+		ArmEnd(angle, &ik_reference_x[i], &ik_reference_y[i]);
+	}
+}
+
+template <typename T, bool FAST>
+Row BenchIk(const char *name)
+{
+	const T length[3] = {(T) ARM_LENGTH1, (T) ARM_LENGTH2, (T) ARM_LENGTH3};
+	std::vector<T> angle(NUM_POSES * 3);
+
+	Row row;
+	row.name = name;
+	row.ns = MeasureNs([&] {
+		for (int i = 0; i < NUM_POSES; i++) {
+			for (int k = 0; k < 3; k++) {
+				angle[i * 3 + k] = (T) pose_angle[k][i];
+			}
+			ArmIkStep<T, FAST>(length, &angle[i * 3], (T) pose_target_x[i],
+				(T) pose_target_y[i], (T) IK_MAX_STEP);
+		}
+		bench_sink = angle[0];
+	}, NUM_POSES);
+
+	row.max_error = 0;
+	row.mean_error = 0;
+	for (int i = 0; i < NUM_POSES; i++) {
+		T a[3] = {(T) pose_angle[0][i], (T) pose_angle[1][i], (T) pose_angle[2][i]};
+		for (int n = 0; n < IK_ITERATIONS; n++) {
+			ArmIkStep<T, FAST>(length, a, (T) pose_target_x[i], (T) pose_target_y[i],
+				(T) IK_MAX_STEP);
+		}
+		long double x, y;
+		ArmEnd(a, &x, &y);
+		double e = (double) hypotl(x - ik_reference_x[i], y - ik_reference_y[i]);
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+Row BenchLegacyIk(void)
+{
+	std::vector<double> angle(NUM_POSES * 3);
+
+	Row row;
+	row.name = "legacy (deg, 12 trig)";
+	row.ns = MeasureNs([&] {
+		for (int i = 0; i < NUM_POSES; i++) {
+			for (int k = 0; k < 3; k++) {
+				angle[i * 3 + k] = toDegree(pose_angle[k][i]);
+			}
+			LegacyIkStep(&angle[i * 3], pose_target_x[i], pose_target_y[i]);
+		}
+		bench_sink = angle[0];
+	}, NUM_POSES);
+
+	row.max_error = 0;
+	row.mean_error = 0;
+	for (int i = 0; i < NUM_POSES; i++) {
+		double a[3] = {toDegree(pose_angle[0][i]), toDegree(pose_angle[1][i]),
+			toDegree(pose_angle[2][i])};
+		for (int n = 0; n < IK_ITERATIONS; n++) {
+			LegacyIkStep(a, pose_target_x[i], pose_target_y[i]);
+		}
+		double r[3] = {toRadian(a[0]), toRadian(a[1]), toRadian(a[2])};
+		long double x, y;
+		ArmEnd(r, &x, &y);
+		double e = (double) hypotl(x - ik_reference_x[i], y - ik_reference_y[i]);
+		row.max_error = e > row.max_error ? e : row.max_error;
+		row.mean_error += e / NUM_POSES;
+	}
+	return row;
+}
+
+
+
+// 歩行 ///////////////////////////////////////////////////////////////////////
+
+// GAIT_STEPS 歩あるいた後の胴の位置を，long double で歩いたものと比べる
+
+GaitState<long double> gait_reference;
+
+template <typename T>
+void InitGait(GaitState<T> *g)
+{
+	g->leg_angle = 0;
+	g->x = -30;
+	g->y = (T) LEG_LENGTH;
+	g->z = 0;
+	g->dir = (T) DegreeToRadian(30.0);
+	g->on_ground = 0;
+}
+
+void ComputeGaitReference(void)
+{
+	InitGait(&gait_reference);
+	for (int n = 0; n < GAIT_STEPS; n++) {
+		GaitStep<long double, false>(&gait_reference, LEG_LENGTH,
+			DegreeToRadian((long double) GAIT_STEP), DegreeToRadian((long double) GAIT_MAX));
+	}
+}
+
+template <typename T, bool FAST>
+Row BenchGait(const char *name)
+{
+	const T step = DegreeToRadian((T) GAIT_STEP);
+	const T max = DegreeToRadian((T) GAIT_MAX);
+	GaitState<T> g;
+
+	Row row;
+	row.name = name;
+	row.ns = MeasureNs([&] {
+		InitGait(&g);
+		for (int n = 0; n < GAIT_STEPS; n++) {
+			GaitStep<T, FAST>(&g, (T) LEG_LENGTH, step, max);
+		}
+		bench_sink = g.x;
+	}, GAIT_STEPS);
+
+	InitGait(&g);
+	for (int n = 0; n < GAIT_STEPS; n++) {
+		GaitStep<T, FAST>(&g, (T) LEG_LENGTH, step, max);
+	}
+	row.max_error = (double) sqrtl((g.x - gait_reference.x) * (g.x - gait_reference.x)
+		+ (g.y - gait_reference.y) * (g.y - gait_reference.y)
+		+ (g.z - gait_reference.z) * (g.z - gait_reference.z));
+	row.mean_error = row.max_error / GAIT_STEPS;
+	return row;
+}
+
+Row BenchLegacyGait(void)
+{
+	LegacyGait g;
+
+	Row row;
+	row.name = "legacy (deg)";
+	row.ns = MeasureNs([&] {
+		memset(&g, 0, sizeof(g));
+		g.body_x = -30;
+		g.body_y = LEG_LENGTH;
+		g.body_dir = 30;
+		for (int n = 0; n < GAIT_STEPS; n++) {
+			LegacyGaitStep(&g);
+		}
+		bench_sink = g.body_x;
+	}, GAIT_STEPS);
+
+	row.max_error = (double) sqrtl((g.body_x - gait_reference.x) * (g.body_x - gait_reference.x)
+		+ (g.body_y - gait_reference.y) * (g.body_y - gait_reference.y)
+		+ (g.body_z - gait_reference.z) * (g.body_z - gait_reference.z));
+	row.mean_error = row.max_error / GAIT_STEPS;
+	return row;
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(void)
+{
+	// 姿勢は全周から，目標は腕の届く円環から選ぶ
+
+	srand(1);
+	for (int k = 0; k < 3; k++) {
+		pose_angle[k].resize(NUM_POSES);
+	}
+	pose_target_x.resize(NUM_POSES);
+	pose_target_y.resize(NUM_POSES);
+	for (int i = 0; i < NUM_POSES; i++) {
+		for (int k = 0; k < 3; k++) {
+			pose_angle[k][i] = (rand() / (double) RAND_MAX * 2.0 - 1.0) * M_PI;
+		}
+		double r = 5.0 + rand() / (double) RAND_MAX * 22.0;
+		double t = rand() / (double) RAND_MAX * 2.0 * M_PI;
+		pose_target_x[i] = r * cos(t);
+		pose_target_y[i] = r * sin(t);
+	}
+	ComputeIkReference();
+	ComputeGaitReference();
+
+	printf("kinematics kernels: %d poses, errors against long double\n", NUM_POSES);
+
+	Row rows[5];
+
+	PrintHeader("forward kinematics + Jacobian", "Mevals/s", "max end err", "mean end err");
+	rows[0] = BenchLegacyForwardJacobian();
+	rows[1] = BenchForwardJacobian<double, false>("double libm");
+	rows[2] = BenchForwardJacobian<double, true>("double fast sincos");
+	rows[3] = BenchForwardJacobian<float, false>("float libm");
+	rows[4] = BenchForwardJacobian<float, true>("float fast sincos");
+	for (int i = 0; i < 5; i++) {
+		PrintRow(rows[i], rows[0].ns);
+	}
+
+	// 型と sin・cos の組ごとに，手で導いたものを基準にする
+
+	PrintHeader("Jacobian: hand-derived, automatic, central differences",
+		"Mevals/s", "max J err", "mean J err");
+	Row jacobian_rows[9];
+	jacobian_rows[0] = BenchJacobian<double, false, JACOBIAN_HAND>("hand double libm");
+	jacobian_rows[1] = BenchJacobian<double, false, JACOBIAN_AUTO>("AD   double libm");
+	jacobian_rows[2] = BenchJacobian<double, false, JACOBIAN_FINITE>("FD   double libm");
+	jacobian_rows[3] = BenchJacobian<double, true, JACOBIAN_HAND>("hand double fast");
+	jacobian_rows[4] = BenchJacobian<double, true, JACOBIAN_AUTO>("AD   double fast");
+	jacobian_rows[5] = BenchJacobian<double, true, JACOBIAN_FINITE>("FD   double fast");
+	jacobian_rows[6] = BenchJacobian<float, true, JACOBIAN_HAND>("hand float fast");
+	jacobian_rows[7] = BenchJacobian<float, true, JACOBIAN_AUTO>("AD   float fast");
+	jacobian_rows[8] = BenchJacobian<float, true, JACOBIAN_FINITE>("FD   float fast");
+	for (int i = 0; i < 9; i++) {
+		PrintRow(jacobian_rows[i], jacobian_rows[i / 3 * 3].ns);
+	}
+
+	PrintHeader("batched forward kinematics (speedup vs double libm)", "Mevals/s",
+		"max end err", "mean end err");
+	rows[1] = BenchForwardBatch<double, false>("double libm");
+	rows[2] = BenchForwardBatch<double, true>("double fast sincos");
+	rows[3] = BenchForwardBatch<float, false>("float libm");
+	rows[4] = BenchForwardBatch<float, true>("float fast sincos");
+	for (int i = 1; i < 5; i++) {
+		PrintRow(rows[i], rows[1].ns);
+	}
+
+	char title[128];
+	snprintf(title, sizeof(title), "IK step (error after %d steps)", IK_ITERATIONS);
+	PrintHeader(title, "Msteps/s", "max end err", "mean end err");
+	rows[0] = BenchLegacyIk();
+	rows[1] = BenchIk<double, false>("double libm");
+	rows[2] = BenchIk<double, true>("double fast sincos");
+	rows[3] = BenchIk<float, false>("float libm");
+	rows[4] = BenchIk<float, true>("float fast sincos");
+	for (int i = 0; i < 5; i++) {
+		PrintRow(rows[i], rows[0].ns);
+	}
+
+	snprintf(title, sizeof(title), "gait step (body drift after %d steps)", GAIT_STEPS);
+	PrintHeader(title, "Msteps/s", "drift", "per step");
+	rows[0] = BenchLegacyGait();
+	rows[1] = BenchGait<double, false>("double libm");
+	rows[2] = BenchGait<double, true>("double fast sincos");
+	rows[3] = BenchGait<float, false>("float libm");
+	rows[4] = BenchGait<float, true>("float fast sincos");
+	for (int i = 0; i < 5; i++) {
+		PrintRow(rows[i], rows[0].ns);
+	}
+
+	return 0;
+}
@@ -0,0 +1,486 @@
+// mesh.h
+//
+// 描画に使うメッシュとその詳細度 (LOD)
+//
+// 球とティーポットはあらかじめ何段階かの細かさで三角形分割しておき，
+// 画面上の大きさに応じて使い分ける．どのメッシュも単位サイズで，
+// 実際の大きさはモデルビュー行列で与える．
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <GL/glut.h>
+
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979
+#endif
+
+
+
+// メッシュ ///////////////////////////////////////////////////////////////////
+
+enum MeshId {
+	MESH_CUBE,     // 一辺 1 の立方体 (原点中心)
+	MESH_SPHERE,   // 半径 1 の球
+	MESH_TEAPOT,   // glutSolidTeapot(1.0) と同じ大きさのティーポット
+	MESH_QUAD,     // xz 平面上の [0,1]x[0,1] の四角形 (上向き)
+	NUM_MESHES
+};
+
+const int MAX_LOD_LEVELS = 4;
+
+// 三角形メッシュ．頂点と法線は xyz の並び
+
+struct Mesh {
+	int num_vertices;
+	int num_indices;
+	GLfloat *vertices;
+	GLfloat *normals;
+	GLuint *indices;
+};
+
+// 詳細度ごとのメッシュと境界球
+
+struct MeshLod {
+	int num_levels;
+	Mesh levels[MAX_LOD_LEVELS];
+	GLfloat min_pixels[MAX_LOD_LEVELS]; // この段を使う最小の投影半径 [pixel]
+	GLfloat center[3];
+	GLfloat radius;
+};
+
+static MeshLod meshes[NUM_MESHES];
+
+inline void AllocMesh(Mesh *mesh, const int num_vertices, const int num_indices)
+{
+	mesh->num_vertices = num_vertices;
+	mesh->num_indices = num_indices;
+	mesh->vertices = new GLfloat[num_vertices * 3];
+	mesh->normals = new GLfloat[num_vertices * 3];
+	mesh->indices = new GLuint[num_indices];
+}
+
+inline void SetVertex(Mesh *mesh, const int i,
+	const double x, const double y, const double z,
+	const double nx, const double ny, const double nz)
+{
+	mesh->vertices[i * 3 + 0] = x;
+	mesh->vertices[i * 3 + 1] = y;
+	mesh->vertices[i * 3 + 2] = z;
+	mesh->normals[i * 3 + 0] = nx;
+	mesh->normals[i * 3 + 1] = ny;
+	mesh->normals[i * 3 + 2] = nz;
+}
+
+
+
+// 基本形状 ///////////////////////////////////////////////////////////////////
+
+// 球 (slices: 経度方向の分割数, stacks: 緯度方向の分割数)
+
+inline void BuildSphere(Mesh *mesh, const int slices, const int stacks)
+{
+	AllocMesh(mesh, (slices + 1) * (stacks + 1), slices * stacks * 6);
+
+	for (int i = 0; i <= stacks; i++) {
+		double phi = M_PI * i / stacks;
+		for (int j = 0; j <= slices; j++) {
+			double theta = 2.0 * M_PI * j / slices;
+			double x = sin(phi) * cos(theta);
+			double y = cos(phi);
+			double z = -sin(phi) * sin(theta);
+			SetVertex(mesh, i * (slices + 1) + j, x, y, z, x, y, z);
+		}
+	}
+
+	int n = 0;
+	for (int i = 0; i < stacks; i++) {
+		for (int j = 0; j < slices; j++) {
+			GLuint a = i * (slices + 1) + j;
+			GLuint b = a + slices + 1;
+			mesh->indices[n++] = a;
+			mesh->indices[n++] = b;
+			mesh->indices[n++] = b + 1;
+			mesh->indices[n++] = a;
+			mesh->indices[n++] = b + 1;
+			mesh->indices[n++] = a + 1;
+		}
+	}
+}
+
+// 立方体
+
+inline void BuildCube(Mesh *mesh)
+{
+	static const GLfloat normals[6][3] = {
+		{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}
+	};
+
+	AllocMesh(mesh, 24, 36);
+
+	for (int f = 0; f < 6; f++) {
+		// 面の法線 n と，面内の二軸 u, v (u x v = n)
+
+		const GLfloat *n = normals[f];
+		GLfloat u[3] = {n[1], n[2], n[0]};
+		GLfloat v[3] = {n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2],
+			n[0] * u[1] - n[1] * u[0]};
+		for (int k = 0; k < 4; k++) {
+			double su = (k == 1 || k == 2) ? 0.5 : -0.5;
+			double sv = (k >= 2) ? 0.5 : -0.5;
+			SetVertex(mesh, f * 4 + k,
+				n[0] * 0.5 + u[0] * su + v[0] * sv,
+				n[1] * 0.5 + u[1] * su + v[1] * sv,
+				n[2] * 0.5 + u[2] * su + v[2] * sv,
+				n[0], n[1], n[2]);
+		}
+		GLuint *idx = mesh->indices + f * 6;
+		idx[0] = f * 4 + 0;
+		idx[1] = f * 4 + 1;
+		idx[2] = f * 4 + 2;
+		idx[3] = f * 4 + 0;
+		idx[4] = f * 4 + 2;
+		idx[5] = f * 4 + 3;
+	}
+}
+
+// 地面の一枡
+
+inline void BuildQuad(Mesh *mesh)
+{
+	AllocMesh(mesh, 4, 6);
+
+	SetVertex(mesh, 0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+	SetVertex(mesh, 1, 0.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+	SetVertex(mesh, 2, 1.0, 0.0, 1.0, 0.0, 1.0, 0.0);
+	SetVertex(mesh, 3, 1.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+
+	GLuint idx[] = {0, 1, 2, 0, 2, 3};
+	for (int i = 0; i < 6; i++) {
+		mesh->indices[i] = idx[i];
+	}
+}
+
+
+
+// ティーポット ///////////////////////////////////////////////////////////////
+
+// Newell のティーポット (パブリックドメイン) の制御点．
+// GLUT と同じく，y <= 0 かつ x >= 0 の部分だけを持ち，残りは鏡映で作る．
+// 0〜5 番のパッチ (縁・胴・蓋・底) は四つ，6〜9 番 (取っ手・注ぎ口) は二つ．
+// GLUT は蓋のつまみの頂点を (0, -0.002), (0.002, 0) とわずかにずらしているが，
+// 並びが逆回りで面が折り返すので，ここでは一点に縮退させて法線は別に求める
+
+static const float teapot_control_points[][3] = {
+	{1.4, 0.0, 2.4}, {1.4, -0.784, 2.4}, {0.784, -1.4, 2.4},
+	{0.0, -1.4, 2.4}, {1.3375, 0.0, 2.53125}, {1.3375, -0.749, 2.53125},
+	{0.749, -1.3375, 2.53125}, {0.0, -1.3375, 2.53125},
+	{1.4375, 0.0, 2.53125}, {1.4375, -0.805, 2.53125},
+	{0.805, -1.4375, 2.53125}, {0.0, -1.4375, 2.53125}, {1.5, 0.0, 2.4},
+	{1.5, -0.84, 2.4}, {0.84, -1.5, 2.4}, {0.0, -1.5, 2.4},
+	{1.75, 0.0, 1.875}, {1.75, -0.98, 1.875}, {0.98, -1.75, 1.875},
+	{0.0, -1.75, 1.875}, {2.0, 0.0, 1.35}, {2.0, -1.12, 1.35},
+	{1.12, -2.0, 1.35}, {0.0, -2.0, 1.35}, {2.0, 0.0, 0.9},
+	{2.0, -1.12, 0.9}, {1.12, -2.0, 0.9}, {0.0, -2.0, 0.9},
+	{2.0, 0.0, 0.45}, {2.0, -1.12, 0.45}, {1.12, -2.0, 0.45},
+	{0.0, -2.0, 0.45}, {1.5, 0.0, 0.225}, {1.5, -0.84, 0.225},
+	{0.84, -1.5, 0.225}, {0.0, -1.5, 0.225}, {1.5, 0.0, 0.15},
+	{1.5, -0.84, 0.15}, {0.84, -1.5, 0.15}, {0.0, -1.5, 0.15},
+	{0.0, 0.0, 3.15}, {0.0, 0.0, 3.15}, {0.0, 0.0, 3.15},
+	{0.8, 0.0, 3.15}, {0.8, -0.45, 3.15}, {0.45, -0.8, 3.15},
+	{0.0, -0.8, 3.15}, {0.0, 0.0, 2.85}, {0.2, 0.0, 2.7},
+	{0.2, -0.112, 2.7}, {0.112, -0.2, 2.7}, {0.0, -0.2, 2.7},
+	{0.4, 0.0, 2.55}, {0.4, -0.224, 2.55}, {0.224, -0.4, 2.55},
+	{0.0, -0.4, 2.55}, {1.3, 0.0, 2.55}, {1.3, -0.728, 2.55},
+	{0.728, -1.3, 2.55}, {0.0, -1.3, 2.55}, {1.3, 0.0, 2.4},
+	{1.3, -0.728, 2.4}, {0.728, -1.3, 2.4}, {0.0, -1.3, 2.4},
+	{0.0, 0.0, 0.0}, {0.0, -1.425, 0.0}, {0.798, -1.425, 0.0},
+	{1.425, -0.798, 0.0}, {1.425, 0.0, 0.0}, {0.0, -1.5, 0.075},
+	{0.84, -1.5, 0.075}, {1.5, -0.84, 0.075}, {1.5, 0.0, 0.075},
+	{-1.6, 0.0, 2.025}, {-1.6, -0.3, 2.025}, {-1.5, -0.3, 2.25},
+	{-1.5, 0.0, 2.25}, {-2.3, 0.0, 2.025}, {-2.3, -0.3, 2.025},
+	{-2.5, -0.3, 2.25}, {-2.5, 0.0, 2.25}, {-2.7, 0.0, 2.025},
+	{-2.7, -0.3, 2.025}, {-3.0, -0.3, 2.25}, {-3.0, 0.0, 2.25},
+	{-2.7, 0.0, 1.8}, {-2.7, -0.3, 1.8}, {-3.0, -0.3, 1.8},
+	{-3.0, 0.0, 1.8}, {-2.7, 0.0, 1.575}, {-2.7, -0.3, 1.575},
+	{-3.0, -0.3, 1.35}, {-3.0, 0.0, 1.35}, {-2.5, 0.0, 1.125},
+	{-2.5, -0.3, 1.125}, {-2.65, -0.3, 0.9375}, {-2.65, 0.0, 0.9375},
+	{-2.0, 0.0, 0.9}, {-2.0, -0.3, 0.9}, {-1.9, -0.3, 0.6},
+	{-1.9, 0.0, 0.6}, {1.7, 0.0, 1.425}, {1.7, -0.66, 1.425},
+	{1.7, -0.66, 0.6}, {1.7, 0.0, 0.6}, {2.6, 0.0, 1.425},
+	{2.6, -0.66, 1.425}, {3.1, -0.66, 0.825}, {3.1, 0.0, 0.825},
+	{2.3, 0.0, 2.1}, {2.3, -0.25, 2.1}, {2.4, -0.25, 2.025},
+	{2.4, 0.0, 2.025}, {2.7, 0.0, 2.4}, {2.7, -0.25, 2.4},
+	{3.3, -0.25, 2.4}, {3.3, 0.0, 2.4}, {2.8, 0.0, 2.475},
+	{2.8, -0.25, 2.475}, {3.525, -0.25, 2.49375}, {3.525, 0.0, 2.49375},
+	{2.9, 0.0, 2.475}, {2.9, -0.15, 2.475}, {3.45, -0.15, 2.5125},
+	{3.45, 0.0, 2.5125}, {2.8, 0.0, 2.4}, {2.8, -0.15, 2.4},
+	{3.2, -0.15, 2.4}, {3.2, 0.0, 2.4}
+};
+
+static const int teapot_patches[][16] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27},
+	{24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39},
+	{40, 41, 42, 40, 43, 44, 45, 46, 47, 47, 47, 47, 48, 49, 50, 51},
+	{48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63},
+	{64, 64, 64, 64, 65, 66, 67, 68, 69, 70, 71, 72, 39, 38, 37, 36},
+	{73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88},
+	{85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95, 96, 97, 98, 99, 100},
+	{101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116},
+	{113, 114, 115, 116, 117, 118, 119, 120, 121, 122, 123, 124, 125, 126, 127, 128}
+};
+
+// 3次ベルンシュタイン基底とその微分
+
+inline void Bernstein3(const double t, double b[4], double db[4])
+{
+	double s = 1.0 - t;
+	b[0] = s * s * s;
+	b[1] = 3.0 * t * s * s;
+	b[2] = 3.0 * t * t * s;
+	b[3] = t * t * t;
+	db[0] = -3.0 * s * s;
+	db[1] = 3.0 * s * s - 6.0 * t * s;
+	db[2] = 6.0 * t * s - 3.0 * t * t;
+	db[3] = 3.0 * t * t;
+}
+
+// パッチ上の点と (正規化していない) 法線を求める
+
+inline void EvalTeapotPatch(const int patch, const double u, const double v,
+	double p[3], double n[3])
+{
+	double bu[4], dbu[4], bv[4], dbv[4];
+	Bernstein3(u, bu, dbu);
+	Bernstein3(v, bv, dbv);
+
+	double du[3] = {0.0, 0.0, 0.0};
+	double dv[3] = {0.0, 0.0, 0.0};
+	for (int k = 0; k < 3; k++) {
+		p[k] = 0.0;
+	}
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			const float *c = teapot_control_points[teapot_patches[patch][i * 4 + j]];
+			for (int k = 0; k < 3; k++) {
+				p[k] += bu[i] * bv[j] * c[k];
+				du[k] += dbu[i] * bv[j] * c[k];
+				dv[k] += bu[i] * dbv[j] * c[k];
+			}
+		}
+	}
+	n[0] = du[1] * dv[2] - du[2] * dv[1];
+	n[1] = du[2] * dv[0] - du[0] * dv[2];
+	n[2] = du[0] * dv[1] - du[1] * dv[0];
+}
+
+// 縮退した辺 (蓋の頂点や底の中心) では法線が 0 になるので，内側へ少しずらして求める
+
+inline void EvalTeapotNormal(const int patch, const double u, const double v,
+	double p[3], double n[3])
+{
+	EvalTeapotPatch(patch, u, v, p, n);
+	if (n[0] * n[0] + n[1] * n[1] + n[2] * n[2] < 1e-12) {
+		double q[3];
+		EvalTeapotPatch(patch, u + (u < 0.5 ? 1e-3 : -1e-3),
+			v + (v < 0.5 ? 1e-3 : -1e-3), q, n);
+	}
+	double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	for (int k = 0; k < 3; k++) {
+		n[k] /= len;
+	}
+}
+
+// パッチの法線が外を向いていれば 1，内を向いていれば -1
+
+inline int TeapotPatchOrientation(const int patch)
+{
+	double p[3], n[3];
+
+	if (patch < 6) {
+		// 縁・胴・蓋・底: ポットの中心から離れる向きが外
+
+		EvalTeapotNormal(patch, 0.5, 0.5, p, n);
+		double d = p[0] * n[0] + p[1] * n[1] + (p[2] - 1.5) * n[2];
+		return d > 0.0 ? 1 : -1;
+	}
+
+	// 取っ手・注ぎ口: 管の最も -y 側の点では -y 向きが外
+
+	double best_y = 0.0, best_ny = 0.0;
+	for (int i = 1; i < 8; i++) {
+		for (int j = 1; j < 8; j++) {
+			EvalTeapotNormal(patch, i / 8.0, j / 8.0, p, n);
+			if (p[1] < best_y) {
+				best_y = p[1];
+				best_ny = n[1];
+			}
+		}
+	}
+	return best_ny < 0.0 ? 1 : -1;
+}
+
+// パッチ一枚を grid x grid に分割する．GLUT と同じく z 軸を上から y 軸上へ
+// 回して 0.5 倍し，(sx, sy) で鏡映した写しを作る
+
+const int NUM_TEAPOT_PATCHES = 10;
+const int NUM_TEAPOT_COPIES = 6 * 4 + 4 * 2;
+
+inline void BuildTeapot(Mesh *mesh, const int grid)
+{
+	const int verts_per_patch = (grid + 1) * (grid + 1);
+	const int indices_per_patch = grid * grid * 6;
+
+	AllocMesh(mesh, verts_per_patch * NUM_TEAPOT_COPIES,
+		indices_per_patch * NUM_TEAPOT_COPIES);
+
+	int copy = 0;
+	for (int patch = 0; patch < NUM_TEAPOT_PATCHES; patch++) {
+		int orientation = TeapotPatchOrientation(patch);
+		int num_copies = patch < 6 ? 4 : 2;
+
+		for (int c = 0; c < num_copies; c++, copy++) {
+			double sx = (c & 2) ? -1.0 : 1.0;
+			double sy = (c & 1) ? -1.0 : 1.0;
+			int base = copy * verts_per_patch;
+
+			for (int i = 0; i <= grid; i++) {
+				for (int j = 0; j <= grid; j++) {
+					double p[3], n[3];
+					EvalTeapotNormal(patch, i / (double) grid, j / (double) grid, p, n);
+					SetVertex(mesh, base + i * (grid + 1) + j,
+						0.5 * sx * p[0], 0.5 * (p[2] - 1.5), -0.5 * sy * p[1],
+						orientation * sx * n[0], orientation * n[2],
+						-orientation * sy * n[1]);
+				}
+			}
+
+			// 鏡映すると三角形の向きが反転するので，並びも逆にする
+
+			int flip = (orientation * sx * sy < 0.0);
+			GLuint *idx = mesh->indices + copy * indices_per_patch;
+			for (int i = 0; i < grid; i++) {
+				for (int j = 0; j < grid; j++) {
+					GLuint a = base + i * (grid + 1) + j;
+					GLuint b = a + grid + 1;
+					GLuint tri[6] = {a, b, b + 1, a, b + 1, a + 1};
+					for (int k = 0; k < 6; k += 3) {
+						*idx++ = tri[k];
+						*idx++ = tri[k + (flip ? 2 : 1)];
+						*idx++ = tri[k + (flip ? 1 : 2)];
+					}
+				}
+			}
+		}
+	}
+
+}
+
+
+
+// 初期化と描画 ///////////////////////////////////////////////////////////////
+
+// 頂点から境界球を求める
+
+inline void ComputeMeshBounds(MeshLod *lod)
+{
+	const Mesh &mesh = lod->levels[0];
+	GLfloat lo[3], hi[3];
+	for (int k = 0; k < 3; k++) {
+		lo[k] = hi[k] = mesh.vertices[k];
+	}
+	for (int i = 1; i < mesh.num_vertices; i++) {
+		for (int k = 0; k < 3; k++) {
+			lo[k] = fmin(lo[k], mesh.vertices[i * 3 + k]);
+			hi[k] = fmax(hi[k], mesh.vertices[i * 3 + k]);
+		}
+	}
+	for (int k = 0; k < 3; k++) {
+		lod->center[k] = (lo[k] + hi[k]) / 2;
+	}
+	lod->radius = 0.0;
+	for (int i = 0; i < mesh.num_vertices; i++) {
+		const GLfloat *v = mesh.vertices + i * 3;
+		GLfloat dx = v[0] - lod->center[0];
+		GLfloat dy = v[1] - lod->center[1];
+		GLfloat dz = v[2] - lod->center[2];
+		lod->radius = fmax(lod->radius, sqrt(dx * dx + dy * dy + dz * dz));
+	}
+}
+
+// すべてのメッシュを作る．起動時に一度だけ呼ぶ
+
+inline void InitMeshes(void)
+{
+	// 球: もとの (16, 8) を二段目とし，近いときはより細かく，遠いときは粗くする
+
+	static const int sphere_slices[] = {32, 16, 10, 6};
+	static const int sphere_stacks[] = {16, 8, 5, 3};
+	static const GLfloat sphere_pixels[] = {48.0, 16.0, 6.0, 0.0};
+
+	MeshLod &sphere = meshes[MESH_SPHERE];
+	sphere.num_levels = 4;
+	for (int i = 0; i < sphere.num_levels; i++) {
+		BuildSphere(&sphere.levels[i], sphere_slices[i], sphere_stacks[i]);
+		sphere.min_pixels[i] = sphere_pixels[i];
+	}
+
+	// ティーポット: パッチ一枚あたりの分割数
+
+	static const int teapot_grids[] = {10, 6, 3, 2};
+	static const GLfloat teapot_pixels[] = {80.0, 30.0, 10.0, 0.0};
+
+	MeshLod &teapot = meshes[MESH_TEAPOT];
+	teapot.num_levels = 4;
+	for (int i = 0; i < teapot.num_levels; i++) {
+		BuildTeapot(&teapot.levels[i], teapot_grids[i]);
+		teapot.min_pixels[i] = teapot_pixels[i];
+	}
+
+	// 立方体と四角形は一段だけ
+
+	meshes[MESH_CUBE].num_levels = 1;
+	meshes[MESH_CUBE].min_pixels[0] = 0.0;
+	BuildCube(&meshes[MESH_CUBE].levels[0]);
+
+	meshes[MESH_QUAD].num_levels = 1;
+	meshes[MESH_QUAD].min_pixels[0] = 0.0;
+	BuildQuad(&meshes[MESH_QUAD].levels[0]);
+
+	for (int i = 0; i < NUM_MESHES; i++) {
+		ComputeMeshBounds(&meshes[i]);
+	}
+}
+
+// 画面上の半径 [pixel] から使う段を選ぶ
+
+inline int SelectLod(const int mesh, const GLfloat pixels)
+{
+	const MeshLod &lod = meshes[mesh];
+	for (int i = 0; i < lod.num_levels - 1; i++) {
+		if (pixels >= lod.min_pixels[i]) {
+			return i;
+		}
+	}
+	return lod.num_levels - 1;
+}
+
+// 頂点配列を設定する．メッシュが変わったときだけ呼べばよい
+
+inline void BindMesh(const int mesh, const int level)
+{
+	const Mesh &m = meshes[mesh].levels[level];
+	glVertexPointer(3, GL_FLOAT, 0, m.vertices);
+	glNormalPointer(GL_FLOAT, 0, m.normals);
+}
+
+inline void DrawBoundMesh(const int mesh, const int level)
+{
+	const Mesh &m = meshes[mesh].levels[level];
+	glDrawElements(GL_TRIANGLES, m.num_indices, GL_UNSIGNED_INT, m.indices);
+}
+
+#endif // MESH_H
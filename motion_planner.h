@@ -0,0 +1,771 @@
+// motion_planner.h
+//
+// 関節空間で障害物を避ける経路を求める RRT-Connect と，その経路を
+// アームが辿る軌道に直す処理
+//
+// 始めの姿勢と，目標の位置へ逆運動学で届く姿勢の両方から木を伸ばし，
+// 二つがつながったらそれを経路とする．木の近傍探索には k-d 木を使う．
+// 枝が障害物に当たらないかは，枝を細かく刻んだ姿勢をまとめて順運動学に
+// 通し，collision.h のカプセルの距離を 4 本ずつ求めて確かめる．
+//
+// スレッドごとに別の乱数で木を育て，最初につながったものを採る．その後
+// 近道 (途中の点を飛ばしても当たらなければ飛ばす) と角の面取りで経路を
+// 滑らかにし，一刻みごとの関節角の列にする．
+// スレッド数は PLANNER_THREADS 環境変数，なければコア数．
+
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include "collision.h"
+#include "random.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+
+
+// 設定 ///////////////////////////////////////////////////////////////////////
+
+struct PlannerArm {
+	float length[ARM_LINKS];
+	float base_x, base_y, base_z;
+	float radius;
+	float lower[ARM_LINKS]; // 関節角の範囲 [rad]
+	float upper[ARM_LINKS];
+};
+
+// 根元のリンクは地面より上，ほかの関節はリンクが重なる手前まで
+
+inline void InitPlannerArm(PlannerArm *arm, const float length[ARM_LINKS],
+	const float radius)
+{
+	for (int i = 0; i < ARM_LINKS; i++) {
+		arm->length[i] = length[i];
+		arm->lower[i] = -(float) KINEMATICS_PI + 0.3f;
+		arm->upper[i] = (float) KINEMATICS_PI - 0.3f;
+	}
+	arm->lower[0] = 0.0f;
+	arm->upper[0] = (float) KINEMATICS_PI;
+	arm->base_x = 0.0f;
+	arm->base_y = 0.0f;
+	arm->base_z = 0.0f;
+	arm->radius = radius;
+}
+
+struct PlannerSettings {
+	int threads;             // 0 なら全スレッド
+	float step;              // 木を一度に伸ばす長さ [rad]
+	int max_samples;         // スレッドあたりの標本数の上限
+	double time_limit;       // [s]
+	int goal_poses;          // 目標の位置に届く姿勢をいくつ木の根にするか
+	float goal_tolerance;    // 目標に届いたとみなす距離
+	int shortcut_iterations;
+	int corner_passes;       // 角の面取りの回数
+	float max_velocity;      // 軌道の関節角速度の上限 [rad/刻み]
+	float max_acceleration;  // [rad/刻み^2]
+};
+
+inline void InitPlannerSettings(PlannerSettings *settings)
+{
+	settings->threads = 0;
+	settings->step = 0.3f;
+	settings->max_samples = 20000;
+	settings->time_limit = 0.5;
+	settings->goal_poses = 4;
+	settings->goal_tolerance = 0.05f;
+	settings->shortcut_iterations = 100;
+	settings->corner_passes = 3;
+	settings->max_velocity = 0.03f;
+	settings->max_acceleration = 0.002f;
+}
+
+// 一刻みごとの関節角．ARM_LINKS 個ずつ並べる
+
+struct ArmTrajectory {
+	std::vector<float> angle;
+	int num_points;
+};
+
+struct PlannerStats {
+	int solved;
+	double seconds;
+	long long samples;      // 全スレッドの合計
+	long long nodes;
+	long long poses;        // 当たり判定をした姿勢の数
+	float raw_length;       // 関節空間での経路長 [rad]
+	float smooth_length;
+	int waypoints;          // 滑らかにする前の経路の点の数
+	int trajectory_points;
+};
+
+
+
+// 姿勢の当たり判定 ///////////////////////////////////////////////////////////
+
+// 姿勢の並びからリンクごとのカプセルの並びを作って判定する．その作業場所
+
+struct PoseCheckBuffer {
+	CapsuleBatch link[ARM_LINKS];
+	std::vector<float> distance, s, t;
+	std::vector<float> poses;
+};
+
+inline int AnyNegative(const float *x, const int n)
+{
+	float smallest = 0.0f;
+	for (int i = 0; i < n; i++) {
+		smallest = x[i] < smallest ? x[i] : smallest;
+	}
+	return smallest < 0.0f;
+}
+
+// n 個の姿勢 angle[ARM_LINKS * i + j] がどれも障害物に当たらなければ 1．
+// リンクの半径は inflate だけ太らせて比べる．順運動学は分岐の無い
+// FastSinCos で求めるのでベクトル化できる．
+// 当たり方は ArmIkStepAvoiding と同じく，根元のリンクと地面は比べない
+
+inline int ArmPosesFree(const PlannerArm &arm, const CollisionScene &scene,
+	const float *angle, const int n, const float inflate, PoseCheckBuffer *buffer)
+{
+	if (buffer->link[0].n != n) {
+		for (int j = 0; j < ARM_LINKS; j++) {
+			ResizeCapsuleBatch(&buffer->link[j], n);
+		}
+		int padded = (int) buffer->link[0].r.size();
+		buffer->distance.resize(padded);
+		buffer->s.resize(padded);
+		buffer->t.resize(padded);
+	}
+
+	float *ax[ARM_LINKS], *ay[ARM_LINKS], *az[ARM_LINKS];
+	float *bx[ARM_LINKS], *by[ARM_LINKS], *bz[ARM_LINKS], *r[ARM_LINKS];
+	for (int j = 0; j < ARM_LINKS; j++) {
+		CapsuleBatch &c = buffer->link[j];
+		ax[j] = &c.ax[0];
+		ay[j] = &c.ay[0];
+		az[j] = &c.az[0];
+		bx[j] = &c.bx[0];
+		by[j] = &c.by[0];
+		bz[j] = &c.bz[0];
+		r[j] = &c.r[0];
+	}
+	const float radius = arm.radius + inflate;
+	for (int i = 0; i < n; i++) {
+		const float *a = angle + ARM_LINKS * i;
+		float s1, c1, s12, c12, s123, c123;
+		FastSinCos(a[0], &s1, &c1);
+		FastSinCos(a[0] + a[1], &s12, &c12);
+		FastSinCos(a[0] + a[1] + a[2], &s123, &c123);
+		const float x1 = arm.base_x + arm.length[0] * c1, y1 = arm.base_y + arm.length[0] * s1;
+		const float x2 = x1 + arm.length[1] * c12, y2 = y1 + arm.length[1] * s12;
+		const float x3 = x2 + arm.length[2] * c123, y3 = y2 + arm.length[2] * s123;
+		ax[0][i] = arm.base_x;
+		ay[0][i] = arm.base_y;
+		bx[0][i] = ax[1][i] = x1;
+		by[0][i] = ay[1][i] = y1;
+		bx[1][i] = ax[2][i] = x2;
+		by[1][i] = ay[2][i] = y2;
+		bx[2][i] = x3;
+		by[2][i] = y3;
+		for (int j = 0; j < ARM_LINKS; j++) {
+			az[j][i] = arm.base_z;
+			bz[j][i] = arm.base_z;
+			r[j][i] = radius;
+		}
+	}
+
+	float *distance = &buffer->distance[0];
+	for (int k = 0; k < scene.num_spheres; k++) {
+		for (int j = 0; j < ARM_LINKS; j++) {
+			CapsuleSphereDistances(buffer->link[j], scene.spheres[k], distance, &buffer->t[0]);
+			if (AnyNegative(distance, n)) {
+				return 0;
+			}
+		}
+	}
+	for (int k = 0; k < scene.num_planes; k++) {
+		for (int j = 1; j < ARM_LINKS; j++) {
+			CapsulePlaneDistances(buffer->link[j], scene.planes[k], distance, &buffer->t[0]);
+			if (AnyNegative(distance, n)) {
+				return 0;
+			}
+		}
+	}
+	CapsuleCapsuleDistances(buffer->link[0], buffer->link[ARM_LINKS - 1], distance,
+		&buffer->s[0], &buffer->t[0]);
+	return !AnyNegative(distance, n);
+}
+
+// 枝の当たり判定でリンクを太らせる最大の量 (半径に対する比)
+
+const float PLANNER_INFLATE = 0.25f;
+
+// 姿勢 a から b へ関節角を直線的に動かしたときに当たらなければ 1 (a は判定済み
+// とする)．リンク上のどの点も一刻みで半径の半分より多くは動かないように刻み，
+// 刻みの間の姿勢も漏らさないよう，動く距離の半分だけリンクを太らせて比べる．
+// そのため障害物まで半径の PLANNER_INFLATE 倍も無い姿勢からは動き出せないことがある
+
+inline int ArmEdgeFree(const PlannerArm &arm, const CollisionScene &scene,
+	const float a[ARM_LINKS], const float b[ARM_LINKS], PoseCheckBuffer *buffer,
+	long long *poses)
+{
+	// 関節 j から先の長さを掛けた角度の変化の和が，点の動く距離の上限
+
+	float travel = 0.0f, reach = 0.0f;
+	for (int j = ARM_LINKS - 1; j >= 0; j--) {
+		reach += arm.length[j];
+		travel += fabsf(b[j] - a[j]) * reach;
+	}
+	int n = (int) ceilf(travel / (2.0f * PLANNER_INFLATE * arm.radius));
+	if (n < 1) {
+		n = 1;
+	}
+
+	buffer->poses.resize(n * ARM_LINKS);
+	for (int i = 0; i < n; i++) {
+		float u = (float) (i + 1) / n;
+		for (int j = 0; j < ARM_LINKS; j++) {
+			buffer->poses[ARM_LINKS * i + j] = a[j] + u * (b[j] - a[j]);
+		}
+	}
+	*poses += n;
+	return ArmPosesFree(arm, scene, &buffer->poses[0], n, 0.5f * travel / n, buffer);
+}
+
+
+
+// 木と k-d 木 ////////////////////////////////////////////////////////////////
+
+// 探索木の節点．k-d 木の節点を兼ね，挿入の順に並べる (0 番が k-d 木の根)
+
+struct PlannerNode {
+	float q[ARM_LINKS];
+	int parent;   // 探索木の親．根なら -1
+	int child[2]; // k-d 木の子．無ければ -1
+};
+
+struct PlannerTree {
+	std::vector<PlannerNode> nodes;
+};
+
+inline float JointDistance2(const float *a, const float *b)
+{
+	float d2 = 0.0f;
+	for (int j = 0; j < ARM_LINKS; j++) {
+		d2 += (a[j] - b[j]) * (a[j] - b[j]);
+	}
+	return d2;
+}
+
+// 深さで分割の軸を巡らせて葉に足す．標本は一様な乱数なので，
+// 釣り合いを取り直さなくても深さはほぼ log n に収まる
+
+inline int AddPlannerNode(PlannerTree *tree, const float q[ARM_LINKS], const int parent)
+{
+	int index = (int) tree->nodes.size();
+	PlannerNode node;
+	for (int j = 0; j < ARM_LINKS; j++) {
+		node.q[j] = q[j];
+	}
+	node.parent = parent;
+	node.child[0] = -1;
+	node.child[1] = -1;
+	tree->nodes.push_back(node);
+
+	int i = 0;
+	for (int depth = 0; index > 0; depth++) {
+		PlannerNode &n = tree->nodes[i];
+		int axis = depth % ARM_LINKS;
+		int side = q[axis] < n.q[axis] ? 0 : 1;
+		if (n.child[side] < 0) {
+			n.child[side] = index;
+			break;
+		}
+		i = n.child[side];
+	}
+	return index;
+}
+
+// q に最も近い節点．分割面までの距離が今の最良より遠い側は調べない
+
+inline void NearestPlannerNode(const PlannerTree &tree, const int i, const int depth,
+	const float q[ARM_LINKS], int *best, float *best_d2)
+{
+	if (i < 0) {
+		return;
+	}
+	const PlannerNode &n = tree.nodes[i];
+	float d2 = JointDistance2(n.q, q);
+	if (d2 < *best_d2) {
+		*best = i;
+		*best_d2 = d2;
+	}
+	int axis = depth % ARM_LINKS;
+	float diff = q[axis] - n.q[axis];
+	int near_side = diff < 0.0f ? 0 : 1;
+	NearestPlannerNode(tree, n.child[near_side], depth + 1, q, best, best_d2);
+	if (diff * diff < *best_d2) {
+		NearestPlannerNode(tree, n.child[1 - near_side], depth + 1, q, best, best_d2);
+	}
+}
+
+
+
+// RRT-Connect ////////////////////////////////////////////////////////////////
+
+enum {
+	PLANNER_TRAPPED,  // 当たるので伸ばせなかった
+	PLANNER_ADVANCED, // step だけ伸ばした
+	PLANNER_REACHED   // 目指した姿勢まで届いた
+};
+
+// スレッドごとの木と作業場所
+
+struct PlannerWorker {
+	PlannerTree tree[2]; // 0: 始めの姿勢から, 1: 目標の姿勢から
+	PoseCheckBuffer buffer;
+	unsigned long long random;
+	long long samples;
+	long long poses;
+	std::vector<float> path;
+};
+
+// 一回の探索の条件と結果．プールのジョブは番号しか受け取らないので共有する
+
+struct PlannerQuery {
+	const PlannerArm *arm;
+	const CollisionScene *scene;
+	const PlannerSettings *settings;
+	float start[ARM_LINKS];
+	float target_x, target_y;
+	int threads;
+	unsigned long long seed;
+	std::chrono::steady_clock::time_point deadline;
+	std::atomic<int> solved;
+	int winner;
+};
+
+static PlannerQuery planner_query;
+static std::vector<PlannerWorker> planner_workers;
+
+inline float WrapAngle(const float a)
+{
+	const float two_pi = (float) (2 * KINEMATICS_PI);
+	return a - two_pi * floorf((a + (float) KINEMATICS_PI) / two_pi);
+}
+
+inline int InJointLimits(const PlannerArm &arm, const float q[ARM_LINKS])
+{
+	for (int j = 0; j < ARM_LINKS; j++) {
+		if (q[j] < arm.lower[j] || q[j] > arm.upper[j]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+inline void RandomPose(const PlannerArm &arm, unsigned long long *random, float q[ARM_LINKS])
+{
+	for (int j = 0; j < ARM_LINKS; j++) {
+		q[j] = arm.lower[j] + (arm.upper[j] - arm.lower[j]) * RandomFloat(random);
+	}
+}
+
+// 木を q へ向けて一歩伸ばす．足した節点の番号を *added に返す
+
+inline int ExtendPlannerTree(PlannerWorker *worker, PlannerTree *tree,
+	const float q[ARM_LINKS], int *added)
+{
+	const PlannerQuery &query = planner_query;
+	int nearest = -1;
+	float d2 = 1e30f;
+	NearestPlannerNode(*tree, 0, 0, q, &nearest, &d2);
+
+	float from[ARM_LINKS], to[ARM_LINKS];
+	const float d = sqrtf(d2);
+	const float step = query.settings->step;
+	const int reached = d <= step;
+	for (int j = 0; j < ARM_LINKS; j++) {
+		from[j] = tree->nodes[nearest].q[j];
+		to[j] = reached ? q[j] : from[j] + (q[j] - from[j]) * (step / d);
+	}
+	if (!ArmEdgeFree(*query.arm, *query.scene, from, to, &worker->buffer, &worker->poses)) {
+		return PLANNER_TRAPPED;
+	}
+	*added = AddPlannerNode(tree, to, nearest);
+	return reached ? PLANNER_REACHED : PLANNER_ADVANCED;
+}
+
+// 届くか当たるまで伸ばし続ける
+
+inline int ConnectPlannerTree(PlannerWorker *worker, PlannerTree *tree,
+	const float q[ARM_LINKS], int *added)
+{
+	int status;
+	do {
+		status = ExtendPlannerTree(worker, tree, q, added);
+	} while (status == PLANNER_ADVANCED);
+	return status;
+}
+
+// 目標の位置に逆運動学で届き，範囲内で当たらない姿勢を探して木 1 の根にする．
+// スレッドごとに違う姿勢から解くので，肘の上下など別の解も根に入る
+
+inline void FindGoalPoses(PlannerWorker *worker, const int index)
+{
+	const PlannerQuery &query = planner_query;
+	const PlannerArm &arm = *query.arm;
+	const PlannerSettings &settings = *query.settings;
+	PlannerTree &goals = worker->tree[1];
+
+	for (int attempt = 0; attempt < settings.goal_poses * 8
+		&& (int) goals.nodes.size() < settings.goal_poses; attempt++) {
+		float q[ARM_LINKS];
+		if (attempt == 0 && index == 0) {
+			for (int j = 0; j < ARM_LINKS; j++) {
+				q[j] = query.start[j];
+			}
+		} else {
+			RandomPose(arm, &worker->random, q);
+		}
+		const float target_x = query.target_x - arm.base_x;
+		const float target_y = query.target_y - arm.base_y;
+		for (int n = 0; n < 100; n++) {
+			if (ArmIkStep<float, true>(arm.length, q, target_x, target_y, 2.0f)
+				< settings.goal_tolerance * 0.5f) {
+				break;
+			}
+		}
+
+		float end_x, end_y;
+		ArmForward<float, true>(arm.length, q, &end_x, &end_y);
+		if ((end_x - target_x) * (end_x - target_x) + (end_y - target_y) * (end_y - target_y)
+			> settings.goal_tolerance * settings.goal_tolerance) {
+			continue;
+		}
+		for (int j = 0; j < ARM_LINKS; j++) {
+			q[j] = WrapAngle(q[j]);
+		}
+		if (!InJointLimits(arm, q)) {
+			continue;
+		}
+
+		// 既にある根とほぼ同じ姿勢なら足さない
+
+		int nearest = -1;
+		float d2 = 1e30f;
+		NearestPlannerNode(goals, goals.nodes.empty() ? -1 : 0, 0, q, &nearest, &d2);
+		if (d2 < settings.step * settings.step) {
+			continue;
+		}
+		worker->poses++;
+		if (ArmPosesFree(arm, *query.scene, q, 1, PLANNER_INFLATE * arm.radius, &worker->buffer)) {
+			AddPlannerNode(&goals, q, -1);
+		}
+	}
+}
+
+// 二つの木の節点 s (木 0) と g (木 1) がつながったときの経路
+
+inline void ExtractPlannerPath(PlannerWorker *worker, const int s, const int g)
+{
+	std::vector<float> &path = worker->path;
+	path.clear();
+	for (int i = s; i >= 0; i = worker->tree[0].nodes[i].parent) {
+		const float *q = worker->tree[0].nodes[i].q;
+		path.insert(path.begin(), q, q + ARM_LINKS);
+	}
+	for (int i = worker->tree[1].nodes[g].parent; i >= 0; i = worker->tree[1].nodes[i].parent) {
+		const float *q = worker->tree[1].nodes[i].q;
+		path.insert(path.end(), q, q + ARM_LINKS);
+	}
+}
+
+inline int PlannerTimeUp(void)
+{
+	return std::chrono::steady_clock::now() > planner_query.deadline;
+}
+
+// index 番のスレッドの探索．どれかが見つけたら残りは止める
+
+inline void RunPlannerWorker(const int index)
+{
+	PlannerQuery &query = planner_query;
+	TRACE_SCOPE("RunPlannerWorker");
+
+	PlannerWorker *worker = &planner_workers[index];
+	worker->tree[0].nodes.clear();
+	worker->tree[1].nodes.clear();
+	worker->path.clear();
+	worker->samples = 0;
+	worker->poses = 0;
+	worker->random = (query.seed + index + 1) * 0x9e3779b97f4a7c15ull;
+
+	AddPlannerNode(&worker->tree[0], query.start, -1);
+	FindGoalPoses(worker, index);
+	const int num_goals = (int) worker->tree[1].nodes.size();
+
+	// まず真っすぐ行けるか
+
+	for (int g = 0; g < num_goals; g++) {
+		if (ArmEdgeFree(*query.arm, *query.scene, query.start, worker->tree[1].nodes[g].q,
+			&worker->buffer, &worker->poses)) {
+			const float *goal = worker->tree[1].nodes[g].q;
+			worker->path.assign(query.start, query.start + ARM_LINKS);
+			worker->path.insert(worker->path.end(), goal, goal + ARM_LINKS);
+			if (query.solved.exchange(1) == 0) {
+				query.winner = index;
+			}
+			return;
+		}
+	}
+
+	int side = 0; // 標本へ向けて伸ばす木．一回ごとに入れ替える
+	while (num_goals > 0 && worker->samples < query.settings->max_samples) {
+		if (query.solved.load(std::memory_order_relaxed)) {
+			return;
+		}
+		if ((worker->samples & 31) == 0 && PlannerTimeUp()) {
+			return;
+		}
+
+		float q[ARM_LINKS];
+		RandomPose(*query.arm, &worker->random, q);
+		worker->samples++;
+
+		int added, connected;
+		if (ExtendPlannerTree(worker, &worker->tree[side], q, &added) != PLANNER_TRAPPED) {
+			float q_new[ARM_LINKS];
+			for (int j = 0; j < ARM_LINKS; j++) {
+				q_new[j] = worker->tree[side].nodes[added].q[j];
+			}
+			if (ConnectPlannerTree(worker, &worker->tree[1 - side], q_new, &connected)
+				== PLANNER_REACHED) {
+				if (side == 0) {
+					ExtractPlannerPath(worker, added, connected);
+				} else {
+					ExtractPlannerPath(worker, connected, added);
+				}
+				if (query.solved.exchange(1) == 0) {
+					query.winner = index;
+				}
+				return;
+			}
+		}
+		side = 1 - side;
+	}
+}
+
+
+
+// スレッド ///////////////////////////////////////////////////////////////////
+
+// worker_pool.h のスレッドを planner_threads 本まで使う．
+// スレッド数は PLANNER_THREADS 環境変数，なければコア数
+
+static int planner_threads;
+
+inline void InitPlanner(void)
+{
+	if (planner_threads) {
+		return;
+	}
+	planner_threads = InitWorkerPool("PLANNER_THREADS");
+	planner_workers.resize(planner_threads);
+}
+
+
+
+// 経路を滑らかにする /////////////////////////////////////////////////////////
+
+inline float PathLength(const std::vector<float> &path)
+{
+	float length = 0.0f;
+	for (size_t i = ARM_LINKS; i < path.size(); i += ARM_LINKS) {
+		length += sqrtf(JointDistance2(&path[i - ARM_LINKS], &path[i]));
+	}
+	return length;
+}
+
+// 経路上の二点を選び，間を真っすぐ結んでも当たらなければ間の点を除く
+
+inline void ShortcutPath(const PlannerArm &arm, const CollisionScene &scene,
+	const int iterations, std::vector<float> *path, PlannerWorker *worker)
+{
+	for (int k = 0; k < iterations; k++) {
+		int n = (int) path->size() / ARM_LINKS;
+		if (n < 3) {
+			return;
+		}
+		int i = (int) (RandomFloat(&worker->random) * n);
+		int j = (int) (RandomFloat(&worker->random) * n);
+		if (i > j) {
+			int swap = i;
+			i = j;
+			j = swap;
+		}
+		if (j - i < 2) {
+			continue;
+		}
+		if (ArmEdgeFree(arm, scene, &(*path)[ARM_LINKS * i], &(*path)[ARM_LINKS * j],
+			&worker->buffer, &worker->poses)) {
+			path->erase(path->begin() + ARM_LINKS * (i + 1), path->begin() + ARM_LINKS * j);
+		}
+	}
+}
+
+// 内側の点 c を，前後の辺を 1/4 ずつ進んだ二点で置き換える (Chaikin)．
+// 二点は元の辺の上にあるので，新しく確かめるのは二点を結ぶ辺だけでよい
+
+inline void CutPathCorners(const PlannerArm &arm, const CollisionScene &scene,
+	const int passes, std::vector<float> *path, PlannerWorker *worker)
+{
+	std::vector<float> cut;
+	for (int pass = 0; pass < passes; pass++) {
+		int n = (int) path->size() / ARM_LINKS;
+		if (n < 3) {
+			return;
+		}
+		cut.assign(path->begin(), path->begin() + ARM_LINKS);
+		for (int k = 1; k < n - 1; k++) {
+			const float *p = &(*path)[ARM_LINKS * (k - 1)];
+			const float *c = &(*path)[ARM_LINKS * k];
+			const float *q = &(*path)[ARM_LINKS * (k + 1)];
+			float a[ARM_LINKS], b[ARM_LINKS];
+			for (int j = 0; j < ARM_LINKS; j++) {
+				a[j] = c[j] + 0.25f * (p[j] - c[j]);
+				b[j] = c[j] + 0.25f * (q[j] - c[j]);
+			}
+			if (ArmEdgeFree(arm, scene, a, b, &worker->buffer, &worker->poses)) {
+				cut.insert(cut.end(), a, a + ARM_LINKS);
+				cut.insert(cut.end(), b, b + ARM_LINKS);
+			} else {
+				cut.insert(cut.end(), c, c + ARM_LINKS);
+			}
+		}
+		cut.insert(cut.end(), path->end() - ARM_LINKS, path->end());
+		path->swap(cut);
+	}
+}
+
+// 経路長に沿って台形の速度で進め，一刻みごとの関節角にする
+
+inline void MakeArmTrajectory(const std::vector<float> &path,
+	const PlannerSettings &settings, ArmTrajectory *trajectory)
+{
+	const float length = PathLength(path);
+	const int n = (int) path.size() / ARM_LINKS;
+	trajectory->angle.clear();
+
+	float s = 0.0f, v = 0.0f;
+	float segment_start = 0.0f; // 辺 k の始点までの長さ
+	int k = 0;
+	while (s < length) {
+		if (length - s <= v * v / (2.0f * settings.max_acceleration)) {
+			v = fmaxf(v - settings.max_acceleration, settings.max_acceleration);
+		} else {
+			v = fminf(v + settings.max_acceleration, settings.max_velocity);
+		}
+		s = fminf(s + v, length);
+
+		float segment = sqrtf(JointDistance2(&path[ARM_LINKS * k], &path[ARM_LINKS * (k + 1)]));
+		while (k < n - 2 && s > segment_start + segment) {
+			segment_start += segment;
+			k++;
+			segment = sqrtf(JointDistance2(&path[ARM_LINKS * k], &path[ARM_LINKS * (k + 1)]));
+		}
+		float u = segment > 0.0f ? fminf((s - segment_start) / segment, 1.0f) : 1.0f;
+		for (int j = 0; j < ARM_LINKS; j++) {
+			const float a = path[ARM_LINKS * k + j];
+			trajectory->angle.push_back(a + u * (path[ARM_LINKS * (k + 1) + j] - a));
+		}
+	}
+	if (trajectory->angle.empty()) {
+		trajectory->angle.assign(path.end() - ARM_LINKS, path.end());
+	}
+	trajectory->num_points = (int) trajectory->angle.size() / ARM_LINKS;
+}
+
+
+
+// 計画 ///////////////////////////////////////////////////////////////////////
+
+// start の姿勢から先端が (target_x, target_y) に届く姿勢までの軌道を求める．
+// 見つかれば 1 を返す．軌道の始めは start の角を (-π, π] に直したもの
+
+inline int PlanArmMotion(const PlannerArm &arm, const CollisionScene &scene,
+	const PlannerSettings &settings, const float start[ARM_LINKS],
+	const float target_x, const float target_y, ArmTrajectory *trajectory,
+	PlannerStats *stats)
+{
+	TRACE_SCOPE("PlanArmMotion");
+
+	InitPlanner();
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	memset(stats, 0, sizeof(*stats));
+
+	PlannerQuery &query = planner_query;
+	query.arm = &arm;
+	query.scene = &scene;
+	query.settings = &settings;
+	for (int j = 0; j < ARM_LINKS; j++) {
+		query.start[j] = WrapAngle(start[j]);
+	}
+	query.target_x = target_x;
+	query.target_y = target_y;
+	query.threads = settings.threads > 0 && settings.threads < planner_threads
+		? settings.threads : planner_threads;
+	query.seed++;
+	query.deadline = begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(settings.time_limit));
+	query.solved = 0;
+	query.winner = -1;
+
+	// 始めから当たっていれば探さない．ワーカーの統計は前の探索のものなので，
+	// 足さずに 0 のまま返す
+
+	PlannerWorker *first = &planner_workers[0];
+	if (!ArmPosesFree(arm, scene, query.start, 1, 0.0f, &first->buffer)) {
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		return 0;
+	}
+	RunWorkerJob(RunPlannerWorker, query.threads);
+
+	for (int i = 0; i < query.threads; i++) {
+		stats->samples += planner_workers[i].samples;
+		stats->nodes += planner_workers[i].tree[0].nodes.size() + planner_workers[i].tree[1].nodes.size();
+		stats->poses += planner_workers[i].poses;
+	}
+	if (query.winner < 0) {
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		return 0;
+	}
+
+	// 見つけたスレッドの経路を滑らかにする
+
+	TRACE_SCOPE("SmoothPath");
+	PlannerWorker *worker = &planner_workers[query.winner];
+	std::vector<float> path = worker->path;
+	long long poses = worker->poses;
+	stats->raw_length = PathLength(path);
+	stats->waypoints = (int) path.size() / ARM_LINKS;
+	ShortcutPath(arm, scene, settings.shortcut_iterations, &path, worker);
+	CutPathCorners(arm, scene, settings.corner_passes, &path, worker);
+	stats->smooth_length = PathLength(path);
+	stats->poses += worker->poses - poses;
+
+	MakeArmTrajectory(path, settings, trajectory);
+	stats->trajectory_points = trajectory->num_points;
+	stats->solved = 1;
+	stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	return 1;
+}
+
+#endif // MOTION_PLANNER_H
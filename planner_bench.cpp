@@ -0,0 +1,188 @@
+// planner_bench.cpp
+//
+// motion_planner.h の計画時間を，いくつかの障害物の置き方について測る
+//
+// 置き方ごとに，障害物から離れた始めの姿勢と，そうした姿勢で届く目標の位置を
+// 乱数で選んで計画させ，成功率と計画時間の分布 (50/90/99 パーセンタイル，
+// 最大) を表にする．経路長は滑らかにする前と後を並べる．
+//
+//   ./planner_bench [queries] [threads]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "motion_planner.h"
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const float ARM_LENGTHS[3] = {10.0f, 12.0f, 8.0f};
+const float ARM_RADIUS = 1.0f;
+
+PlannerArm arm;
+PlannerSettings settings;
+PoseCheckBuffer buffer;
+unsigned long long random_state = 1;
+
+
+
+// 障害物の置き方 /////////////////////////////////////////////////////////////
+
+void AddSphereRow(CollisionScene *scene, const float x0, const float y0,
+	const float x1, const float y1, const int n, const float r)
+{
+	for (int i = 0; i < n; i++) {
+		float u = n > 1 ? (float) i / (n - 1) : 0.0f;
+		AddCollisionSphere(scene, x0 + u * (x1 - x0), y0 + u * (y1 - y0), 0.0f, r);
+	}
+}
+
+// 何も無い
+void SceneOpen(CollisionScene *)
+{
+}
+
+// 手前に柱が立ち，その向こうへ届くには上から回り込む
+void ScenePillar(CollisionScene *scene)
+{
+	AddSphereRow(scene, 14.0f, 2.0f, 14.0f, 14.0f, 5, 2.0f);
+	AddSphereRow(scene, -14.0f, 2.0f, -14.0f, 14.0f, 5, 2.0f);
+}
+
+// 棚の上と下を行き来する
+void SceneShelf(CollisionScene *scene)
+{
+	AddSphereRow(scene, 8.0f, 12.0f, 26.0f, 12.0f, 7, 1.5f);
+	AddSphereRow(scene, -26.0f, 12.0f, -8.0f, 12.0f, 7, 1.5f);
+}
+
+// 壁の隙間を抜ける
+void SceneWindow(CollisionScene *scene)
+{
+	AddSphereRow(scene, 12.0f, 1.0f, 12.0f, 9.0f, 4, 1.5f);
+	AddSphereRow(scene, 12.0f, 15.0f, 12.0f, 27.0f, 5, 1.5f);
+	AddSphereRow(scene, -12.0f, 1.0f, -12.0f, 27.0f, 9, 1.5f);
+}
+
+// 散らばった球
+void SceneClutter(CollisionScene *scene)
+{
+	unsigned long long state = 12345;
+	for (int i = 0; i < 16; i++) {
+		float r = 8.0f + 22.0f * RandomFloat(&state);
+		float theta = (float) KINEMATICS_PI * RandomFloat(&state);
+		AddCollisionSphere(scene, r * cosf(theta), r * sinf(theta), 0.0f,
+			1.0f + 1.5f * RandomFloat(&state));
+	}
+}
+
+struct BenchScene {
+	const char *name;
+	void (*build)(CollisionScene *);
+};
+
+const BenchScene BENCH_SCENES[] = {
+	{"open", SceneOpen},
+	{"pillar", ScenePillar},
+	{"shelf", SceneShelf},
+	{"window", SceneWindow},
+	{"clutter", SceneClutter},
+};
+const int NUM_BENCH_SCENES = sizeof(BENCH_SCENES) / sizeof(BENCH_SCENES[0]);
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+// 障害物から少し離れた姿勢を乱数で選ぶ
+
+void RandomFreePose(const CollisionScene &scene, float q[ARM_LINKS])
+{
+	do {
+		RandomPose(arm, &random_state, q);
+	} while (!ArmPosesFree(arm, scene, q, 1, PLANNER_INFLATE * arm.radius, &buffer));
+}
+
+double Percentile(std::vector<double> x, const double p)
+{
+	if (x.empty()) {
+		return 0.0;
+	}
+	std::sort(x.begin(), x.end());
+	size_t i = (size_t) (p / 100.0 * (x.size() - 1) + 0.5);
+	return x[i];
+}
+
+void PrintRow(const char *name, const int queries, const std::vector<double> &ms,
+	const double samples, const double poses, const double raw, const double smooth)
+{
+	int n = (int) ms.size();
+	printf("  %-8s %5.1f%% %8.2f %8.2f %8.2f %8.2f %9.0f %10.0f %6.2f -> %5.2f\n",
+		name, 100.0 * n / queries, Percentile(ms, 50), Percentile(ms, 90),
+		Percentile(ms, 99), Percentile(ms, 100), samples / queries,
+		poses / queries, n ? raw / n : 0.0, n ? smooth / n : 0.0);
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	const int queries = argc > 1 ? atoi(argv[1]) : 100;
+	InitPlannerArm(&arm, ARM_LENGTHS, ARM_RADIUS);
+	InitPlannerSettings(&settings);
+	settings.threads = argc > 2 ? atoi(argv[2]) : 0;
+	InitPlanner();
+
+	printf("%d queries per scene, %d threads, time limit %.0f ms\n", queries,
+		settings.threads > 0 && settings.threads < planner_threads
+		? settings.threads : planner_threads, settings.time_limit * 1e3);
+	printf("  %-8s %6s %8s %8s %8s %8s %9s %10s %15s\n", "scene", "solved",
+		"p50 ms", "p90 ms", "p99 ms", "max ms", "samples", "poses", "length [rad]");
+
+	std::vector<double> all_ms;
+	int all_queries = 0;
+	for (int k = 0; k < NUM_BENCH_SCENES; k++) {
+		CollisionScene scene;
+		ClearCollisionScene(&scene);
+		AddCollisionPlane(&scene, 0.0f, 1.0f, 0.0f, 0.0f);
+		BENCH_SCENES[k].build(&scene);
+
+		std::vector<double> ms;
+		double samples = 0, poses = 0, raw = 0, smooth = 0, seconds = 0;
+		for (int i = 0; i < queries; i++) {
+			// 目標は障害物から離れた姿勢の先端にして，必ず届くようにする
+
+			float start[ARM_LINKS], goal[ARM_LINKS], target_x, target_y;
+			RandomFreePose(scene, start);
+			RandomFreePose(scene, goal);
+			ArmForward<float, false>(arm.length, goal, &target_x, &target_y);
+
+			ArmTrajectory trajectory;
+			PlannerStats stats;
+			PlanArmMotion(arm, scene, settings, start, target_x, target_y, &trajectory, &stats);
+			samples += stats.samples;
+			poses += stats.poses;
+			seconds += stats.seconds;
+			if (stats.solved) {
+				ms.push_back(stats.seconds * 1e3);
+				raw += stats.raw_length;
+				smooth += stats.smooth_length;
+			}
+		}
+		PrintRow(BENCH_SCENES[k].name, queries, ms, samples, poses, raw, smooth);
+		printf("  %8s %.1f Mposes/s checked\n", "", poses / seconds * 1e-6);
+		all_ms.insert(all_ms.end(), ms.begin(), ms.end());
+		all_queries += queries;
+	}
+
+	printf("  %-8s %5.1f%% %8.2f %8.2f %8.2f %8.2f\n", "all",
+		100.0 * all_ms.size() / all_queries, Percentile(all_ms, 50),
+		Percentile(all_ms, 90), Percentile(all_ms, 99), Percentile(all_ms, 100));
+	return 0;
+}
@@ -0,0 +1,113 @@
+// ppm_diff.cpp
+//
+// p キーで保存した frame_gl.ppm と frame_soft.ppm のような二枚の PPM を比べる
+//
+// 色成分ごとの差の最大と平均，どれかの成分の差が threshold を超えた
+// 画素の割合を表示する．max_percent を与えると，その割合を超えたときに
+// 2 を返すので，画像の比較テストにそのまま使える．
+//
+//   ./ppm_diff a.ppm b.ppm [threshold] [max_percent]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+
+
+// 読み込み ///////////////////////////////////////////////////////////////////
+
+// ヘッダの数を一つ読む．# から行末までは注釈として飛ばす
+
+int ReadPPMNumber(FILE *fp, int *value)
+{
+	int c;
+	while ((c = fgetc(fp)) != EOF) {
+		if (c == '#') {
+			while ((c = fgetc(fp)) != EOF && c != '\n') {
+			}
+		} else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+			ungetc(c, fp);
+			return fscanf(fp, "%d", value) == 1;
+		}
+	}
+	return 0;
+}
+
+// 8bit の P6 を読む．読めなければ 1 を返す
+
+int LoadPPM(const char *filename, int *width, int *height,
+	std::vector<unsigned char> *pixels)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		perror(filename);
+		return 1;
+	}
+	int max_value;
+	if (fgetc(fp) != 'P' || fgetc(fp) != '6' || !ReadPPMNumber(fp, width)
+		|| !ReadPPMNumber(fp, height) || !ReadPPMNumber(fp, &max_value)
+		|| *width <= 0 || *height <= 0 || max_value != 255) {
+		fprintf(stderr, "%s: not an 8-bit binary PPM\n", filename);
+		fclose(fp);
+		return 1;
+	}
+	fgetc(fp); // ヘッダの後の空白一つ
+
+	pixels->resize((size_t) *width * *height * 3);
+	if (fread(&(*pixels)[0], 1, pixels->size(), fp) != pixels->size()) {
+		fprintf(stderr, "%s: truncated\n", filename);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s a.ppm b.ppm [threshold] [max_percent]\n", argv[0]);
+		return 1;
+	}
+	const int threshold = argc > 3 ? atoi(argv[3]) : 8;
+	const double max_percent = argc > 4 ? atof(argv[4]) : 100.0;
+
+	int width_a, height_a, width_b, height_b;
+	std::vector<unsigned char> a, b;
+	if (LoadPPM(argv[1], &width_a, &height_a, &a)
+		|| LoadPPM(argv[2], &width_b, &height_b, &b)) {
+		return 1;
+	}
+	if (width_a != width_b || height_a != height_b) {
+		fprintf(stderr, "%s is %dx%d but %s is %dx%d\n", argv[1], width_a,
+			height_a, argv[2], width_b, height_b);
+		return 1;
+	}
+
+	const size_t num_pixels = (size_t) width_a * height_a;
+	int max_delta = 0;
+	double sum = 0.0;
+	size_t over = 0;
+	for (size_t i = 0; i < num_pixels; i++) {
+		int pixel_delta = 0;
+		for (int k = 0; k < 3; k++) {
+			int d = abs(a[i * 3 + k] - b[i * 3 + k]);
+			sum += d;
+			pixel_delta = d > pixel_delta ? d : pixel_delta;
+		}
+		max_delta = pixel_delta > max_delta ? pixel_delta : max_delta;
+		if (pixel_delta > threshold) {
+			over++;
+		}
+	}
+
+	const double percent = 100.0 * over / num_pixels;
+	printf("%s vs %s (%dx%d): max delta %d, mean delta %.4f, "
+		"%.3f%% of pixels over %d\n", argv[1], argv[2], width_a, height_a,
+		max_delta, sum / (num_pixels * 3), percent, threshold);
+	return percent > max_percent ? 2 : 0;
+}
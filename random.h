@@ -0,0 +1,49 @@
+// random.h
+//
+// 乱数
+//
+// 状態を呼ぶ側が持つ xorshift64*．スレッドや世界ごとに状態を分ければ，
+// 互いに干渉せず，同じ種からはいつも同じ列が出る．状態は 0 にしない．
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+
+
+// 乱数 ///////////////////////////////////////////////////////////////////////
+
+inline unsigned long long NextRandom(unsigned long long *state)
+{
+	unsigned long long x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 2685821657736338717ull;
+}
+
+// [0, 1) の一様乱数
+
+inline float RandomFloat(unsigned long long *state)
+{
+	return (float) (NextRandom(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+inline double RandomDouble(unsigned long long *state)
+{
+	return (double) (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// 番号から状態を作る．1, 2, 3, ... のような隣り合った種でも列が似ないよう，
+// splitmix64 で混ぜてから使う
+
+inline unsigned long long SeedRandom(const unsigned long long seed)
+{
+	unsigned long long z = seed + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	z ^= z >> 31;
+	return z ? z : 1;
+}
+
+#endif // RANDOM_H
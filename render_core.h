@@ -0,0 +1,824 @@
+// render_core.h
+//
+// 3dof_arm と walk が共有する描画の土台
+//
+// 行列は float で CPU 側のスタックに持ち，固定機能の行列スタック (double) や
+// glGet での読み戻しは使わない．メッシュは起動時に一つの頂点バッファ (VBO)
+// へまとめて送っておき，描くときはオフセットを指定するだけにする．
+// 陰影は固定機能の GL_LIGHT0 と glMaterial と同じ式を頂点シェーダで求めるので，
+// 見た目は変わらない．シェーダか VBO が使えない環境では，同じ行列と光源を
+// 固定機能のパイプラインとクライアント側の頂点配列に渡して描く．
+//
+// 場面の描画は次の順に呼ぶ．
+//   SetRenderViewport() と Set*Projection() で投影を決め，
+//   LookAt() などで行列スタックにビュー変換を置き，SetRenderLight() で光源を置く．
+//   物体は PushMatrix() / Translate() / Rotate() / Scale() で座標系を動かして
+//   draw_list.h の RecordDraw() で積む．
+
+#ifndef RENDER_CORE_H
+#define RENDER_CORE_H
+
+#include <GL/glut.h>
+#include <GL/glext.h>
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "mesh.h"
+
+
+
+// 行列 ///////////////////////////////////////////////////////////////////////
+
+// どれも OpenGL と同じ列優先の 4x4 行列．変換は右から掛ける (glTranslate などと同じ)
+
+inline void SetIdentityMatrix(GLfloat m[16])
+{
+	for (int i = 0; i < 16; i++) {
+		m[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	}
+}
+
+// out = a * b．out は a や b と同じ配列でもよい
+
+inline void MultiplyMatrix(const GLfloat a[16], const GLfloat b[16], GLfloat out[16])
+{
+	GLfloat r[16];
+	for (int c = 0; c < 4; c++) {
+		for (int k = 0; k < 4; k++) {
+			r[c * 4 + k] = a[k] * b[c * 4] + a[4 + k] * b[c * 4 + 1]
+				+ a[8 + k] * b[c * 4 + 2] + a[12 + k] * b[c * 4 + 3];
+		}
+	}
+	for (int i = 0; i < 16; i++) {
+		out[i] = r[i];
+	}
+}
+
+inline void TranslateMatrix(GLfloat m[16], const GLfloat x, const GLfloat y, const GLfloat z)
+{
+	for (int k = 0; k < 4; k++) {
+		m[12 + k] += m[k] * x + m[4 + k] * y + m[8 + k] * z;
+	}
+}
+
+inline void ScaleMatrix(GLfloat m[16], const GLfloat x, const GLfloat y, const GLfloat z)
+{
+	for (int k = 0; k < 4; k++) {
+		m[k] *= x;
+		m[4 + k] *= y;
+		m[8 + k] *= z;
+	}
+}
+
+// 軸 (x, y, z) まわりに angle [rad] 回す
+
+inline void RotateMatrix(GLfloat m[16], const GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
+{
+	GLfloat len = sqrt(x * x + y * y + z * z);
+	if (len == 0.0f) {
+		return;
+	}
+	x /= len;
+	y /= len;
+	z /= len;
+	const GLfloat s = sin(angle), c = cos(angle), t = 1.0f - c;
+
+	// 回転行列の列 j の成分 i は r[j][i]
+
+	const GLfloat r[3][3] = {
+		{t * x * x + c, t * x * y + s * z, t * x * z - s * y},
+		{t * x * y - s * z, t * y * y + c, t * y * z + s * x},
+		{t * x * z + s * y, t * y * z - s * x, t * z * z + c}
+	};
+	GLfloat col[3][4];
+	for (int j = 0; j < 3; j++) {
+		for (int k = 0; k < 4; k++) {
+			col[j][k] = m[k] * r[j][0] + m[4 + k] * r[j][1] + m[8 + k] * r[j][2];
+		}
+	}
+	for (int j = 0; j < 3; j++) {
+		for (int k = 0; k < 4; k++) {
+			m[j * 4 + k] = col[j][k];
+		}
+	}
+}
+
+// gluPerspective() と同じ透視投影 (fovy は度)
+
+inline void PerspectiveMatrix(GLfloat m[16], const double fovy, const double aspect,
+	const double near_z, const double far_z)
+{
+	const double f = 1.0 / tan(fovy * M_PI / 360.0);
+	for (int i = 0; i < 16; i++) {
+		m[i] = 0.0f;
+	}
+	m[0] = f / aspect;
+	m[5] = f;
+	m[10] = (far_z + near_z) / (near_z - far_z);
+	m[11] = -1.0f;
+	m[14] = 2.0 * far_z * near_z / (near_z - far_z);
+}
+
+// glOrtho() と同じ平行投影
+
+inline void OrthoMatrix(GLfloat m[16], const double left, const double right,
+	const double bottom, const double top, const double near_z, const double far_z)
+{
+	SetIdentityMatrix(m);
+	m[0] = 2.0 / (right - left);
+	m[5] = 2.0 / (top - bottom);
+	m[10] = -2.0 / (far_z - near_z);
+	m[12] = -(right + left) / (right - left);
+	m[13] = -(top + bottom) / (top - bottom);
+	m[14] = -(far_z + near_z) / (far_z - near_z);
+}
+
+// gluLookAt() と同じビュー変換を m に掛ける
+
+inline void LookAtMatrix(GLfloat m[16], const double eye_x, const double eye_y,
+	const double eye_z, const double center_x, const double center_y,
+	const double center_z, const double up_x, const double up_y, const double up_z)
+{
+	double f[3] = {center_x - eye_x, center_y - eye_y, center_z - eye_z};
+	double f_len = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	for (int k = 0; k < 3; k++) {
+		f[k] /= f_len;
+	}
+
+	// s = f x up, u = s x f
+
+	double s[3] = {f[1] * up_z - f[2] * up_y, f[2] * up_x - f[0] * up_z,
+		f[0] * up_y - f[1] * up_x};
+	double s_len = sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+	for (int k = 0; k < 3; k++) {
+		s[k] /= s_len;
+	}
+	double u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2],
+		s[0] * f[1] - s[1] * f[0]};
+
+	GLfloat v[16];
+	SetIdentityMatrix(v);
+	for (int k = 0; k < 3; k++) {
+		v[k * 4 + 0] = s[k];
+		v[k * 4 + 1] = u[k];
+		v[k * 4 + 2] = -f[k];
+	}
+	MultiplyMatrix(m, v, m);
+	TranslateMatrix(m, -eye_x, -eye_y, -eye_z);
+}
+
+// 法線の変換 (左上 3x3 の逆行列の転置) を列優先の 3x3 で求める．
+// 拡大縮小が一様でなくても法線は面に垂直なまま移る
+
+inline void NormalMatrix(const GLfloat m[16], GLfloat n[9])
+{
+	// 余因子 C(r, c) を巡回の添字で求めると，符号が自然に付く
+
+	GLfloat cofactor[9];
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) {
+			int r1 = (r + 1) % 3, r2 = (r + 2) % 3;
+			int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+			cofactor[c * 3 + r] = m[c1 * 4 + r1] * m[c2 * 4 + r2]
+				- m[c2 * 4 + r1] * m[c1 * 4 + r2];
+		}
+	}
+	GLfloat det = m[0] * cofactor[0] + m[4] * cofactor[3] + m[8] * cofactor[6];
+	GLfloat inv = det != 0.0f ? 1.0f / det : 0.0f;
+	for (int i = 0; i < 9; i++) {
+		n[i] = cofactor[i] * inv;
+	}
+}
+
+
+
+// 行列スタック ///////////////////////////////////////////////////////////////
+
+// モデルビュー行列のスタック．glPushMatrix() などと同じく，溢れた Push と
+// 空での Pop は何もしない
+
+const int MATRIX_STACK_DEPTH = 32;
+
+static GLfloat matrix_stack[MATRIX_STACK_DEPTH][16];
+static int matrix_depth;
+
+inline GLfloat *CurrentMatrix(void)
+{
+	return matrix_stack[matrix_depth];
+}
+
+inline void LoadIdentity(void)
+{
+	SetIdentityMatrix(CurrentMatrix());
+}
+
+inline void LoadMatrix(const GLfloat m[16])
+{
+	GLfloat *top = CurrentMatrix();
+	for (int i = 0; i < 16; i++) {
+		top[i] = m[i];
+	}
+}
+
+inline void PushMatrix(void)
+{
+	if (matrix_depth == MATRIX_STACK_DEPTH - 1) {
+		fprintf(stderr, "render: matrix stack overflow\n");
+		return;
+	}
+	const GLfloat *top = CurrentMatrix();
+	matrix_depth++;
+	LoadMatrix(top);
+}
+
+inline void PopMatrix(void)
+{
+	if (matrix_depth > 0) {
+		matrix_depth--;
+	}
+}
+
+inline void Translate(const double x, const double y, const double z)
+{
+	TranslateMatrix(CurrentMatrix(), x, y, z);
+}
+
+// angle はラジアン
+
+inline void Rotate(const double angle, const double x, const double y, const double z)
+{
+	RotateMatrix(CurrentMatrix(), angle, x, y, z);
+}
+
+inline void Scale(const double x, const double y, const double z)
+{
+	ScaleMatrix(CurrentMatrix(), x, y, z);
+}
+
+
+
+// 投影とビュー ///////////////////////////////////////////////////////////////
+
+static GLfloat render_projection[16];
+static GLint render_viewport[4];
+
+inline void SetRenderViewport(const int x, const int y, const int w, const int h)
+{
+	render_viewport[0] = x;
+	render_viewport[1] = y;
+	render_viewport[2] = w;
+	render_viewport[3] = h;
+	glViewport(x, y, w, h);
+}
+
+inline void SetRenderProjection(const GLfloat m[16])
+{
+	for (int i = 0; i < 16; i++) {
+		render_projection[i] = m[i];
+	}
+}
+
+// ビューポートの縦横比で透視投影にする (fovy は度)
+
+inline void SetPerspectiveProjection(const double fovy, const double near_z,
+	const double far_z)
+{
+	PerspectiveMatrix(render_projection, fovy,
+		render_viewport[2] / (double) render_viewport[3], near_z, far_z);
+}
+
+// ビューポートの縦横比で，高さ 2 * half_height が見える平行投影にする
+
+inline void SetOrthoProjection(const double half_height, const double near_z,
+	const double far_z)
+{
+	double half_width = half_height * render_viewport[2] / (double) render_viewport[3];
+	OrthoMatrix(render_projection, -half_width, half_width, -half_height, half_height,
+		near_z, far_z);
+}
+
+// 行列スタックの今の段をビュー変換にする
+
+inline void LookAt(const double eye_x, const double eye_y, const double eye_z,
+	const double center_x, const double center_y, const double center_z,
+	const double up_x, const double up_y, const double up_z)
+{
+	LoadIdentity();
+	LookAtMatrix(CurrentMatrix(), eye_x, eye_y, eye_z, center_x, center_y, center_z,
+		up_x, up_y, up_z);
+}
+
+
+
+// 光源とマテリアル ///////////////////////////////////////////////////////////
+
+// 光源は一つ．環境光・拡散光・鏡面光は両プログラムで共通で，位置だけを選ぶ
+
+struct RenderLight {
+	GLfloat position[4]; // 視点座標系 (w = 0 なら平行光源)
+	GLfloat ambient[4];
+	GLfloat diffuse[4];
+	GLfloat specular[4];
+};
+
+const GLfloat RENDER_MODEL_AMBIENT[4] = {0.2f, 0.2f, 0.2f, 1.0f}; // GL_LIGHT_MODEL_AMBIENT の既定値
+const GLfloat MATERIAL_AMBIENT_RATIO = 0.2f; // 拡散色に対する環境色の割合
+
+static RenderLight render_light;
+
+// ワールド座標系の位置 position に光源を置く．glLightfv() と同じく，
+// 今のモデルビュー行列 (ふつうはビュー変換だけ) で視点座標系へ移す
+
+inline void SetRenderLight(const GLfloat position[4])
+{
+	const GLfloat *m = CurrentMatrix();
+	for (int k = 0; k < 4; k++) {
+		render_light.position[k] = m[k] * position[0] + m[4 + k] * position[1]
+			+ m[8 + k] * position[2] + m[12 + k] * position[3];
+		render_light.ambient[k] = k < 3 ? 0.2f : 1.0f;
+		render_light.diffuse[k] = 1.0f;
+		render_light.specular[k] = 1.0f;
+	}
+}
+
+const int MAX_MATERIALS = 64;
+
+struct Material {
+	GLfloat r, g, b;
+	GLfloat shininess;
+};
+
+static Material material_table[MAX_MATERIALS];
+static int num_materials;
+
+// マテリアルを登録して番号を返す．同じ色が登録済みならその番号を返す
+
+inline int AddMaterial(const double r, const double g, const double b,
+	const double shininess = 50.0)
+{
+	for (int i = 0; i < num_materials; i++) {
+		const Material &m = material_table[i];
+		if (m.r == (GLfloat) r && m.g == (GLfloat) g && m.b == (GLfloat) b
+			&& m.shininess == (GLfloat) shininess) {
+			return i;
+		}
+	}
+	if (num_materials == MAX_MATERIALS) {
+		fprintf(stderr, "render: too many materials\n");
+		return 0;
+	}
+	Material &m = material_table[num_materials];
+	m.r = r;
+	m.g = g;
+	m.b = b;
+	m.shininess = shininess;
+	return num_materials++;
+}
+
+
+
+// GL の関数 //////////////////////////////////////////////////////////////////
+
+// VBO (OpenGL 1.5) とシェーダ (2.0) の関数は，実行時に GLUT から取り出す．
+// glutGetProcAddress() の無い GLUT では固定機能で描く
+
+static PFNGLGENBUFFERSPROC render_glGenBuffers;
+static PFNGLBINDBUFFERPROC render_glBindBuffer;
+static PFNGLBUFFERDATAPROC render_glBufferData;
+static PFNGLCREATESHADERPROC render_glCreateShader;
+static PFNGLSHADERSOURCEPROC render_glShaderSource;
+static PFNGLCOMPILESHADERPROC render_glCompileShader;
+static PFNGLGETSHADERIVPROC render_glGetShaderiv;
+static PFNGLGETSHADERINFOLOGPROC render_glGetShaderInfoLog;
+static PFNGLCREATEPROGRAMPROC render_glCreateProgram;
+static PFNGLATTACHSHADERPROC render_glAttachShader;
+static PFNGLBINDATTRIBLOCATIONPROC render_glBindAttribLocation;
+static PFNGLLINKPROGRAMPROC render_glLinkProgram;
+static PFNGLGETPROGRAMIVPROC render_glGetProgramiv;
+static PFNGLGETPROGRAMINFOLOGPROC render_glGetProgramInfoLog;
+static PFNGLUSEPROGRAMPROC render_glUseProgram;
+static PFNGLGETUNIFORMLOCATIONPROC render_glGetUniformLocation;
+static PFNGLUNIFORM1FPROC render_glUniform1f;
+static PFNGLUNIFORM3FVPROC render_glUniform3fv;
+static PFNGLUNIFORM4FVPROC render_glUniform4fv;
+static PFNGLUNIFORMMATRIX3FVPROC render_glUniformMatrix3fv;
+static PFNGLUNIFORMMATRIX4FVPROC render_glUniformMatrix4fv;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC render_glEnableVertexAttribArray;
+static PFNGLDISABLEVERTEXATTRIBARRAYPROC render_glDisableVertexAttribArray;
+static PFNGLVERTEXATTRIBPOINTERPROC render_glVertexAttribPointer;
+
+inline int LoadRenderFunctions(void)
+{
+#ifdef FREEGLUT
+	render_glGenBuffers = (PFNGLGENBUFFERSPROC) glutGetProcAddress("glGenBuffers");
+	render_glBindBuffer = (PFNGLBINDBUFFERPROC) glutGetProcAddress("glBindBuffer");
+	render_glBufferData = (PFNGLBUFFERDATAPROC) glutGetProcAddress("glBufferData");
+	render_glCreateShader = (PFNGLCREATESHADERPROC) glutGetProcAddress("glCreateShader");
+	render_glShaderSource = (PFNGLSHADERSOURCEPROC) glutGetProcAddress("glShaderSource");
+	render_glCompileShader = (PFNGLCOMPILESHADERPROC) glutGetProcAddress("glCompileShader");
+	render_glGetShaderiv = (PFNGLGETSHADERIVPROC) glutGetProcAddress("glGetShaderiv");
+	render_glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)
+		glutGetProcAddress("glGetShaderInfoLog");
+	render_glCreateProgram = (PFNGLCREATEPROGRAMPROC) glutGetProcAddress("glCreateProgram");
+	render_glAttachShader = (PFNGLATTACHSHADERPROC) glutGetProcAddress("glAttachShader");
+	render_glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)
+		glutGetProcAddress("glBindAttribLocation");
+	render_glLinkProgram = (PFNGLLINKPROGRAMPROC) glutGetProcAddress("glLinkProgram");
+	render_glGetProgramiv = (PFNGLGETPROGRAMIVPROC) glutGetProcAddress("glGetProgramiv");
+	render_glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)
+		glutGetProcAddress("glGetProgramInfoLog");
+	render_glUseProgram = (PFNGLUSEPROGRAMPROC) glutGetProcAddress("glUseProgram");
+	render_glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)
+		glutGetProcAddress("glGetUniformLocation");
+	render_glUniform1f = (PFNGLUNIFORM1FPROC) glutGetProcAddress("glUniform1f");
+	render_glUniform3fv = (PFNGLUNIFORM3FVPROC) glutGetProcAddress("glUniform3fv");
+	render_glUniform4fv = (PFNGLUNIFORM4FVPROC) glutGetProcAddress("glUniform4fv");
+	render_glUniformMatrix3fv = (PFNGLUNIFORMMATRIX3FVPROC)
+		glutGetProcAddress("glUniformMatrix3fv");
+	render_glUniformMatrix4fv = (PFNGLUNIFORMMATRIX4FVPROC)
+		glutGetProcAddress("glUniformMatrix4fv");
+	render_glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)
+		glutGetProcAddress("glEnableVertexAttribArray");
+	render_glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)
+		glutGetProcAddress("glDisableVertexAttribArray");
+	render_glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)
+		glutGetProcAddress("glVertexAttribPointer");
+
+	return render_glGenBuffers && render_glBindBuffer && render_glBufferData
+		&& render_glCreateShader && render_glShaderSource && render_glCompileShader
+		&& render_glGetShaderiv && render_glGetShaderInfoLog && render_glCreateProgram
+		&& render_glAttachShader && render_glBindAttribLocation && render_glLinkProgram
+		&& render_glGetProgramiv && render_glGetProgramInfoLog && render_glUseProgram
+		&& render_glGetUniformLocation && render_glUniform1f && render_glUniform3fv
+		&& render_glUniform4fv && render_glUniformMatrix3fv && render_glUniformMatrix4fv
+		&& render_glEnableVertexAttribArray && render_glDisableVertexAttribArray
+		&& render_glVertexAttribPointer;
+#else
+	return 0;
+#endif
+}
+
+
+
+// シェーダ ///////////////////////////////////////////////////////////////////
+
+// 固定機能の頂点ごとの陰影と同じ式．視線は (0, 0, 1) (GL_LIGHT_MODEL_LOCAL_VIEWER
+// が偽)，鏡面反射は光源が面の表にあるときだけ，色は頂点で [0, 1] に切り詰めてから
+// 補間する (グーローシェーディング)
+
+static const char *render_vertex_shader =
+	"#version 120\n"
+	"attribute vec3 position;\n"
+	"attribute vec3 normal;\n"
+	"uniform mat4 projection;\n"
+	"uniform mat4 modelview;\n"
+	"uniform mat3 normal_matrix;\n"
+	"uniform vec4 light_position;\n"
+	"uniform vec3 light_ambient;\n"
+	"uniform vec3 light_diffuse;\n"
+	"uniform vec3 light_specular;\n"
+	"uniform vec3 model_ambient;\n"
+	"uniform vec3 diffuse;\n"
+	"uniform float ambient_ratio;\n"
+	"uniform float shininess;\n"
+	"varying vec3 color;\n"
+	"void main()\n"
+	"{\n"
+	"	vec4 p = modelview * vec4(position, 1.0);\n"
+	"	vec3 n = normalize(normal_matrix * normal);\n"
+	"	vec3 l = normalize(light_position.w == 0.0 ? light_position.xyz\n"
+	"		: light_position.xyz - p.xyz);\n"
+	"	float n_dot_l = max(dot(n, l), 0.0);\n"
+	"	float specular = 0.0;\n"
+	"	if (n_dot_l > 0.0) {\n"
+	"		specular = pow(max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0),\n"
+	"			shininess);\n"
+	"	}\n"
+	"	color = clamp(diffuse * ambient_ratio * (model_ambient + light_ambient)\n"
+	"		+ diffuse * n_dot_l * light_diffuse + specular * light_specular, 0.0, 1.0);\n"
+	"	gl_Position = projection * p;\n"
+	"}\n";
+
+static const char *render_fragment_shader =
+	"#version 120\n"
+	"varying vec3 color;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = vec4(color, 1.0);\n"
+	"}\n";
+
+const GLuint RENDER_ATTRIB_POSITION = 0;
+const GLuint RENDER_ATTRIB_NORMAL = 1;
+
+struct RenderProgram {
+	GLuint program;
+	GLint projection;
+	GLint modelview;
+	GLint normal_matrix;
+	GLint light_position;
+	GLint light_ambient;
+	GLint light_diffuse;
+	GLint light_specular;
+	GLint model_ambient;
+	GLint diffuse;
+	GLint ambient_ratio;
+	GLint shininess;
+};
+
+static RenderProgram render_program;
+
+// 失敗したらログを出して 0 を返す
+
+inline GLuint CompileRenderShader(const GLenum type, const char *source)
+{
+	GLuint shader = render_glCreateShader(type);
+	render_glShaderSource(shader, 1, &source, NULL);
+	render_glCompileShader(shader);
+
+	GLint ok;
+	render_glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		render_glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "render: shader compile failed\n%s\n", log);
+		return 0;
+	}
+	return shader;
+}
+
+inline int BuildRenderProgram(RenderProgram *p)
+{
+	GLuint vertex = CompileRenderShader(GL_VERTEX_SHADER, render_vertex_shader);
+	GLuint fragment = CompileRenderShader(GL_FRAGMENT_SHADER, render_fragment_shader);
+	if (!vertex || !fragment) {
+		return 0;
+	}
+
+	p->program = render_glCreateProgram();
+	render_glAttachShader(p->program, vertex);
+	render_glAttachShader(p->program, fragment);
+	render_glBindAttribLocation(p->program, RENDER_ATTRIB_POSITION, "position");
+	render_glBindAttribLocation(p->program, RENDER_ATTRIB_NORMAL, "normal");
+	render_glLinkProgram(p->program);
+
+	GLint ok;
+	render_glGetProgramiv(p->program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		render_glGetProgramInfoLog(p->program, sizeof(log), NULL, log);
+		fprintf(stderr, "render: shader link failed\n%s\n", log);
+		return 0;
+	}
+
+	p->projection = render_glGetUniformLocation(p->program, "projection");
+	p->modelview = render_glGetUniformLocation(p->program, "modelview");
+	p->normal_matrix = render_glGetUniformLocation(p->program, "normal_matrix");
+	p->light_position = render_glGetUniformLocation(p->program, "light_position");
+	p->light_ambient = render_glGetUniformLocation(p->program, "light_ambient");
+	p->light_diffuse = render_glGetUniformLocation(p->program, "light_diffuse");
+	p->light_specular = render_glGetUniformLocation(p->program, "light_specular");
+	p->model_ambient = render_glGetUniformLocation(p->program, "model_ambient");
+	p->diffuse = render_glGetUniformLocation(p->program, "diffuse");
+	p->ambient_ratio = render_glGetUniformLocation(p->program, "ambient_ratio");
+	p->shininess = render_glGetUniformLocation(p->program, "shininess");
+	return 1;
+}
+
+
+
+// 頂点バッファ ///////////////////////////////////////////////////////////////
+
+// すべてのメッシュのすべての段を一つの VBO (位置と法線を交互に) と
+// 一つの添字バッファに詰める．添字はメッシュの先頭からの番号のままなので，
+// メッシュを切り替えるときに頂点属性の開始位置をずらす
+
+struct MeshRange {
+	size_t vertex_offset; // [byte]
+	size_t index_offset;  // [byte]
+};
+
+static GLuint render_vertex_buffer;
+static GLuint render_index_buffer;
+static MeshRange mesh_ranges[NUM_MESHES][MAX_LOD_LEVELS];
+
+inline void UploadMeshes(void)
+{
+	size_t num_vertices = 0, num_indices = 0;
+	for (int i = 0; i < NUM_MESHES; i++) {
+		for (int j = 0; j < meshes[i].num_levels; j++) {
+			num_vertices += meshes[i].levels[j].num_vertices;
+			num_indices += meshes[i].levels[j].num_indices;
+		}
+	}
+
+	std::vector<GLfloat> vertices(num_vertices * 6);
+	std::vector<GLuint> indices(num_indices);
+	size_t v = 0, n = 0;
+	for (int i = 0; i < NUM_MESHES; i++) {
+		for (int j = 0; j < meshes[i].num_levels; j++) {
+			const Mesh &m = meshes[i].levels[j];
+			mesh_ranges[i][j].vertex_offset = v * sizeof(GLfloat) * 6;
+			mesh_ranges[i][j].index_offset = n * sizeof(GLuint);
+			for (int k = 0; k < m.num_vertices; k++, v++) {
+				for (int c = 0; c < 3; c++) {
+					vertices[v * 6 + c] = m.vertices[k * 3 + c];
+					vertices[v * 6 + 3 + c] = m.normals[k * 3 + c];
+				}
+			}
+			for (int k = 0; k < m.num_indices; k++) {
+				indices[n++] = m.indices[k];
+			}
+		}
+	}
+
+	render_glGenBuffers(1, &render_vertex_buffer);
+	render_glBindBuffer(GL_ARRAY_BUFFER, render_vertex_buffer);
+	render_glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
+		&vertices[0], GL_STATIC_DRAW);
+	render_glGenBuffers(1, &render_index_buffer);
+	render_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render_index_buffer);
+	render_glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+		&indices[0], GL_STATIC_DRAW);
+	render_glBindBuffer(GL_ARRAY_BUFFER, 0);
+	render_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+
+
+// 初期化 /////////////////////////////////////////////////////////////////////
+
+static int render_shader_ready; // シェーダと VBO が使えるか
+static int render_use_shader;   // 1 ならシェーダと VBO で描く (0 なら固定機能)
+static GLfloat render_clear_color[4];
+
+// ウィンドウを作った後，InitMeshes() の後に一度だけ呼ぶ
+
+inline void InitRender(const GLfloat r, const GLfloat g, const GLfloat b, const GLfloat a)
+{
+	// 背景色の設定
+
+	render_clear_color[0] = r;
+	render_clear_color[1] = g;
+	render_clear_color[2] = b;
+	render_clear_color[3] = a;
+	glClearColor(r, g, b, a);
+
+	// Zバッファによる隠面消去と，裏を向いているポリゴンの省略
+
+	glEnable(GL_DEPTH_TEST);
+	glCullFace(GL_BACK);
+	glEnable(GL_CULL_FACE);
+
+	// 固定機能で描くときの設定 (法線は正規化し，色は頂点間で補間する)
+
+	glShadeModel(GL_SMOOTH);
+	glEnable(GL_NORMALIZE);
+
+	matrix_depth = 0;
+	LoadIdentity();
+
+	render_shader_ready = LoadRenderFunctions() && BuildRenderProgram(&render_program);
+	if (render_shader_ready) {
+		UploadMeshes();
+	} else {
+		fprintf(stderr, "render: shaders or vertex buffers unavailable, "
+			"falling back to the fixed-function pipeline\n");
+	}
+	render_use_shader = render_shader_ready;
+}
+
+// シェーダと固定機能を切り替える (見た目と速さの比較用)
+
+inline void ToggleRenderShader(void)
+{
+	render_use_shader = render_shader_ready && !render_use_shader;
+}
+
+inline const char *RenderPathName(void)
+{
+	return render_use_shader ? "shader+vbo" : "fixed-function";
+}
+
+
+
+// 描画 ///////////////////////////////////////////////////////////////////////
+
+// BeginRenderPass() から EndRenderPass() の間で，マテリアルとメッシュを
+// 変わったときだけ設定し，メッシュを行列ごとに描く．投影と光源は
+// BeginRenderPass() の時点のものを使う
+
+inline void BeginRenderPass(void)
+{
+	if (render_use_shader) {
+		const RenderProgram &p = render_program;
+		render_glUseProgram(p.program);
+		render_glUniformMatrix4fv(p.projection, 1, GL_FALSE, render_projection);
+		render_glUniform4fv(p.light_position, 1, render_light.position);
+		render_glUniform3fv(p.light_ambient, 1, render_light.ambient);
+		render_glUniform3fv(p.light_diffuse, 1, render_light.diffuse);
+		render_glUniform3fv(p.light_specular, 1, render_light.specular);
+		render_glUniform3fv(p.model_ambient, 1, RENDER_MODEL_AMBIENT);
+		render_glUniform1f(p.ambient_ratio, MATERIAL_AMBIENT_RATIO);
+
+		render_glBindBuffer(GL_ARRAY_BUFFER, render_vertex_buffer);
+		render_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render_index_buffer);
+		render_glEnableVertexAttribArray(RENDER_ATTRIB_POSITION);
+		render_glEnableVertexAttribArray(RENDER_ATTRIB_NORMAL);
+		return;
+	}
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadMatrixf(render_projection);
+	glMatrixMode(GL_MODELVIEW);
+
+	// 光源の位置は視点座標系で持っているので，単位行列のもとで置く
+
+	glLoadIdentity();
+	glLightfv(GL_LIGHT0, GL_POSITION, render_light.position);
+	glLightfv(GL_LIGHT0, GL_AMBIENT, render_light.ambient);
+	glLightfv(GL_LIGHT0, GL_DIFFUSE, render_light.diffuse);
+	glLightfv(GL_LIGHT0, GL_SPECULAR, render_light.specular);
+	glLightModelfv(GL_LIGHT_MODEL_AMBIENT, RENDER_MODEL_AMBIENT);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_LIGHTING);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+}
+
+inline void EndRenderPass(void)
+{
+	if (render_use_shader) {
+		render_glDisableVertexAttribArray(RENDER_ATTRIB_POSITION);
+		render_glDisableVertexAttribArray(RENDER_ATTRIB_NORMAL);
+		render_glBindBuffer(GL_ARRAY_BUFFER, 0);
+		render_glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		render_glUseProgram(0);
+		return;
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisable(GL_LIGHTING);
+}
+
+// 物体の色の設定
+
+inline void ApplyMaterial(const int id)
+{
+	const Material &m = material_table[id];
+	if (render_use_shader) {
+		const GLfloat diffuse[3] = {m.r, m.g, m.b};
+		render_glUniform3fv(render_program.diffuse, 1, diffuse);
+		render_glUniform1f(render_program.shininess, m.shininess);
+		return;
+	}
+
+	GLfloat mat_ambient[] = {m.r * MATERIAL_AMBIENT_RATIO, m.g * MATERIAL_AMBIENT_RATIO,
+		m.b * MATERIAL_AMBIENT_RATIO, 1.0f};
+	GLfloat mat_diffuse[] = {m.r, m.g, m.b, 1.0f};
+	GLfloat mat_specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+	glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
+	glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
+	glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
+	glMaterialf(GL_FRONT, GL_SHININESS, m.shininess);
+}
+
+// メッシュが変わったときだけ呼ぶ
+
+inline void BindRenderMesh(const int mesh, const int level)
+{
+	if (render_use_shader) {
+		size_t offset = mesh_ranges[mesh][level].vertex_offset;
+		render_glVertexAttribPointer(RENDER_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE,
+			sizeof(GLfloat) * 6, (const GLvoid *) offset);
+		render_glVertexAttribPointer(RENDER_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE,
+			sizeof(GLfloat) * 6, (const GLvoid *) (offset + sizeof(GLfloat) * 3));
+		return;
+	}
+	BindMesh(mesh, level);
+}
+
+// 視点座標系へのモデルビュー行列 matrix でメッシュを描く
+
+inline void DrawRenderMesh(const GLfloat matrix[16], const int mesh, const int level)
+{
+	if (render_use_shader) {
+		GLfloat normal[9];
+		NormalMatrix(matrix, normal);
+		render_glUniformMatrix4fv(render_program.modelview, 1, GL_FALSE, matrix);
+		render_glUniformMatrix3fv(render_program.normal_matrix, 1, GL_FALSE, normal);
+		glDrawElements(GL_TRIANGLES, meshes[mesh].levels[level].num_indices,
+			GL_UNSIGNED_INT, (const GLvoid *) mesh_ranges[mesh][level].index_offset);
+		return;
+	}
+	glLoadMatrixf(matrix);
+	DrawBoundMesh(mesh, level);
+}
+
+#endif // RENDER_CORE_H
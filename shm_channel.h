@@ -0,0 +1,197 @@
+// shm_channel.h
+//
+// 別プロセスとアームの間で目標位置と関節角をやりとりする共有メモリ
+//
+// POSIX 共有メモリの中に，一方向のリングバッファ (書き手と読み手が一つずつ)
+// を二本置く．
+//   targets: 計画側 -> アーム  目標位置
+//   status:  アーム -> 計画側  解いた関節角とエンドエフェクタの誤差
+// 書き手は head だけ，読み手は tail だけを進めるので，ロックは要らない．
+
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+
+
+
+// メッセージ /////////////////////////////////////////////////////////////////
+
+struct TargetMessage {
+	unsigned long long seq;
+	unsigned long long send_ns;  // 計画側が積んだ時刻 (CLOCK_MONOTONIC)
+	double x, y, z;
+};
+
+struct StatusMessage {
+	unsigned long long target_seq;      // 最後に受け取った目標の番号
+	unsigned long long target_send_ns;  // その目標が積まれた時刻
+	unsigned long long publish_ns;      // この状態を積んだ時刻
+	double angle[3];                    // [deg]
+	double end_x, end_y;                // エンドエフェクタの位置
+	double error;                       // 目標までの距離
+};
+
+inline unsigned long long MonotonicNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+
+// リングバッファ /////////////////////////////////////////////////////////////
+
+// 容量 N は 2 のべき．head と tail は別のキャッシュラインに置き，
+// 互いの値は手元に写しておいて，足りなくなったときだけ読み直す
+
+template <typename T, unsigned N>
+struct ShmRing {
+	static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+	alignas(64) std::atomic<unsigned long long> head;  // 書き手が進める
+	alignas(64) unsigned long long cached_tail;        // 書き手だけが触る
+	alignas(64) std::atomic<unsigned long long> tail;  // 読み手が進める
+	alignas(64) unsigned long long cached_head;        // 読み手だけが触る
+	alignas(64) T slots[N];
+
+	void Init(void)
+	{
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		cached_tail = 0;
+		cached_head = 0;
+	}
+
+	// 満杯なら 0 を返す
+
+	int Push(const T &message)
+	{
+		unsigned long long h = head.load(std::memory_order_relaxed);
+		if (h - cached_tail == N) {
+			cached_tail = tail.load(std::memory_order_acquire);
+			if (h - cached_tail == N) {
+				return 0;
+			}
+		}
+		slots[h & (N - 1)] = message;
+		head.store(h + 1, std::memory_order_release);
+		return 1;
+	}
+
+	// 空なら 0 を返す
+
+	int Pop(T *message)
+	{
+		unsigned long long t = tail.load(std::memory_order_relaxed);
+		if (t == cached_head) {
+			cached_head = head.load(std::memory_order_acquire);
+			if (t == cached_head) {
+				return 0;
+			}
+		}
+		*message = slots[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return 1;
+	}
+};
+
+static_assert(std::atomic<unsigned long long>::is_always_lock_free,
+	"shared memory rings need lock-free 64-bit atomics");
+
+
+
+// 共有メモリ /////////////////////////////////////////////////////////////////
+
+const unsigned int ARM_CHANNEL_MAGIC = 0x41524d43; // "ARMC"
+const unsigned int ARM_CHANNEL_VERSION = 1;
+const unsigned ARM_CHANNEL_CAPACITY = 4096;
+
+struct ArmChannel {
+	std::atomic<unsigned int> magic;  // 初期化が終わってから書く
+	unsigned int version;
+	ShmRing<TargetMessage, ARM_CHANNEL_CAPACITY> targets;
+	ShmRing<StatusMessage, ARM_CHANNEL_CAPACITY> status;
+};
+
+// name ("/arm" など) の共有メモリを開く．まだ無ければ作って初期化する．
+// 失敗したら NULL
+
+inline ArmChannel *OpenArmChannel(const char *name)
+{
+	int created = 1;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		created = 0;
+		fd = shm_open(name, O_RDWR, 0600);
+	}
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+	if (created && ftruncate(fd, sizeof(ArmChannel)) != 0) {
+		perror(name);
+		close(fd);
+		return NULL;
+	}
+
+	// 相手が作ったばかりなら大きさが決まるまで待つ
+
+	struct stat st;
+	for (int i = 0; fstat(fd, &st) == 0 && st.st_size < (off_t) sizeof(ArmChannel); i++) {
+		if (i == 1000) {
+			fprintf(stderr, "%s: size mismatch\n", name);
+			close(fd);
+			return NULL;
+		}
+		usleep(1000);
+	}
+
+	void *p = mmap(NULL, sizeof(ArmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(name);
+		return NULL;
+	}
+
+	ArmChannel *channel = (ArmChannel *) p;
+	if (created) {
+		channel->version = ARM_CHANNEL_VERSION;
+		channel->targets.Init();
+		channel->status.Init();
+		channel->magic.store(ARM_CHANNEL_MAGIC, std::memory_order_release);
+	} else {
+		for (int i = 0; channel->magic.load(std::memory_order_acquire) != ARM_CHANNEL_MAGIC; i++) {
+			if (i == 1000) {
+				fprintf(stderr, "%s: not an arm channel\n", name);
+				munmap(p, sizeof(ArmChannel));
+				return NULL;
+			}
+			usleep(1000);
+		}
+		if (channel->version != ARM_CHANNEL_VERSION) {
+			fprintf(stderr, "%s: version %u, expected %u\n", name,
+				channel->version, ARM_CHANNEL_VERSION);
+			munmap(p, sizeof(ArmChannel));
+			return NULL;
+		}
+	}
+	return channel;
+}
+
+inline void CloseArmChannel(ArmChannel *channel)
+{
+	munmap(channel, sizeof(ArmChannel));
+}
+
+#endif // SHM_CHANNEL_H
@@ -0,0 +1,429 @@
+// snapshot.h
+//
+// 場面のスナップショット (バイナリ形式)
+//
+// 場面を作り直さずに始められるよう，状態の配列とメッシュをそのまま
+// ファイルに書く．ファイルは見出し，節の表，節の中身の順に並ぶ．
+// 節は名前 (tag) と要素の大きさ・個数を持ち，中身は 64 バイト境界に置く．
+// 読むときはファイルを mmap して検査するだけで，解釈 (parse) はしない．
+// メッシュはマップした領域をそのまま指すので，起動時にテッセレーションが
+// 要らない．
+//
+// 書式を変えたら SNAPSHOT_VERSION を上げる．構造体の大きさは節ごとに
+// 確かめるので，版が同じでも合わない節は読まない．バイト順はこの
+// マシンのままで，違うバイト順のファイルは拒む．
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "mesh.h"
+
+
+
+// 書式 ///////////////////////////////////////////////////////////////////////
+
+const char SNAPSHOT_MAGIC[8] = {'G', 'L', 'U', 'T', 'S', 'N', 'A', 'P'};
+const unsigned int SNAPSHOT_VERSION = 1;
+const unsigned int SNAPSHOT_BYTE_ORDER = 0x01020304;
+const unsigned long long SNAPSHOT_ALIGNMENT = 64;
+const int SNAPSHOT_TAG_LENGTH = 16;
+
+struct SnapshotHeader {
+	char magic[8];
+	unsigned int version;
+	unsigned int byte_order;         // 書いたマシンで SNAPSHOT_BYTE_ORDER
+	unsigned int section_size;       // sizeof(SnapshotSection)
+	unsigned int num_sections;
+	unsigned long long file_size;
+};
+
+struct SnapshotSection {
+	char tag[SNAPSHOT_TAG_LENGTH];   // "arm.state" など．NUL で終わる
+	unsigned long long offset;       // ファイルの先頭から
+	unsigned long long count;
+	unsigned int element_size;
+	unsigned int reserved;
+};
+
+inline unsigned long long AlignSnapshotOffset(const unsigned long long offset)
+{
+	return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+}
+
+
+
+// 書き出し ///////////////////////////////////////////////////////////////////
+
+// 節を並べてから WriteSnapshot() で一度に書く．AddSnapshotSection() に渡した
+// 領域は書き終えるまで生かしておく．AllocSnapshotSection() の領域は
+// 書き手が持つ
+
+struct SnapshotWriter {
+	std::vector<SnapshotSection> sections;
+	std::vector<const void *> data;
+	std::vector<std::vector<unsigned char> > owned;
+};
+
+inline void AddSnapshotSection(SnapshotWriter *writer, const char *tag,
+	const void *data, const unsigned int element_size, const unsigned long long count)
+{
+	SnapshotSection section;
+	memset(&section, 0, sizeof(section));
+	size_t length = strlen(tag);
+	memcpy(section.tag, tag, std::min(length, (size_t) SNAPSHOT_TAG_LENGTH - 1));
+	section.count = count;
+	section.element_size = element_size;
+	writer->sections.push_back(section);
+	writer->data.push_back(data);
+}
+
+inline void *AllocSnapshotSection(SnapshotWriter *writer, const char *tag,
+	const unsigned int element_size, const unsigned long long count)
+{
+	writer->owned.push_back(std::vector<unsigned char>(element_size * count));
+	void *data = writer->owned.back().data();
+	AddSnapshotSection(writer, tag, data, element_size, count);
+	return data;
+}
+
+template <typename T>
+inline void AddSnapshotVector(SnapshotWriter *writer, const char *tag,
+	const std::vector<T> &v)
+{
+	AddSnapshotSection(writer, tag, v.data(), sizeof(T), v.size());
+}
+
+// 一時ファイルに書いてから置き換える．いま別のプロセス (や自分) がマップ
+// しているファイルは中身が変わらずに残る．失敗したら -1
+
+inline int WriteSnapshot(SnapshotWriter *writer, const char *path)
+{
+	unsigned long long offset = AlignSnapshotOffset(sizeof(SnapshotHeader)
+		+ writer->sections.size() * sizeof(SnapshotSection));
+	for (size_t i = 0; i < writer->sections.size(); i++) {
+		SnapshotSection &section = writer->sections[i];
+		section.offset = offset;
+		offset = AlignSnapshotOffset(offset + section.count * section.element_size);
+	}
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.section_size = sizeof(SnapshotSection);
+	header.num_sections = writer->sections.size();
+	header.file_size = offset;
+
+	std::vector<char> temp_path(strlen(path) + 5);
+	snprintf(temp_path.data(), temp_path.size(), "%s.tmp", path);
+	FILE *fp = fopen(temp_path.data(), "wb");
+	if (!fp) {
+		perror(temp_path.data());
+		return -1;
+	}
+
+	// 節の間の隙間は 0 で埋める
+
+	static const char zeros[SNAPSHOT_ALIGNMENT] = {};
+	unsigned long long written = 0;
+	int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	written += sizeof(header);
+	if (!writer->sections.empty()) {
+		ok = ok && fwrite(writer->sections.data(), sizeof(SnapshotSection),
+			writer->sections.size(), fp) == writer->sections.size();
+		written += writer->sections.size() * sizeof(SnapshotSection);
+	}
+	for (size_t i = 0; ok && i < writer->sections.size(); i++) {
+		const SnapshotSection &section = writer->sections[i];
+		unsigned long long size = section.count * section.element_size;
+		ok = fwrite(zeros, 1, section.offset - written, fp) == section.offset - written;
+		ok = ok && (size == 0 || fwrite(writer->data[i], 1, size, fp) == size);
+		written = section.offset + size;
+	}
+	ok = ok && fwrite(zeros, 1, header.file_size - written, fp) == header.file_size - written;
+	if (fclose(fp) != 0) {
+		ok = 0;
+	}
+	if (!ok || rename(temp_path.data(), path) != 0) {
+		perror(path);
+		unlink(temp_path.data());
+		return -1;
+	}
+	return 0;
+}
+
+
+
+// 読み込み ///////////////////////////////////////////////////////////////////
+
+struct Snapshot {
+	const unsigned char *data;       // マップした領域．NULL なら開いていない
+	unsigned long long size;
+	const SnapshotHeader *header;
+	const SnapshotSection *sections;
+};
+
+inline void CloseSnapshot(Snapshot *snapshot)
+{
+	if (snapshot->data) {
+		munmap((void *) snapshot->data, snapshot->size);
+	}
+	snapshot->data = NULL;
+}
+
+// path を読み出し専用でマップし，見出しと節の表を確かめる．失敗したら -1
+
+inline int OpenSnapshot(Snapshot *snapshot, const char *path)
+{
+	snapshot->data = NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	if (st.st_size < (off_t) sizeof(SnapshotHeader)) {
+		fprintf(stderr, "%s: not a snapshot\n", path);
+		close(fd);
+		return -1;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	snapshot->data = (const unsigned char *) p;
+	snapshot->size = st.st_size;
+	snapshot->header = (const SnapshotHeader *) p;
+	snapshot->sections = (const SnapshotSection *) (snapshot->header + 1);
+
+	const SnapshotHeader &header = *snapshot->header;
+	const char *error = NULL;
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+		error = "not a snapshot";
+	} else if (header.byte_order != SNAPSHOT_BYTE_ORDER) {
+		error = "written with another byte order";
+	} else if (header.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "%s: version %u, expected %u\n", path,
+			header.version, SNAPSHOT_VERSION);
+		CloseSnapshot(snapshot);
+		return -1;
+	} else if (header.section_size != sizeof(SnapshotSection)
+		|| header.file_size != snapshot->size
+		|| sizeof(SnapshotHeader) + (unsigned long long) header.num_sections
+			* sizeof(SnapshotSection) > snapshot->size) {
+		error = "truncated or damaged";
+	}
+
+	// 節が全部ファイルに収まり，境界が揃っていること
+
+	for (unsigned int i = 0; !error && i < header.num_sections; i++) {
+		const SnapshotSection &section = snapshot->sections[i];
+		if (section.tag[SNAPSHOT_TAG_LENGTH - 1] != '\0'
+			|| section.offset % SNAPSHOT_ALIGNMENT != 0
+			|| section.offset > snapshot->size
+			|| (section.element_size != 0
+				&& section.count > (snapshot->size - section.offset) / section.element_size)) {
+			error = "truncated or damaged";
+		}
+	}
+	if (error) {
+		fprintf(stderr, "%s: %s\n", path, error);
+		CloseSnapshot(snapshot);
+		return -1;
+	}
+	return 0;
+}
+
+// tag の節の中身を返す．無いか，要素の大きさが違えば NULL
+
+inline const void *FindSnapshotSection(const Snapshot &snapshot, const char *tag,
+	const unsigned int element_size, unsigned long long *count)
+{
+	*count = 0;
+	for (unsigned int i = 0; i < snapshot.header->num_sections; i++) {
+		const SnapshotSection &section = snapshot.sections[i];
+		if (strncmp(section.tag, tag, SNAPSHOT_TAG_LENGTH) != 0) {
+			continue;
+		}
+		if (section.element_size != element_size) {
+			fprintf(stderr, "snapshot: %s has %u-byte elements, expected %u\n",
+				tag, section.element_size, element_size);
+			return NULL;
+		}
+		*count = section.count;
+		return snapshot.data + section.offset;
+	}
+	return NULL;
+}
+
+// 要素がちょうど一つの節を value へ写す．無ければ -1
+
+template <typename T>
+inline int ReadSnapshotValue(const Snapshot &snapshot, const char *tag, T *value)
+{
+	unsigned long long count;
+	const void *p = FindSnapshotSection(snapshot, tag, sizeof(T), &count);
+	if (!p || count != 1) {
+		return -1;
+	}
+	memcpy(value, p, sizeof(T));
+	return 0;
+}
+
+// count 個の要素の節を v へ写す．無いか，個数が違えば -1
+
+template <typename T>
+inline int ReadSnapshotVector(const Snapshot &snapshot, const char *tag,
+	const unsigned long long count, std::vector<T> *v)
+{
+	unsigned long long n;
+	const T *p = (const T *) FindSnapshotSection(snapshot, tag, sizeof(T), &n);
+	if (!p || n != count) {
+		return -1;
+	}
+	v->assign(p, p + n);
+	return 0;
+}
+
+
+
+// メッシュ ///////////////////////////////////////////////////////////////////
+
+// 段ごとの大きさと，共通の配列の中での位置 (要素の番号)
+
+struct MeshLodRecord {
+	int num_levels;
+	int num_vertices[MAX_LOD_LEVELS];
+	int num_indices[MAX_LOD_LEVELS];
+	unsigned long long vertex_offset[MAX_LOD_LEVELS]; // mesh.vertices, mesh.normals
+	unsigned long long index_offset[MAX_LOD_LEVELS];  // mesh.indices
+	GLfloat min_pixels[MAX_LOD_LEVELS];
+	GLfloat center[3];
+	GLfloat radius;
+};
+
+// すべてのメッシュを四つの節に詰める．頂点と法線と添字は全段をつなげる
+
+inline void AddMeshSnapshot(SnapshotWriter *writer)
+{
+	MeshLodRecord *records = (MeshLodRecord *) AllocSnapshotSection(writer,
+		"mesh.lod", sizeof(MeshLodRecord), NUM_MESHES);
+	unsigned long long num_vertices = 0, num_indices = 0;
+	for (int i = 0; i < NUM_MESHES; i++) {
+		const MeshLod &lod = meshes[i];
+		MeshLodRecord &record = records[i];
+		memset(&record, 0, sizeof(record));
+		record.num_levels = lod.num_levels;
+		for (int l = 0; l < lod.num_levels; l++) {
+			record.num_vertices[l] = lod.levels[l].num_vertices;
+			record.num_indices[l] = lod.levels[l].num_indices;
+			record.vertex_offset[l] = num_vertices * 3;
+			record.index_offset[l] = num_indices;
+			record.min_pixels[l] = lod.min_pixels[l];
+			num_vertices += lod.levels[l].num_vertices;
+			num_indices += lod.levels[l].num_indices;
+		}
+		memcpy(record.center, lod.center, sizeof(record.center));
+		record.radius = lod.radius;
+	}
+
+	GLfloat *vertices = (GLfloat *) AllocSnapshotSection(writer, "mesh.vertices",
+		sizeof(GLfloat), num_vertices * 3);
+	GLfloat *normals = (GLfloat *) AllocSnapshotSection(writer, "mesh.normals",
+		sizeof(GLfloat), num_vertices * 3);
+	GLuint *indices = (GLuint *) AllocSnapshotSection(writer, "mesh.indices",
+		sizeof(GLuint), num_indices);
+	for (int i = 0; i < NUM_MESHES; i++) {
+		for (int l = 0; l < meshes[i].num_levels; l++) {
+			const Mesh &mesh = meshes[i].levels[l];
+			memcpy(vertices + records[i].vertex_offset[l], mesh.vertices,
+				mesh.num_vertices * 3 * sizeof(GLfloat));
+			memcpy(normals + records[i].vertex_offset[l], mesh.normals,
+				mesh.num_vertices * 3 * sizeof(GLfloat));
+			memcpy(indices + records[i].index_offset[l], mesh.indices,
+				mesh.num_indices * sizeof(GLuint));
+		}
+	}
+}
+
+// メッシュの配列をマップした領域に向ける．InitMeshes() の代わりに，描画の
+// 初期化より前に呼ぶ．snapshot は閉じずに生かしておく．
+// メッシュの節が無いか，合わなければ -1 で，meshes[] には触らない
+
+inline int LoadMeshSnapshot(const Snapshot &snapshot)
+{
+	unsigned long long num_records, num_vertices, num_normals, num_indices;
+	const MeshLodRecord *records = (const MeshLodRecord *) FindSnapshotSection(
+		snapshot, "mesh.lod", sizeof(MeshLodRecord), &num_records);
+	const GLfloat *vertices = (const GLfloat *) FindSnapshotSection(
+		snapshot, "mesh.vertices", sizeof(GLfloat), &num_vertices);
+	const GLfloat *normals = (const GLfloat *) FindSnapshotSection(
+		snapshot, "mesh.normals", sizeof(GLfloat), &num_normals);
+	const GLuint *indices = (const GLuint *) FindSnapshotSection(
+		snapshot, "mesh.indices", sizeof(GLuint), &num_indices);
+	if (!records || !vertices || !normals || !indices
+		|| num_records != NUM_MESHES || num_normals != num_vertices) {
+		return -1;
+	}
+
+	// 添字が頂点の範囲を越えないことまで確かめてから使う
+
+	for (int i = 0; i < NUM_MESHES; i++) {
+		const MeshLodRecord &record = records[i];
+		if (record.num_levels < 1 || record.num_levels > MAX_LOD_LEVELS) {
+			return -1;
+		}
+		for (int l = 0; l < record.num_levels; l++) {
+			if (record.num_vertices[l] < 0 || record.num_indices[l] < 0
+				|| record.vertex_offset[l] + record.num_vertices[l] * 3ull > num_vertices
+				|| record.index_offset[l] + record.num_indices[l] > num_indices) {
+				return -1;
+			}
+			const GLuint *idx = indices + record.index_offset[l];
+			for (int k = 0; k < record.num_indices[l]; k++) {
+				if (idx[k] >= (GLuint) record.num_vertices[l]) {
+					return -1;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < NUM_MESHES; i++) {
+		const MeshLodRecord &record = records[i];
+		MeshLod &lod = meshes[i];
+		lod.num_levels = record.num_levels;
+		for (int l = 0; l < record.num_levels; l++) {
+			Mesh &mesh = lod.levels[l];
+			mesh.num_vertices = record.num_vertices[l];
+			mesh.num_indices = record.num_indices[l];
+			mesh.vertices = (GLfloat *) vertices + record.vertex_offset[l];
+			mesh.normals = (GLfloat *) normals + record.vertex_offset[l];
+			mesh.indices = (GLuint *) indices + record.index_offset[l];
+			lod.min_pixels[l] = record.min_pixels[l];
+		}
+		memcpy(lod.center, record.center, sizeof(lod.center));
+		lod.radius = record.radius;
+	}
+	return 0;
+}
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,711 @@
+// soft_raster.h
+//
+// 描画コマンドを CPU だけで描くソフトウェアラスタライザ
+//
+// GPU の無い計算機では，OpenGL の固定機能パイプラインもホストの
+// ソフトウェア実装 (単一スレッド) で動くことになる．ここでは draw_list.h の
+// コマンド列を受け取り，render_core.h のシェーダと同じ式で頂点ごとに
+// 陰影を付け (グーローシェーディング)，画面を TILE_SIZE 四方のタイルに
+// 分けて全コアで塗る．最後に glDrawPixels() で一度だけ画面に転送する．
+//
+// 処理は二段に分かれる．
+//   1. 頂点処理: コマンドをスレッド数に分け，座標変換・陰影付け・近平面での
+//      クリッピングを行って，三角形を重なるタイルに振り分ける
+//   2. 画素処理: タイルを取り合いながら，タイルごとの Z バッファで塗る．
+//      辺関数と Z・色の補間は SSE で横 4 画素ずつ求める
+
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <GL/glut.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "draw_list.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+
+
+// 描画状態 ///////////////////////////////////////////////////////////////////
+
+const int TILE_SIZE = 64;
+
+// ソフトウェア描画に必要な描画状態．CaptureSoftRasterState() で
+// render_core.h の現在の状態から写し取るか，直接値を入れて使う
+
+struct SoftRasterState {
+	GLfloat projection[16];
+	GLint viewport[4];
+	GLfloat light_position[4]; // 視点座標系
+	GLfloat light_ambient[4];
+	GLfloat light_diffuse[4];
+	GLfloat light_specular[4];
+	GLfloat model_ambient[4];  // GL_LIGHT_MODEL_AMBIENT
+	GLfloat clear_color[4];
+	int cull_back_faces;
+};
+
+inline void CaptureSoftRasterState(SoftRasterState *state)
+{
+	for (int i = 0; i < 16; i++) {
+		state->projection[i] = render_projection[i];
+	}
+	for (int k = 0; k < 4; k++) {
+		state->viewport[k] = render_viewport[k];
+		state->light_position[k] = render_light.position[k];
+		state->light_ambient[k] = render_light.ambient[k];
+		state->light_diffuse[k] = render_light.diffuse[k];
+		state->light_specular[k] = render_light.specular[k];
+		state->model_ambient[k] = RENDER_MODEL_AMBIENT[k];
+		state->clear_color[k] = render_clear_color[k];
+	}
+	state->cull_back_faces = glIsEnabled(GL_CULL_FACE);
+}
+
+
+
+// 三角形とタイル /////////////////////////////////////////////////////////////
+
+// 画面座標での三角形．辺関数と，画面上で線形な量 (Z, 1/w, 色/w) の平面式
+// a * x + b * y + c を持つ
+
+struct SoftTriangle {
+	GLfloat edge[3][3];
+	GLfloat z[3];
+	GLfloat inv_w[3];
+	GLfloat r[3], g[3], b[3];
+	int top_left[3]; // 辺上の画素を含めるか (左上規則)
+	int min_x, min_y, max_x, max_y;
+};
+
+// 頂点処理を受け持つスレッドごとの作業領域
+
+struct SoftRasterWorker {
+	std::vector<SoftTriangle> triangles;
+	std::vector<std::vector<int> > bins; // タイルごとの三角形番号
+	std::vector<GLfloat> clip;           // 頂点のクリップ座標 (xyzw)
+	std::vector<GLfloat> color;          // 頂点の色 (rgb)
+};
+
+struct SoftRasterStats {
+	int threads;
+	int triangles;      // 裏面・画面外を除いて振り分けた三角形の数
+	int tiles;
+	double geometry_ms;
+	double raster_ms;
+	double present_ms;
+};
+
+static SoftRasterState soft_state;
+static SoftRasterStats soft_raster_stats;
+
+static int soft_width, soft_height;
+static int soft_tiles_x, soft_tiles_y;
+static unsigned char *soft_color;  // RGBA，下の行から (glDrawPixels の並び)
+static GLfloat *soft_depth;        // タイルごとに連続した Z バッファ
+
+static const unsigned long long *soft_keys;
+static int soft_num_commands;
+static std::vector<SoftRasterWorker> soft_workers;
+static std::atomic<int> soft_next_tile;
+
+// 画面の大きさが変わったときだけ確保し直す
+
+inline void ResizeSoftTarget(const int width, const int height)
+{
+	if (width == soft_width && height == soft_height) {
+		return;
+	}
+	soft_width = width;
+	soft_height = height;
+	soft_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	soft_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	delete [] soft_color;
+	delete [] soft_depth;
+	soft_color = new unsigned char[width * height * 4];
+	soft_depth = new GLfloat[soft_tiles_x * soft_tiles_y * TILE_SIZE * TILE_SIZE];
+
+	for (size_t i = 0; i < soft_workers.size(); i++) {
+		soft_workers[i].bins.assign(soft_tiles_x * soft_tiles_y, std::vector<int>());
+	}
+}
+
+
+
+// スレッド ///////////////////////////////////////////////////////////////////
+
+// worker_pool.h のスレッドを soft_threads 本使う．
+// スレッド数は SOFT_RASTER_THREADS 環境変数，なければコア数
+
+static int soft_threads;
+
+inline void InitSoftRaster(void)
+{
+	if (soft_threads) {
+		return;
+	}
+	soft_threads = InitWorkerPool("SOFT_RASTER_THREADS");
+	soft_workers.resize(soft_threads);
+}
+
+
+
+// 頂点処理 ///////////////////////////////////////////////////////////////////
+
+// render_core.h のシェーダ (固定機能パイプライン) と同じ式で，
+// 視点座標系の点 p，法線 n の色を求める
+
+inline void ShadeVertex(const Material &m, const GLfloat p[3], const GLfloat n[3],
+	GLfloat color[3])
+{
+	const SoftRasterState &s = soft_state;
+	const GLfloat ratio = MATERIAL_AMBIENT_RATIO;
+	const GLfloat diffuse[3] = {m.r, m.g, m.b};
+
+	// 光源の方向 (w = 0 なら平行光源)
+
+	GLfloat l[3];
+	for (int k = 0; k < 3; k++) {
+		l[k] = s.light_position[3] == 0.0f ? s.light_position[k]
+			: s.light_position[k] - p[k];
+	}
+	GLfloat len = sqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+	for (int k = 0; k < 3; k++) {
+		l[k] /= len;
+	}
+	GLfloat n_dot_l = n[0] * l[0] + n[1] * l[1] + n[2] * l[2];
+
+	// 鏡面反射は視線を (0, 0, 1) とした中間ベクトルで求める
+
+	GLfloat specular = 0.0f;
+	if (n_dot_l > 0.0f) {
+		GLfloat h[3] = {l[0], l[1], l[2] + 1.0f};
+		GLfloat h_len = sqrt(h[0] * h[0] + h[1] * h[1] + h[2] * h[2]);
+		GLfloat n_dot_h = (n[0] * h[0] + n[1] * h[1] + n[2] * h[2]) / h_len;
+		if (n_dot_h > 0.0f) {
+			specular = pow(n_dot_h, m.shininess);
+		}
+	} else {
+		n_dot_l = 0.0f;
+	}
+
+	for (int k = 0; k < 3; k++) {
+		GLfloat c = diffuse[k] * ratio * (s.model_ambient[k] + s.light_ambient[k])
+			+ diffuse[k] * n_dot_l * s.light_diffuse[k]
+			+ specular * s.light_specular[k];
+		color[k] = c < 1.0f ? c : 1.0f;
+	}
+}
+
+// クリップ座標の頂点．近平面で切るときに補間する
+
+struct ClipVertex {
+	GLfloat x, y, z, w;
+	GLfloat r, g, b;
+};
+
+inline ClipVertex LerpClipVertex(const ClipVertex &a, const ClipVertex &b,
+	const GLfloat t)
+{
+	ClipVertex v;
+	v.x = a.x + (b.x - a.x) * t;
+	v.y = a.y + (b.y - a.y) * t;
+	v.z = a.z + (b.z - a.z) * t;
+	v.w = a.w + (b.w - a.w) * t;
+	v.r = a.r + (b.r - a.r) * t;
+	v.g = a.g + (b.g - a.g) * t;
+	v.b = a.b + (b.b - a.b) * t;
+	return v;
+}
+
+// 画面座標の三角形を作ってタイルに振り分ける
+
+inline void SetupTriangle(SoftRasterWorker &worker, const ClipVertex *cv[3])
+{
+	const SoftRasterState &s = soft_state;
+	GLfloat x[3], y[3], z[3], iw[3];
+	for (int i = 0; i < 3; i++) {
+		iw[i] = 1.0f / cv[i]->w;
+		x[i] = (cv[i]->x * iw[i] + 1.0f) * 0.5f * s.viewport[2] + s.viewport[0];
+		y[i] = (cv[i]->y * iw[i] + 1.0f) * 0.5f * s.viewport[3] + s.viewport[1];
+		z[i] = (cv[i]->z * iw[i] + 1.0f) * 0.5f;
+	}
+
+	// 反時計回りが表．裏面と面積 0 は捨てる
+
+	GLfloat area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area == 0.0f || (area < 0.0f && s.cull_back_faces)) {
+		return;
+	}
+	if (area < 0.0f) {
+		// 裏面を描くときは頂点の順を入れ替えて表にする
+
+		const ClipVertex *t = cv[1];
+		cv[1] = cv[2];
+		cv[2] = t;
+		SetupTriangle(worker, cv);
+		return;
+	}
+
+	// 画素の中心 (x + 0.5, y + 0.5) が入る範囲
+
+	GLfloat lo_x = fmin(x[0], fmin(x[1], x[2]));
+	GLfloat hi_x = fmax(x[0], fmax(x[1], x[2]));
+	GLfloat lo_y = fmin(y[0], fmin(y[1], y[2]));
+	GLfloat hi_y = fmax(y[0], fmax(y[1], y[2]));
+	SoftTriangle t;
+	t.min_x = (int) fmax(ceil(lo_x - 0.5f), 0.0f);
+	t.min_y = (int) fmax(ceil(lo_y - 0.5f), 0.0f);
+	t.max_x = (int) fmin(floor(hi_x - 0.5f), soft_width - 1.0f);
+	t.max_y = (int) fmin(floor(hi_y - 0.5f), soft_height - 1.0f);
+	if (t.min_x > t.max_x || t.min_y > t.max_y) {
+		return;
+	}
+
+	// 辺 i は頂点 i の向かいの辺 (i+1 -> i+2)．内側が正
+
+	GLfloat inv_area = 1.0f / area;
+	for (int i = 0; i < 3; i++) {
+		int a = (i + 1) % 3, b = (i + 2) % 3;
+		GLfloat ea = y[a] - y[b];
+		GLfloat eb = x[b] - x[a];
+		t.edge[i][0] = ea;
+		t.edge[i][1] = eb;
+		t.edge[i][2] = -(ea * x[a] + eb * y[a]);
+		t.top_left[i] = (ea > 0.0f) || (ea == 0.0f && eb < 0.0f);
+	}
+
+	// 重心座標 w_i = edge_i / area から各量の平面式を作る
+
+	GLfloat zv[3], rv[3], gv[3], bv[3];
+	for (int i = 0; i < 3; i++) {
+		zv[i] = z[i];
+		rv[i] = cv[i]->r * iw[i];
+		gv[i] = cv[i]->g * iw[i];
+		bv[i] = cv[i]->b * iw[i];
+	}
+	GLfloat *dst[5] = {t.z, t.inv_w, t.r, t.g, t.b};
+	const GLfloat *src[5] = {zv, iw, rv, gv, bv};
+	for (int q = 0; q < 5; q++) {
+		for (int k = 0; k < 3; k++) {
+			dst[q][k] = (src[q][0] * t.edge[0][k] + src[q][1] * t.edge[1][k]
+				+ src[q][2] * t.edge[2][k]) * inv_area;
+		}
+	}
+
+	int index = worker.triangles.size();
+	worker.triangles.push_back(t);
+	for (int ty = t.min_y / TILE_SIZE; ty <= t.max_y / TILE_SIZE; ty++) {
+		for (int tx = t.min_x / TILE_SIZE; tx <= t.max_x / TILE_SIZE; tx++) {
+			worker.bins[ty * soft_tiles_x + tx].push_back(index);
+		}
+	}
+}
+
+// 近平面 (z >= -w) で切ってから三角形を作る
+
+inline void ClipTriangle(SoftRasterWorker &worker, const ClipVertex &a,
+	const ClipVertex &b, const ClipVertex &c)
+{
+	const ClipVertex *in[3] = {&a, &b, &c};
+	ClipVertex out[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		const ClipVertex &p = *in[i];
+		const ClipVertex &q = *in[(i + 1) % 3];
+		GLfloat dp = p.z + p.w;
+		GLfloat dq = q.z + q.w;
+		if (dp >= 0.0f) {
+			out[n++] = p;
+		}
+		if ((dp >= 0.0f) != (dq >= 0.0f)) {
+			out[n++] = LerpClipVertex(p, q, dp / (dp - dq));
+		}
+	}
+	for (int i = 1; i + 1 < n; i++) {
+		const ClipVertex *tri[3] = {&out[0], &out[i], &out[i + 1]};
+		SetupTriangle(worker, tri);
+	}
+}
+
+// 一つのコマンドの頂点を処理する
+
+inline void ProcessCommand(SoftRasterWorker &worker, const DrawCommand &cmd)
+{
+	const Mesh &mesh = meshes[cmd.mesh].levels[cmd.lod];
+	const Material &material = material_table[cmd.material];
+	const GLfloat *m = cmd.matrix;
+	const GLfloat *p = soft_state.projection;
+
+	// 法線はシェーダと同じ左上 3x3 の逆転置行列で移す (長さは後で正規化)
+
+	GLfloat nm[9];
+	NormalMatrix(m, nm);
+
+	worker.clip.resize(mesh.num_vertices * 4);
+	worker.color.resize(mesh.num_vertices * 3);
+
+	for (int i = 0; i < mesh.num_vertices; i++) {
+		const GLfloat *v = mesh.vertices + i * 3;
+		const GLfloat *vn = mesh.normals + i * 3;
+
+		GLfloat e[3], n[3];
+		for (int k = 0; k < 3; k++) {
+			e[k] = m[k] * v[0] + m[4 + k] * v[1] + m[8 + k] * v[2] + m[12 + k];
+		}
+		for (int k = 0; k < 3; k++) {
+			n[k] = nm[k] * vn[0] + nm[3 + k] * vn[1] + nm[6 + k] * vn[2];
+		}
+		GLfloat len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len > 0.0f) {
+			for (int k = 0; k < 3; k++) {
+				n[k] /= len;
+			}
+		}
+
+		ShadeVertex(material, e, n, &worker.color[i * 3]);
+
+		GLfloat *c = &worker.clip[i * 4];
+		for (int k = 0; k < 4; k++) {
+			c[k] = p[k] * e[0] + p[4 + k] * e[1] + p[8 + k] * e[2] + p[12 + k];
+		}
+	}
+
+	for (int i = 0; i < mesh.num_indices; i += 3) {
+		ClipVertex cv[3];
+		for (int k = 0; k < 3; k++) {
+			int index = mesh.indices[i + k];
+			const GLfloat *c = &worker.clip[index * 4];
+			const GLfloat *col = &worker.color[index * 3];
+			cv[k].x = c[0];
+			cv[k].y = c[1];
+			cv[k].z = c[2];
+			cv[k].w = c[3];
+			cv[k].r = col[0];
+			cv[k].g = col[1];
+			cv[k].b = col[2];
+		}
+		if (cv[0].z + cv[0].w >= 0.0f && cv[1].z + cv[1].w >= 0.0f
+			&& cv[2].z + cv[2].w >= 0.0f) {
+			const ClipVertex *tri[3] = {&cv[0], &cv[1], &cv[2]};
+			SetupTriangle(worker, tri);
+		} else {
+			ClipTriangle(worker, cv[0], cv[1], cv[2]);
+		}
+	}
+}
+
+// 並べ替えたコマンド列を連続した区間に分けて処理する．区間の順は保たれるので，
+// タイルでスレッド番号順に塗れば GL と同じ順に描いたことになる
+
+inline void GeometryJob(const int index)
+{
+	TRACE_SCOPE("GeometryJob");
+	SoftRasterWorker &worker = soft_workers[index];
+	worker.triangles.clear();
+	for (size_t i = 0; i < worker.bins.size(); i++) {
+		worker.bins[i].clear();
+	}
+
+	int n = soft_threads;
+	int begin = (long long) soft_num_commands * index / n;
+	int end = (long long) soft_num_commands * (index + 1) / n;
+	for (int i = begin; i < end; i++) {
+		ProcessCommand(worker, draw_commands[SortedCommand(soft_keys, i)]);
+	}
+}
+
+
+
+// 画素処理 ///////////////////////////////////////////////////////////////////
+
+inline unsigned char ToByte(const GLfloat c)
+{
+	return (unsigned char) (c * 255.0f + 0.5f);
+}
+
+// 三角形の tile 内の部分を塗る．depth はタイルの Z バッファ
+
+inline void RasterizeTriangle(const SoftTriangle &t, const int tile_x0,
+	const int tile_y0, GLfloat *depth)
+{
+	int x0 = t.min_x > tile_x0 ? t.min_x : tile_x0;
+	int y0 = t.min_y > tile_y0 ? t.min_y : tile_y0;
+	int x1 = t.max_x < tile_x0 + TILE_SIZE - 1 ? t.max_x : tile_x0 + TILE_SIZE - 1;
+	int y1 = t.max_y < tile_y0 + TILE_SIZE - 1 ? t.max_y : tile_y0 + TILE_SIZE - 1;
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	// 4 画素単位で進むので左端を 4 の倍数にそろえる
+
+	x0 = tile_x0 + ((x0 - tile_x0) & ~3);
+
+#ifdef __SSE2__
+	const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 ea[3], eb[3], ec[3], tl[3];
+	for (int i = 0; i < 3; i++) {
+		ea[i] = _mm_set1_ps(t.edge[i][0]);
+		eb[i] = _mm_set1_ps(t.edge[i][1]);
+		ec[i] = _mm_set1_ps(t.edge[i][2]);
+		tl[i] = _mm_castsi128_ps(_mm_set1_epi32(t.top_left[i] ? -1 : 0));
+	}
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 za = _mm_set1_ps(t.z[0]), zb = _mm_set1_ps(t.z[1]),
+		zc = _mm_set1_ps(t.z[2]);
+
+	for (int y = y0; y <= y1; y++) {
+		__m128 py = _mm_set1_ps(y + 0.5f);
+		GLfloat *depth_row = depth + (y - tile_y0) * TILE_SIZE;
+		unsigned char *color_row = soft_color + (size_t) y * soft_width * 4;
+
+		for (int x = x0; x <= x1; x += 4) {
+			__m128 px = _mm_add_ps(_mm_set1_ps((GLfloat) x), lane);
+
+			// 三辺とも内側 (左上規則の辺は 0 も含む) の画素
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int i = 0; i < 3; i++) {
+				__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ea[i], px),
+					_mm_mul_ps(eb[i], py)), ec[i]);
+				__m128 ok = _mm_or_ps(_mm_cmpgt_ps(e, zero),
+					_mm_and_ps(tl[i], _mm_cmpeq_ps(e, zero)));
+				inside = _mm_and_ps(inside, ok);
+			}
+
+			// Z テスト (GL_LESS) と深さの範囲 [0, 1]
+
+			__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(za, px),
+				_mm_mul_ps(zb, py)), zc);
+			GLfloat *d = depth_row + (x - tile_x0);
+			__m128 old = _mm_loadu_ps(d);
+			inside = _mm_and_ps(inside, _mm_cmplt_ps(z, old));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(z, zero));
+			inside = _mm_and_ps(inside, _mm_cmple_ps(z, one));
+
+			int mask = _mm_movemask_ps(inside);
+			if (mask == 0) {
+				continue;
+			}
+			_mm_storeu_ps(d, _mm_or_ps(_mm_and_ps(inside, z),
+				_mm_andnot_ps(inside, old)));
+
+			// 色は (色/w) / (1/w) で透視補正する
+
+			__m128 iw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.inv_w[0]), px),
+				_mm_mul_ps(_mm_set1_ps(t.inv_w[1]), py)), _mm_set1_ps(t.inv_w[2]));
+			__m128 w = _mm_div_ps(one, iw);
+			GLfloat rgb[3][4];
+			const GLfloat *plane[3] = {t.r, t.g, t.b};
+			for (int k = 0; k < 3; k++) {
+				__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[k][0]), px),
+					_mm_mul_ps(_mm_set1_ps(plane[k][1]), py)), _mm_set1_ps(plane[k][2]));
+				c = _mm_min_ps(_mm_max_ps(_mm_mul_ps(c, w), zero), one);
+				_mm_storeu_ps(rgb[k], c);
+			}
+			for (int l = 0; l < 4; l++) {
+				if ((mask & (1 << l)) && x + l < soft_width) {
+					unsigned char *dst = color_row + (x + l) * 4;
+					dst[0] = ToByte(rgb[0][l]);
+					dst[1] = ToByte(rgb[1][l]);
+					dst[2] = ToByte(rgb[2][l]);
+					dst[3] = 255;
+				}
+			}
+		}
+	}
+#else
+	for (int y = y0; y <= y1; y++) {
+		GLfloat py = y + 0.5f;
+		GLfloat *depth_row = depth + (y - tile_y0) * TILE_SIZE;
+		unsigned char *color_row = soft_color + (size_t) y * soft_width * 4;
+
+		for (int x = x0; x <= x1 && x < soft_width; x++) {
+			GLfloat px = x + 0.5f;
+			int inside = 1;
+			for (int i = 0; i < 3; i++) {
+				GLfloat e = t.edge[i][0] * px + t.edge[i][1] * py + t.edge[i][2];
+				inside &= (e > 0.0f) || (e == 0.0f && t.top_left[i]);
+			}
+			GLfloat z = t.z[0] * px + t.z[1] * py + t.z[2];
+			GLfloat &d = depth_row[x - tile_x0];
+			if (!inside || !(z < d) || z < 0.0f || z > 1.0f) {
+				continue;
+			}
+			d = z;
+			GLfloat w = 1.0f / (t.inv_w[0] * px + t.inv_w[1] * py + t.inv_w[2]);
+			const GLfloat *plane[3] = {t.r, t.g, t.b};
+			unsigned char *dst = color_row + x * 4;
+			for (int k = 0; k < 3; k++) {
+				GLfloat c = (plane[k][0] * px + plane[k][1] * py + plane[k][2]) * w;
+				dst[k] = ToByte(c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c));
+			}
+			dst[3] = 255;
+		}
+	}
+#endif
+}
+
+// タイルを一枚ずつ取って，消去してから全スレッドの三角形を順に塗る
+
+inline void RasterJob(int)
+{
+	TRACE_SCOPE("RasterJob");
+	const int num_tiles = soft_tiles_x * soft_tiles_y;
+	const GLfloat *clear = soft_state.clear_color;
+	unsigned char clear_rgba[4] = {ToByte(clear[0]), ToByte(clear[1]),
+		ToByte(clear[2]), ToByte(clear[3])};
+
+	for (;;) {
+		int tile = soft_next_tile.fetch_add(1);
+		if (tile >= num_tiles) {
+			break;
+		}
+		int tile_x0 = (tile % soft_tiles_x) * TILE_SIZE;
+		int tile_y0 = (tile / soft_tiles_x) * TILE_SIZE;
+		GLfloat *depth = soft_depth + (size_t) tile * TILE_SIZE * TILE_SIZE;
+
+		for (int i = 0; i < TILE_SIZE * TILE_SIZE; i++) {
+			depth[i] = 1.0f;
+		}
+		for (int y = tile_y0; y < tile_y0 + TILE_SIZE && y < soft_height; y++) {
+			unsigned char *row = soft_color + ((size_t) y * soft_width + tile_x0) * 4;
+			for (int x = tile_x0; x < tile_x0 + TILE_SIZE && x < soft_width; x++) {
+				memcpy(row, clear_rgba, 4);
+				row += 4;
+			}
+		}
+
+		for (size_t w = 0; w < soft_workers.size(); w++) {
+			const SoftRasterWorker &worker = soft_workers[w];
+			const std::vector<int> &bin = worker.bins[tile];
+			for (size_t i = 0; i < bin.size(); i++) {
+				RasterizeTriangle(worker.triangles[bin[i]], tile_x0, tile_y0, depth);
+			}
+		}
+	}
+}
+
+
+
+// フレームの描画 /////////////////////////////////////////////////////////////
+
+inline double SoftElapsedMs(const std::chrono::steady_clock::time_point &from)
+{
+	return std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - from).count();
+}
+
+// soft_state を設定済みとして，記録したコマンド列を soft_color に描く
+
+inline void RasterizeDrawList(void)
+{
+	TRACE_SCOPE("RasterizeDrawList");
+	InitSoftRaster();
+	ResizeSoftTarget(soft_state.viewport[2], soft_state.viewport[3]);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	soft_keys = SortDrawList();
+	soft_num_commands = num_draw_commands;
+	RunWorkerJob(GeometryJob, soft_threads);
+
+	std::chrono::steady_clock::time_point geometry_end = std::chrono::steady_clock::now();
+	soft_raster_stats.geometry_ms = SoftElapsedMs(start);
+
+	soft_next_tile = 0;
+	RunWorkerJob(RasterJob, soft_threads);
+	soft_raster_stats.raster_ms = SoftElapsedMs(geometry_end);
+
+	soft_raster_stats.threads = soft_threads;
+	soft_raster_stats.tiles = soft_tiles_x * soft_tiles_y;
+	soft_raster_stats.triangles = 0;
+	for (size_t i = 0; i < soft_workers.size(); i++) {
+		soft_raster_stats.triangles += soft_workers[i].triangles.size();
+	}
+
+	draw_list_stats.commands = num_draw_commands;
+	draw_list_stats.material_changes = 0;
+	draw_list_stats.mesh_changes = 0;
+	draw_list_stats.arena_used = frame_arena_used;
+}
+
+// SubmitDrawList() の代わりに呼ぶ．CPU で描いた画像を画面へ転送する
+
+inline void SubmitDrawListSoft(void)
+{
+	CaptureSoftRasterState(&soft_state);
+	soft_state.viewport[0] = 0;
+	soft_state.viewport[1] = 0;
+	RasterizeDrawList();
+
+	TRACE_SCOPE("PresentSoft");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	glRasterPos2f(-1.0f, -1.0f);
+	glDrawPixels(soft_width, soft_height, GL_RGBA, GL_UNSIGNED_BYTE, soft_color);
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+
+	soft_raster_stats.present_ms = SoftElapsedMs(start);
+}
+
+inline void PrintSoftRasterStats(FILE *fp)
+{
+	fprintf(fp, "soft: %d threads, %d triangles, %d tiles, "
+		"geometry %.2f ms, raster %.2f ms, present %.2f ms\n",
+		soft_raster_stats.threads, soft_raster_stats.triangles,
+		soft_raster_stats.tiles, soft_raster_stats.geometry_ms,
+		soft_raster_stats.raster_ms, soft_raster_stats.present_ms);
+}
+
+// 現在の画面を PPM に保存する．GL と CPU の出力を画像で比べるのに使う
+
+inline int SaveFramebufferPPM(const char *filename, const int width,
+	const int height)
+{
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		perror(filename);
+		return 1;
+	}
+	std::vector<unsigned char> pixels(width * height * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+	// PPM は上の行から
+
+	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	for (int y = height - 1; y >= 0; y--) {
+		fwrite(&pixels[(size_t) y * width * 3], 1, width * 3, fp);
+	}
+	fclose(fp);
+	return 0;
+}
+
+#endif // SOFT_RASTER_H
@@ -0,0 +1,302 @@
+// trace.h
+//
+// コールバックやシミュレーションの区間を記録して Chrome の trace 形式で書き出す
+//
+// 区間の始めと終わりの時刻を，スレッドごとの固定長の輪に一件ずつ書く．
+// 輪の書き手はそのスレッドだけなので，記録にロックは要らない．満杯になったら
+// 古いものから上書きし，書き出すときは各スレッドの直近 TRACE_BUFFER_EVENTS
+// 件ほどを読む．
+// 出力は chrome://tracing や https://ui.perfetto.dev でそのまま開ける．
+//
+//   TRACE_SCOPE("Display");        // このブロックの終わりまでを一区間として記録
+//   TRACE_THREAD_NAME("raster 1"); // 表示用のスレッド名
+//
+// 記録は StartTrace() / StopTrace() (キー入力など) か，環境変数
+// GLUT_TRACE=出力先 で起動時から有効にする．NO_TRACE を定義して
+// コンパイルすると，マクロは空になり何も残らない．
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <time.h>
+
+
+
+#ifndef NO_TRACE
+
+// 記録 ///////////////////////////////////////////////////////////////////////
+
+const int TRACE_BUFFER_EVENTS = 1 << 17; // スレッドあたり (24 バイト/件)．2 のべき
+
+// 書き出し中に記録を止めたスレッドがまだ一件書いているかもしれないので，
+// いちばん古い数件は読まない
+
+const int TRACE_BUFFER_SLACK = 16;
+
+struct TraceEvent {
+	const char *name;         // 文字列リテラルに限る
+	unsigned long long start; // [ns]
+	unsigned long long end;
+};
+
+struct TraceBuffer {
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+	std::atomic<unsigned long long> count; // 書き手が書き終えた件数 (通算)
+	int generation;                        // これが trace_generation と違えば古い記録
+	int tid;
+	char thread_name[32];
+};
+
+static std::atomic<int> trace_enabled;
+static std::atomic<int> trace_generation;
+static unsigned long long trace_start_ns;
+static const char *trace_path;
+static std::mutex trace_mutex;                 // バッファの登録と書き出しだけで使う
+static std::vector<TraceBuffer *> trace_buffers;
+static thread_local TraceBuffer *trace_buffer;
+static thread_local char trace_thread_name[32];
+
+inline unsigned long long TraceNowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// このスレッドのバッファ．初めて呼ばれたときに作って登録する
+
+inline TraceBuffer *GetTraceBuffer(void)
+{
+	TraceBuffer *buffer = trace_buffer;
+	if (!buffer) {
+		buffer = new TraceBuffer();
+		buffer->count = 0;
+		buffer->generation = trace_generation.load();
+		memcpy(buffer->thread_name, trace_thread_name, sizeof(trace_thread_name));
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		buffer->tid = (int) trace_buffers.size() + 1;
+		trace_buffers.push_back(buffer);
+		trace_buffer = buffer;
+	}
+
+	// 記録を始め直していたら，自分のバッファを空にする
+
+	int generation = trace_generation.load(std::memory_order_acquire);
+	if (buffer->generation != generation) {
+		buffer->generation = generation;
+		buffer->count.store(0, std::memory_order_relaxed);
+	}
+	return buffer;
+}
+
+inline void RecordTraceEvent(TraceBuffer *buffer, const char *name,
+	const unsigned long long start, const unsigned long long end)
+{
+	unsigned long long n = buffer->count.load(std::memory_order_relaxed);
+	TraceEvent &event = buffer->events[n & (TRACE_BUFFER_EVENTS - 1)];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	buffer->count.store(n + 1, std::memory_order_release);
+}
+
+// 記録していないときは時刻も取らない
+
+struct TraceScope {
+	const char *name;
+	unsigned long long start;
+
+	TraceScope(const char *scope_name)
+	{
+		name = trace_enabled.load(std::memory_order_relaxed) ? scope_name : NULL;
+		start = name ? TraceNowNs() : 0;
+	}
+
+	~TraceScope()
+	{
+		if (name) {
+			RecordTraceEvent(GetTraceBuffer(), name, start, TraceNowNs());
+		}
+	}
+};
+
+// バッファは記録を始めるまで作らないので，名前は手元に控えておく
+
+inline void SetTraceThreadName(const char *name)
+{
+	snprintf(trace_thread_name, sizeof(trace_thread_name), "%s", name);
+	if (trace_buffer) {
+		memcpy(trace_buffer->thread_name, trace_thread_name, sizeof(trace_thread_name));
+	}
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) SetTraceThreadName(name)
+
+
+
+// 書き出し ///////////////////////////////////////////////////////////////////
+
+// 一区間を記録する手間を測っておき，書き出すときに負荷の目安として示す
+
+inline double MeasureTraceCostNs(void)
+{
+	static TraceBuffer scratch;
+	const int n = 10000;
+	scratch.count = 0;
+	unsigned long long start = TraceNowNs();
+	for (int i = 0; i < n; i++) {
+		unsigned long long begin = TraceNowNs();
+		RecordTraceEvent(&scratch, "calibrate", begin, TraceNowNs());
+	}
+	return (TraceNowNs() - start) / (double) n;
+}
+
+inline void WriteTraceJson(FILE *fp, long long *p_events, long long *p_dropped)
+{
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+		"\"args\":{\"name\":\"%s\"}}", program_invocation_short_name);
+
+	long long events = 0, dropped = 0;
+	int generation = trace_generation.load();
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	for (size_t b = 0; b < trace_buffers.size(); b++) {
+		TraceBuffer *buffer = trace_buffers[b];
+		if (buffer->generation != generation) {
+			continue; // 今回は何も記録していない
+		}
+		if (buffer->thread_name[0]) {
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"%s\"}}", buffer->tid, buffer->thread_name);
+		}
+		unsigned long long n = buffer->count.load(std::memory_order_acquire);
+		unsigned long long first = 0;
+		if (n > TRACE_BUFFER_EVENTS - TRACE_BUFFER_SLACK) {
+			first = n - (TRACE_BUFFER_EVENTS - TRACE_BUFFER_SLACK);
+		}
+		for (unsigned long long i = first; i < n; i++) {
+			const TraceEvent &event = buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+			if (event.start < trace_start_ns) {
+				continue;
+			}
+			fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f}", event.name, buffer->tid,
+				(event.start - trace_start_ns) * 1e-3,
+				(event.end - event.start) * 1e-3);
+		}
+		events += n - first;
+		dropped += first;
+	}
+	fprintf(fp, "\n]}\n");
+	*p_events = events;
+	*p_dropped = dropped;
+}
+
+
+
+// 開始と終了 /////////////////////////////////////////////////////////////////
+
+inline int IsTracing(void)
+{
+	return trace_enabled.load(std::memory_order_relaxed);
+}
+
+// path に書き出す記録を始める
+
+inline void StartTrace(const char *path)
+{
+	if (IsTracing()) {
+		return;
+	}
+	trace_path = path;
+	trace_start_ns = TraceNowNs();
+	trace_generation.fetch_add(1, std::memory_order_release);
+	trace_enabled.store(1, std::memory_order_release);
+	fprintf(stderr, "trace: recording to %s\n", path);
+}
+
+inline void StopTrace(void)
+{
+	if (!IsTracing()) {
+		return;
+	}
+	trace_enabled.store(0, std::memory_order_release);
+	unsigned long long span = TraceNowNs() - trace_start_ns;
+
+	FILE *fp = strcmp(trace_path, "-") == 0 ? stdout : fopen(trace_path, "w");
+	if (!fp) {
+		perror(trace_path);
+		return;
+	}
+	long long events, dropped;
+	WriteTraceJson(fp, &events, &dropped);
+	if (fp != stdout) {
+		fclose(fp);
+	}
+
+	double cost = MeasureTraceCostNs();
+	fprintf(stderr, "trace: %lld events in %.2f s written to %s (%lld older ones overwritten), "
+		"about %.0f ns each, %.3f%% of one core\n",
+		events, span * 1e-9, trace_path, dropped, cost,
+		100.0 * (events + dropped) * cost / span);
+}
+
+// GLUT_TRACE が設定されていれば記録を始め，終了時に書き出す
+
+inline void InitTrace(void)
+{
+	const char *env = getenv("GLUT_TRACE");
+	if (env && env[0]) {
+		StartTrace(env);
+	}
+	atexit(StopTrace);
+}
+
+inline void ToggleTrace(const char *path)
+{
+	if (IsTracing()) {
+		StopTrace();
+	} else {
+		StartTrace(path);
+	}
+}
+
+
+
+#else // NO_TRACE
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+
+inline int IsTracing(void)
+{
+	return 0;
+}
+
+inline void StartTrace(const char *)
+{
+	fprintf(stderr, "trace: compiled out (NO_TRACE)\n");
+}
+
+inline void StopTrace(void) {}
+inline void InitTrace(void) {}
+
+inline void ToggleTrace(const char *path)
+{
+	StartTrace(path);
+}
+
+#endif // NO_TRACE
+
+#endif // TRACE_H
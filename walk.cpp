@@ -6,8 +6,18 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <cmath>
+#include <chrono>
+
+#include "draw_list.h"
+#include "soft_raster.h"
+#include "frame_capture.h"
+#include "trace.h"
+#include "kinematics.h"
+#include "snapshot.h"
+#include "walk_world.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979
@@ -45,8 +55,8 @@ const double UP_Z = 0.0;
 
 // 物体関連
 
-const double ROT_ANGLE_VELOCITY = 2.0;
-const double ANGLE_MAX = 40.0;
+const double ROT_ANGLE_VELOCITY = DegreeToRadian(2.0); // [rad]
+const double ANGLE_MAX = DegreeToRadian(40.0);
 
 const double LEG_LENGTH = 5.0;
 const double LEG_THICKNESS = 1.0;
@@ -57,214 +67,460 @@ const double INITIAL_BODY_Y = LEG_LENGTH;
 const double INITIAL_BODY_Z = 0.0;
 const double INITIAL_BODY_DIR = 0.0;
 
+// 光源の位置 (w = 1 なので点光源) と地面の枡の数・大きさ
+
+const GLfloat LIGHT_POSITION[4] = {20.0, 50.0, 30.0, 1.0};
+const int GROUND_NUM = 10;
+const double GROUND_SIZE = 10.0;
+
+// 群衆表示のときのキャラクタの間隔
+
+const double CROWD_SPACING = 12.0;
+
+// 複数の視点で描くときの視点．画面を 2x2 に分けて左上から並べる
+
+enum {
+	VIEW_MAIN,   // EYE_* から TARGET_* を見る
+	VIEW_TOP,    // 真上からの平行投影
+	VIEW_SIDE,   // 真横 (+z 側) からの平行投影
+	VIEW_FOLLOW, // キャラクタの後ろから追いかける
+	NUM_VIEWS
+};
+
+const double ORTHO_HALF_HEIGHT = 55.0;   // 平行投影で見える高さの半分
+const double ORTHO_DISTANCE = 200.0;     // 平行投影の視点から注視点まで
+const double SIDE_VIEW_Y = 10.0;
+const double FOLLOW_DISTANCE = 25.0;     // 追いかける視点の，キャラクタの後ろへの距離
+const double FOLLOW_HEIGHT = 12.0;
+
 
 // グローバル変数
 
 int window_width;
 int window_height;
-int counter;
-int is_moving;
 
 double angle_x;
 double angle_y;
 
-double leg_angle;
-double body_x, body_y, body_z;
-double body_dir;
-int on_ground; // 0: left, 1: right
+// キャラクタの世界．全部を毎回進めるが，描いて操作するのは
+// selected_world 番目だけ
+
+std::vector<WalkWorld> worlds;
+int selected_world;
+WalkWorld *world;           // &worlds[selected_world]
+WorldHostStats world_stats;
+
+int show_stats;
+int use_soft_raster; // 1 なら CPU で描く
+int save_frame;      // 1 なら次の描画を PPM に保存する
+const char *capture_request; // 次の描画から撮影を始めるときの出力先
+int crowd_size; // 0 なら一人だけ
+int multi_view; // 1 なら画面を分けて複数の視点から描く
+
+DrawView views[NUM_VIEWS];
+
+const char *snapshot_path; // S で書き，L で読むファイル
+Snapshot mesh_snapshot;    // 起動時に読んだもの．メッシュがここを指す
+
+// マテリアル番号
+
+int material_blue, material_orange, material_yellow, material_face;
+int material_ground1, material_ground2;
 
 
 // キャラクタの初期化 //
 
-void InitCharacterPosition(void)
+void InitCharacterPosition(WalkWorld *w)
 {
-	leg_angle =INITIAL_LEG_ANGLE;
-	body_x = INITIAL_BODY_X;
-	body_y = INITIAL_BODY_Y;
-	body_z = INITIAL_BODY_Z;
-	body_dir = INITIAL_BODY_DIR;
+	w->leg_angle = INITIAL_LEG_ANGLE;
+	w->body_x = INITIAL_BODY_X;
+	w->body_y = INITIAL_BODY_Y;
+	w->body_z = INITIAL_BODY_Z;
+	w->body_dir = INITIAL_BODY_DIR;
 }
 
-
-// OpenGL の設定 //
-
-void InitGL(void)
+void SelectWorld(const int i)
 {
-	// 背景色の設定
+	selected_world = i;
+	world = &worlds[i];
+}
 
-	glClearColor(1.0, 1.0, 1.0, 0.0);
+// n 個の世界を作る．最初の世界はいつもの歩き方で，ほかの世界は歩幅と
+// 曲がり方を乱数で変える
 
-	// シェーディング方法の設定
+void InitWorlds(const int n)
+{
+	unsigned long long random_state = 1;
+	worlds.assign(n, WalkWorld());
+	for (int i = 0; i < n; i++) {
+		InitWalkWorld(&worlds[i], LEG_LENGTH, ROT_ANGLE_VELOCITY, ANGLE_MAX);
+		InitCharacterPosition(&worlds[i]);
+		if (i > 0) {
+			worlds[i].step *= 0.5 + RandomDouble(&random_state);
+			worlds[i].turn = DegreeToRadian(2.0 * RandomDouble(&random_state) - 1.0);
+		}
+	}
+	SelectWorld(0);
+}
 
-	glShadeModel(GL_SMOOTH);
 
-	// Zバッファによる隠面消去を有効にする。
+// スナップショット //
 
-	glEnable(GL_DEPTH_TEST);
+// 世界の数と選んでいる世界，世界ごとの歩き方と状態．構造体ごとそのまま書く
 
-	// 裏を向いているポリゴンを描かない
+struct WalkSnapshotHost {
+	int num_worlds;
+	int selected_world;
+	int crowd_size;
+	int reserved;
+};
 
-	glCullFace(GL_BACK);
-	glEnable(GL_CULL_FACE);
+struct WalkSnapshotState {
+	double leg_length;
+	double step;
+	double angle_max;
+	double turn;
+	double leg_angle;
+	double body[3];
+	double body_dir;
+	long long counter;
+	int on_ground;
+	int is_moving;
+};
 
-	// 法線を正規化する
+int SaveSnapshot(const char *path)
+{
+	TRACE_SCOPE("SaveSnapshot");
+
+	SnapshotWriter writer;
+
+	WalkSnapshotHost host;
+	memset(&host, 0, sizeof(host));
+	host.num_worlds = worlds.size();
+	host.selected_world = selected_world;
+	host.crowd_size = crowd_size;
+	AddSnapshotSection(&writer, "walk.host", &host, sizeof(host), 1);
+
+	WalkSnapshotState *states = (WalkSnapshotState *) AllocSnapshotSection(&writer,
+		"walk.worlds", sizeof(WalkSnapshotState), worlds.size());
+	for (size_t i = 0; i < worlds.size(); i++) {
+		const WalkWorld &w = worlds[i];
+		WalkSnapshotState &state = states[i];
+		memset(&state, 0, sizeof(state));
+		state.leg_length = w.leg_length;
+		state.step = w.step;
+		state.angle_max = w.angle_max;
+		state.turn = w.turn;
+		state.leg_angle = w.leg_angle;
+		state.body[0] = w.body_x;
+		state.body[1] = w.body_y;
+		state.body[2] = w.body_z;
+		state.body_dir = w.body_dir;
+		state.counter = w.counter;
+		state.on_ground = w.on_ground;
+		state.is_moving = w.is_moving;
+	}
+	AddMeshSnapshot(&writer);
 
-	glEnable(GL_NORMALIZE);
+	if (WriteSnapshot(&writer, path) != 0) {
+		return -1;
+	}
+	fprintf(stderr, "snapshot: wrote %s\n", path);
+	return 0;
 }
 
-// 光源の設定
+// with_meshes なら，メッシュも作らずにスナップショットを指す
+// (描画の初期化より前だけ)．読めなければ -1 で，場面はそのまま
 
-void SetLight(void)
+int LoadSnapshot(const char *path, const int with_meshes)
 {
-	GLfloat light_position0[] = {20.0, 50.0, 30.0, 1.0};
-	GLfloat light_ambient0[] = {0.2, 0.2, 0.2, 1.0};
-	GLfloat light_diffuse0[] = {1.0, 1.0, 1.0, 1.0};
-	GLfloat light_specular0[] = {1.0, 1.0, 1.0, 1.0};
-
-	glLightfv(GL_LIGHT0, GL_POSITION, light_position0);
-	glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient0);
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse0);
-	glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular0);
-
-	glEnable(GL_LIGHT0);
-	glEnable(GL_LIGHTING);
+	TRACE_SCOPE("LoadSnapshot");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	Snapshot snapshot;
+	if (OpenSnapshot(&snapshot, path) != 0) {
+		return -1;
+	}
+
+	WalkSnapshotHost host;
+	unsigned long long num_states = 0;
+	const WalkSnapshotState *states = NULL;
+	if (ReadSnapshotValue(snapshot, "walk.host", &host) == 0) {
+		states = (const WalkSnapshotState *) FindSnapshotSection(snapshot,
+			"walk.worlds", sizeof(WalkSnapshotState), &num_states);
+	}
+	if (!states || host.num_worlds <= 0
+		|| num_states != (unsigned long long) host.num_worlds) {
+		fprintf(stderr, "%s: no walking character\n", path);
+		CloseSnapshot(&snapshot);
+		return -1;
+	}
+	worlds.assign(host.num_worlds, WalkWorld());
+	for (int i = 0; i < host.num_worlds; i++) {
+		const WalkSnapshotState &state = states[i];
+		WalkWorld &w = worlds[i];
+		InitWalkWorld(&w, state.leg_length, state.step, state.angle_max);
+		w.turn = state.turn;
+		w.leg_angle = state.leg_angle;
+		w.body_x = state.body[0];
+		w.body_y = state.body[1];
+		w.body_z = state.body[2];
+		w.body_dir = state.body_dir;
+		w.counter = state.counter;
+		w.on_ground = state.on_ground;
+		w.is_moving = state.is_moving;
+	}
+	SelectWorld(host.selected_world >= 0 && host.selected_world < host.num_worlds
+		? host.selected_world : 0);
+	crowd_size = host.crowd_size;
+
+	unsigned long long size = snapshot.size;
+	int mapped = with_meshes && LoadMeshSnapshot(snapshot) == 0;
+	if (with_meshes && !mapped) {
+		InitMeshes();
+	}
+	if (mapped) {
+		mesh_snapshot = snapshot;
+	} else {
+		CloseSnapshot(&snapshot);
+	}
+
+	fprintf(stderr, "snapshot: loaded %s (%.1f MB, %d worlds%s) in %.2f ms\n", path,
+		size / 1048576.0, host.num_worlds, mapped ? ", meshes mapped" : "",
+		std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count());
+	return 0;
 }
 
-// 物体の色の設定
 
-void SetMaterial(const double r, const double g, const double b, const double shininess = 50.0)
-{
-		const double ratio = 0.2;
+// OpenGL の設定 //
 
-	GLfloat mat_ambient[] = {r * ratio, g * ratio, b * ratio, 1.0};
-	GLfloat mat_diffuse[] = {r, g, b, 1.0};
-	GLfloat mat_specular[] = {1.0, 1.0, 1.0, 1.0};
-	GLfloat mat_shininess[] = {shininess};
+// 物体の色の設定
 
-	glMaterialfv(GL_FRONT, GL_AMBIENT, mat_ambient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, mat_specular);
-	glMaterialfv(GL_FRONT, GL_SHININESS, mat_shininess);
+void InitMaterials(void)
+{
+	material_blue = AddMaterial(0.1, 0.2, 1.0);
+	material_orange = AddMaterial(0.9, 0.4, 0.1);
+	material_yellow = AddMaterial(0.9, 0.9, 0.1);
+	material_face = AddMaterial(0.4, 0.4, 0.4);
+	material_ground1 = AddMaterial(0.9, 0.9, 0.9);
+	material_ground2 = AddMaterial(0.6, 0.6, 1.0);
 }
 
 // 物体の描画
 
 // パーツを描く
 
-void DrawOneLeg(void)
+void DrawOneLeg(const int material)
 {
-	glPushMatrix();
-	glTranslated(0.0, -LEG_LENGTH / 2, 0.0);
-	glScaled(LEG_THICKNESS, LEG_LENGTH, LEG_THICKNESS);
-	glutSolidCube(1.0);
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, -LEG_LENGTH / 2, 0.0);
+	Scale(LEG_THICKNESS, LEG_LENGTH, LEG_THICKNESS);
+	RecordDraw(MESH_CUBE, material);
+	PopMatrix();
 }
 
 // ティーポット（顔）を描く
 
 void DrawTeapot(void)
 {
-	glPushMatrix(); // 一時的に座標系情報を保存
+	PushMatrix(); // 一時的に座標系情報を保存
 
-	glScalef(1.0f, 1.0f, -1.0f); // Teapotは面の表裏が一般的な設定となぜか逆
-	glutSolidTeapot(LEG_LENGTH / 2);
+	Scale(LEG_LENGTH / 2, LEG_LENGTH / 2, LEG_LENGTH / 2);
+	RecordDraw(MESH_TEAPOT, material_face);
 
-	glPopMatrix(); // 保存してあった座標系情報を戻す
+	PopMatrix(); // 保存してあった座標系情報を戻す
 }
 
 // キャラクタを描く
 
 void DrawCharacter(const double x, const double y, const double z, const double angle, const double dir)
 {
-	glPushMatrix();
-	glTranslated(x, y, z);
-	glRotated(dir, 0.0, 1.0, 0.0);
+	PushMatrix();
+	Translate(x, y, z);
+	Rotate(dir, 0.0, 1.0, 0.0);
+
+	// 足先から顔までを囲む球が見えなければ何も積まない
+
+	if (!IsSphereVisible(0.0, LEG_LENGTH * 0.3, 0.0, LEG_LENGTH * 1.6)) {
+		PopMatrix();
+		return;
+	}
 
 	// 左足
 
-	SetMaterial(0.1, 0.2, 1.0);
-	glPushMatrix();
-	glTranslated(0.0, 0.0, -LEG_THICKNESS/ 2);
-	glRotated(angle / 2, 0.0, 0.0, 1.0);
-	DrawOneLeg();
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, 0.0, -LEG_THICKNESS/ 2);
+	Rotate(angle / 2, 0.0, 0.0, 1.0);
+	DrawOneLeg(material_blue);
+	PopMatrix();
 
 	// 右足
 
-	SetMaterial(0.9, 0.4, 0.1);
-	glPushMatrix();
-	glTranslated(0.0, 0.0, LEG_THICKNESS / 2);
-	glRotated(-angle / 2, 0.0, 0.0, 1.0);
-	DrawOneLeg();
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, 0.0, LEG_THICKNESS / 2);
+	Rotate(-angle / 2, 0.0, 0.0, 1.0);
+	DrawOneLeg(material_orange);
+	PopMatrix();
 
 	// 胴
 
-	SetMaterial(0.9, 0.9, 0.1);
-	glPushMatrix();
-	glTranslated(0.0, LEG_LENGTH, 0.0);
-	DrawOneLeg();
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, LEG_LENGTH, 0.0);
+	DrawOneLeg(material_yellow);
+	PopMatrix();
 	
 	// 右腕
 
-	SetMaterial(0.1, 0.2, 1.0);
-	glPushMatrix();
-	glTranslated(0.0, LEG_LENGTH, LEG_THICKNESS);
-	glRotated(angle / 2, 0.0, 0.0, 1.0);
-	DrawOneLeg();
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, LEG_LENGTH, LEG_THICKNESS);
+	Rotate(angle / 2, 0.0, 0.0, 1.0);
+	DrawOneLeg(material_blue);
+	PopMatrix();
 
 	// 左腕
 
-	SetMaterial(0.9, 0.4, 0.1);
-	glPushMatrix();
-	glTranslated(0.0, LEG_LENGTH, -LEG_THICKNESS);
-	glRotated(-angle / 2, 0.0, 0.0, 1.0);
-	DrawOneLeg();
-	glPopMatrix();
+	PushMatrix();
+	Translate(0.0, LEG_LENGTH, -LEG_THICKNESS);
+	Rotate(-angle / 2, 0.0, 0.0, 1.0);
+	DrawOneLeg(material_orange);
+	PopMatrix();
 
 	// 顔
 
-	SetMaterial(0.4, 0.4, 0.4);
-	glPushMatrix();
-	glTranslated(0.0, LEG_LENGTH * 5 / 4, 0.0);
+	PushMatrix();
+	Translate(0.0, LEG_LENGTH * 5 / 4, 0.0);
 	DrawTeapot();
-	glPopMatrix();
+	PopMatrix();
 	
 
-	glPopMatrix();
+	PopMatrix();
 }
 
-// 地面を描く
+// 群衆を描く．選んでいるキャラクタと同じ動きのまま，格子状にずらして並べる
 
-void DrawGround(void)
+void DrawCrowd(void)
 {
-	const int num = 10;
-	const double size = 10.0;
-
-	glPushMatrix();
-	glScaled(size, 1.0, size);
-	glTranslated(-num / 2.0, 0.0, -num / 2.0);
-
-	glNormal3d(0.0, 1.0, 0.0);
-	glBegin(GL_QUADS);
-	for (int i = 0; i < num; i++) {
-		for (int j = 0; j < num; j ++) {
-			if ((i + j) % 2 == 0) {
-				SetMaterial(0.9, 0.9, 0.9);
-			} else {
-				SetMaterial(0.6, 0.6, 1.0);
-			}
-			glVertex3i(i, 0, j);
-			glVertex3i(i, 0, (j + 1));
-			glVertex3i((i + 1), 0, (j + 1));
-			glVertex3i((i + 1), 0, j);
-		}
+	TRACE_SCOPE("DrawCrowd");
+
+	int columns = (int) ceil(sqrt((double) crowd_size));
+
+	for (int i = 0; i < crowd_size; i++) {
+		double dx = (i % columns - columns / 2) * CROWD_SPACING;
+		double dz = (i / columns + 1) * CROWD_SPACING;
+		DrawCharacter(world->body_x + dx, world->body_y, world->body_z - dz,
+			world->leg_angle, world->body_dir);
+	}
+}
+
+// 場面全体を積む
+
+void DrawScene(void)
+{
+	PushMatrix();
+
+	RecordGround(GROUND_NUM, GROUND_SIZE, material_ground1, material_ground2);
+	DrawCharacter(world->body_x, world->body_y, world->body_z, world->leg_angle,
+		world->body_dir);
+	DrawCrowd();
+
+	PopMatrix();
+}
+
+
+
+// 視点の設定 //
+
+// 視点 view を，ウインドウ内の (x, y) から幅 w，高さ h の領域に設定する
+
+void SetView(const int view, const int x, const int y, const int w, const int h)
+{
+	SetRenderViewport(x, y, w, h);
+
+	if (view == VIEW_TOP || view == VIEW_SIDE) {
+		SetOrthoProjection(ORTHO_HALF_HEIGHT, NEAR_CLIPPINT_LENGTH, FAR_CLIPPINT_LENGTH);
+	} else {
+		SetPerspectiveProjection(FIELD_OF_VIEW, NEAR_CLIPPINT_LENGTH, FAR_CLIPPINT_LENGTH);
+	}
+
+	if (view == VIEW_TOP) {
+		LookAt(0.0, ORTHO_DISTANCE, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, -1.0);
+	} else if (view == VIEW_SIDE) {
+		LookAt(0.0, SIDE_VIEW_Y, ORTHO_DISTANCE, 0.0, SIDE_VIEW_Y, 0.0,
+			UP_X, UP_Y, UP_Z);
+	} else if (view == VIEW_FOLLOW) {
+		// 進む向きは (cos dir, 0, -sin dir)
+
+		LookAt(world->body_x - FOLLOW_DISTANCE * cos(world->body_dir), FOLLOW_HEIGHT,
+			world->body_z + FOLLOW_DISTANCE * sin(world->body_dir),
+			world->body_x, world->body_y, world->body_z, UP_X, UP_Y, UP_Z);
+	} else {
+		LookAt(EYE_X, EYE_Y, EYE_Z, // カメラの位置
+			TARGET_X, TARGET_Y, TARGET_Z, //注視点
+			UP_X, UP_Y, UP_Z); // カメラ撮像面の上向き方向
 	}
-	glEnd();
+}
+
+// 一つの視点から描く
+
+void DrawSingleView(void)
+{
+	SetView(VIEW_MAIN, 0, 0, window_width, window_height);
+
+	// 光源位置の設定
+
+	SetRenderLight(LIGHT_POSITION);
+
+	// 物体の配置
 
-	glPopMatrix();
+	do {
+		BeginDrawList();
+		DrawScene();
+	} while (RetryDrawList());
+
+	// マテリアル順に並べ替えて描く
+
+	if (use_soft_raster) {
+		SubmitDrawListSoft();
+	} else {
+		SubmitDrawList();
+	}
+}
+
+// 画面を 2x2 に分けて全部の視点から描く．場面を積むのは一度だけで，
+// 視点ごとにはカリングと描画だけを繰り返す
+
+void DrawMultiView(void)
+{
+	TRACE_SCOPE("DrawMultiView");
+
+	int w = window_width / 2, h = window_height / 2;
+	for (int i = 0; i < NUM_VIEWS; i++) {
+		SetView(i, (i % 2) * w, (1 - i / 2) * h, w, h);
+		CaptureDrawView(&views[i]);
+	}
+
+	// ワールド座標系で積む
+
+	LoadIdentity();
+	do {
+		BeginSharedDrawList(views, NUM_VIEWS);
+		DrawScene();
+		EndSharedDrawList();
+	} while (RetryDrawList());
+
+	for (int i = 0; i < NUM_VIEWS; i++) {
+		ApplyDrawView(views[i]);
+		SetRenderLight(LIGHT_POSITION);
+		CullDrawView(&views[i]);
+		if (use_soft_raster) {
+			SubmitDrawListSoft();
+		} else {
+			SubmitDrawList();
+		}
+		FinishDrawView(&views[i]);
+	}
 }
 
 
@@ -275,34 +531,62 @@ void DrawGround(void)
 
 void Display(void)
 {
+	TRACE_SCOPE("Display");
+
+	MarkFrameStart();
+
+	// 撮影の開始 (--capture で指定されたとき)
+
+	if (capture_request) {
+		StartCapture(capture_request, window_width, window_height);
+		capture_request = NULL;
+	}
+
 	// 画面をクリア
 
+	SetRenderViewport(0, 0, window_width, window_height);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// カメラの位置を設定
-
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	gluLookAt(EYE_X, EYE_Y, EYE_Z, // カメラの位置
-		TARGET_X, TARGET_Y, TARGET_Z, //注視点
-		UP_X, UP_Y, UP_Z); // カメラ撮像面の上向き方向
+	// カメラを置いて描く
 
-	// 光源位置の設定
+	if (multi_view) {
+		DrawMultiView();
+	} else {
+		DrawSingleView();
+	}
+	SetRenderViewport(0, 0, window_width, window_height);
 
-	SetLight();
+	if (show_stats) {
+		PrintDrawListStats(stderr);
+		if (use_soft_raster) {
+			PrintSoftRasterStats(stderr);
+		}
+		if (multi_view) {
+			PrintDrawViewStats(stderr);
+		}
+		PrintWorldHostStats(stderr, world_stats);
+		fprintf(stderr, "world %d: step %lld\n", selected_world, world->counter);
+	}
 
-	// 物体の配置
+	// 画像比較用に保存
 
-	glPushMatrix();
+	if (save_frame) {
+		SaveFramebufferPPM(use_soft_raster ? "frame_soft.ppm" : "frame_gl.ppm",
+			window_width, window_height);
+		save_frame = 0;
+	}
 
-	DrawGround();
-	DrawCharacter(body_x, body_y, body_z, leg_angle, body_dir);
+	// 撮影中なら読み出しを発行する
 
-	glPopMatrix();
+	CaptureFrame();
+	MarkFrameEnd();
 
 	// バッファの入れ替え
 
-	glutSwapBuffers();
+	{
+		TRACE_SCOPE("glutSwapBuffers");
+		glutSwapBuffers();
+	}
 }
 
 // ウインドウリサイズ
@@ -312,28 +596,64 @@ void Reshape(int w, int h)
 	window_width = w;
 	window_height = h;
 
-	glViewport(0, 0, window_width, window_height);
+	// 動画の途中で大きさは変えられないので，撮影を終える
+
+	if (capture.active && (w != capture.width || h != capture.height)) {
+		StopCapture();
+	}
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(FIELD_OF_VIEW, window_width / (double) window_height, NEAR_CLIPPINT_LENGTH, FAR_CLIPPINT_LENGTH);
+	// 投影は描くたびに SetView() で視点ごとに決める
 
-	glMatrixMode(GL_MODELVIEW);
+	SetRenderViewport(0, 0, window_width, window_height);
 }
 
 // キー入力
 
 void Keyboard(unsigned char key, int x, int y)
 {
+	TRACE_SCOPE("Keyboard");
+
 	if (key == 'q' || key == 3 || key == 27) { // 3: Ctrl-C, 27: ESC
+		StopCapture();
 		exit(0);
 	} else if (key == 'r') {
-		InitCharacterPosition();
+		InitCharacterPosition(world);
 		glutPostRedisplay();
 	} else if (key == 'm') {
-		body_dir -= ROT_ANGLE_VELOCITY;
+		world->body_dir -= ROT_ANGLE_VELOCITY;
 	} else if (key == 'n') {
-		body_dir += ROT_ANGLE_VELOCITY;
+		world->body_dir += ROT_ANGLE_VELOCITY;
+	} else if (key == 'i') {
+		show_stats = 1 - show_stats;
+	} else if (key == 'b') {
+		use_soft_raster = 1 - use_soft_raster;
+	} else if (key == 'g') {
+		ToggleRenderShader();
+		glutPostRedisplay();
+	} else if (key == 'c') {
+		if (capture.active) {
+			StopCapture();
+		} else {
+			StartCapture("capture.y4m", window_width, window_height);
+		}
+	} else if (key == 't') {
+		ToggleTrace("trace.json");
+	} else if (key == 'p') {
+		save_frame = 1;
+		glutPostRedisplay();
+	} else if (key == 'v') {
+		multi_view = 1 - multi_view;
+		glutPostRedisplay();
+	} else if ((key == '[' || key == ']') && worlds.size() > 1) {
+		int n = worlds.size();
+		SelectWorld((selected_world + (key == ']' ? 1 : n - 1)) % n);
+		fprintf(stderr, "world %d of %d\n", selected_world, n);
+		glutPostRedisplay();
+	} else if (key == 'S') {
+		SaveSnapshot(snapshot_path);
+	} else if (key == 'L') {
+		LoadSnapshot(snapshot_path, 0);
+		glutPostRedisplay();
 	}
 }
 
@@ -341,8 +661,10 @@ void Keyboard(unsigned char key, int x, int y)
 
 void MouseButton(int button, int state, int x, int y)
 {
+	TRACE_SCOPE("MouseButton");
+
 	if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-		is_moving = 1 - is_moving;
+		world->is_moving = 1 - world->is_moving;
 	}
 	if (button == GLUT_MIDDLE_BUTTON && state == GLUT_DOWN) {}
 	if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN) {}
@@ -353,33 +675,13 @@ void MouseButton(int button, int state, int x, int y)
 
 void Idle(void)
 {
-	if (is_moving) {
-		counter++;
-
-		switch (on_ground)
-		{
-		case 0: // left on ground
-			leg_angle -= ROT_ANGLE_VELOCITY;
-			body_x -= ((LEG_LENGTH * cos(M_PI * (90 - leg_angle / 2) / 180)) - (LEG_LENGTH * cos(M_PI * ( 90 - (leg_angle + ROT_ANGLE_VELOCITY) / 2) / 180))) * cos(M_PI * body_dir / 180);
-			body_y += (LEG_LENGTH * sin(M_PI * (90 - leg_angle / 2) / 180)) - (LEG_LENGTH * sin(M_PI * ( 90 - (leg_angle + ROT_ANGLE_VELOCITY) / 2) / 180));
-			body_z += ((LEG_LENGTH * cos(M_PI * (90 - leg_angle / 2) / 180)) - (LEG_LENGTH * cos(M_PI * ( 90 - (leg_angle + ROT_ANGLE_VELOCITY) / 2) / 180))) * sin(M_PI * body_dir / 180);
-			if (leg_angle < -ANGLE_MAX) {
-				on_ground = 1;
-			}
-			break;
-		case 1: // right on ground
-			leg_angle += ROT_ANGLE_VELOCITY;
-			body_x += ((LEG_LENGTH * cos(M_PI * (90 - leg_angle / 2) / 180) - (LEG_LENGTH * cos(M_PI * (90 - (leg_angle - ROT_ANGLE_VELOCITY) / 2) / 180)))) * cos(M_PI * body_dir / 180);
-			body_y += (LEG_LENGTH * sin(M_PI * (90 - leg_angle / 2) / 180) - (LEG_LENGTH * sin(M_PI * (90 - (leg_angle - ROT_ANGLE_VELOCITY) / 2) / 180)));
-			body_z -= ((LEG_LENGTH * cos(M_PI * (90 - leg_angle / 2) / 180) - (LEG_LENGTH * cos(M_PI * (90 - (leg_angle - ROT_ANGLE_VELOCITY) / 2) / 180)))) * sin(M_PI * body_dir / 180);
-			if (leg_angle > ANGLE_MAX) {
-				on_ground = 0;
-			}
-			break;
-		default:
-			break;
-		}
-		
+	if (AnyWorldMoving(worlds)) {
+		TRACE_SCOPE("Idle"); // 空回りは記録しない
+
+		// 全部の世界を一歩ずつ進める (walk_world.h)
+
+		TickWorlds(&worlds, 1, 0, &world_stats);
+
 		glutPostRedisplay();
 	}
 }
@@ -393,10 +695,19 @@ int main(int argc, char **argv)
 
 	window_width = WINDOW_WIDTH;
 	window_height = WINDOW_HEIGHT;
-	counter = 0;
-	is_moving = 1;
+	show_stats = 0;
+	use_soft_raster = 0;
+	save_frame = 0;
+	crowd_size = 0;
+	multi_view = 0;
+	snapshot_path = "scene.snap";
+
+	InitMaterials();
 
-	InitCharacterPosition();
+	// GLUT_TRACE が設定されていれば記録を始める
+
+	TRACE_THREAD_NAME("main");
+	InitTrace();
 
 	// GLUTの初期化
 
@@ -406,6 +717,42 @@ int main(int argc, char **argv)
 	glutInitWindowPosition(WINDOW_POSITION_X, WINDOW_POSITION_Y);
 	glutCreateWindow(argv[0]);
 
+	// GLUT が使わなかった引数の解釈
+
+	int load_snapshot = 0;
+	int num_worlds = 1;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--crowd") == 0 && i + 1 < argc) {
+			crowd_size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--worlds") == 0 && i + 1 < argc) {
+			num_worlds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--soft") == 0) {
+			use_soft_raster = 1;
+		} else if (strcmp(argv[i], "--views") == 0) {
+			multi_view = 1;
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_request = argv[++i];
+		} else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+			snapshot_path = argv[++i];
+			load_snapshot = 1;
+		}
+	}
+
+	// --snapshot のファイルがあれば場面とメッシュをそこから取る (--worlds より
+	// 優先する)．無ければいつもどおり作り，次から使えるよう書いておく
+
+	if (load_snapshot && access(snapshot_path, F_OK) == 0) {
+		if (LoadSnapshot(snapshot_path, 1) != 0) {
+			return 1;
+		}
+	} else {
+		InitWorlds(num_worlds > 0 ? num_worlds : 1);
+		InitMeshes();
+		if (load_snapshot) {
+			SaveSnapshot(snapshot_path);
+		}
+	}
+
 	// コールバック関数の設定
 
 	glutDisplayFunc(Display);
@@ -416,7 +763,7 @@ int main(int argc, char **argv)
 
 	// OpenGLの各種初期設定
 
-	InitGL();
+	InitRender(1.0, 1.0, 1.0, 0.0);
 
 	// GLUTに制御を移管
 
@@ -0,0 +1,82 @@
+// walk_world.h
+//
+// 歩くキャラクタの世界
+//
+// 一人のキャラクタの歩き方 (脚の長さ，振る速さ，開きの上限，曲がる速さ) と
+// 位置・姿勢を一つの WalkWorld にまとめる．世界どうしは何も共有しないので，
+// world_host.h の TickWorlds() で別々のスレッドから進められる．
+
+#ifndef WALK_WORLD_H
+#define WALK_WORLD_H
+
+#include "kinematics.h"
+#include "world_host.h"
+
+
+
+// 世界 ///////////////////////////////////////////////////////////////////////
+
+struct alignas(64) WalkWorld {
+	// 設定
+
+	KinematicsReal leg_length;
+	KinematicsReal step;        // 一刻みで脚を振る角度 [rad]
+	KinematicsReal angle_max;   // 脚の開きの上限 [rad]
+	KinematicsReal turn;        // 一刻みで向きを変える角度 [rad]
+
+	// 状態
+
+	double leg_angle; // [rad]
+	double body_x, body_y, body_z;
+	double body_dir;  // [rad]
+	int on_ground;    // 0: left, 1: right
+	int is_moving;
+	long long counter;          // 進めた刻みの数
+};
+
+// 原点に脚を閉じて立ち，x 軸の向きを向く
+
+inline void InitWalkWorld(WalkWorld *world, const double leg_length,
+	const double step, const double angle_max)
+{
+	world->leg_length = leg_length;
+	world->step = step;
+	world->angle_max = angle_max;
+	world->turn = 0.0;
+	world->leg_angle = 0.0;
+	world->body_x = 0.0;
+	world->body_y = leg_length;
+	world->body_z = 0.0;
+	world->body_dir = 0.0;
+	world->on_ground = 0;
+	world->is_moving = 1;
+	world->counter = 0;
+}
+
+// 一歩分脚を振る．計算は kinematics.h で選んだ型で行い，結果だけ書き戻す
+
+inline void TickWorld(WalkWorld *world)
+{
+	if (!world->is_moving) {
+		return;
+	}
+	world->counter++;
+
+	GaitState<KinematicsReal> gait;
+	gait.leg_angle = world->leg_angle;
+	gait.x = world->body_x;
+	gait.y = world->body_y;
+	gait.z = world->body_z;
+	gait.dir = world->body_dir;
+	gait.on_ground = world->on_ground;
+	GaitStep<KinematicsReal, KINEMATICS_FAST>(&gait, world->leg_length,
+		world->step, world->angle_max);
+	world->leg_angle = gait.leg_angle;
+	world->body_x = gait.x;
+	world->body_y = gait.y;
+	world->body_z = gait.z;
+	world->on_ground = gait.on_ground;
+	world->body_dir += world->turn;
+}
+
+#endif // WALK_WORLD_H
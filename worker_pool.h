@@ -0,0 +1,126 @@
+// worker_pool.h
+//
+// 起動したままのワーカースレッドに，番号だけ違う同じ仕事を配る
+//
+// CPU 描画 (soft_raster.h)，経路計画 (motion_planner.h)，世界の刻み
+// (world_host.h) が一つのプールを共有する．スレッドは最初に使われたときに
+// 作り，exit() で終わっても困らないよう切り離して持ち続ける．使う側は
+// InitWorkerPool() で自分の環境変数からスレッド数を決め，RunWorkerJob() で
+// その数だけのスレッドに仕事を配る．
+// プールは一番多く求めた数まで増える．仕事はメインスレッドから一つずつ
+// 配る．仕事の中から RunWorkerJob() を呼んではいけない．
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "trace.h"
+
+
+
+// スレッド ///////////////////////////////////////////////////////////////////
+
+struct WorkerPool {
+	int num_threads;
+	void (*job)(int);
+	int job_threads;     // job を実行するスレッドの数 (番号 0 〜 job_threads - 1)
+	int generation;
+	int pending;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+};
+
+static WorkerPool *worker_pool;
+
+// seen は作ったときの世代．後から増やしたスレッドが，もう終わった仕事を
+// 始めないようにする
+
+inline void WorkerThread(const int index, int seen)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "worker %d", index);
+	TRACE_THREAD_NAME(name);
+
+	for (;;) {
+		void (*job)(int);
+		{
+			std::unique_lock<std::mutex> lock(worker_pool->mutex);
+			worker_pool->start.wait(lock, [&] { return worker_pool->generation != seen; });
+			seen = worker_pool->generation;
+			if (index >= worker_pool->job_threads) {
+				continue;
+			}
+			job = worker_pool->job;
+		}
+		job(index);
+		{
+			std::lock_guard<std::mutex> lock(worker_pool->mutex);
+			if (--worker_pool->pending == 0) {
+				worker_pool->done.notify_one();
+			}
+		}
+	}
+}
+
+// スレッド数を環境変数 env_name，なければコア数で決めて返す．プールの
+// スレッドが足りなければその数まで増やす
+
+inline int InitWorkerPool(const char *env_name)
+{
+	int n = std::thread::hardware_concurrency();
+	const char *env = getenv(env_name);
+	if (env && atoi(env) > 0) {
+		n = atoi(env);
+	}
+	if (n < 1) {
+		n = 1;
+	}
+
+	if (!worker_pool) {
+		worker_pool = new WorkerPool();
+		worker_pool->num_threads = 1;
+		worker_pool->job = NULL;
+		worker_pool->job_threads = 0;
+		worker_pool->generation = 0;
+		worker_pool->pending = 0;
+	}
+	std::lock_guard<std::mutex> lock(worker_pool->mutex);
+	for (int i = worker_pool->num_threads; i < n; i++) {
+		std::thread(WorkerThread, i, worker_pool->generation).detach();
+	}
+	if (n > worker_pool->num_threads) {
+		worker_pool->num_threads = n;
+	}
+	return n;
+}
+
+// job(0) 〜 job(threads - 1) を別々のスレッドで実行し，終わるまで待つ．
+// job(0) は呼んだスレッドで実行する
+
+inline void RunWorkerJob(void (*job)(int), int threads)
+{
+	if (threads > worker_pool->num_threads) {
+		threads = worker_pool->num_threads;
+	}
+	if (threads > 1) {
+		std::lock_guard<std::mutex> lock(worker_pool->mutex);
+		worker_pool->job = job;
+		worker_pool->job_threads = threads;
+		worker_pool->pending = threads - 1;
+		worker_pool->generation++;
+		worker_pool->start.notify_all();
+	}
+	job(0);
+	if (threads > 1) {
+		std::unique_lock<std::mutex> lock(worker_pool->mutex);
+		worker_pool->done.wait(lock, [] { return worker_pool->pending == 0; });
+	}
+}
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,155 @@
+// world_bench.cpp
+//
+// world_host.h で，たくさんのアームの世界と歩くキャラクタの世界を進める
+// 速さを，使うスレッドの数ごとに測る
+//
+// 世界の数と刻みの数は同じまま，スレッドを 1 本から WORLD_THREADS (なければ
+// コア数) まで倍々に増やし，一秒あたりに進めた世界の刻みの数を表にする．
+// 世界どうしは何も共有しないので，どのスレッド数でも最後の状態は 1 本の
+// ときと一致するはずで，それも確かめる．
+//
+//   ./world_bench [worlds] [steps]
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "arm_world.h"
+#include "walk_world.h"
+
+
+
+// 定数・変数の宣言 ///////////////////////////////////////////////////////////
+
+const double ARM_LENGTHS[3] = {10.0, 12.0, 8.0};
+const double ARM_MAX_STEP = 0.5;
+const double ARM_RADIUS = 1.0;
+
+const double LEG_LENGTH = 5.0;
+const double LEG_STEP = DegreeToRadian(2.0);
+const double LEG_ANGLE_MAX = DegreeToRadian(40.0);
+
+
+
+// 世界の用意 /////////////////////////////////////////////////////////////////
+
+// 世界ごとに種を変え，届くたびに次の目標を選ばせる．半分の世界には
+// 障害物の球を一つ置く
+
+void InitArmWorlds(std::vector<ArmWorld> *worlds, const int n)
+{
+	worlds->assign(n, ArmWorld());
+	for (int i = 0; i < n; i++) {
+		ArmWorld *w = &(*worlds)[i];
+		InitArmWorld(w, ARM_LENGTHS, ARM_MAX_STEP, ARM_RADIUS, i + 1);
+		w->retarget = 1;
+		if (i % 2) {
+			AddCollisionSphere(&w->scene, 12.0f, 14.0f, 0.0f, 2.0f);
+		}
+		RandomArmTarget(w);
+	}
+}
+
+void InitWalkWorlds(std::vector<WalkWorld> *worlds, const int n)
+{
+	unsigned long long random_state = 1;
+	worlds->assign(n, WalkWorld());
+	for (int i = 0; i < n; i++) {
+		WalkWorld *w = &(*worlds)[i];
+		InitWalkWorld(w, LEG_LENGTH, LEG_STEP, LEG_ANGLE_MAX);
+		w->step *= 0.5 + RandomDouble(&random_state);
+		w->turn = DegreeToRadian(2.0 * RandomDouble(&random_state) - 1.0);
+	}
+}
+
+// 最後の状態の比較．ArmWorld の軌道は std::vector を持ち，構造体には
+// 詰め物もあるので，バイト列ではなく状態を一つずつ比べる
+
+int SameWorld(const ArmWorld &a, const ArmWorld &b)
+{
+	return a.arm_angle1 == b.arm_angle1 && a.arm_angle2 == b.arm_angle2
+		&& a.arm_angle3 == b.arm_angle3
+		&& a.target_x == b.target_x && a.target_y == b.target_y
+		&& a.target_z == b.target_z && a.distance == b.distance
+		&& a.is_moving == b.is_moving && a.counter == b.counter
+		&& a.reached == b.reached && a.random_state == b.random_state
+		&& a.avoidance.clearance == b.avoidance.clearance
+		&& a.avoidance.contacts == b.avoidance.contacts;
+}
+
+int SameWorld(const WalkWorld &a, const WalkWorld &b)
+{
+	return a.leg_angle == b.leg_angle
+		&& a.body_x == b.body_x && a.body_y == b.body_y && a.body_z == b.body_z
+		&& a.body_dir == b.body_dir && a.on_ground == b.on_ground
+		&& a.is_moving == b.is_moving && a.counter == b.counter;
+}
+
+template <typename World>
+int SameWorlds(const std::vector<World> &a, const std::vector<World> &b)
+{
+	if (a.size() != b.size()) {
+		return 0;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (!SameWorld(a[i], b[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+
+// 計測 ///////////////////////////////////////////////////////////////////////
+
+// 1 本のときの結果を基準に，スレッドを倍々に増やして同じだけ進める
+
+template <typename World>
+void BenchWorlds(const char *name, void (*init)(std::vector<World> *, int),
+	const int num_worlds, const int steps)
+{
+	std::vector<World> reference, worlds;
+	WorldHostStats stats;
+	double one_thread = 0.0;
+
+	for (int threads = 1; ; threads *= 2) {
+		if (threads > world_threads) {
+			threads = world_threads;
+		}
+		init(&worlds, num_worlds);
+		TickWorlds(&worlds, steps, threads, &stats);
+		double rate = (double) num_worlds * steps / stats.ms / 1000.0;
+		if (threads == 1) {
+			reference = worlds;
+			one_thread = rate;
+		}
+		printf("  %-5s %7d %8d %10.2f %12.2f %7.2fx %s\n", name, stats.threads, steps,
+			stats.ms, rate, rate / one_thread,
+			SameWorlds(reference, worlds) ? "same" : "DIFFERENT");
+		if (threads == world_threads) {
+			break;
+		}
+	}
+}
+
+
+
+// mainはここから /////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	const int num_worlds = argc > 1 ? atoi(argv[1]) : 10000;
+	const int steps = argc > 2 ? atoi(argv[2]) : 100;
+	InitWorldHost();
+
+	printf("%d worlds, %d steps, up to %d threads (%d bytes per arm world, "
+		"%d per walk world)\n", num_worlds, steps, world_threads,
+		(int) sizeof(ArmWorld), (int) sizeof(WalkWorld));
+	printf("  %-5s %7s %8s %10s %12s %8s %s\n", "world", "threads", "steps",
+		"ms", "M steps/s", "speedup", "result");
+
+	BenchWorlds<ArmWorld>("arm", InitArmWorlds, num_worlds, steps);
+	BenchWorlds<WalkWorld>("walk", InitWalkWorlds, num_worlds, steps);
+	return 0;
+}
@@ -0,0 +1,149 @@
+// world_host.h
+//
+// 一つのプロセスで，互いに独立した世界をたくさん動かす
+//
+// 世界 (arm_world.h の ArmWorld，walk_world.h の WalkWorld) は一つの場面の
+// 状態と設定をすべて自分で持ち，ほかの世界とは何も共有しない．
+// TickWorlds() は世界の並びを WORLD_CHUNK 個ずつの塊に分け，ワーカー
+// スレッドが塊を順に取って進める．一つの世界を触るのはいつも一つの
+// スレッドだけなので，ロックは要らない．世界はキャッシュラインに揃えて
+// 置くので，隣の世界を書いても行の取り合いにならない．
+// 世界ごとの刻みは World に対する TickWorld(World *) で与える．
+
+#ifndef WORLD_HOST_H
+#define WORLD_HOST_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "trace.h"
+#include "random.h"
+#include "worker_pool.h"
+
+
+
+// スレッド ///////////////////////////////////////////////////////////////////
+
+// worker_pool.h のスレッドを world_threads 本まで使う．
+// スレッド数は WORLD_THREADS 環境変数，なければコア数
+
+static int world_threads;
+
+inline void InitWorldHost(void)
+{
+	if (world_threads) {
+		return;
+	}
+	world_threads = InitWorkerPool("WORLD_THREADS");
+}
+
+
+
+// 世界をまとめて進める ///////////////////////////////////////////////////////
+
+// 一つの塊の世界の数．世界ごとの仕事は小さいので，塊を取る回数を抑える
+
+const int WORLD_CHUNK = 64;
+
+struct WorldJob {
+	void (*tick)(void *worlds, int begin, int end, int steps);
+	void *worlds;
+	int num_worlds;
+	int steps;
+	int threads;
+	std::atomic<int> next_chunk;
+};
+
+static WorldJob world_job;
+
+struct WorldHostStats {
+	int worlds;
+	int steps;
+	int threads;
+	double ms;
+};
+
+// 世界を一つずつ，steps 刻み続けて進める．一つの世界の状態がキャッシュに
+// 乗っている間に刻みを重ねる
+
+template <typename World>
+inline void TickWorldRange(void *worlds, const int begin, const int end,
+	const int steps)
+{
+	World *w = (World *) worlds;
+	for (int i = begin; i < end; i++) {
+		for (int s = 0; s < steps; s++) {
+			TickWorld(&w[i]);
+		}
+	}
+}
+
+inline void TickWorldsJob(int)
+{
+	TRACE_SCOPE("TickWorlds");
+
+	for (;;) {
+		int begin = world_job.next_chunk.fetch_add(1, std::memory_order_relaxed) * WORLD_CHUNK;
+		if (begin >= world_job.num_worlds) {
+			break;
+		}
+		int end = std::min(begin + WORLD_CHUNK, world_job.num_worlds);
+		world_job.tick(world_job.worlds, begin, end, world_job.steps);
+	}
+}
+
+// すべての世界を steps 刻み進める．threads が 0 か多すぎれば全スレッドを使う．
+// ただし塊の数を超えるスレッドは使わない
+
+template <typename World>
+inline void TickWorlds(std::vector<World> *worlds, const int steps,
+	const int threads, WorldHostStats *stats)
+{
+	InitWorldHost();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	world_job.tick = TickWorldRange<World>;
+	world_job.worlds = worlds->data();
+	world_job.num_worlds = worlds->size();
+	world_job.steps = steps;
+	// 塊の数より多いスレッドは仕事がない．WORLD_CHUNK 個までなら呼んだ
+	// スレッドだけで進め，ワーカーを起こさない
+	int chunks = std::max(1, (world_job.num_worlds + WORLD_CHUNK - 1) / WORLD_CHUNK);
+	world_job.threads = threads > 0 && threads < world_threads ? threads : world_threads;
+	world_job.threads = std::min(world_job.threads, chunks);
+	world_job.next_chunk.store(0, std::memory_order_relaxed);
+	RunWorkerJob(TickWorldsJob, world_job.threads);
+
+	stats->worlds = worlds->size();
+	stats->steps = steps;
+	stats->threads = world_job.threads;
+	stats->ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+// どれか一つでも動いていれば 1
+
+template <typename World>
+inline int AnyWorldMoving(const std::vector<World> &worlds)
+{
+	for (size_t i = 0; i < worlds.size(); i++) {
+		if (worlds[i].is_moving) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+inline void PrintWorldHostStats(FILE *fp, const WorldHostStats &stats)
+{
+	fprintf(fp, "worlds: %d worlds x %d steps on %d threads in %.3f ms "
+		"(%.2f M world-steps/s)\n", stats.worlds, stats.steps, stats.threads,
+		stats.ms, stats.ms > 0.0
+			? (double) stats.worlds * stats.steps / stats.ms / 1000.0 : 0.0);
+}
+
+#endif // WORLD_HOST_H